@@ -11,7 +11,11 @@
 //				The "ScsiQueryDevice" sample at http://blogs.msdn.com/adioltean/articles/344588.aspx.
 //
 
+#include <emmintrin.h>			// SSE2 intrinsics for the identify string decode
+#include "DriveVendors.h"
+
 #define ATA_DISK_SECTOR_SIZE  512		// Size, in bytes, of the ATA disk Sector (also the Identify Sector)
+#define ATA_STRING_MAX_FIELD  60		// Bytes, the longest identify string field (words 176-205)
 
 #pragma pack(push,1)
 //
@@ -98,63 +102,477 @@ typedef struct TAtaDiskIdentifySector
 #pragma	pack(pop)
 
 static const unsigned int nSizeTAtaDiskIdentifySector = sizeof(TAtaDiskIdentifySector);
+
+
+//  Identify string fields (serial number, firmware, model, media serial number) hold ASCII with
+//  each byte pair swapped, padded with spaces.  AtaStringDecode() swaps a field into the caller's
+//  buffer, trims the white space and NUL terminates it, returning the length.  A NUL within the
+//  field ends the string.  The SSE2 form swaps and classifies 16 bytes per step, yielding
+//  bit masks of space and NUL positions so that the trim is a pair of bit scans.  Fields are
+//  at most 60 bytes, which makes 32 byte AVX2 steps no gain.  The scalar form, the original
+//  one pair and one isspace per step, remains for processors lacking SSE2 and as the reference.
+//  AtaStringDecodeBatch() decodes the strings of many sectors (e.g. an identify archive) at once.
+//
+
+inline bool IsAtaStringSpace(unsigned char c)
+	{ return ((c == ' ') || ((c >= 0x09) && (c <= 0x0D))); }
+
+// Trim the decoded field in place.
+inline unsigned int AtaStringTrim(char *pszDest, unsigned int nFirst, unsigned int nEnd)
+{
+	while ((nFirst < nEnd) && (IsAtaStringSpace((unsigned char)pszDest[nFirst])))
+		nFirst++;
+	while ((nEnd > nFirst) && (IsAtaStringSpace((unsigned char)pszDest[nEnd - 1])))
+		nEnd--;
+	if (nFirst > 0)
+		::memmove(pszDest, pszDest + nFirst, nEnd - nFirst);
+	pszDest[nEnd - nFirst] = '\0';
+	return (nEnd - nFirst);
+}
+
+// pszDest holds at least nSize + 1 chars.
+inline unsigned int AtaStringDecodeScalar(const unsigned char *pbyField, unsigned int nSize, char *pszDest)
+{
+	unsigned int nEnd = nSize;
+
+	for (unsigned int i = 0; (i + 1) < nSize; i += 2)
+	{
+		pszDest[i] = (char)pbyField[i + 1];
+		pszDest[i + 1] = (char)pbyField[i];
+	}
+	if (nSize & 1)
+		pszDest[nSize - 1] = (char)pbyField[nSize - 1];
+	for (unsigned int i = 0; i < nSize; i++)
+		if (pszDest[i] == '\0')
+		{
+			nEnd = i;
+			break;
+		}
+	return AtaStringTrim(pszDest, 0, nEnd);
+}
+
+inline unsigned int LowestBit64(unsigned __int64 n)
+{
+	unsigned long nIndex = 0;
+	if (::_BitScanForward(&nIndex, (unsigned long)n))
+		return nIndex;
+	::_BitScanForward(&nIndex, (unsigned long)(n >> 32));
+	return (nIndex + 32);
+}
+
+inline unsigned int HighestBit64(unsigned __int64 n)
+{
+	unsigned long nIndex = 0;
+	if (::_BitScanReverse(&nIndex, (unsigned long)(n >> 32)))
+		return (nIndex + 32);
+	::_BitScanReverse(&nIndex, (unsigned long)n);
+	return nIndex;
+}
+
+// As above for fields of up to 64 bytes with SSE2, the caller having established its presence.
+inline unsigned int AtaStringDecodeSse2(const unsigned char *pbyField, unsigned int nSize, char *pszDest)
+{
+	const __m128i xZero = _mm_setzero_si128();
+	const __m128i xSpace = _mm_set1_epi8(' ');
+	const __m128i xTab = _mm_set1_epi8(0x09);
+	const __m128i xFour = _mm_set1_epi8(0x04);
+	unsigned __int64 nSpaces = 0, nNuls = 0;
+	unsigned int i = 0;
+
+	if (nSize > 64)
+		return AtaStringDecodeScalar(pbyField, nSize, pszDest);
+
+	for (; (i + 16) <= nSize; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(pbyField + i));
+		x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+		_mm_storeu_si128((__m128i*)(pszDest + i), x);
+
+		// White space is ' ' or 0x09-0x0D (i.e. x - 0x09 <= 4, unsigned).
+		__m128i xOffset = _mm_sub_epi8(x, xTab);
+		__m128i xWhite = _mm_or_si128(_mm_cmpeq_epi8(x, xSpace), _mm_cmpeq_epi8(_mm_min_epu8(xOffset, xFour), xOffset));
+		nSpaces |= (unsigned __int64)(unsigned int)_mm_movemask_epi8(xWhite) << i;
+		nNuls |= (unsigned __int64)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, xZero)) << i;
+	}
+	for (; i < nSize; i++)
+	{
+		char c = (char)pbyField[((i ^ 1) < nSize) ? (i ^ 1) : i];		// An odd last byte has no pair
+		pszDest[i] = c;
+		if (IsAtaStringSpace((unsigned char)c))
+			nSpaces |= (unsigned __int64)1 << i;
+		else if (c == '\0')
+			nNuls |= (unsigned __int64)1 << i;
+	}
+
+	// Keep [first non-space, last non-space] ahead of the first NUL.
+	unsigned int nEnd = (nNuls) ? LowestBit64(nNuls) : nSize;
+	unsigned __int64 nKeep = ~nSpaces & ((nEnd >= 64) ? ~(unsigned __int64)0 : (((unsigned __int64)1 << nEnd) - 1));
+	if (nKeep == 0)
+	{
+		pszDest[0] = '\0';
+		return 0;
+	}
+	unsigned int nFirst = LowestBit64(nKeep);
+	unsigned int nLength = HighestBit64(nKeep) - nFirst + 1;
+	if (nFirst > 0)
+		::memmove(pszDest, pszDest + nFirst, nLength);
+	pszDest[nLength] = '\0';
+	return nLength;
+}
+
+inline bool AtaStringSse2Available(void)
+{
+#if defined(_M_X64)
+	return true;
+#else
+	static const bool s_bSse2 = (::IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != FALSE);
+	return s_bSse2;
+#endif
+}
+
+inline unsigned int AtaStringDecode(const unsigned char *pbyField, unsigned int nSize, char *pszDest)
+{
+	return ((AtaStringSse2Available()) ? AtaStringDecodeSse2(pbyField, nSize, pszDest) : AtaStringDecodeScalar(pbyField, nSize, pszDest));
+}
+
+
+//  Identify Sector integrity (ATA8-ACS 7.16.7.86) : where word 255 bits 7:0 hold the signature
+//  A5h, bits 15:8 hold a checksum making the sum of all 512 bytes zero modulo 256.  A drive
+//  lacking the signature does not report a checksum, and its sector cannot be verified.  The
+//  SSE2 sum is a PSADBW of each 16 bytes against zero, accumulated in two 64-bit lanes.
+//
+
+#define ATA_INTEGRITY_SIGNATURE		0xA5
+
+enum EIdentifyIntegrity { eIntegrityNotReported = 0, eIntegrityValid, eIntegrityCorrupt };
+
+inline unsigned char AtaSectorSumScalar(const unsigned char *pbySector)
+{
+	unsigned char bySum = 0;
+	for (unsigned int i = 0; i < ATA_DISK_SECTOR_SIZE; i++)
+		bySum = (unsigned char)(bySum + pbySector[i]);
+	return bySum;
+}
+
+inline unsigned char AtaSectorSumSse2(const unsigned char *pbySector)
+{
+	const __m128i xZero = _mm_setzero_si128();
+	__m128i xSum = _mm_setzero_si128();
+
+	for (unsigned int i = 0; i < ATA_DISK_SECTOR_SIZE; i += 16)
+		xSum = _mm_add_epi64(xSum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(pbySector + i)), xZero));
+	xSum = _mm_add_epi64(xSum, _mm_srli_si128(xSum, 8));
+	return (unsigned char)_mm_cvtsi128_si32(xSum);
+}
+
+inline EIdentifyIntegrity AtaIdentifyIntegrity(const TAtaDiskIdentifySector &rSector, bool bSse2)
+{
+	if ((rSector.wIntegrityWord & 0xFF) != ATA_INTEGRITY_SIGNATURE)
+		return eIntegrityNotReported;
+	unsigned char bySum = (bSse2) ? AtaSectorSumSse2((const unsigned char*)&rSector) : AtaSectorSumScalar((const unsigned char*)&rSector);
+	return ((bySum == 0) ? eIntegrityValid : eIntegrityCorrupt);
+}
+
+inline EIdentifyIntegrity AtaIdentifyIntegrity(const TAtaDiskIdentifySector &rSector)
+{
+	return AtaIdentifyIntegrity(rSector, AtaStringSse2Available());
+}
+
+
+//  Word-wise sector comparison (e.g. archive differences, snapshot diffs).  The SSE2 form compares
+//  16 words per step : two PCMPEQW results are packed to bytes so that one PMOVMSKB yields a bit
+//  per word.
+//
+
+// Set bit (i % 16) of pwMask[i / 16] for each word i of the sector differing from the baseline,
+// returning the count of differing words.
+inline unsigned int AtaSectorDiffScalar(const unsigned __int16 *pwSector, const unsigned __int16 *pwBaseline, unsigned __int16 *pwMask)
+{
+	unsigned int nChanged = 0;
+
+	for (unsigned int g = 0; g < (ATA_DISK_SECTOR_SIZE / 32); g++)
+	{
+		pwMask[g] = 0;
+		for (unsigned int i = 0; i < 16; i++)
+			if (pwSector[(g * 16) + i] != pwBaseline[(g * 16) + i])
+			{
+				pwMask[g] |= (unsigned __int16)(1 << i);
+				nChanged++;
+			}
+	}
+	return nChanged;
+}
+
+inline unsigned int AtaSectorDiffSse2(const unsigned __int16 *pwSector, const unsigned __int16 *pwBaseline, unsigned __int16 *pwMask)
+{
+	unsigned int nChanged = 0;
+
+	for (unsigned int g = 0; g < (ATA_DISK_SECTOR_SIZE / 32); g++)
+	{
+		const __m128i *pxSector = (const __m128i*)(pwSector + (g * 16));
+		const __m128i *pxBaseline = (const __m128i*)(pwBaseline + (g * 16));
+		__m128i xEqual0 = _mm_cmpeq_epi16(_mm_loadu_si128(pxSector), _mm_loadu_si128(pxBaseline));
+		__m128i xEqual1 = _mm_cmpeq_epi16(_mm_loadu_si128(pxSector + 1), _mm_loadu_si128(pxBaseline + 1));
+		unsigned int nMask = ~(unsigned int)_mm_movemask_epi8(_mm_packs_epi16(xEqual0, xEqual1)) & 0xFFFF;
+
+		pwMask[g] = (unsigned __int16)nMask;
+		for (; nMask; nMask &= (nMask - 1))
+			nChanged++;
+	}
+	return nChanged;
+}
+
+inline unsigned int AtaSectorDiff(const unsigned __int16 *pwSector, const unsigned __int16 *pwBaseline, unsigned __int16 *pwMask)
+{
+	return ((AtaStringSse2Available()) ? AtaSectorDiffSse2(pwSector, pwBaseline, pwMask) : AtaSectorDiffScalar(pwSector, pwBaseline, pwMask));
+}
+
+
+// Identify Sector reads, and those found corrupt, of a drive (i.e. through its bridge).
+typedef struct TIdentifyIntegrityStats
+{
+	unsigned int	nReads;
+	unsigned int	nCorrupt;			// Reads failing the checksum
+	unsigned int	nRecovered;			// Corrupt reads whose re-read then verified
+
+	TIdentifyIntegrityStats(void) : nReads(0), nCorrupt(0), nRecovered(0) {}
+} TIdentifyIntegrityStats;
+
+
+typedef struct TIdentifyStrings
+{
+	char	szSerialNo[sizeof(((TAtaDiskIdentifySector*)0)->pszSerialNumber) + 1];
+	char	szFirmware[sizeof(((TAtaDiskIdentifySector*)0)->pszFirmwareRev) + 1];
+	char	szModel[sizeof(((TAtaDiskIdentifySector*)0)->pszModelNumber) + 1];
+	char	szMediaSerialNo[sizeof(((TAtaDiskIdentifySector*)0)->pszCurrentMediaSerialNo) + 1];
+} TIdentifyStrings;
+
+
+// Decode the string fields of nCount sectors, the processor check made once for the batch.  The
+// integrity of each sector is verified in the same pass if pIntegrity (nCount entries) is given;
+// the count of corrupt sectors is returned.
+inline size_t AtaStringDecodeBatch(const TAtaDiskIdentifySector *pSectors, size_t nCount, TIdentifyStrings *pStrings,
+								   EIdentifyIntegrity *pIntegrity = NULL)
+{
+	bool bSse2 = AtaStringSse2Available();
+	size_t nCorrupt = 0;
+
+	unsigned int (*pfnDecode)(const unsigned char*, unsigned int, char*) = 
+		(bSse2) ? AtaStringDecodeSse2 : AtaStringDecodeScalar;
+
+	for (size_t n = 0; n < nCount; n++)
+	{
+		const TAtaDiskIdentifySector &rSector = pSectors[n];
+		TIdentifyStrings &rStrings = pStrings[n];
+
+		if ((n + 1) < nCount)
+			_mm_prefetch((const char*)&pSectors[n + 1].pszSerialNumber[0], _MM_HINT_T0);
+		pfnDecode((const unsigned char*)rSector.pszSerialNumber, sizeof(rSector.pszSerialNumber), rStrings.szSerialNo);
+		pfnDecode((const unsigned char*)rSector.pszFirmwareRev, sizeof(rSector.pszFirmwareRev), rStrings.szFirmware);
+		pfnDecode((const unsigned char*)rSector.pszModelNumber, sizeof(rSector.pszModelNumber), rStrings.szModel);
+		pfnDecode((const unsigned char*)rSector.pszCurrentMediaSerialNo, sizeof(rSector.pszCurrentMediaSerialNo), rStrings.szMediaSerialNo);
+		if ((pIntegrity) && ((pIntegrity[n] = AtaIdentifyIntegrity(rSector, bSse2)) == eIntegrityCorrupt))
+			nCorrupt++;
+	}
+	return nCorrupt;
+}
+
+
+//  The TDriveCapabilities struct is the typed decode of an Identify Sector's capacity, geometry,
+//  transport and feature words, decoded once when the sector is read (see TIdentifySector) so
+//  that callers never interpret raw words.  Word references are to ACS-3 (T13/2161-D) 7.12.7.
+//
+typedef struct TDriveCapabilities
+{
+	unsigned __int64	nUserSectors;				// 100-103 if 48 bit addressing, else 60-61
+	unsigned __int64	nWorldWideName;				// 108-111, 0 if absent
+	unsigned int		nLogicalSectorSize;			// Bytes, 106 and 117-118
+	unsigned int		nPhysicalSectorSize;		// Bytes, 106
+	unsigned short		nRotationRate;				// 217 : RPM, 1 if non-rotating (i.e. solid state), 0 if unreported
+	unsigned char		nQueueDepth;				// 75 : NCQ depth, 0 if NCQ is unsupported
+	unsigned char		nSataGeneration;			// 76 : Highest signaling speed, 1 (1.5 Gb/s) to 3 (6.0 Gb/s), 0 if not SATA
+	unsigned char		nMajorVersion;				// 80 : Highest ATA/ATAPI or ACS version supported (e.g. 8 for ATA8-ACS)
+	unsigned int		bLba48 : 1;					// 83 bit 10
+	unsigned int		bNcq : 1;					// 76 bit 8
+	unsigned int		bSmart : 1;					// 82 bit 0
+	unsigned int		bTrim : 1;					// 169 bit 0
+	unsigned int		bSecuritySupported : 1;		// 128 bit 0 (i.e. the ATA Security feature set)
+	unsigned int		bSecurityEnabled : 1;		// 128 bit 1
+	unsigned int		bSecurityLocked : 1;		// 128 bit 2
+	unsigned int		bSecurityFrozen : 1;		// 128 bit 3
+	unsigned int		bTrustedComputing : 1;		// 48 bit 0 (i.e. TRUSTED SEND/RECEIVE)
+	unsigned int		bDriveTrust : 1;			// 150 bits 4 and 12 (Seagate DriveTrust, vendor specific)
+
+	inline unsigned __int64 CapacityBytes(void) const
+		{ return (nUserSectors * nLogicalSectorSize); }
+
+	// A word reporting validity in bits 15:14 (i.e. 01b).
+	static inline bool IsValidWord(unsigned __int16 w)
+		{ return ((w & 0xC000) == 0x4000); }
+
+	// A word that is neither zero nor all ones (i.e. implemented).
+	static inline bool IsReported(unsigned __int16 w)
+		{ return ((w != 0x0000) && (w != 0xFFFF)); }
+
+	void Decode(const TAtaDiskIdentifySector &rSector)
+	{
+		const unsigned __int16 *pwWords = (const unsigned __int16*)&rSector;
+
+		::ZeroMemory(this, sizeof(*this));
+		if (rSector.wGeneralConfiguration == 0)
+			return;
+
+		// Capacity
+		bLba48 = ((rSector.wCommandSetSupported2 & 0x0400) != 0);
+		if (bLba48)
+			nUserSectors = ((unsigned __int64)rSector.pwMaxUserLBA[0]) | ((unsigned __int64)rSector.pwMaxUserLBA[1] << 16) |
+						   ((unsigned __int64)rSector.pwMaxUserLBA[2] << 32);	// Word 103 is reserved (i.e. 48 bits)
+		if (nUserSectors == 0)
+			nUserSectors = rSector.ulTotalAddressableSectors;
+
+		// Sector sizes : logical sectors longer than 256 words are sized by words 117-118, and a
+		// physical sector is 2^n logical sectors.
+		nLogicalSectorSize = ATA_DISK_SECTOR_SIZE;
+		nPhysicalSectorSize = ATA_DISK_SECTOR_SIZE;
+		if (IsValidWord(rSector.wSectorSize))
+		{
+			if ((rSector.wSectorSize & 0x1000) && (rSector.ulWordsPerLogicalSector > 256))
+				nLogicalSectorSize = rSector.ulWordsPerLogicalSector * 2;
+			nPhysicalSectorSize = nLogicalSectorSize;
+			if (rSector.wSectorSize & 0x2000)
+				nPhysicalSectorSize <<= (rSector.wSectorSize & 0x000F);
+		}
+
+		// Transport : word 76 is zero (or all ones) on parallel ATA.
+		unsigned __int16 wSataCapabilities = pwWords[76];
+		if (IsReported(wSataCapabilities))
+		{
+			bNcq = ((wSataCapabilities & 0x0100) != 0);
+			nSataGeneration = (wSataCapabilities & 0x0008) ? 3 : ((wSataCapabilities & 0x0004) ? 2 : ((wSataCapabilities & 0x0002) ? 1 : 0));
+			if (bNcq)
+				nQueueDepth = (unsigned char)((rSector.wQueueDepth & 0x001F) + 1);
+		}
+		if (IsReported(rSector.wMajorVersion))
+		{
+			for (unsigned char nBit = 15; nBit > 0; nBit--)
+				if (rSector.wMajorVersion & (1 << nBit))
+				{
+					nMajorVersion = nBit;
+					break;
+				}
+		}
+		nRotationRate = (IsReported(pwWords[217]) && ((pwWords[217] == 1) || (pwWords[217] >= 0x0401))) ? pwWords[217] : 0;
+
+		// Features
+		if (IsValidWord(rSector.wCommandSetSupported2))
+			bSmart = ((rSector.wCommandSetSupported1 & 0x0001) != 0);
+		bTrim = ((pwWords[169] & 0x0001) != 0);
+		bSecuritySupported = ((rSector.wSecurityStatus & 0x0001) != 0);
+		if (bSecuritySupported)
+		{
+			bSecurityEnabled = ((rSector.wSecurityStatus & 0x0002) != 0);
+			bSecurityLocked = ((rSector.wSecurityStatus & 0x0004) != 0);
+			bSecurityFrozen = ((rSector.wSecurityStatus & 0x0008) != 0);
+		}
+		bTrustedComputing = (IsValidWord(rSector.wReserved1) && ((rSector.wReserved1 & 0x0001) != 0));
+		bDriveTrust = (((rSector.pwVendorSpecific[21] & 0x0010) != 0) && ((rSector.pwVendorSpecific[21] & 0x1000) != 0));
+
+		if ((IsValidWord(rSector.wCommandSetDefault)) && (rSector.wCommandSetDefault & 0x0100))
+			nWorldWideName = ((unsigned __int64)rSector.wIEEEOUI << 48) | ((unsigned __int64)rSector.wUniqueID3 << 32) |
+							 ((unsigned __int64)rSector.wUniqueID2 << 16) | (unsigned __int64)rSector.wUniqueID1;
+	}
+} TDriveCapabilities;
+
 static const char *pszEmptyString = "\0";
-static unsigned char cDestBuffer[nSizeTAtaDiskIdentifySector];
- 
+
+// The buffer a string field is decoded into (see TIdentifySector::GetModel), sized for the longest.
+#define IDENTIFY_FIELD_CHARS	(sizeof(((TAtaDiskIdentifySector*)0)->pszCurrentMediaSerialNo) + 1)
+
 
 // The TIdentifySector struct is used to hold the disk drive Identify Sector content.
 //
 typedef struct TIdentifySector
 {
 	TAtaDiskIdentifySector	_sectorData;	
+	TDriveCapabilities		_sCapabilities;		// Decoded from _sectorData, see DecodeCapabilities
+	TDriveClass				_sClass;			// ""
 
 	TIdentifySector(void) 
 	{
 		ASSERT((sizeof(TAtaDiskIdentifySector)) == ATA_DISK_SECTOR_SIZE);
 		_sectorData.wGeneralConfiguration = 0;
+		::ZeroMemory((void*)&_sCapabilities, sizeof(_sCapabilities));
 		return; 
 	}
 
-	TIdentifySector(TIdentifySector &rSector) 
+	TIdentifySector(const TIdentifySector &rSector) 
 	{
 		::memcpy_s((void*)&_sectorData, sizeof(TAtaDiskIdentifySector), (void*)&rSector._sectorData, sizeof(TAtaDiskIdentifySector));
+		_sCapabilities = rSector._sCapabilities;
+		_sClass = rSector._sClass;
 	}
 
-	TIdentifySector &operator=(TIdentifySector &rSector)
+	TIdentifySector &operator=(const TIdentifySector &rSector)
 	{
 		::memcpy_s((void*)&_sectorData, sizeof(TAtaDiskIdentifySector), (void*)&rSector._sectorData, sizeof(TAtaDiskIdentifySector));
+		_sCapabilities = rSector._sCapabilities;
+		_sClass = rSector._sClass;
 		return *this;
 	}
 
 	inline void Initialize(void)
 	{
 		::ZeroMemory((void*)&_sectorData, sizeof(TAtaDiskIdentifySector));
+		::ZeroMemory((void*)&_sCapabilities, sizeof(_sCapabilities));
+		_sClass = TDriveClass();
 	}
 
+	// Decode the capabilities, and classify the drive, once the sector data has been read.
+	inline void DecodeCapabilities(void)
+	{
+		char szModel[sizeof(_sectorData.pszModelNumber) + 1];
+		char szFirmware[sizeof(_sectorData.pszFirmwareRev) + 1];
+
+		_sCapabilities.Decode(_sectorData);
+		AtaStringDecode((const unsigned char*)_sectorData.pszModelNumber, sizeof(_sectorData.pszModelNumber), szModel);
+		AtaStringDecode((const unsigned char*)_sectorData.pszFirmwareRev, sizeof(_sectorData.pszFirmwareRev), szFirmware);
+		_sClass = ::ClassifyDrive(szModel, szFirmware, _sCapabilities.nWorldWideName);
+	}
+
+	inline const TDriveCapabilities &Capabilities(void) const
+		{ return _sCapabilities; }
+
+	// The vendor, family and quirks, see DriveVendors.h.
+	inline const TDriveClass &DriveClass(void) const
+		{ return _sClass; }
+
 	inline bool IsSectorDataAvailable(void) { return (_sectorData.wGeneralConfiguration > 0); }
 
-	inline const char* GetModel(void)
+	// The string fields are decoded into the caller's buffer, so that threads decoding drives
+	// concurrently do not share one.
+	inline const char* GetModel(char (&szDest)[IDENTIFY_FIELD_CHARS])
 	{
-		return(GetByteSwapField((const unsigned char*)&_sectorData.pszModelNumber[0], sizeof(_sectorData.pszModelNumber))); 
+		return(GetByteSwapField((const unsigned char*)&_sectorData.pszModelNumber[0], sizeof(_sectorData.pszModelNumber), szDest)); 
 	}
 
-	const char* GetFirmware(void)
+	const char* GetFirmware(char (&szDest)[IDENTIFY_FIELD_CHARS])
 	{
-		return(GetByteSwapField((const unsigned char*)&_sectorData.pszFirmwareRev[0], sizeof(_sectorData.pszFirmwareRev))); 
+		return(GetByteSwapField((const unsigned char*)&_sectorData.pszFirmwareRev[0], sizeof(_sectorData.pszFirmwareRev), szDest)); 
 	}
 
-	const char* GetSerialNo(void)
+	const char* GetSerialNo(char (&szDest)[IDENTIFY_FIELD_CHARS])
 	{
-		return(GetByteSwapField((const unsigned char*)&_sectorData.pszSerialNumber[0], sizeof(_sectorData.pszSerialNumber))); 
+		return(GetByteSwapField((const unsigned char*)&_sectorData.pszSerialNumber[0], sizeof(_sectorData.pszSerialNumber), szDest)); 
 	}
 
+	// The 64 bit NAA world wide name of words 108-111 (most significant word first), 0 if absent
+	// (i.e. word 87 bit 8 clear).  See TDriveCapabilities.
+	inline unsigned __int64 GetWorldWideName(void)
+		{ return _sCapabilities.nWorldWideName; }
+
 	const char* GetVendorID(void)
 	{
-		// TODO : build a table of vendor strings and return that based upon model analysis.
-		if (IsSeagateModel())
-			return("Seagate");
-		else
-			return(":-)");
+		return(_sClass.pszVendor);
 	}
 
 	bool IsSeagateModel(void)
@@ -189,7 +607,7 @@ typedef struct TIdentifySector
 	}
 
   private:  
-	const char *GetByteSwapField(const unsigned char *pBytes, unsigned short uSize)
+	const char *GetByteSwapField(const unsigned char *pBytes, unsigned short uSize, char (&szDest)[IDENTIFY_FIELD_CHARS])
 	{
 		ASSERT(pBytes != NULL);
 		ASSERT((uSize > 0) && (uSize <= sizeof(_sectorData.pszCurrentMediaSerialNo)));	
@@ -199,41 +617,9 @@ typedef struct TIdentifySector
 		if ((!pBytes) || (!IsSectorDataAvailable()) || (uSize > sizeof(_sectorData.pszCurrentMediaSerialNo)))
 			return(pszEmptyString);
 
-		// first copy specified field to the working cDestBuffer
-		::ZeroMemory((void*)&cDestBuffer[0], sizeof(cDestBuffer));
-		if (::memcpy_s(&cDestBuffer[0], sizeof(cDestBuffer), pBytes, uSize))
-			return(pszEmptyString);   
-		
-		// next, swap the bytes within the cDestBuffer
-		SwapBytes((unsigned char *)&cDestBuffer[0], uSize);
-		cDestBuffer[uSize - 1] = '\0';
-
-		// remove any prepended spaces	// TODO : move this code to a separate inline member method.
-		unsigned char *pFront = cDestBuffer;
-		while ((::isspace(*pFront)) && (*pFront != '\0'))
-			pFront++;
-
-		// remove any appended spaces	// TODO : move this code to a separate inline member method.
-		unsigned char *pBack = &cDestBuffer[uSize - 2];
-		while ((::isspace(*pBack)) && (pBack > pFront))
-		{
-			*pBack = '\0';
-			pBack--;
-		}
-		return((const char *)pFront);
-	}
-
-	void SwapBytes(unsigned char *pBytes, unsigned short uSize)
-	{
-		unsigned short	i;
-		unsigned char	c;
-
-		for(i = 0; i < uSize; i += 2)
-		{
-			c = pBytes[i];
-			pBytes[i] = pBytes[i + 1];
-			pBytes[i+1] = c;
-		}
+		// swap and trim the field into the caller's szDest (see AtaStringDecode)
+		AtaStringDecode(pBytes, uSize, szDest);
+		return((const char *)szDest);
 	}
 } TIdentifySector;
 
@@ -18,7 +18,19 @@ struct	IDENTIFY_DEVICE_OUTDATA
 
 interface IAtaInterface : public IBusInterface
 {
-	virtual bool ReadIdentifySector(_bstr_t &rbstrErrorInfo)
+	// The drive's returned Status (CurrentTaskFile[6]) : with ERR set, the command failed as the
+	// Error register (CurrentTaskFile[0]) describes, though the IOCTL itself succeeded.
+	static bool DeviceStatusOk(TBusError &rError, EBusOperation eOperation, const ATA_PASS_THROUGH_DIRECT &rAptd)
+	{
+		if (0x01 & rAptd.CurrentTaskFile[6])
+		{
+			rError.SetAtaError(eOperation, rAptd.CurrentTaskFile[6], rAptd.CurrentTaskFile[0]);
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool ReadIdentifySector(TBusError &rError)
 	{
 		TRACE(L"IAtaInterface::ReadIdentifySector\n");
 		CDiskDrive<IAtaInterface> *pDisk = dynamic_cast<CDiskDrive<IAtaInterface>*>(this);
@@ -45,41 +57,22 @@ interface IAtaInterface : public IBusInterface
 			&dwReturnedLength,
 			NULL) )
 		{
-			if ( 0x01 & regs.bCommandReg )			// error bit set.
-			{
-				rbstrErrorInfo = ::BuildMessage(L"IAtaInterface::ReadIdentifySector : Error=0x%02X : "
-					L"NoMedia=%02X : "
-					L"Abort=%02X : "
-					L"MediaChangeRequest=%02X : "
-					L"DeviceNotFound=%02X : "
-					L"MediaChanged=%02x : "
-					L"Uncorr=%02X : "
-					L"IntrCRC=%02X\n", 
-					regs.bFeaturesReg,
-					regs.bFeaturesReg & 0x02,
-					regs.bFeaturesReg & 0x04,
-					regs.bFeaturesReg & 0x08,
-					regs.bFeaturesReg & 0x10,
-					regs.bFeaturesReg & 0x20,
-					regs.bFeaturesReg & 0x40,
-					regs.bFeaturesReg & 0x80);
-				TRACE((const wchar_t*)rbstrErrorInfo);
-			}
-			else
-			{
-				::TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
-				rbstrErrorInfo = ::BuildMessage(L"IAtaInterface::ReadIdentifySector : %ws\n", (const wchar_t*)rbstrErrorInfo);
-			}
+			rError.SetOsError(eBusOpIdentify, ::GetLastError());
 			return false;
 		}
+		if (!DeviceStatusOk(rError, eBusOpIdentify, aptd))
+			return false;
 
-		// TODO : Deeper success checking? 
+		// The sector's integrity word is verified by CDiskDrive::QueryIdentifySector.
 		if (dwReturnedLength < sizeof(aptd))  
+		{
+			rError.SetOsError(eBusOpIdentify, ERROR_BAD_LENGTH);
 			return false;						
+		}
 		return true;
 	}
 
-	virtual bool Send(_bstr_t &rbstrErrorInfo, const BYTE *pbyBuffer, unsigned nSizeBuffer)
+	virtual bool Send(TBusError &rError, const BYTE *pbyBuffer, unsigned nSizeBuffer)
 	{
 		TRACE(L"IAtaInterface::Send\n");
 		CDiskDrive<IAtaInterface> *pDisk = dynamic_cast<CDiskDrive<IAtaInterface>*>(this);
@@ -87,6 +80,7 @@ interface IAtaInterface : public IBusInterface
 		ASSERT((pbyBuffer != NULL) && (nSizeBuffer > 0));
 
 		DWORD bytesMoved = 0;
+		unsigned nTransferLength = nSizeBuffer / pDisk->BytesPerSector();
 		ATA_PASS_THROUGH_DIRECT aptd = { sizeof(aptd) };
 		aptd.DataTransferLength = nSizeBuffer;
 		aptd.DataBuffer         = (void*)pbyBuffer;
@@ -94,8 +88,11 @@ interface IAtaInterface : public IBusInterface
 
 		IDEREGS& regs = (IDEREGS&)(aptd.CurrentTaskFile);
 		::ZeroMemory( &regs, sizeof(regs) );
-		regs.bFeaturesReg       = 0xF0;										// Protocol ID Vendor Unique, see the T13 specs
-		regs.bSectorCountReg    = (UCHAR)(nSizeBuffer / pDisk->BytesPerSector());     // ATA disk sector size is 512 bytes of data  
+		regs.bFeaturesReg       = pDisk->SecurityProtocol();				// Protocol ID (0xF0 Vendor Unique, 0x01 TCG), see the T13 specs
+		regs.bSectorCountReg    = (UCHAR)(nTransferLength & 0xFF);			// Transfer length (7:0) in blocks, ATA disk sector size is 512 bytes of data  
+		regs.bSectorNumberReg   = (UCHAR)(nTransferLength >> 8);			// Transfer length (15:8)
+		regs.bCylLowReg         = (UCHAR)(pDisk->ComId() & 0xFF);			// SP Specific (7:0), i.e. the TCG ComID
+		regs.bCylHighReg        = (UCHAR)(pDisk->ComId() >> 8);				// SP Specific (15:8)
 		regs.bDriveHeadReg      = 0x40;
 
 		aptd.AtaFlags           = ATA_FLAGS_DATA_OUT | ATA_FLAGS_DRDY_REQUIRED;
@@ -110,38 +107,15 @@ interface IAtaInterface : public IBusInterface
 			&bytesMoved,
 			NULL) )
 		{
-			if ( 0x01 & regs.bCommandReg ) // error bit set.
-			{
-				rbstrErrorInfo = ::BuildMessage(L"IAtaInterface::Send : Error=0x%02X : "
-					L"NoMedia=%02X : "
-					L"Abort=%02X : "
-					L"MediaChangeRequest=%02X : "
-					L"DeviceNotFound=%02X : "
-					L"MediaChanged=%02x : "
-					L"Uncorr=%02X : "
-					L"IntrCRC=%02X\n", 
-					regs.bFeaturesReg,
-					regs.bFeaturesReg & 0x02,
-					regs.bFeaturesReg & 0x04,
-					regs.bFeaturesReg & 0x08,
-					regs.bFeaturesReg & 0x10,
-					regs.bFeaturesReg & 0x20,
-					regs.bFeaturesReg & 0x40,
-					regs.bFeaturesReg & 0x80);
-				TRACE((const wchar_t*)rbstrErrorInfo);
-			}
-			else
-			{
-				::TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
-				rbstrErrorInfo = ::BuildMessage(L"IAtaInterface::Send : %ws\n", (const wchar_t*)rbstrErrorInfo);
-			}
+			rError.SetOsError(eBusOpSend, ::GetLastError());
 			return false;
 		}
-		// TODO : Deeper success checking? 
+		if (!DeviceStatusOk(rError, eBusOpSend, aptd))
+			return false;
 		return true;
 	}
 
-	virtual bool Receive(_bstr_t &rbstrErrorInfo, const BYTE *pbyBuffer, unsigned nSizeBuffer)
+	virtual bool Receive(TBusError &rError, const BYTE *pbyBuffer, unsigned nSizeBuffer)
 	{
 		TRACE(L"IAtaInterface::Receive\n");
 		CDiskDrive<IAtaInterface> *pDisk = dynamic_cast<CDiskDrive<IAtaInterface>*>(this);
@@ -149,6 +123,7 @@ interface IAtaInterface : public IBusInterface
 		ASSERT((pbyBuffer != NULL) && (nSizeBuffer > 0));
 
 		DWORD bytesMoved = 0;
+		unsigned nTransferLength = nSizeBuffer / pDisk->BytesPerSector();
 		ATA_PASS_THROUGH_DIRECT aptd = { sizeof(aptd) };
 		aptd.DataTransferLength = nSizeBuffer;
 		aptd.DataBuffer         = (void*)pbyBuffer;
@@ -156,8 +131,11 @@ interface IAtaInterface : public IBusInterface
 
 		IDEREGS& regs = (IDEREGS&)(aptd.CurrentTaskFile);
 		::ZeroMemory( &regs, sizeof(regs) );
-		regs.bFeaturesReg       = 0xF0;  // Protocol ID Vendor Unique
-		regs.bSectorCountReg    = (UCHAR)(nSizeBuffer / pDisk->BytesPerSector());     // ATA disk sector size is 512 bytes of data 
+		regs.bFeaturesReg       = pDisk->SecurityProtocol();  // Protocol ID
+		regs.bSectorCountReg    = (UCHAR)(nTransferLength & 0xFF);     // ATA disk sector size is 512 bytes of data 
+		regs.bSectorNumberReg   = (UCHAR)(nTransferLength >> 8);
+		regs.bCylLowReg         = (UCHAR)(pDisk->ComId() & 0xFF);
+		regs.bCylHighReg        = (UCHAR)(pDisk->ComId() >> 8);
 		regs.bDriveHeadReg      = 0x40;
 
 		aptd.AtaFlags           = ATA_FLAGS_DATA_IN | ATA_FLAGS_DRDY_REQUIRED;
@@ -172,34 +150,11 @@ interface IAtaInterface : public IBusInterface
 			&bytesMoved,
 			NULL) )
 		{
-			if ( 0x01 & regs.bCommandReg ) // error bit set.
-			{
-				rbstrErrorInfo = ::BuildMessage(L"IAtaInterface::Receive : Error=0x%02X : "
-					L"NoMedia=%02X : "
-					L"Abort=%02X : "
-					L"MediaChangeRequest=%02X : "
-					L"DeviceNotFound=%02X : "
-					L"MediaChanged=%02x : "
-					L"Uncorr=%02X : "
-					L"IntrCRC=%02X\n", 
-					regs.bFeaturesReg,
-					regs.bFeaturesReg & 0x02,
-					regs.bFeaturesReg & 0x04,
-					regs.bFeaturesReg & 0x08,
-					regs.bFeaturesReg & 0x10,
-					regs.bFeaturesReg & 0x20,
-					regs.bFeaturesReg & 0x40,
-					regs.bFeaturesReg & 0x80);
-				TRACE((const wchar_t*)rbstrErrorInfo);
-			}
-			else
-			{
-				::TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
-				rbstrErrorInfo = ::BuildMessage(L"IAtaInterface::Receive : %ws\n", (const wchar_t*)rbstrErrorInfo);
-			}
+			rError.SetOsError(eBusOpReceive, ::GetLastError());
 			return false;
 		}
-		// TODO : Deeper success checking? 
+		if (!DeviceStatusOk(rError, eBusOpReceive, aptd))
+			return false;
 		return true;
 	}
 
@@ -0,0 +1,195 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+
+//  The TBusError struct is the outcome of a failed bus transport call (see IBusInterface) : the
+//  operation, the phase at which it failed and the raw status of that phase, i.e. the Win32
+//  error of the DeviceIoControl call, the ATA Status and Error registers, or the SCSI status and
+//  sense data.  It is filled with a few stores, and so costs nothing to produce on the failure
+//  path (e.g. a degraded bridge failing every command); Describe formats the text, calling
+//  FormatMessage, only when the error is to be displayed.
+//
+//		see:	T13 ATA8-ACS, section 6 (the Status and Error registers)
+//				T10 SPC-3, section 4.5 (sense data, fixed and descriptor formats)
+//
+
+enum EBusOperation
+{
+	eBusOpNone = 0,
+	eBusOpIdentify,						// IDENTIFY DEVICE
+	eBusOpSend,							// TRUSTED SEND
+	eBusOpReceive,						// TRUSTED RECEIVE
+};
+
+enum EBusPhase
+{
+	eBusPhaseNone = 0,					// i.e. no error
+	eBusPhaseArgument,					// Invalid argument or device handle
+	eBusPhaseUnsupported,				// No transport for the drive's bus type
+	eBusPhaseDeviceIo,					// DeviceIoControl failed : dwOsError
+	eBusPhaseAtaStatus,					// The drive set the ATA ERR bit : byAtaStatus, byAtaError
+	eBusPhaseScsiStatus,				// The bridge reported failure : byScsiStatus and the sense data
+	eBusPhaseIntegrity,					// The Identify Sector failed its checksum on each read
+	eBusPhaseComPacket,					// Malformed ComPacket header
+	eBusPhaseNoResponse,				// No response outstanding for the ComID
+	eBusPhaseOverflow,					// Response exceeds the maximum transfer : dwDetail bytes
+	eBusPhaseTimeout,					// No TPer response within dwDetail ms
+	eBusPhaseEnd
+};
+
+typedef struct TBusError
+{
+	DWORD			dwOsError;			// Win32 error, eBusPhaseDeviceIo
+	DWORD			dwDetail;			// Phase specific, see EBusPhase
+	BYTE			byOperation;		// EBusOperation
+	BYTE			byPhase;			// EBusPhase
+	BYTE			byAtaStatus;
+	BYTE			byAtaError;
+	BYTE			byScsiStatus;
+	BYTE			bySenseResponse;	// Sense byte 0 (e.g. 0x70 fixed, 0x72 descriptor format)
+	BYTE			bySenseKey;
+	BYTE			byAsc;
+	BYTE			byAscq;
+
+	TBusError(void) { Clear(); }
+
+	inline void Clear(void)
+		{ ::ZeroMemory(this, sizeof(*this)); }
+
+	inline bool Failed(void) const
+		{ return (byPhase != eBusPhaseNone); }
+
+	inline void Set(EBusOperation eOperation, EBusPhase ePhase, DWORD dwPhaseDetail = 0)
+	{
+		Clear();
+		byOperation = (BYTE)eOperation;
+		byPhase = (BYTE)ePhase;
+		dwDetail = dwPhaseDetail;
+	}
+
+	inline void SetOsError(EBusOperation eOperation, DWORD dwError)
+	{
+		Set(eOperation, eBusPhaseDeviceIo);
+		dwOsError = dwError;
+	}
+
+	inline void SetAtaError(EBusOperation eOperation, BYTE byStatus, BYTE byError)
+	{
+		Set(eOperation, eBusPhaseAtaStatus);
+		byAtaStatus = byStatus;
+		byAtaError = byError;
+	}
+
+	// pbySense of nSense bytes (SPC-3 fixed or descriptor format); an ATA Return descriptor, if
+	// the bridge appended one at byte 8, gives the ATA registers.
+	inline void SetScsiError(EBusOperation eOperation, BYTE byStatus, const BYTE *pbySense, unsigned int nSense)
+	{
+		Set(eOperation, eBusPhaseScsiStatus);
+		byScsiStatus = byStatus;
+		if (nSense < 4)
+			return;
+		bySenseResponse = pbySense[0] & 0x7F;
+		if ((bySenseResponse == 0x72) || (bySenseResponse == 0x73))
+		{
+			bySenseKey = pbySense[1] & 0x0F;
+			byAsc = pbySense[2];
+			byAscq = pbySense[3];
+			if ((nSense >= 22) && (pbySense[8] == 0x09))		// ATA Return descriptor
+			{
+				byAtaError = pbySense[11];
+				byAtaStatus = pbySense[21];
+			}
+		}
+		else if ((nSense >= 14) && ((bySenseResponse == 0x70) || (bySenseResponse == 0x71)))
+		{
+			bySenseKey = pbySense[2] & 0x0F;
+			byAsc = pbySense[12];
+			byAscq = pbySense[13];
+		}
+	}
+
+	// The nearest Win32 error, for callers reporting one (e.g. the DriveTrust API).
+	DWORD Win32Error(void) const
+	{
+		switch (byPhase)
+		{
+		case eBusPhaseNone:			return ERROR_SUCCESS;
+		case eBusPhaseArgument:		return ERROR_INVALID_PARAMETER;
+		case eBusPhaseUnsupported:	return ERROR_NOT_SUPPORTED;
+		case eBusPhaseDeviceIo:		return dwOsError;
+		case eBusPhaseIntegrity:	return ERROR_CRC;
+		case eBusPhaseComPacket:	return ERROR_INVALID_DATA;
+		case eBusPhaseNoResponse:	return ERROR_NO_DATA;
+		case eBusPhaseOverflow:		return ERROR_MORE_DATA;
+		case eBusPhaseTimeout:		return ERROR_TIMEOUT;
+		}
+		return ERROR_IO_DEVICE;
+	}
+
+	// The error as text, prefixed with the drive's name if given.
+	_bstr_t Describe(const wchar_t *pszDrive = NULL) const
+	{
+		static const wchar_t *const s_apszOperations[] = { L"Bus", L"Identify", L"Trusted Send", L"Trusted Receive" };
+		static const wchar_t *const s_apszAtaErrors[] = { L"", L"NoMedia", L"Abort", L"MediaChangeRequest", L"DeviceNotFound",
+														  L"MediaChanged", L"Uncorr", L"IntrCRC" };
+		const wchar_t *pszOperation = (byOperation < (sizeof(s_apszOperations) / sizeof(s_apszOperations[0]))) ? s_apszOperations[byOperation] : L"Bus";
+		wchar_t szText[512];
+		wchar_t szFlags[128] = L"";
+		_bstr_t bstrOsError;
+
+		for (unsigned int nBit = 1; nBit < 8; nBit++)
+			if (byAtaError & (1 << nBit))
+			{
+				::wcscat_s(szFlags, (szFlags[0]) ? L", " : L" (");
+				::wcscat_s(szFlags, s_apszAtaErrors[nBit]);
+			}
+		if (szFlags[0])
+			::wcscat_s(szFlags, L")");
+
+		switch (byPhase)
+		{
+		case eBusPhaseNone:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : No error.", pszOperation);
+			break;
+		case eBusPhaseArgument:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : Invalid argument or device handle.", pszOperation);
+			break;
+		case eBusPhaseUnsupported:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : Unsupported bus interface type.", pszOperation);
+			break;
+		case eBusPhaseDeviceIo:
+			::TranslateErrorCode(dwOsError, bstrOsError);
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : %ws", pszOperation, (bstrOsError.length()) ? (const wchar_t*)bstrOsError : L"");
+			break;
+		case eBusPhaseAtaStatus:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : ATA Status=0x%02X Error=0x%02X%ws", pszOperation, byAtaStatus, byAtaError, szFlags);
+			break;
+		case eBusPhaseScsiStatus:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : ScsiStatus=0x%02X Sense=0x%02X Key=0x%X ASC=0x%02X ASCQ=0x%02X, ATA Status=0x%02X Error=0x%02X%ws",
+						   pszOperation, byScsiStatus, bySenseResponse, bySenseKey, byAsc, byAscq, byAtaStatus, byAtaError, szFlags);
+			break;
+		case eBusPhaseIntegrity:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : The sector failed its integrity checksum on every read.", pszOperation);
+			break;
+		case eBusPhaseComPacket:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : Malformed ComPacket header.", pszOperation);
+			break;
+		case eBusPhaseNoResponse:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : No response outstanding for ComID 0x%04X.", pszOperation, dwDetail);
+			break;
+		case eBusPhaseOverflow:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : Response of %u bytes exceeds the maximum transfer.", pszOperation, dwDetail);
+			break;
+		case eBusPhaseTimeout:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : Timed out after %u ms awaiting the TPer response.", pszOperation, dwDetail);
+			break;
+		default:
+			::_snwprintf_s(szText, _TRUNCATE, L"%ws : Unknown failure (phase %u).", pszOperation, byPhase);
+			break;
+		}
+		return (pszDrive) ? _bstr_t(pszDrive) + L" : " + szText : _bstr_t(szText);
+	}
+} TBusError;
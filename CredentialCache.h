@@ -0,0 +1,597 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include <emmintrin.h>			// SSE2 intrinsics for the 4-lane SHA-256
+#include <bcrypt.h>				// BCryptGenRandom, for the cache's per-process tag key
+
+
+//  Credential derivation for self-encrypting drive authentication.
+//
+//  Drive PINs are derived from a credential with PBKDF2-HMAC-SHA256 (see: RFC 2898 and FIPS 180-2),
+//  salted per drive (typically by the drive serial number), so that one credential yields a
+//  distinct PIN per drive.  The derivation is deliberately expensive; to keep fleet operations
+//  from being CPU-bound :
+//
+//		1.  The HMAC key schedule (ipad / opad blocks) is computed once per credential and shared by
+//			every drive, since only the salt differs.
+//		2.  The PBKDF2 iteration loop, which hashes fixed-size 32 byte blocks, runs four drives at
+//			once in the lanes of SSE2 registers.
+//		3.  Derived keys are cached by (tag of the credential, salt, iteration count) within
+//			page-locked memory, so repeated lock / unlock passes skip the derivation entirely.
+//			The tag is an HMAC-SHA256 under a random key drawn for each cache, never a plain
+//			hash : a memory dump then offers no fast offline test of guessed PINs, nor matches
+//			the same credential across processes.
+//
+//  All intermediate key material is zeroized with SecureZeroMemory before release.
+//
+
+#define SHA256_DIGEST_LENGTH			32
+#define SHA256_BLOCK_LENGTH				64
+#define CREDENTIAL_KEY_LENGTH			32			// Derived PIN length (one PBKDF2 block)
+#define CREDENTIAL_MAX_SALT				64
+#define CREDENTIAL_CACHE_ENTRIES		512
+#define CREDENTIAL_DEFAULT_ITERATIONS	75000
+#define CREDENTIAL_TAG_KEY_LENGTH		32
+
+static const unsigned __int32 g_aSha256K[64] =
+{
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static const unsigned __int32 g_aSha256Init[8] =
+{
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+#define SHA256_ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+
+// One SHA-256 compression of a block given as 16 host-order words.
+inline void Sha256CompressWords(unsigned __int32 aState[8], const unsigned __int32 aBlock[16])
+{
+	unsigned __int32 W[64];
+	unsigned __int32 a = aState[0], b = aState[1], c = aState[2], d = aState[3];
+	unsigned __int32 e = aState[4], f = aState[5], g = aState[6], h = aState[7];
+
+	for (int t = 0; t < 16; t++)
+		W[t] = aBlock[t];
+	for (int t = 16; t < 64; t++)
+	{
+		unsigned __int32 s0 = SHA256_ROTR(W[t - 15], 7) ^ SHA256_ROTR(W[t - 15], 18) ^ (W[t - 15] >> 3);
+		unsigned __int32 s1 = SHA256_ROTR(W[t - 2], 17) ^ SHA256_ROTR(W[t - 2], 19) ^ (W[t - 2] >> 10);
+		W[t] = W[t - 16] + s0 + W[t - 7] + s1;
+	}
+	for (int t = 0; t < 64; t++)
+	{
+		unsigned __int32 t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + g_aSha256K[t] + W[t];
+		unsigned __int32 t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	aState[0] += a; aState[1] += b; aState[2] += c; aState[3] += d;
+	aState[4] += e; aState[5] += f; aState[6] += g; aState[7] += h;
+}
+
+
+#define SHA256_ROTR4(x, n)	_mm_or_si128(_mm_srli_epi32((x), (n)), _mm_slli_epi32((x), 32 - (n)))
+
+// Four independent SHA-256 compressions, lane i of each register belonging to message i.
+inline void Sha256CompressWords4(__m128i aState[8], const __m128i aBlock[16])
+{
+	__m128i W[64];
+	__m128i a = aState[0], b = aState[1], c = aState[2], d = aState[3];
+	__m128i e = aState[4], f = aState[5], g = aState[6], h = aState[7];
+
+	for (int t = 0; t < 16; t++)
+		W[t] = aBlock[t];
+	for (int t = 16; t < 64; t++)
+	{
+		__m128i s0 = _mm_xor_si128(_mm_xor_si128(SHA256_ROTR4(W[t - 15], 7), SHA256_ROTR4(W[t - 15], 18)), _mm_srli_epi32(W[t - 15], 3));
+		__m128i s1 = _mm_xor_si128(_mm_xor_si128(SHA256_ROTR4(W[t - 2], 17), SHA256_ROTR4(W[t - 2], 19)), _mm_srli_epi32(W[t - 2], 10));
+		W[t] = _mm_add_epi32(_mm_add_epi32(W[t - 16], s0), _mm_add_epi32(W[t - 7], s1));
+	}
+	for (int t = 0; t < 64; t++)
+	{
+		__m128i S1 = _mm_xor_si128(_mm_xor_si128(SHA256_ROTR4(e, 6), SHA256_ROTR4(e, 11)), SHA256_ROTR4(e, 25));
+		__m128i ch = _mm_xor_si128(_mm_and_si128(e, f), _mm_andnot_si128(e, g));
+		__m128i t1 = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(h, S1), _mm_add_epi32(ch, W[t])), _mm_set1_epi32((int)g_aSha256K[t]));
+		__m128i S0 = _mm_xor_si128(_mm_xor_si128(SHA256_ROTR4(a, 2), SHA256_ROTR4(a, 13)), SHA256_ROTR4(a, 22));
+		__m128i maj = _mm_xor_si128(_mm_xor_si128(_mm_and_si128(a, b), _mm_and_si128(a, c)), _mm_and_si128(b, c));
+		__m128i t2 = _mm_add_epi32(S0, maj);
+		h = g; g = f; f = e; e = _mm_add_epi32(d, t1);
+		d = c; c = b; b = a; a = _mm_add_epi32(t1, t2);
+	}
+	aState[0] = _mm_add_epi32(aState[0], a); aState[1] = _mm_add_epi32(aState[1], b);
+	aState[2] = _mm_add_epi32(aState[2], c); aState[3] = _mm_add_epi32(aState[3], d);
+	aState[4] = _mm_add_epi32(aState[4], e); aState[5] = _mm_add_epi32(aState[5], f);
+	aState[6] = _mm_add_epi32(aState[6], g); aState[7] = _mm_add_epi32(aState[7], h);
+}
+
+
+// Incremental SHA-256 over a byte stream.
+typedef struct TSha256
+{
+	unsigned __int32	aState[8];
+	unsigned __int64	nTotal;
+	BYTE				abyBlock[SHA256_BLOCK_LENGTH];
+	unsigned int		nUsed;
+
+	void Init(void)
+	{
+		memcpy(aState, g_aSha256Init, sizeof(aState));
+		nTotal = 0;
+		nUsed = 0;
+	}
+
+	void CompressBlock(void)
+	{
+		unsigned __int32 aWords[16];
+		for (int i = 0; i < 16; i++)
+			aWords[i] = n32ByteSwap(*(unsigned __int32*)&abyBlock[i * 4]);
+		Sha256CompressWords(aState, aWords);
+		::SecureZeroMemory(aWords, sizeof(aWords));
+	}
+
+	void Update(const BYTE *pbyData, size_t nLength)
+	{
+		nTotal += nLength;
+		while (nLength > 0)
+		{
+			size_t nCopy = SHA256_BLOCK_LENGTH - nUsed;
+			if (nCopy > nLength)
+				nCopy = nLength;
+			memcpy(&abyBlock[nUsed], pbyData, nCopy);
+			nUsed += (unsigned int)nCopy;
+			pbyData += nCopy;
+			nLength -= nCopy;
+			if (nUsed == SHA256_BLOCK_LENGTH)
+			{
+				CompressBlock();
+				nUsed = 0;
+			}
+		}
+	}
+
+	void Final(BYTE abyDigest[SHA256_DIGEST_LENGTH])
+	{
+		unsigned __int64 nBits = nTotal * 8;
+		abyBlock[nUsed++] = 0x80;
+		if (nUsed > (SHA256_BLOCK_LENGTH - 8))
+		{
+			memset(&abyBlock[nUsed], 0, SHA256_BLOCK_LENGTH - nUsed);
+			CompressBlock();
+			nUsed = 0;
+		}
+		memset(&abyBlock[nUsed], 0, SHA256_BLOCK_LENGTH - 8 - nUsed);
+		for (int i = 0; i < 8; i++)
+			abyBlock[SHA256_BLOCK_LENGTH - 1 - i] = (BYTE)(nBits >> (i * 8));
+		CompressBlock();
+		for (int i = 0; i < 8; i++)
+			*(unsigned __int32*)&abyDigest[i * 4] = n32ByteSwap(aState[i]);
+		Wipe();
+	}
+
+	void Wipe(void)
+		{ ::SecureZeroMemory(this, sizeof(*this)); }
+} TSha256;
+
+
+// HMAC-SHA256 with the ipad / opad blocks precomputed (see: RFC 2104).
+typedef struct THmacSha256
+{
+	TSha256		sInner;
+	TSha256		sOuter;
+
+	void Init(const BYTE *pbyKey, size_t nKeyLength)
+	{
+		BYTE abyKey[SHA256_BLOCK_LENGTH];
+		BYTE abyPad[SHA256_BLOCK_LENGTH];
+
+		memset(abyKey, 0, sizeof(abyKey));
+		if (nKeyLength > SHA256_BLOCK_LENGTH)
+		{
+			sInner.Init();
+			sInner.Update(pbyKey, nKeyLength);
+			sInner.Final(abyKey);
+		}
+		else if (nKeyLength > 0)
+			memcpy(abyKey, pbyKey, nKeyLength);
+
+		for (int i = 0; i < SHA256_BLOCK_LENGTH; i++)
+			abyPad[i] = abyKey[i] ^ 0x36;
+		sInner.Init();
+		sInner.Update(abyPad, sizeof(abyPad));
+		for (int i = 0; i < SHA256_BLOCK_LENGTH; i++)
+			abyPad[i] = abyKey[i] ^ 0x5C;
+		sOuter.Init();
+		sOuter.Update(abyPad, sizeof(abyPad));
+
+		::SecureZeroMemory(abyKey, sizeof(abyKey));
+		::SecureZeroMemory(abyPad, sizeof(abyPad));
+	}
+
+	void Mac(const BYTE *pbyData, size_t nLength, BYTE abyMac[SHA256_DIGEST_LENGTH]) const
+	{
+		TSha256 sHash = sInner;
+		BYTE abyInner[SHA256_DIGEST_LENGTH];
+
+		sHash.Update(pbyData, nLength);
+		sHash.Final(abyInner);
+		sHash = sOuter;
+		sHash.Update(abyInner, sizeof(abyInner));
+		sHash.Final(abyMac);
+		::SecureZeroMemory(abyInner, sizeof(abyInner));
+	}
+
+	// One PBKDF2 iteration U = HMAC(U) on a 32 byte value held as 8 host-order words.  Both
+	// the inner and outer hashes are then exactly one padded block beyond the keyed state.
+	void IterateWords(unsigned __int32 aU[8]) const
+	{
+		unsigned __int32 aBlock[16];
+		unsigned __int32 aState[8];
+
+		memcpy(aBlock, aU, 8 * sizeof(unsigned __int32));
+		aBlock[8] = 0x80000000;
+		memset(&aBlock[9], 0, 6 * sizeof(unsigned __int32));
+		aBlock[15] = (SHA256_BLOCK_LENGTH + SHA256_DIGEST_LENGTH) * 8;
+
+		memcpy(aState, sInner.aState, sizeof(aState));
+		Sha256CompressWords(aState, aBlock);
+		memcpy(aBlock, aState, sizeof(aState));
+		memcpy(aU, sOuter.aState, sizeof(aState));
+		Sha256CompressWords(aU, aBlock);
+
+		::SecureZeroMemory(aBlock, sizeof(aBlock));
+		::SecureZeroMemory(aState, sizeof(aState));
+	}
+
+	// As IterateWords for four values at once, lane i of each register holding word n of value i.
+	void IterateWords4(__m128i aU[8]) const
+	{
+		__m128i aBlock[16];
+		__m128i aState[8];
+
+		for (int i = 0; i < 8; i++)
+		{
+			aBlock[i] = aU[i];
+			aState[i] = _mm_set1_epi32((int)sInner.aState[i]);
+		}
+		aBlock[8] = _mm_set1_epi32((int)0x80000000);
+		for (int i = 9; i < 15; i++)
+			aBlock[i] = _mm_setzero_si128();
+		aBlock[15] = _mm_set1_epi32((SHA256_BLOCK_LENGTH + SHA256_DIGEST_LENGTH) * 8);
+
+		Sha256CompressWords4(aState, aBlock);
+		for (int i = 0; i < 8; i++)
+		{
+			aBlock[i] = aState[i];
+			aU[i] = _mm_set1_epi32((int)sOuter.aState[i]);
+		}
+		Sha256CompressWords4(aU, aBlock);
+
+		::SecureZeroMemory(aBlock, sizeof(aBlock));
+		::SecureZeroMemory(aState, sizeof(aState));
+	}
+
+	void Wipe(void)
+	{
+		sInner.Wipe();
+		sOuter.Wipe();
+	}
+} THmacSha256;
+
+
+// PBKDF2 first iteration U1 = HMAC(salt || INT(1)), returned as host-order words.
+inline void Pbkdf2FirstBlock(const THmacSha256 &rHmac, const BYTE *pbySalt, unsigned int nSaltLength, unsigned __int32 aU[8])
+{
+	BYTE abyMessage[CREDENTIAL_MAX_SALT + 4];
+	BYTE abyMac[SHA256_DIGEST_LENGTH];
+
+	ASSERT(nSaltLength <= CREDENTIAL_MAX_SALT);
+	memcpy(abyMessage, pbySalt, nSaltLength);
+	abyMessage[nSaltLength + 0] = 0;
+	abyMessage[nSaltLength + 1] = 0;
+	abyMessage[nSaltLength + 2] = 0;
+	abyMessage[nSaltLength + 3] = 1;
+	rHmac.Mac(abyMessage, nSaltLength + 4, abyMac);
+	for (int i = 0; i < 8; i++)
+		aU[i] = n32ByteSwap(*(unsigned __int32*)&abyMac[i * 4]);
+	::SecureZeroMemory(abyMac, sizeof(abyMac));
+}
+
+
+// Derive a 32 byte key for each of nCount salts from the same credential.  Salts are processed
+// four at a time within SSE2 lanes, the remainder (or all, lacking SSE2) one at a time.
+inline void Pbkdf2Sha256Batch(const THmacSha256 &rHmac, unsigned int nIterations, size_t nCount,
+							  const BYTE *const *ppbySalts, const unsigned int *pnSaltLengths,
+							  BYTE (*pabyKeys)[CREDENTIAL_KEY_LENGTH])
+{
+	TRACE(L"Pbkdf2Sha256Batch\n");
+	unsigned __int32 aLanes[4][8];
+	unsigned __int32 aT[4][8];
+	size_t nDone = 0;
+
+#if !defined(_M_X64)
+	if (::IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+#endif
+	{
+		__m128i aU[8];
+		__m128i aAccum[8];
+
+		for (; (nDone + 4) <= nCount; nDone += 4)
+		{
+			for (int n = 0; n < 4; n++)
+				Pbkdf2FirstBlock(rHmac, ppbySalts[nDone + n], pnSaltLengths[nDone + n], aLanes[n]);
+			for (int i = 0; i < 8; i++)
+			{
+				aU[i] = _mm_set_epi32((int)aLanes[3][i], (int)aLanes[2][i], (int)aLanes[1][i], (int)aLanes[0][i]);
+				aAccum[i] = aU[i];
+			}
+			for (unsigned int c = 1; c < nIterations; c++)
+			{
+				rHmac.IterateWords4(aU);
+				for (int i = 0; i < 8; i++)
+					aAccum[i] = _mm_xor_si128(aAccum[i], aU[i]);
+			}
+			for (int i = 0; i < 8; i++)
+			{
+				_mm_storeu_si128((__m128i*)aLanes[0], aAccum[i]);
+				for (int n = 0; n < 4; n++)
+					*(unsigned __int32*)&pabyKeys[nDone + n][i * 4] = n32ByteSwap(aLanes[0][n]);
+			}
+		}
+		::SecureZeroMemory(aU, sizeof(aU));
+		::SecureZeroMemory(aAccum, sizeof(aAccum));
+	}
+
+	for (; nDone < nCount; nDone++)
+	{
+		Pbkdf2FirstBlock(rHmac, ppbySalts[nDone], pnSaltLengths[nDone], aLanes[0]);
+		memcpy(aT[0], aLanes[0], sizeof(aT[0]));
+		for (unsigned int c = 1; c < nIterations; c++)
+		{
+			rHmac.IterateWords(aLanes[0]);
+			for (int i = 0; i < 8; i++)
+				aT[0][i] ^= aLanes[0][i];
+		}
+		for (int i = 0; i < 8; i++)
+			*(unsigned __int32*)&pabyKeys[nDone][i * 4] = n32ByteSwap(aT[0][i]);
+	}
+	::SecureZeroMemory(aLanes, sizeof(aLanes));
+	::SecureZeroMemory(aT, sizeof(aT));
+}
+
+
+//  The CCredentialWipe class zeroizes a credential held in a _bstr_t (e.g. from the command
+//  line) when it leaves scope, however the scope is left : the narrow copy that _bstr_t caches
+//  once converted, then the wide characters.
+class CCredentialWipe
+{
+  private:
+	_bstr_t		&_rbstrCredential;
+
+	CCredentialWipe(const CCredentialWipe&);
+	CCredentialWipe &operator=(const CCredentialWipe&);
+
+  public:
+	CCredentialWipe(_bstr_t &rbstrCredential) : _rbstrCredential(rbstrCredential) {}
+
+	~CCredentialWipe()
+	{
+		if (_rbstrCredential.length() == 0)
+			return;
+		char *pszNarrow = const_cast<char*>((const char*)_rbstrCredential);
+		if (pszNarrow)
+			::SecureZeroMemory(pszNarrow, strlen(pszNarrow));
+		::SecureZeroMemory((wchar_t*)_rbstrCredential, _rbstrCredential.length() * sizeof(wchar_t));
+	}
+};
+
+
+typedef struct TCredentialCacheEntry
+{
+	BYTE				abyCredentialTag[SHA256_DIGEST_LENGTH];		// Keyed tag of the credential (see CCredentialCache), never the credential
+	BYTE				abySalt[CREDENTIAL_MAX_SALT];
+	unsigned int		nSaltLength;
+	unsigned int		nIterations;
+	unsigned __int64	nLastUse;									// 0 = unused
+	BYTE				abyKey[CREDENTIAL_KEY_LENGTH];
+} TCredentialCacheEntry;
+
+
+//  The CCredentialCache class derives (and caches) per-drive keys.  The entries, and the keyed
+//  HMAC state tagging credentials, live in a single page-locked allocation so that neither is
+//  written to the page file; the least recently used entry is replaced when full.  The tag key
+//  is drawn at construction and zeroized with the entries.  Safe for use from concurrent drive
+//  sessions.
+class CCredentialCache
+{
+  private:
+	TCredentialCacheEntry	*_pEntries;
+	THmacSha256				*_pTagHmac;			// Follows the entries
+	size_t					_nEntries;
+	bool					_bLocked;			// VirtualLock succeeded
+	SRWLOCK					_srwLock;
+	unsigned __int64		_nClock;
+	unsigned __int64		_nHits;
+	unsigned __int64		_nMisses;
+
+	CCredentialCache(const CCredentialCache&);
+	CCredentialCache &operator=(const CCredentialCache&);
+
+	inline size_t AllocationSize(size_t nEntries) const
+		{ return ((nEntries * sizeof(TCredentialCacheEntry)) + sizeof(THmacSha256)); }
+
+	TCredentialCacheEntry *Find(const BYTE *pbyCredentialTag, const BYTE *pbySalt, unsigned int nSaltLength, unsigned int nIterations)
+	{
+		for (size_t i = 0; i < _nEntries; i++)
+		{
+			TCredentialCacheEntry &rEntry = _pEntries[i];
+			if ((rEntry.nLastUse != 0) && (rEntry.nSaltLength == nSaltLength) && (rEntry.nIterations == nIterations) &&
+				(memcmp(rEntry.abySalt, pbySalt, nSaltLength) == 0) &&
+				(memcmp(rEntry.abyCredentialTag, pbyCredentialTag, SHA256_DIGEST_LENGTH) == 0))
+				return &rEntry;
+		}
+		return NULL;
+	}
+
+	TCredentialCacheEntry *Victim(void)
+	{
+		TCredentialCacheEntry *pVictim = &_pEntries[0];
+		for (size_t i = 1; (i < _nEntries) && (pVictim->nLastUse != 0); i++)
+			if (_pEntries[i].nLastUse < pVictim->nLastUse)
+				pVictim = &_pEntries[i];
+		return pVictim;
+	}
+
+  public:
+	// The cache is unavailable (see DeriveKeys) if the allocation or the random tag key fails.
+	CCredentialCache(size_t nEntries = CREDENTIAL_CACHE_ENTRIES) : _pEntries(NULL), _pTagHmac(NULL), _nEntries(0), _bLocked(false),
+		_nClock(0), _nHits(0), _nMisses(0)
+	{
+		BYTE abyTagKey[CREDENTIAL_TAG_KEY_LENGTH];
+
+		::InitializeSRWLock(&_srwLock);
+		_pEntries = (TCredentialCacheEntry*)::VirtualAlloc(NULL, AllocationSize(nEntries), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!_pEntries)
+			return;
+		_nEntries = nEntries;
+		_bLocked = (::VirtualLock(_pEntries, AllocationSize(_nEntries)) != FALSE);
+		_pTagHmac = reinterpret_cast<THmacSha256*>(&_pEntries[_nEntries]);
+
+		if (!BCRYPT_SUCCESS(::BCryptGenRandom(NULL, abyTagKey, sizeof(abyTagKey), BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+		{
+			Release();
+			return;
+		}
+		_pTagHmac->Init(abyTagKey, sizeof(abyTagKey));
+		::SecureZeroMemory(abyTagKey, sizeof(abyTagKey));
+	}
+
+	~CCredentialCache()
+	{
+		Release();
+	}
+
+	// Zeroize the cached keys and the tag key, and free them.
+	void Release(void)
+	{
+		if (_pEntries)
+		{
+			::SecureZeroMemory(_pEntries, AllocationSize(_nEntries));
+			if (_bLocked)
+				::VirtualUnlock(_pEntries, AllocationSize(_nEntries));
+			::VirtualFree(_pEntries, 0, MEM_RELEASE);
+			_pEntries = NULL;
+			_pTagHmac = NULL;
+			_nEntries = 0;
+			_bLocked = false;
+		}
+	}
+
+	// Zeroize all cached keys (the tag key stays).
+	void Clear(void)
+	{
+		::AcquireSRWLockExclusive(&_srwLock);
+		if (_pEntries)
+			::SecureZeroMemory(_pEntries, _nEntries * sizeof(TCredentialCacheEntry));
+		::ReleaseSRWLockExclusive(&_srwLock);
+	}
+
+	// Derive the key of each salt from the credential, from the cache where possible.
+	bool DeriveKeys(_bstr_t &rbstrErrorInfo, const BYTE *pbyCredential, unsigned int nCredentialLength, unsigned int nIterations,
+					size_t nCount, const BYTE *const *ppbySalts, const unsigned int *pnSaltLengths,
+					BYTE (*pabyKeys)[CREDENTIAL_KEY_LENGTH])
+	{
+		TRACE(L"CCredentialCache::DeriveKeys\n");
+		BYTE abyCredentialTag[SHA256_DIGEST_LENGTH];
+		std::vector<size_t> vMisses;
+
+		if ((!_pEntries) || (nIterations == 0))
+		{
+			rbstrErrorInfo = L"CCredentialCache::DeriveKeys : Cache unavailable or invalid iteration count.";
+			return false;
+		}
+		for (size_t i = 0; i < nCount; i++)
+		{
+			if (pnSaltLengths[i] > CREDENTIAL_MAX_SALT)
+			{
+				rbstrErrorInfo = ::BuildMessage(L"CCredentialCache::DeriveKeys : Salt exceeds %d bytes.", CREDENTIAL_MAX_SALT);
+				return false;
+			}
+		}
+
+		_pTagHmac->Mac(pbyCredential, nCredentialLength, abyCredentialTag);
+
+		::AcquireSRWLockExclusive(&_srwLock);
+		for (size_t i = 0; i < nCount; i++)
+		{
+			TCredentialCacheEntry *pEntry = Find(abyCredentialTag, ppbySalts[i], pnSaltLengths[i], nIterations);
+			if (pEntry)
+			{
+				memcpy(pabyKeys[i], pEntry->abyKey, CREDENTIAL_KEY_LENGTH);
+				pEntry->nLastUse = ++_nClock;
+				_nHits++;
+			}
+			else
+				vMisses.push_back(i);
+		}
+		::ReleaseSRWLockExclusive(&_srwLock);
+
+		if (!vMisses.empty())
+		{
+			// Derive the misses as one batch, outside the lock.
+			std::vector<const BYTE*> vSalts(vMisses.size());
+			std::vector<unsigned int> vSaltLengths(vMisses.size());
+			std::vector<BYTE> vKeys(vMisses.size() * CREDENTIAL_KEY_LENGTH);
+			BYTE (*pabyDerived)[CREDENTIAL_KEY_LENGTH] = (BYTE (*)[CREDENTIAL_KEY_LENGTH])&vKeys[0];
+			THmacSha256 sHmac;
+
+			for (size_t i = 0; i < vMisses.size(); i++)
+			{
+				vSalts[i] = ppbySalts[vMisses[i]];
+				vSaltLengths[i] = pnSaltLengths[vMisses[i]];
+			}
+			sHmac.Init(pbyCredential, nCredentialLength);
+			::Pbkdf2Sha256Batch(sHmac, nIterations, vMisses.size(), &vSalts[0], &vSaltLengths[0], pabyDerived);
+			sHmac.Wipe();
+
+			::AcquireSRWLockExclusive(&_srwLock);
+			for (size_t i = 0; i < vMisses.size(); i++)
+			{
+				TCredentialCacheEntry *pEntry = Victim();
+				memcpy(pabyKeys[vMisses[i]], pabyDerived[i], CREDENTIAL_KEY_LENGTH);
+				memcpy(pEntry->abyCredentialTag, abyCredentialTag, SHA256_DIGEST_LENGTH);
+				memcpy(pEntry->abySalt, vSalts[i], vSaltLengths[i]);
+				pEntry->nSaltLength = vSaltLengths[i];
+				pEntry->nIterations = nIterations;
+				memcpy(pEntry->abyKey, pabyDerived[i], CREDENTIAL_KEY_LENGTH);
+				pEntry->nLastUse = ++_nClock;
+				_nMisses++;
+			}
+			::ReleaseSRWLockExclusive(&_srwLock);
+			::SecureZeroMemory(&vKeys[0], vKeys.size());
+		}
+		::SecureZeroMemory(abyCredentialTag, sizeof(abyCredentialTag));
+		return true;
+	}
+
+	inline bool IsLocked(void) const
+		{ return _bLocked; }
+
+	inline unsigned __int64 Hits(void) const
+		{ return _nHits; }
+
+	inline unsigned __int64 Misses(void) const
+		{ return _nMisses; }
+};	// CCredentialCache
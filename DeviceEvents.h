@@ -0,0 +1,288 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#endif
+
+
+//  Disk drive hotplug events.
+//
+//  An IDeviceEventSource reports disk drives as they are attached or removed, so an inventory
+//  can probe only the added device and drop only the removed one instead of re-enumerating.
+//  Sources :
+//
+//		CNetlinkEventSource			Kernel uevents (NETLINK_KOBJECT_UEVENT) on Linux.
+//		CDeviceNotificationSource	RegisterDeviceNotification on Windows, see PlatformWin32.cpp.
+//		CEventFileSource			Replays uevent records from a file, standing in for either.
+//
+//  The event file holds uevent records as KEY=VALUE lines, each record ended by an empty line,
+//  e.g. as captured by "udevadm monitor --kernel --property" :
+//
+//		ACTION=add
+//		SUBSYSTEM=block
+//		DEVTYPE=disk
+//		DEVNAME=sdb
+//
+//  Only whole disks are reported (i.e. SUBSYSTEM=block and DEVTYPE=disk), not partitions.  Like
+//  DiskEnumerator.h this header is free of Windows types.
+//
+
+enum EDeviceEventType { eDeviceAdded = 1, eDeviceRemoved };
+
+typedef struct TDeviceEvent
+{
+	EDeviceEventType	eType;
+	std::wstring		strDeviceID;	// e.g. /dev/sdb or \\.\PHYSICALDRIVE2, empty if unknown
+										// (i.e. "some disk was removed, verify those known")
+	TDeviceEvent(void) : eType(eDeviceAdded) {}
+} TDeviceEvent;
+
+
+struct IDeviceEventSource
+{
+	virtual ~IDeviceEventSource() {}
+
+	virtual bool Begin(std::wstring &rstrErrorInfo) = 0;
+
+	// Wait up to nTimeoutMs for the next event; false on timeout, exhaustion or failure
+	// (rstrErrorInfo set only for the latter).
+	virtual bool Wait(std::wstring &rstrErrorInfo, TDeviceEvent &rEvent, unsigned int nTimeoutMs) = 0;
+
+	virtual void End(void) = 0;
+};
+
+
+//  Accumulates the KEY=VALUE properties of one uevent record.
+typedef struct TUeventRecord
+{
+	std::string		strAction;
+	std::string		strSubsystem;
+	std::string		strDevType;
+	std::string		strDevName;
+
+	void Clear(void)
+	{
+		strAction.clear();
+		strSubsystem.clear();
+		strDevType.clear();
+		strDevName.clear();
+	}
+
+	void Property(const char *pszProperty, size_t nLength)
+	{
+		const char *pszEquals = (const char*)memchr(pszProperty, '=', nLength);
+		if (!pszEquals)
+			return;
+
+		std::string strKey(pszProperty, pszEquals - pszProperty);
+		std::string strValue(pszEquals + 1, (pszProperty + nLength) - (pszEquals + 1));
+		if (strKey == "ACTION")
+			strAction = strValue;
+		else if (strKey == "SUBSYSTEM")
+			strSubsystem = strValue;
+		else if (strKey == "DEVTYPE")
+			strDevType = strValue;
+		else if (strKey == "DEVNAME")
+			strDevName = strValue;
+	}
+
+	// Translate to a TDeviceEvent if this record is a whole disk being added or removed.
+	bool ToEvent(TDeviceEvent &rEvent) const
+	{
+		if ((strSubsystem != "block") || (strDevType != "disk"))
+			return false;
+		if (strAction == "add")
+			rEvent.eType = eDeviceAdded;
+		else if (strAction == "remove")
+			rEvent.eType = eDeviceRemoved;
+		else
+			return false;
+
+		// DEVNAME is relative to /dev (or \\.\) unless given as a full path.
+		std::string strDeviceID = strDevName;
+		if ((!strDeviceID.empty()) && (strDeviceID[0] != '/') && (strDeviceID[0] != '\\'))
+#ifdef _WIN32
+			strDeviceID = "\\\\.\\" + strDeviceID;
+#else
+			strDeviceID = "/dev/" + strDeviceID;
+#endif
+		rEvent.strDeviceID.assign(strDeviceID.begin(), strDeviceID.end());
+		return true;
+	}
+} TUeventRecord;
+
+
+class CEventFileSource : public IDeviceEventSource
+{
+  private:
+	std::string		_strPath;
+	FILE			*_pFile;
+
+	CEventFileSource(const CEventFileSource&);
+	CEventFileSource &operator=(const CEventFileSource&);
+
+  public:
+	CEventFileSource(const char *pszPath) : _strPath(pszPath), _pFile(NULL)
+	{
+	}
+
+	virtual ~CEventFileSource()
+	{
+		End();
+	}
+
+	virtual bool Begin(std::wstring &rstrErrorInfo)
+	{
+		End();
+		rstrErrorInfo.clear();
+		_pFile = fopen(_strPath.c_str(), "r");
+		if (!_pFile)
+		{
+			rstrErrorInfo = L"CEventFileSource::Begin : Unable to open the event file " + std::wstring(_strPath.begin(), _strPath.end());
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool Wait(std::wstring &rstrErrorInfo, TDeviceEvent &rEvent, unsigned int)
+	{
+		TUeventRecord sRecord;
+		char szLine[512];
+		bool bRecord = false;
+
+		rstrErrorInfo.clear();
+		if (!_pFile)
+			return false;
+		while (fgets(szLine, sizeof(szLine), _pFile))
+		{
+			size_t nLength = strlen(szLine);
+			while ((nLength > 0) && ((szLine[nLength - 1] == '\n') || (szLine[nLength - 1] == '\r')))
+				szLine[--nLength] = '\0';
+
+			if (nLength > 0)
+			{
+				sRecord.Property(szLine, nLength);
+				bRecord = true;
+			}
+			else if (bRecord)
+			{
+				if (sRecord.ToEvent(rEvent))
+					return true;
+				sRecord.Clear();
+				bRecord = false;
+			}
+		}
+		return ((bRecord) && (sRecord.ToEvent(rEvent)));		// i.e. a last record lacking the empty line
+	}
+
+	virtual void End(void)
+	{
+		if (_pFile)
+		{
+			fclose(_pFile);
+			_pFile = NULL;
+		}
+	}
+};	// CEventFileSource
+
+
+#ifdef __linux__
+
+//  Kernel uevents arrive as one datagram per event : "ACTION@DEVPATH" then NUL separated
+//  KEY=VALUE properties.  see: Documentation/ABI/testing/sysfs-uevent in the Linux kernel.
+class CNetlinkEventSource : public IDeviceEventSource
+{
+  private:
+	int		_nSocket;
+
+	CNetlinkEventSource(const CNetlinkEventSource&);
+	CNetlinkEventSource &operator=(const CNetlinkEventSource&);
+
+  public:
+	CNetlinkEventSource(void) : _nSocket(-1)
+	{
+	}
+
+	virtual ~CNetlinkEventSource()
+	{
+		End();
+	}
+
+	virtual bool Begin(std::wstring &rstrErrorInfo)
+	{
+		struct sockaddr_nl sAddress;
+
+		End();
+		rstrErrorInfo.clear();
+		_nSocket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+		if (_nSocket < 0)
+		{
+			std::string strError = strerror(errno);
+			rstrErrorInfo = L"CNetlinkEventSource::Begin : socket : " + std::wstring(strError.begin(), strError.end());
+			return false;
+		}
+
+		memset(&sAddress, 0, sizeof(sAddress));
+		sAddress.nl_family = AF_NETLINK;
+		sAddress.nl_groups = 1;			// The kernel uevent multicast group
+		if (bind(_nSocket, (struct sockaddr*)&sAddress, sizeof(sAddress)) < 0)
+		{
+			std::string strError = strerror(errno);
+			rstrErrorInfo = L"CNetlinkEventSource::Begin : bind : " + std::wstring(strError.begin(), strError.end());
+			End();
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool Wait(std::wstring &rstrErrorInfo, TDeviceEvent &rEvent, unsigned int nTimeoutMs)
+	{
+		char abyBuffer[8192];
+		struct pollfd sPoll;
+
+		rstrErrorInfo.clear();
+		if (_nSocket < 0)
+			return false;
+		sPoll.fd = _nSocket;
+		sPoll.events = POLLIN;
+
+		// Uninteresting events (partitions, other subsystems) are consumed within the timeout.
+		while (poll(&sPoll, 1, (int)nTimeoutMs) > 0)
+		{
+			ssize_t nReceived = recv(_nSocket, abyBuffer, sizeof(abyBuffer) - 1, 0);
+			TUeventRecord sRecord;
+
+			if (nReceived <= 0)
+				return false;
+			abyBuffer[nReceived] = '\0';
+			for (const char *pszProperty = abyBuffer; pszProperty < (abyBuffer + nReceived); pszProperty += strlen(pszProperty) + 1)
+				sRecord.Property(pszProperty, strlen(pszProperty));
+			if (sRecord.ToEvent(rEvent))
+				return true;
+		}
+		return false;
+	}
+
+	virtual void End(void)
+	{
+		if (_nSocket >= 0)
+		{
+			close(_nSocket);
+			_nSocket = -1;
+		}
+	}
+};	// CNetlinkEventSource
+
+#endif // __linux__
@@ -6,6 +6,10 @@
 
 #include "stdafx.h"
 #include "AtaIdentifySector.h"
+#include "TrustedReceive.h"
+#include "TraceRing.h"
+#include "BusError.h"
+#include "RetryPolicy.h"
 
 interface IBusInterface;
 template <typename T> class CDiskDrive;
@@ -16,15 +20,73 @@ typedef std::vector<pCDiskDrive> TListDiskDrives;
 //  disk drive via varying bus interfaces (e.g. ATA, USB, SCSI, etc.).  Additionally, and especially
 //  with external USB drives, the USB bridge chipset model will introduce further complexities.
 //  Use this interface to isolate those complexities.  See AtaInterface.h and UsbInterface.h.
+//  A failed call describes its failure in a TBusError, formatted only if displayed (see BusError.h).
+//  Drives of every bus are held as CDiskDrive<IBusInterface> (see pCDiskDrive), so the destructor
+//  is virtual : deleting one runs the destructor of its own CDiskDrive type.
 
 interface IBusInterface
 {
-	virtual bool ReadIdentifySector(_bstr_t &rbstrErrorInfo) = 0;
-	virtual bool Send(_bstr_t &rbstrErrorInfo, const BYTE *pbyBuffer, unsigned nSizeBuffer) = 0;
-	virtual bool Receive(_bstr_t &rbstrErrorInfo, const BYTE *pbyBuffer, unsigned nSizeBuffer) = 0;
+	virtual ~IBusInterface() {}
+	virtual bool ReadIdentifySector(TBusError &rError) = 0;
+	virtual bool Send(TBusError &rError, const BYTE *pbyBuffer, unsigned nSizeBuffer) = 0;
+	virtual bool Receive(TBusError &rError, const BYTE *pbyBuffer, unsigned nSizeBuffer) = 0;
 };
 
 
+//  The TSharedDevice struct holds an open disk device HANDLE together with the critical section
+//  serializing its Send/Receive pairs.  It is shared, by reference count, among every CDiskDrive
+//  copy of the one drive : a copy neither duplicates the handle nor creates a critical section,
+//  and the pairs of all copies are serialized by the one lock, as they must be for the device.
+//  KernelCalls() counts the handle and critical section operations performed on drives' behalf
+//  (i.e. creation and closure), see BenchmarkDriveCopies in DiskInfo.cpp.
+
+typedef struct TSharedDevice
+{
+	HANDLE				hDevice;
+	CRITICAL_SECTION	critSection;
+	volatile LONG		lRefCount;
+
+	static volatile LONG &KernelCalls(void)
+	{
+		static volatile LONG s_lKernelCalls = 0;
+		return s_lKernelCalls;
+	}
+
+	// Takes ownership of hDevice, which is closed on the last Release.
+	static TSharedDevice *Create(HANDLE hDevice)
+	{
+		TSharedDevice *pDevice = new TSharedDevice;
+		pDevice->hDevice = hDevice;
+		pDevice->lRefCount = 1;
+		if (!::InitializeCriticalSectionAndSpinCount(&pDevice->critSection, 0x80000400))
+		{
+			delete pDevice;
+			throw ::BuildMessage(L"Initialize critical section : %ws : %d", __FILEW__, __LINE__);
+		}
+		::InterlockedIncrement(&KernelCalls());
+		return pDevice;
+	}
+
+	inline void AddRef(void)
+		{ ::InterlockedIncrement(&lRefCount); }
+
+	void Release(void)
+	{
+		if (::InterlockedDecrement(&lRefCount) == 0)
+		{
+			if (hDevice != INVALID_HANDLE_VALUE)
+			{
+				::CloseHandle(hDevice);
+				::InterlockedIncrement(&KernelCalls());
+			}
+			::DeleteCriticalSection(&critSection);
+			::InterlockedIncrement(&KernelCalls());
+			delete this;
+		}
+	}
+} TSharedDevice;
+
+
 //  The CDiskDrive class illustrates an encapsulation of information and functionality
 //  related to a WMI descriptive disk drive object.  The bus type for accessing the drive is 
 //  encapsulated within the IBusInterface derived type.  We are only interested
@@ -33,6 +95,8 @@ interface IBusInterface
 //  interface.  See AtaIdentifySector.h.
 //  TODO : There is an operation timeout value associated with the DeviceIoControl API.  It's is
 //  herein hard-coded at 15 seconds (i.e. 0x0F).  Need to expose this as a parameter for modification.
+//  Copies share the device (see TSharedDevice) and moves transfer it, so neither makes a kernel
+//  call; a moved-from drive has no device (i.e. HandleIsValid is false).
 
 template <typename IBusInterfaceType> 
 class CDiskDrive : public IBusInterfaceType
@@ -46,23 +110,29 @@ class CDiskDrive : public IBusInterfaceType
 	unsigned short		_nSCSILogicalUnit;		// WMI Win32_DiskDrive : SCSILogicalUnit
 	unsigned short		_nSCSIPort;				// WMI Win32_DiskDrive : SCSIPort
 	unsigned short		_nSCSITargetId;			// WMI Win32_DiskDrive : SCSITargetId
-	HANDLE				_hDevice;				// Windows HANDLE to the disk device				
+	TSharedDevice		*_pDevice;				// Windows HANDLE to the disk device and its lock, NULL if none
 	TIdentifySector		_sIdentifySector;		// The disk "Identify Sector" content
 	_bstr_t				_bstrModel;				// Derived from the "Identify Sector"
 	_bstr_t				_bstrFirmware;			// ""
 	_bstr_t				_bstrSerialNo;			// ""
 	_bstr_t				_bstrVendorID;			// ""
-	CRITICAL_SECTION	_critSection;			// Synchronize threads to ensure Send/Receive pairs are atomic.
+	BYTE				_bySecurityProtocol;	// Trusted Send/Receive : Security Protocol (e.g. 0x01 for TCG)
+	unsigned short		_nComId;				// Trusted Send/Receive : SP Specific (i.e. the TCG ComID)
+	TReceivePollStats	_sPollStats;			// Observed TPer response latency, see TrustedReceive.h
+	TIdentifyIntegrityStats	_sIntegrityStats;	// Identify Sector reads failing the checksum
+	TBusRetryStats		_sRetryStats;			// Retry decisions, see RetryPolicy.h
+	TRetryBudget		_sRetryBudget;			// ""
+	volatile LONG		_lRefCount;				// Intrusive reference count, see AddRef/Release.
 
   protected:
-	inline bool Send(_bstr_t &rbstrErrorInfo, const BYTE *pbyBuffer, unsigned short nLength)
+	inline bool Send(TBusError &rError, const BYTE *pbyBuffer, unsigned short nLength)
 	{
-		return(dynamic_cast<IBusInterfaceType*>(this)->Send(rbstrErrorInfo, pbyBuffer, nLength));
+		return(dynamic_cast<IBusInterfaceType*>(this)->Send(rError, pbyBuffer, nLength));
 	}
 
-	inline bool Receive(_bstr_t &rbstrErrorInfo, const BYTE *pbyBuffer, unsigned short nLength)
+	inline bool Receive(TBusError &rError, const BYTE *pbyBuffer, unsigned short nLength)
 	{
-		return(dynamic_cast<IBusInterfaceType*>(this)->Receive(rbstrErrorInfo, pbyBuffer, nLength));
+		return(dynamic_cast<IBusInterfaceType*>(this)->Receive(rError, pbyBuffer, nLength));
 	}
 
 	BOOL DeviceIo(DWORD dwIoControlCode, LPVOID lpInBuffer, DWORD nInBufferSize, LPVOID lpOutBuffer, DWORD nOutBufferSize, LPDWORD lpBytesReturned, LPOVERLAPPED lpOverlapped)
@@ -76,6 +146,7 @@ class CDiskDrive : public IBusInterfaceType
 
 		ASSERT(HandleIsValid()); 	
 		BOOL bres;
+		unsigned __int64 nStart = ::PerfCounterMicroseconds();
 
 		bres = ::DeviceIoControl(Handle(),
 			dwIoControlCode, 
@@ -86,45 +157,373 @@ class CDiskDrive : public IBusInterfaceType
 			lpBytesReturned,
 			lpOverlapped);
 
+		DWORD dwError = (bres) ? ERROR_SUCCESS : ::GetLastError();
+		::TraceEvent(eTraceDeviceIo, TraceId(), TraceOpcode(dwIoControlCode, lpInBuffer, nInBufferSize), dwIoControlCode,
+					 ((lpBytesReturned) ? *lpBytesReturned : 0), dwError, (unsigned int)(::PerfCounterMicroseconds() - nStart));
+		::SetLastError(dwError);
 		return bres;
 	}
 
+	// The command of a pass-through request, for its trace record; 0 for other requests.
+	static unsigned int TraceOpcode(DWORD dwIoControlCode, LPVOID lpInBuffer, DWORD nInBufferSize)
+	{
+		if ((dwIoControlCode == IOCTL_ATA_PASS_THROUGH_DIRECT) && (nInBufferSize >= sizeof(ATA_PASS_THROUGH_DIRECT)))
+			return ((const ATA_PASS_THROUGH_DIRECT*)lpInBuffer)->CurrentTaskFile[6];		// i.e. IDEREGS bCommandReg
+		if ((dwIoControlCode == IOCTL_SCSI_PASS_THROUGH_DIRECT) && (nInBufferSize >= sizeof(SCSI_PASS_THROUGH_DIRECT)))
+			return ((const SCSI_PASS_THROUGH_DIRECT*)lpInBuffer)->Cdb[0];
+		return 0;
+	}
+
+	// The delay before retrying a failed attempt (1 based), or RETRY_NEVER if the operation is
+	// complete : it succeeded, or its failure is permanent, unrepeatable or out of attempts or
+	// budget, or its backoff would outlast dwRemainingMs (see RetryPolicy.h).  With bRefusalOnly,
+	// only a definite refusal is retried.  The caller holds the drive critical section, and
+	// releases it before waiting.
+	DWORD RetryDelayMs(bool bSucceeded, const TBusError &rError, unsigned int nAttempt, bool bRepeatable = true, 
+					   bool bRefusalOnly = false, DWORD dwRemainingMs = INFINITE)
+	{
+		const TRetryPolicy &rPolicy = ::RetryPolicy();
+
+		if (bSucceeded)
+		{
+			if (nAttempt > 1)
+				_sRetryStats.nRecovered++;
+			return RETRY_NEVER;
+		}
+		if (!bRepeatable)
+			return RETRY_NEVER;
+		if ((bRefusalOnly ? ::RetryClassifyRefusal(rError) : ::RetryClassify(rError)) == eRetryPermanent)
+		{
+			_sRetryStats.nPermanent++;
+			return RETRY_NEVER;
+		}
+
+		DWORD dwDelayMs = rPolicy.BackoffMs(nAttempt, TraceId());
+		if ((nAttempt >= rPolicy.nMaxAttempts) || (dwDelayMs >= dwRemainingMs))
+		{
+			_sRetryStats.nExhausted++;
+			return RETRY_NEVER;
+		}
+		if (!_sRetryBudget.Take(rPolicy, ::GetTickCount64()))
+		{
+			_sRetryStats.nBudgetDenied++;
+			return RETRY_NEVER;
+		}
+		_sRetryStats.nRetries++;
+		_sRetryStats.nBackoffMs += dwDelayMs;
+		::TraceEvent(eTraceRetry, TraceId(), rError.byOperation, nAttempt, rError.byPhase, rError.Win32Error(), dwDelayMs);
+		return dwDelayMs;
+	}
+
+	// What is left of dwTimeoutMs (INFINITE = unbounded) since nStartUs (see PerfCounterMicroseconds).
+	static DWORD RemainingMs(unsigned __int64 nStartUs, DWORD dwTimeoutMs)
+	{
+		if (dwTimeoutMs == INFINITE)
+			return INFINITE;
+		unsigned __int64 nElapsedMs = (::PerfCounterMicroseconds() - nStartUs) / 1000;
+		return (nElapsedMs < dwTimeoutMs) ? (DWORD)(dwTimeoutMs - nElapsedMs) : 0;
+	}
+
   public:
-	bool QueryIdentifySector(_bstr_t &rbstrErrorInfo)
+	// The failure, if any, is left in rError and as the thread's last Win32 error.
+	bool QueryIdentifySector(TBusError &rError)
 	{
 		TRACE(L"CDiskDrive::QueryIdentifySector\n");
 		bool bres = true;
+		DWORD dwDelayMs = RETRY_NEVER;
 		ASSERT(HandleIsValid()); 
 
+		rError.Clear();
 		if (!HandleIsValid())
 		{
-			rbstrErrorInfo = L"QueryIdentifySector : Invalid device handle.";
+			rError.Set(eBusOpIdentify, eBusPhaseArgument);
+			::SetLastError(rError.Win32Error());
 			return false;
 		}
 		_sIdentifySector.Initialize();
+		_bstrModel = _bstrFirmware = _bstrSerialNo = _bstrVendorID = _bstr_t();
 		
 		// ACCOMPLISH THREAD SYNCHRONIZATION AROUND THIS SEND/RECEIVE TRANSACTION!
-		::EnterCriticalSection(&_critSection); 
-		bres = dynamic_cast<IBusInterfaceType*>(this)->ReadIdentifySector(rbstrErrorInfo);
-		::LeaveCriticalSection(&_critSection);
-
-		if (bres == false)
+		// A sector failing its checksum (e.g. garbled by a USB bridge) is read once more.  A
+		// transient failure is retried per the RetryPolicy, other threads using the drive between.
+		for (unsigned int nAttempt = 1; ; nAttempt++)
 		{
-			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			::EnterCriticalSection(&_pDevice->critSection); 
+			bres = dynamic_cast<IBusInterfaceType*>(this)->ReadIdentifySector(rError);
+			_sIntegrityStats.nReads++;
+			if ((bres == true) && (::AtaIdentifyIntegrity(_sIdentifySector._sectorData) == eIntegrityCorrupt))
+			{
+				_sIntegrityStats.nCorrupt++;
+				_sIdentifySector.Initialize();
+				bres = dynamic_cast<IBusInterfaceType*>(this)->ReadIdentifySector(rError);
+				_sIntegrityStats.nReads++;
+				if ((bres == true) && (::AtaIdentifyIntegrity(_sIdentifySector._sectorData) == eIntegrityCorrupt))
+				{
+					_sIntegrityStats.nCorrupt++;
+					_sIdentifySector.Initialize();
+					rError.Set(eBusOpIdentify, eBusPhaseIntegrity);
+					bres = false;
+				}
+				else if (bres == true)
+					_sIntegrityStats.nRecovered++;
+			}
+			dwDelayMs = RetryDelayMs(bres, rError, nAttempt);
+			::LeaveCriticalSection(&_pDevice->critSection);
+			if (dwDelayMs == RETRY_NEVER)
+				break;
+			::Sleep(dwDelayMs);
+		}
+		::TraceEvent(eTraceIdentify, TraceId(), 0xEC, _sIntegrityStats.nReads, _sIntegrityStats.nCorrupt, rError.Win32Error());
+
+		if (bres == true)
+			_sIdentifySector.DecodeCapabilities();
+		else
+			::SetLastError(rError.Win32Error());
+		return bres;
+	}
+
+	// As above, the failure described for display.
+	bool QueryIdentifySector(_bstr_t &rbstrErrorInfo)
+	{
+		TBusError sError;
+		bool bres = QueryIdentifySector(sError);
+
+		if (!bres)
 			rbstrErrorInfo = ::BuildMessage(L"Error : %ws : %ws : Failed to read the disk 'Identify Sector'. : %ws", 
 				(const wchar_t*)_bstrName,
 				(const wchar_t*)_bstrInterfaceType,
-				(const wchar_t*)rbstrErrorInfo);
+				(const wchar_t*)sError.Describe());
+		return bres;
+	}
+
+	// Transmit an IF-SEND command payload and collect the complete IF-RECV response ComPacket.
+	// The Send/Receive pair is atomic with respect to other threads using this drive.  The
+	// rResponse buffer is resized to the ComPacket header plus its reported Length.
+	bool Transmit(TBusError &rError, const BYTE *pbyCommand, unsigned nCommandLength, 
+				  std::vector<BYTE> &rResponse, DWORD dwTimeoutMs = TCG_RECEIVE_TIMEOUT_MS)
+	{
+		TRACE(L"CDiskDrive::Transmit\n");
+		bool bres = true;
+		ASSERT(HandleIsValid()); 
+
+		rError.Clear();
+		if (!HandleIsValid())
+		{
+			rError.Set(eBusOpSend, eBusPhaseArgument);
+			return false;
+		}
+
+		// ACCOMPLISH THREAD SYNCHRONIZATION AROUND THIS SEND/RECEIVE TRANSACTION!
+		::EnterCriticalSection(&_pDevice->critSection); 
+		bres = dynamic_cast<IBusInterfaceType*>(this)->Send(rError, pbyCommand, nCommandLength);
+		if (bres == true)
+			bres = ReceiveComPacket(rError, rResponse, dwTimeoutMs);
+		::LeaveCriticalSection(&_pDevice->critSection);
+		return bres;
+	}
+
+	// As above, with the Security Protocol and ComID selected for this exchange only, within the
+	// same critical section so that concurrent sessions on differing ComIDs do not interfere.  An IF-SEND the drive definitely
+	// refused (e.g. busy, not ready) is retried per the RetryPolicy; one that may have been
+	// accepted (e.g. timed out), and a failed IF-RECV, are not.  Here dwTimeoutMs bounds the
+	// whole exchange, retries and their backoff included.
+	bool Transmit(TBusError &rError, BYTE bySecurityProtocol, unsigned short nComId, const BYTE *pbyCommand, 
+				  unsigned nCommandLength, std::vector<BYTE> &rResponse, DWORD dwTimeoutMs = TCG_RECEIVE_TIMEOUT_MS)
+	{
+		TRACE(L"CDiskDrive::Transmit\n");
+		bool bres = true;
+		DWORD dwDelayMs = RETRY_NEVER;
+		unsigned __int64 nStartUs = ::PerfCounterMicroseconds();
+
+		if (!HandleIsValid())
+		{
+			rError.Set(eBusOpSend, eBusPhaseArgument);
+			return false;
+		}
+		for (unsigned int nAttempt = 1; ; nAttempt++)
+		{
+			::EnterCriticalSection(&_pDevice->critSection); 
+			BYTE bySavedProtocol = _bySecurityProtocol;
+			unsigned short nSavedComId = _nComId;
+			SetTrustedProtocol(bySecurityProtocol, nComId);
+			bres = Transmit(rError, pbyCommand, nCommandLength, rResponse, RemainingMs(nStartUs, dwTimeoutMs));
+			SetTrustedProtocol(bySavedProtocol, nSavedComId);
+			dwDelayMs = RetryDelayMs(bres, rError, nAttempt, (rError.byOperation == eBusOpSend), true, RemainingMs(nStartUs, dwTimeoutMs));
+			::LeaveCriticalSection(&_pDevice->critSection);
+			if (dwDelayMs == RETRY_NEVER)
+				break;
+			::Sleep(dwDelayMs);
 		}
 		return bres;
 	}
 
+	// As above, the failure described for display.
+	bool Transmit(_bstr_t &rbstrErrorInfo, BYTE bySecurityProtocol, unsigned short nComId, const BYTE *pbyCommand, 
+				  unsigned nCommandLength, std::vector<BYTE> &rResponse, DWORD dwTimeoutMs = TCG_RECEIVE_TIMEOUT_MS)
+	{
+		TBusError sError;
+		bool bres = Transmit(sError, bySecurityProtocol, nComId, pbyCommand, nCommandLength, rResponse, dwTimeoutMs);
+
+		if (!bres)
+			rbstrErrorInfo = sError.Describe(_bstrName);
+		return bres;
+	}
+
+	// A single IF-RECV of rBuffer.size() bytes without a preceding IF-SEND (e.g. Level 0 Discovery),
+	// retried per the RetryPolicy within dwTimeoutMs.  The drive's own Security Protocol and ComID
+	// are left as they were.
+	bool TrustedReceive(TBusError &rError, BYTE bySecurityProtocol, unsigned short nComId, std::vector<BYTE> &rBuffer, 
+						DWORD dwTimeoutMs = INFINITE)
+	{
+		TRACE(L"CDiskDrive::TrustedReceive\n");
+		bool bres = true;
+		DWORD dwDelayMs = RETRY_NEVER;
+		unsigned __int64 nStartUs = ::PerfCounterMicroseconds();
+		ASSERT(rBuffer.size() > 0);
+
+		rError.Clear();
+		if ((!HandleIsValid()) || (rBuffer.size() == 0))
+		{
+			rError.Set(eBusOpReceive, eBusPhaseArgument);
+			return false;
+		}
+
+		for (unsigned int nAttempt = 1; ; nAttempt++)
+		{
+			::EnterCriticalSection(&_pDevice->critSection); 
+			BYTE bySavedProtocol = _bySecurityProtocol;
+			unsigned short nSavedComId = _nComId;
+			SetTrustedProtocol(bySecurityProtocol, nComId);
+			bres = dynamic_cast<IBusInterfaceType*>(this)->Receive(rError, &rBuffer[0], (unsigned)rBuffer.size());
+			SetTrustedProtocol(bySavedProtocol, nSavedComId);
+			dwDelayMs = RetryDelayMs(bres, rError, nAttempt, true, false, RemainingMs(nStartUs, dwTimeoutMs));
+			::LeaveCriticalSection(&_pDevice->critSection);
+			if (dwDelayMs == RETRY_NEVER)
+				break;
+			::Sleep(dwDelayMs);
+		}
+		return bres;
+	}
+
+	// As above, the failure described for display.
+	bool TrustedReceive(_bstr_t &rbstrErrorInfo, BYTE bySecurityProtocol, unsigned short nComId, std::vector<BYTE> &rBuffer, 
+						DWORD dwTimeoutMs = INFINITE)
+	{
+		TBusError sError;
+		bool bres = TrustedReceive(sError, bySecurityProtocol, nComId, rBuffer, dwTimeoutMs);
+
+		if (!bres)
+			rbstrErrorInfo = sError.Describe(_bstrName);
+		return bres;
+	}
+
+	// Poll IF-RECV until the TPer returns a response ComPacket, honouring OutstandingData and
+	// MinTransfer.  The caller must hold the drive critical section (see Transmit).
+	bool ReceiveComPacket(TBusError &rError, std::vector<BYTE> &rResponse, DWORD dwTimeoutMs = TCG_RECEIVE_TIMEOUT_MS)
+	{
+		TRACE(L"CDiskDrive::ReceiveComPacket\n");
+		unsigned int nBlockSize = (_nBytesPerSector > 0) ? _nBytesPerSector : TCG_TRANSFER_BLOCK_SIZE;
+		unsigned int nMaxTransfer = TCG_MAX_TRANSFER_BLOCKS * nBlockSize;
+		unsigned int nTransfer = TcgRoundUpTransfer((_sPollStats.nLastResponseLength > nSizeTComPacketHeader) ? 
+									_sPollStats.nLastResponseLength : nSizeTComPacketHeader, nBlockSize);
+		unsigned __int64 nStartUs = ::PerfCounterMicroseconds();
+		unsigned __int64 nTimeoutUs = (unsigned __int64)dwTimeoutMs * 1000;
+		unsigned int nEmpty = 0;
+		TComPacketStatus status;
+
+		SleepMicroseconds((_sPollStats.FirstPollDelayUs() < nTimeoutUs) ? _sPollStats.FirstPollDelayUs() : (unsigned int)nTimeoutUs);
+		for (;;)
+		{
+			rResponse.assign(nTransfer, 0);
+			if (!dynamic_cast<IBusInterfaceType*>(this)->Receive(rError, &rResponse[0], nTransfer))
+				return false;
+			_sPollStats.nReceives++;
+
+			if (!status.Decode(&rResponse[0], nTransfer))
+			{
+				rError.Set(eBusOpReceive, eBusPhaseComPacket);
+				return false;
+			}
+
+			// The response is present, though possibly truncated by our transfer length.
+			unsigned int nRequired = 0;
+			if (status.HasResponse())
+			{
+				if ((nSizeTComPacketHeader + status.nLength) <= nTransfer)
+				{
+					rResponse.resize(nSizeTComPacketHeader + status.nLength);
+					_sPollStats.RecordResponse(::PerfCounterMicroseconds() - nStartUs, (unsigned int)rResponse.size());
+					return true;
+				}
+				nRequired = nSizeTComPacketHeader + status.nLength;
+			}
+			else if (!status.IsPending())
+			{
+				rError.Set(eBusOpReceive, eBusPhaseNoResponse, _nComId);
+				return false;
+			}
+			else if (status.PendingBytes() > 0)
+			{
+				nRequired = nSizeTComPacketHeader + status.PendingBytes();
+			}
+
+			// Ready, but larger than requested : reissue immediately sized to exactly what is pending.
+			if (nRequired > nTransfer)
+			{
+				nTransfer = TcgRoundUpTransfer(nRequired, nBlockSize);
+				if (nTransfer > nMaxTransfer)
+				{
+					rError.Set(eBusOpReceive, eBusPhaseOverflow, nRequired);
+					return false;
+				}
+				_sPollStats.nResizedReceives++;
+				continue;
+			}
+
+			// Still processing : back off and poll again.
+			_sPollStats.nEmptyReceives++;
+			nEmpty++;
+			unsigned __int64 nElapsedUs = ::PerfCounterMicroseconds() - nStartUs;
+			if (nElapsedUs >= nTimeoutUs)
+			{
+				rError.Set(eBusOpReceive, eBusPhaseTimeout, dwTimeoutMs);
+				return false;
+			}
+			unsigned int nDelayUs = _sPollStats.NextPollDelayUs(nEmpty);
+			if ((nElapsedUs + nDelayUs) > nTimeoutUs)
+				nDelayUs = (unsigned int)(nTimeoutUs - nElapsedUs);
+			SleepMicroseconds(nDelayUs);
+		}
+	}
+
+	// Select the Security Protocol and SP Specific (ComID) values used by subsequent Send/Receive calls.
+	inline void SetTrustedProtocol(BYTE bySecurityProtocol, unsigned short nComId)
+	{
+		_bySecurityProtocol = bySecurityProtocol;
+		_nComId = nComId;
+	}
+
+	// A CDiskDrive is created with one reference, owned by the list (e.g. TListDiskDrives) it is
+	// placed within.  A thread using a drive beyond the lifetime of that list entry (e.g. while a
+	// hotplug removal drops it from the inventory) holds a reference of its own.  The last
+	// Release deletes the drive, closing its device handle.
+	inline LONG AddRef(void)
+		{ return ::InterlockedIncrement(&_lRefCount); }
+
+	inline LONG Release(void)
+	{
+		LONG lRefCount = ::InterlockedDecrement(&_lRefCount);
+		if (lRefCount == 0)
+			delete static_cast<IBusInterface*>(this);
+		return lRefCount;
+	}
+
 	// Accessors
 	inline bool HandleIsValid(void) 
-		{ return (_hDevice != INVALID_HANDLE_VALUE); }
+		{ return ((_pDevice) && (_pDevice->hDevice != INVALID_HANDLE_VALUE)); }
 	
-	inline const HANDLE &Handle(void) 
-		{ return _hDevice; }
+	inline HANDLE Handle(void) 
+		{ return (_pDevice ? _pDevice->hDevice : INVALID_HANDLE_VALUE); }
 
 	inline const _bstr_t &Name(void) 
 		{ return _bstrName; }
@@ -147,30 +546,66 @@ class CDiskDrive : public IBusInterfaceType
 	inline const short SCSITargetId(void) 
 		{ return _nSCSITargetId; }
 
+	// The SCSI address as one value (port, bus, target and unit, a byte each), naming the drive in trace records.
+	inline unsigned int TraceId(void) const
+		{ return ((_nSCSIPort & 0xFF) << 24) | ((_nSCSIBus & 0xFF) << 16) | ((_nSCSITargetId & 0xFF) << 8) | (_nSCSILogicalUnit & 0xFF); }
+
 	inline const TIdentifySector &IdentifySector(void) 
 		{ return _sIdentifySector; }
 
 	inline bool IsAtaPassthruCapable(void) 
 		{ return _sIdentifySector.IsAtaPassthruCapable(); }
 
+	inline bool IsDriveTrustCapable(void) 
+		{ return (_sIdentifySector.Capabilities().bDriveTrust != 0); }
+
+	// Decoded by QueryIdentifySector, all zero until then.
+	inline const TDriveCapabilities &Capabilities(void) 
+		{ return _sIdentifySector.Capabilities(); }
+
+	// Classified by QueryIdentifySector, see DriveVendors.h.
+	inline const TDriveClass &DriveClass(void) 
+		{ return _sIdentifySector.DriveClass(); }
+
+	inline BYTE SecurityProtocol(void) 
+		{ return _bySecurityProtocol; }
+
+	inline unsigned short ComId(void) 
+		{ return _nComId; }
+
+	inline const TReceivePollStats &PollStats(void) 
+		{ return _sPollStats; }
+
+	inline const TIdentifyIntegrityStats &IntegrityStats(void) 
+		{ return _sIntegrityStats; }
+
+	inline const TBusRetryStats &RetryStats(void) 
+		{ return _sRetryStats; }
+
 	inline const _bstr_t &Model(void) 
 	{ 
+		char szField[IDENTIFY_FIELD_CHARS];
 		if (_bstrModel.length() == 0)
-			_bstrModel = _sIdentifySector.GetModel();
+			_bstrModel = _sIdentifySector.GetModel(szField);
 		return _bstrModel; 
 	}
 	inline const _bstr_t &Firmware(void)
 	{ 
+		char szField[IDENTIFY_FIELD_CHARS];
 		if (_bstrFirmware.length() == 0)
-			_bstrFirmware = _sIdentifySector.GetFirmware();
+			_bstrFirmware = _sIdentifySector.GetFirmware(szField);
 		return _bstrFirmware; 
 	}
 	inline const _bstr_t &SerialNo(void)
 	{ 
+		char szField[IDENTIFY_FIELD_CHARS];
 		if (_bstrSerialNo.length() == 0)
-			_bstrSerialNo = _sIdentifySector.GetSerialNo();
+			_bstrSerialNo = _sIdentifySector.GetSerialNo(szField);
 		return _bstrSerialNo; 
 	}
+	inline unsigned __int64 WorldWideName(void)
+		{ return _sIdentifySector.GetWorldWideName(); }
+
 	inline const _bstr_t &VendorID(void)
 	{ 
 		if (_bstrVendorID.length() == 0)
@@ -179,91 +614,59 @@ class CDiskDrive : public IBusInterfaceType
 	}
 
 	// Constructors and destructor
-	CDiskDrive()
-	{
-		_hDevice = INVALID_HANDLE_VALUE;
-		_nBytesPerSector = IDENTIFY_BUFFER_SIZE;
-		_nSCSIBus = 0;
-		_nSCSILogicalUnit = 0;
-		_nSCSIPort = 0;
-		_nSCSITargetId = 0;
-		if (!::InitializeCriticalSectionAndSpinCount(&_critSection, 0x80000400))
-			throw ::BuildMessage(L"Initialize critical section : %ws : %ws", __FILE__, __LINE__);
-	}
-
-	CDiskDrive(CDiskDrive &rInfo) : _bstrName(rInfo._bstrName), 
-		_bstrInterfaceType(rInfo._bstrInterfaceType),
-		_nDriveIndex(rInfo._nDriveIndex),
-		_nBytesPerSector(rInfo._nBytesPerSector),
-		_nSCSIBus(rInfo._nSCSIBus),
-		_nSCSILogicalUnit(rInfo._nSCSILogicalUnit),
-		_nSCSIPort(rInfo._nSCSIPort),
-		_nSCSITargetId(rInfo._nSCSITargetId)
-	{
-		if (::DuplicateHandle(::GetCurrentProcess(), 
-			rInfo._hDevice, 
-			::GetCurrentProcess(),
-			&this->_hDevice, 
-			0,
-			FALSE,
-			DUPLICATE_SAME_ACCESS) == 0)
-			_hDevice = INVALID_HANDLE_VALUE;
-		_sIdentifySector = rInfo._sIdentifySector;
-		ASSERT(_nBytesPerSector <= (sizeof(_sIdentifySector._sectorData)));
-		if (!::InitializeCriticalSectionAndSpinCount(&_critSection, 0x80000400))
-			throw ::BuildMessage(L"Initialize critical section : %ws : %ws", __FILE__, __LINE__);
+	CDiskDrive() : _nBytesPerSector(IDENTIFY_BUFFER_SIZE), _nSCSIBus(0), _nSCSILogicalUnit(0), _nSCSIPort(0), _nSCSITargetId(0),
+		_pDevice(NULL), _bySecurityProtocol(TCG_SECURITY_PROTOCOL_VENDOR), _nComId(0), _lRefCount(1)
+	{
 	}
 
-	CDiskDrive(CDiskDrive *pInfo)
+	// A copy shares the device, see TSharedDevice.
+	CDiskDrive(const CDiskDrive &rInfo) : _pDevice(rInfo._pDevice), _lRefCount(1)
 	{
-		if (pInfo)
+		if (_pDevice)
+			_pDevice->AddRef();
+		AssignAttributes(rInfo);
+	}
+
+	// A move takes the device, leaving rInfo without one.
+	CDiskDrive(CDiskDrive &&rInfo) throw() : _pDevice(rInfo._pDevice), _lRefCount(1)
+	{
+		rInfo._pDevice = NULL;
+		AssignAttributes(rInfo);
+	}
+
+	CDiskDrive(CDiskDrive *pInfo) : _pDevice(NULL), _lRefCount(1)
+	{
+		if (!pInfo)
+			throw ::BuildMessage(L"E_POINTER : %ws : %d", __FILEW__, __LINE__);
+		*this = *pInfo;
+	}
+
+	// Assignment shares (or, from an rvalue, takes) the device, releasing any previously held.
+	// The reference count is that of this object and is not assigned.
+	CDiskDrive &operator=(const CDiskDrive &rInfo)
+	{
+		if (this != &rInfo)
 		{
-			_bstrName = pInfo->_bstrName;
-			_bstrInterfaceType = pInfo->_bstrInterfaceType;
-			if (::DuplicateHandle(::GetCurrentProcess(), 
-				pInfo->_hDevice, 
-				::GetCurrentProcess(),
-				&this->_hDevice, 
-				0,
-				FALSE,
-				DUPLICATE_SAME_ACCESS) == 0)
-				_hDevice = INVALID_HANDLE_VALUE;
-			this->_sIdentifySector = pInfo->_sIdentifySector;
-			this->_nBytesPerSector = pInfo->_nBytesPerSector;
-			ASSERT(this->_nBytesPerSector <= (sizeof(this->_sIdentifySector._sectorData)));
-			this->_nSCSIBus = pInfo->_nSCSIBus;
-			this->_nSCSILogicalUnit = pInfo->_nSCSILogicalUnit;
-			this->_nSCSIPort = pInfo->_nSCSIPort;
-			this->_nSCSITargetId = pInfo->_nSCSITargetId;
-			if (!::InitializeCriticalSectionAndSpinCount(&_critSection, 0x80000400))
-				throw ::BuildMessage(L"Initialize critical section : %ws : %ws", __FILE__, __LINE__);
+			if (rInfo._pDevice)
+				rInfo._pDevice->AddRef();
+			if (_pDevice)
+				_pDevice->Release();
+			_pDevice = rInfo._pDevice;
+			AssignAttributes(rInfo);
+		}
+		return *this;
+	}
+
+	CDiskDrive &operator=(CDiskDrive &&rInfo) throw()
+	{
+		if (this != &rInfo)
+		{
+			if (_pDevice)
+				_pDevice->Release();
+			_pDevice = rInfo._pDevice;
+			rInfo._pDevice = NULL;
+			AssignAttributes(rInfo);
 		}
-		else
-			throw ::BuildMessage(L"E_POINTER : %ws : %ws", __FILE__, __LINE__);
-	}
-
-	CDiskDrive &operator=(CDiskDrive &rInfo)
-	{
-		this->_bstrName = rInfo._bstrName;
-		this->_bstrInterfaceType = rInfo._bstrInterfaceType;
-		if (::DuplicateHandle(::GetCurrentProcess(), 
-			rInfo._hDevice, 
-			::GetCurrentProcess(),
-			&this->_hDevice, 
-			0,
-			FALSE,
-			DUPLICATE_SAME_ACCESS) == 0)
-			this->_hDevice = INVALID_HANDLE_VALUE;
-		this->_sIdentifySector = rInfo._sIdentifySector;
-		this->_sIdentifySector = rInfo._sIdentifySector;
-		this->_nBytesPerSector = rInfo._nBytesPerSector;
-		ASSERT(this->_nBytesPerSector <= (sizeof(this->_sIdentifySector._sectorData)));
-		this->_nSCSIBus = rInfo._nSCSIBus;
-		this->_nSCSILogicalUnit = rInfo._nSCSILogicalUnit;
-		this->_nSCSIPort = rInfo._nSCSIPort;
-		this->_nSCSITargetId = rInfo._nSCSITargetId;
-		if (!::InitializeCriticalSectionAndSpinCount(&_critSection, 0x80000400))
-			throw ::BuildMessage(L"Initialize critical section : %ws : %ws", __FILE__, __LINE__);
 		return *this;
 	}
 
@@ -274,28 +677,52 @@ class CDiskDrive : public IBusInterfaceType
 		unsigned int nSCSIBus,
 		unsigned short nSCSILogicalUnit,
 		unsigned short nSCSIPort,
-		unsigned short nSCSITargetId) 
+		unsigned short nSCSITargetId) : _pDevice(NULL), _lRefCount(1)
 	{
-		// This constructor only used within GetDiskDriveDevices() herein.
-		// Assume it is safe to ignore handle closure potential.
+		// This constructor only used within OpenDiskDrive(), which hands over hDevice.
 		_bstrName = bstrName; 
 		_bstrInterfaceType = bstrInterfaceType;
-		_hDevice = hDevice; 
 		_nBytesPerSector = nBytesPerSector;
 		ASSERT(_nBytesPerSector <= (sizeof(_sIdentifySector._sectorData)));
 		_nSCSIBus = (unsigned short)nSCSIBus;
 		_nSCSILogicalUnit = nSCSILogicalUnit;
 		_nSCSIPort = nSCSIPort;
 		_nSCSITargetId = nSCSITargetId;
-		if (!::InitializeCriticalSectionAndSpinCount(&_critSection, 0x80000400))
-			throw ::BuildMessage(L"Initialize critical section : %ws : %ws", __FILE__, __LINE__);
+		_bySecurityProtocol = TCG_SECURITY_PROTOCOL_VENDOR;
+		_nComId = 0;
+		_pDevice = TSharedDevice::Create(hDevice);
 	}
 
 	~CDiskDrive()
 	{
-		if (_hDevice != INVALID_HANDLE_VALUE)
-			::CloseHandle(_hDevice);	
-		::DeleteCriticalSection(&_critSection);
+		if (_pDevice)
+			_pDevice->Release();
+	}
+
+  private:
+	// Everything but the device and the reference count; the identify strings are reference
+	// counted BSTRs, so copying them copies no characters.
+	void AssignAttributes(const CDiskDrive &rInfo)
+	{
+		_bstrName = rInfo._bstrName;
+		_bstrInterfaceType = rInfo._bstrInterfaceType;
+		_nBytesPerSector = rInfo._nBytesPerSector;
+		ASSERT(_nBytesPerSector <= (sizeof(_sIdentifySector._sectorData)));
+		_nSCSIBus = rInfo._nSCSIBus;
+		_nSCSILogicalUnit = rInfo._nSCSILogicalUnit;
+		_nSCSIPort = rInfo._nSCSIPort;
+		_nSCSITargetId = rInfo._nSCSITargetId;
+		_sIdentifySector = rInfo._sIdentifySector;
+		_bstrModel = rInfo._bstrModel;
+		_bstrFirmware = rInfo._bstrFirmware;
+		_bstrSerialNo = rInfo._bstrSerialNo;
+		_bstrVendorID = rInfo._bstrVendorID;
+		_bySecurityProtocol = rInfo._bySecurityProtocol;
+		_nComId = rInfo._nComId;
+		_sPollStats = rInfo._sPollStats;
+		_sIntegrityStats = rInfo._sIntegrityStats;
+		_sRetryStats = rInfo._sRetryStats;
+		_sRetryBudget = rInfo._sRetryBudget;
 	}
 };   // CDiskDrive
 
@@ -304,22 +731,22 @@ class CDiskDrive : public IBusInterfaceType
 
 interface IUnsupportedInterface : public IBusInterface
 {
-	virtual bool ReadIdentifySector(_bstr_t &rbstrErrorInfo)
+	virtual bool ReadIdentifySector(TBusError &rError)
 	{
-		return Unsupported(rbstrErrorInfo);
+		return Unsupported(rError, eBusOpIdentify);
 	}
-	virtual bool Send(_bstr_t &rbstrErrorInfo, const BYTE *, unsigned )    
+	virtual bool Send(TBusError &rError, const BYTE *, unsigned )    
 	{
-		return Unsupported(rbstrErrorInfo);
+		return Unsupported(rError, eBusOpSend);
 	}
-	virtual bool Receive(_bstr_t &rbstrErrorInfo, const BYTE *, unsigned )
+	virtual bool Receive(TBusError &rError, const BYTE *, unsigned )
 	{
-		return Unsupported(rbstrErrorInfo);
+		return Unsupported(rError, eBusOpReceive);
 	}
-	inline bool Unsupported(_bstr_t &rbstrErrorInfo)
+	inline bool Unsupported(TBusError &rError, EBusOperation eOperation)
 	{
 		TRACE(L"IUnsupportedInterface\n");
-		rbstrErrorInfo = L"Unsupported bus interface type.";
+		rError.Set(eOperation, eBusPhaseUnsupported);
 		return false;
 	}
 };   // IUnsupportedInterface
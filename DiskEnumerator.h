@@ -0,0 +1,380 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cwctype>
+#include <stdlib.h>
+
+
+//  The IDiskEnumerator interface produces the per-drive attributes required to open and construct
+//  a CDiskDrive (see DiskPlatform.h), one drive at a time, so the first drive is available before
+//  enumeration completes.  Implementations :
+//
+//		CWmiDiskEnumerator		Win32_DiskDrive via WMI, see PlatformWin32.cpp.
+//		CSysfsDiskEnumerator	/sys/block and /sys/class/scsi_device on Linux, see SysfsEnumerator.h.
+//		CSimulatedDiskEnumerator	Synthetic drives at a modelled cost, see SimulatedEnumerator.h.
+//
+//  Begin takes a TEnumerationQuery : the attributes the caller requires (a backend need not fetch
+//  the others, which are left at their defaults) and the number of devices to retrieve per round
+//  trip where the backend has such a notion (e.g. IEnumWbemClassObject::Next).  It may also carry
+//  a TDiskFilter, evaluated against the enumerated attributes before any device is opened; a
+//  backend may pass the filter on to its source (e.g. a WQL WHERE clause) but need not.
+//
+//  This header, and the attribute types, are free of Windows and COM types so that the backends
+//  may be built and exercised on any platform.
+//
+
+typedef struct TDiskDeviceAttributes
+{
+	std::wstring		strDeviceID;			// e.g. \\.\PHYSICALDRIVE0, /dev/sda
+	std::wstring		strInterfaceType;		// IDE, USB, SCSI, ... as per Win32_DiskDrive
+	unsigned int		nBytesPerSector;
+	unsigned short		nSCSIBus;				// Channel
+	unsigned short		nSCSILogicalUnit;
+	unsigned short		nSCSIPort;				// Host adapter
+	unsigned short		nSCSITargetId;
+	std::wstring		strModel;				// As cached by the operating system, not from IDENTIFY
+	std::wstring		strSerialNumber;		// ditto, empty if unknown
+
+	TDiskDeviceAttributes(void) : nBytesPerSector(512), nSCSIBus(0), nSCSILogicalUnit(0), nSCSIPort(0), nSCSITargetId(0) {}
+} TDiskDeviceAttributes;
+
+
+//  Attribute projection, one bit per TDiskDeviceAttributes field.  eDiskFieldsAll is not a
+//  projection at all (i.e. every attribute the backend knows, as per SELECT *), kept for comparison.
+enum EDiskAttributeField
+{
+	eDiskFieldDeviceID			= 0x0001,
+	eDiskFieldInterfaceType		= 0x0002,
+	eDiskFieldBytesPerSector	= 0x0004,
+	eDiskFieldSCSIBus			= 0x0008,
+	eDiskFieldSCSILogicalUnit	= 0x0010,
+	eDiskFieldSCSIPort			= 0x0020,
+	eDiskFieldSCSITargetId		= 0x0040,
+	eDiskFieldModel				= 0x0080,
+	eDiskFieldSerialNumber		= 0x0100,
+
+	eDiskFieldsAddress			= eDiskFieldSCSIBus | eDiskFieldSCSILogicalUnit | eDiskFieldSCSIPort | eDiskFieldSCSITargetId,
+	eDiskFieldsOpen				= eDiskFieldDeviceID | eDiskFieldInterfaceType | eDiskFieldBytesPerSector | eDiskFieldsAddress,
+	eDiskFieldsAll				= 0xFFFF
+};
+
+#define DISK_ENUM_DEFAULT_BATCH		16
+#define DISK_FILTER_ANY				-1
+#define DISK_FILTER_ANY_TOKEN		L"any"		// Filter value for DISK_FILTER_ANY, e.g. port=any
+#define DISK_FILTER_MAX_ADDRESS		0xFFFF		// i.e. unsigned short
+
+
+// Case insensitive match of a * and ? wildcard pattern.
+inline bool WildcardMatch(const wchar_t *pszPattern, const wchar_t *pszText)
+{
+	const wchar_t *pszStar = NULL, *pszResume = NULL;
+
+	while (*pszText)
+	{
+		if ((*pszPattern == L'?') || (towupper(*pszPattern) == towupper(*pszText)))
+		{
+			pszPattern++;
+			pszText++;
+		}
+		else if (*pszPattern == L'*')
+		{
+			pszStar = pszPattern++;
+			pszResume = pszText;
+		}
+		else if (pszStar)
+		{
+			pszPattern = pszStar + 1;
+			pszText = ++pszResume;
+		}
+		else
+			return false;
+	}
+	while (*pszPattern == L'*')
+		pszPattern++;
+	return (*pszPattern == L'\0');
+}
+
+
+//  Selects drives by their enumerated attributes, so that those not selected are never opened
+//  (nor identified).  Empty patterns and DISK_FILTER_ANY match anything.  The model and serial
+//  number are those the operating system has cached from its own earlier IDENTIFY or INQUIRY
+//  (e.g. Win32_DiskDrive.Model, /sys/block/<name>/device/model), a drive lacking one fails a
+//  pattern on it.
+typedef struct TDiskFilter
+{
+	std::wstring		strInterfaceType;		// e.g. USB
+	int					nSCSIPort;
+	int					nSCSIBus;
+	int					nSCSITargetId;
+	std::wstring		strPathPattern;			// e.g. \\.\PHYSICALDRIVE1? or /dev/sd*
+	std::wstring		strModelPattern;
+	std::wstring		strSerialPattern;
+
+	TDiskFilter(void) : nSCSIPort(DISK_FILTER_ANY), nSCSIBus(DISK_FILTER_ANY), nSCSITargetId(DISK_FILTER_ANY) {}
+
+	// The attributes required to evaluate the filter.
+	unsigned int Fields(void) const
+	{
+		unsigned int nFields = 0;
+
+		if (!strInterfaceType.empty())
+			nFields |= eDiskFieldInterfaceType;
+		if (nSCSIPort != DISK_FILTER_ANY)
+			nFields |= eDiskFieldSCSIPort;
+		if (nSCSIBus != DISK_FILTER_ANY)
+			nFields |= eDiskFieldSCSIBus;
+		if (nSCSITargetId != DISK_FILTER_ANY)
+			nFields |= eDiskFieldSCSITargetId;
+		if (!strModelPattern.empty())
+			nFields |= eDiskFieldModel;
+		if (!strSerialPattern.empty())
+			nFields |= eDiskFieldSerialNumber;
+		return nFields;
+	}
+
+	inline bool MatchesPath(const std::wstring &strDeviceID) const
+		{ return ((strPathPattern.empty()) || (WildcardMatch(strPathPattern.c_str(), strDeviceID.c_str()))); }
+
+	bool Matches(const TDiskDeviceAttributes &rAttributes) const
+	{
+		if ((!strInterfaceType.empty()) && (!WildcardMatch(strInterfaceType.c_str(), rAttributes.strInterfaceType.c_str())))
+			return false;
+		if (((nSCSIPort != DISK_FILTER_ANY) && (nSCSIPort != rAttributes.nSCSIPort)) ||
+			((nSCSIBus != DISK_FILTER_ANY) && (nSCSIBus != rAttributes.nSCSIBus)) ||
+			((nSCSITargetId != DISK_FILTER_ANY) && (nSCSITargetId != rAttributes.nSCSITargetId)))
+			return false;
+		if (!MatchesPath(rAttributes.strDeviceID))
+			return false;
+		if ((!strModelPattern.empty()) && (!WildcardMatch(strModelPattern.c_str(), rAttributes.strModel.c_str())))
+			return false;
+		if ((!strSerialPattern.empty()) && (!WildcardMatch(strSerialPattern.c_str(), rAttributes.strSerialNumber.c_str())))
+			return false;
+		return true;
+	}
+
+	// Parse a port, bus or target value : decimal digits, or DISK_FILTER_ANY_TOKEN.
+	static bool ParseAddress(const std::wstring &strKey, const std::wstring &strValue, int &rnValue, std::wstring &rstrErrorInfo)
+	{
+		unsigned long nValue = 0;
+		size_t i = 0;
+
+		if (strValue == DISK_FILTER_ANY_TOKEN)
+		{
+			rnValue = DISK_FILTER_ANY;
+			return true;
+		}
+		for (; (i < strValue.length()) && (strValue[i] >= L'0') && (strValue[i] <= L'9') && (nValue <= DISK_FILTER_MAX_ADDRESS); i++)
+			nValue = (nValue * 10) + (strValue[i] - L'0');
+		if ((strValue.empty()) || (i < strValue.length()) || (nValue > DISK_FILTER_MAX_ADDRESS))
+		{
+			rstrErrorInfo = L"Invalid " + strKey + L" '" + strValue + L"' : expected 0 to 65535 or " DISK_FILTER_ANY_TOKEN L".";
+			return false;
+		}
+		rnValue = (int)nValue;
+		return true;
+	}
+
+	// Parse a comma separated list of key=value terms, keys being interface, port, bus, target,
+	// path, model and serial, e.g. "interface=USB,model=ST3*".  Port, bus and target take a
+	// number or DISK_FILTER_ANY_TOKEN.  False, with rstrErrorInfo naming the term, on a term
+	// without a value, an unknown key or a value that is not a number.
+	bool Parse(const wchar_t *pszSpecification, std::wstring &rstrErrorInfo)
+	{
+		std::wstring strSpecification(pszSpecification ? pszSpecification : L"");
+		size_t nStart = 0;
+
+		*this = TDiskFilter();
+		while (nStart < strSpecification.length())
+		{
+			size_t nEnd = strSpecification.find(L',', nStart);
+			if (nEnd == std::wstring::npos)
+				nEnd = strSpecification.length();
+
+			std::wstring strTerm = strSpecification.substr(nStart, nEnd - nStart);
+			size_t nEquals = strTerm.find(L'=');
+			if (nEquals == std::wstring::npos)
+			{
+				rstrErrorInfo = L"Invalid term '" + strTerm + L"' : expected key=value.";
+				return false;
+			}
+			std::wstring strKey = strTerm.substr(0, nEquals);
+			std::wstring strValue = strTerm.substr(nEquals + 1);
+
+			if (strKey == L"interface")
+				strInterfaceType = strValue;
+			else if (strKey == L"port")
+			{
+				if (!ParseAddress(strKey, strValue, nSCSIPort, rstrErrorInfo))
+					return false;
+			}
+			else if (strKey == L"bus")
+			{
+				if (!ParseAddress(strKey, strValue, nSCSIBus, rstrErrorInfo))
+					return false;
+			}
+			else if (strKey == L"target")
+			{
+				if (!ParseAddress(strKey, strValue, nSCSITargetId, rstrErrorInfo))
+					return false;
+			}
+			else if (strKey == L"path")
+				strPathPattern = strValue;
+			else if (strKey == L"model")
+				strModelPattern = strValue;
+			else if (strKey == L"serial")
+				strSerialPattern = strValue;
+			else
+			{
+				rstrErrorInfo = L"Unknown key '" + strKey + L"'.";
+				return false;
+			}
+			nStart = nEnd + 1;
+		}
+		return true;
+	}
+} TDiskFilter;
+
+
+typedef struct TEnumerationQuery
+{
+	unsigned int		nFields;				// EDiskAttributeField bits, DeviceID is always fetched
+	unsigned int		nBatchSize;				// Devices per round trip, at least 1
+	const TDiskFilter	*pFilter;				// Optional, not owned
+
+	TEnumerationQuery(unsigned int fields = eDiskFieldsOpen, unsigned int batch = DISK_ENUM_DEFAULT_BATCH, const TDiskFilter *filter = NULL) 
+		: nFields(fields | eDiskFieldDeviceID | (filter ? filter->Fields() : 0)), nBatchSize(batch ? batch : 1), pFilter(filter) {}
+
+	inline bool Wants(unsigned int nField) const
+		{ return ((nFields & nField) != 0); }
+
+	inline bool Selects(const TDiskDeviceAttributes &rAttributes) const
+		{ return ((!pFilter) || (pFilter->Matches(rAttributes))); }
+} TEnumerationQuery;
+
+
+struct IDiskEnumerator
+{
+	virtual ~IDiskEnumerator() {}
+
+	// Start (or restart) an enumeration of the attributes within rQuery.
+	virtual bool Begin(std::wstring &rstrErrorInfo, const TEnumerationQuery &rQuery) = 0;
+
+	// The next drive; false once enumeration is complete (rstrErrorInfo empty) or on failure.
+	virtual bool Next(std::wstring &rstrErrorInfo, TDiskDeviceAttributes &rAttributes) = 0;
+
+	// Release enumeration resources.
+	virtual void End(void) = 0;
+};
+
+
+//  Enumeration timing, the interesting figure being time-to-first-drive (i.e. how soon work
+//  on the first drive could begin) versus the total.
+typedef struct TEnumerationStats
+{
+	unsigned long long	nBeginUs;				// Until Begin returned
+	unsigned long long	nFirstDriveUs;			// Until the first drive's attributes were available
+	unsigned long long	nFirstOpenUs;			// Until the first drive object was constructed
+	unsigned long long	nTotalUs;
+	unsigned int		nDrives;				// Selected by the filter, if any
+	unsigned int		nFiltered;				// Enumerated but not selected (i.e. never opened)
+
+	TEnumerationStats(void) : nBeginUs(0), nFirstDriveUs(0), nFirstOpenUs(0), nTotalUs(0), nDrives(0), nFiltered(0) {}
+} TEnumerationStats;
+
+
+inline unsigned long long EnumerationClockUs(void)
+{
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Collect the attributes of every drive selected by the query, timing the enumeration if pStats
+// is provided.
+inline bool EnumerateDiskDevices(IDiskEnumerator &rEnumerator, std::wstring &rstrErrorInfo,
+								 std::vector<TDiskDeviceAttributes> &rDevices, TEnumerationStats *pStats = NULL,
+								 const TEnumerationQuery &rQuery = TEnumerationQuery())
+{
+	unsigned long long nStart = EnumerationClockUs();
+	TDiskDeviceAttributes sAttributes;
+	bool bres = rEnumerator.Begin(rstrErrorInfo, rQuery);
+
+	if (pStats)
+		pStats->nBeginUs = EnumerationClockUs() - nStart;
+	while ((bres) && (rEnumerator.Next(rstrErrorInfo, sAttributes)))
+	{
+		if (!rQuery.Selects(sAttributes))
+		{
+			if (pStats)
+				pStats->nFiltered++;
+			continue;
+		}
+		if ((pStats) && (rDevices.empty()))
+			pStats->nFirstDriveUs = pStats->nFirstOpenUs = EnumerationClockUs() - nStart;
+		rDevices.push_back(sAttributes);
+	}
+	rEnumerator.End();
+	if (!rstrErrorInfo.empty())
+		bres = false;
+
+	if (pStats)
+	{
+		pStats->nTotalUs = EnumerationClockUs() - nStart;
+		pStats->nDrives = (unsigned int)rDevices.size();
+	}
+	return bres;
+}
+
+
+//  Startup latency of a backend for a given query over several enumerations, the first of which
+//  (i.e. a cold start) is reported separately from the best and mean of the remainder.
+typedef struct TEnumerationBenchmark
+{
+	TEnumerationStats	sCold;
+	unsigned long long	nBestFirstDriveUs;
+	unsigned long long	nBestTotalUs;
+	unsigned long long	nMeanFirstDriveUs;
+	unsigned long long	nMeanTotalUs;
+	unsigned int		nRuns;					// Warm runs averaged
+
+	TEnumerationBenchmark(void) : nBestFirstDriveUs(0), nBestTotalUs(0), nMeanFirstDriveUs(0), nMeanTotalUs(0), nRuns(0) {}
+} TEnumerationBenchmark;
+
+
+inline bool BenchmarkDiskEnumerator(IDiskEnumerator &rEnumerator, const TEnumerationQuery &rQuery, unsigned int nRuns,
+									std::wstring &rstrErrorInfo, TEnumerationBenchmark &rResult)
+{
+	std::vector<TDiskDeviceAttributes> vDevices;
+
+	rResult = TEnumerationBenchmark();
+	if (!EnumerateDiskDevices(rEnumerator, rstrErrorInfo, vDevices, &rResult.sCold, rQuery))
+		return false;
+
+	for (unsigned int i = 0; i < nRuns; i++)
+	{
+		TEnumerationStats sStats;
+
+		vDevices.clear();
+		if (!EnumerateDiskDevices(rEnumerator, rstrErrorInfo, vDevices, &sStats, rQuery))
+			return false;
+		if ((i == 0) || (sStats.nFirstDriveUs < rResult.nBestFirstDriveUs))
+			rResult.nBestFirstDriveUs = sStats.nFirstDriveUs;
+		if ((i == 0) || (sStats.nTotalUs < rResult.nBestTotalUs))
+			rResult.nBestTotalUs = sStats.nTotalUs;
+		rResult.nMeanFirstDriveUs += sStats.nFirstDriveUs;
+		rResult.nMeanTotalUs += sStats.nTotalUs;
+		rResult.nRuns++;
+	}
+	if (rResult.nRuns)
+	{
+		rResult.nMeanFirstDriveUs /= rResult.nRuns;
+		rResult.nMeanTotalUs /= rResult.nRuns;
+	}
+	return true;
+}
@@ -24,12 +24,357 @@
 
 #include "stdafx.h"
 #include "DiskDrive.h"
-#include "UsbInterface.h"
-#include "AtaInterface.h"
+#include "DiskPlatform.h"
+#include "FleetLocking.h"
+#include "InventoryService.h"
+#include "DriveRegistry.h"
+#include "SimulatedEnumerator.h"
+#include "IdentifySnapshot.h"
+#include "IdentifyArchive.h"
+#include "SnapshotDiff.h"
+#include "TcgBulkTransfer.h"
 
-#pragma comment(lib, "wbemuuid.lib")	// link with this lib for the WMI API's.
+#define BENCHMARK_RUNS				5
+#define BENCHMARK_SIMULATED_DRIVES	16
+#define BENCHMARK_DRIVE_COPIES		4096
+#define BENCHMARK_IDENTIFY_SECTORS	10000
+
+
+// Startup latency of each enumeration backend, unprojected and unbatched (i.e. as formerly
+// queried) versus projected and batched.  The simulated backend needs no hardware.  The sysfs
+// backend is benchmarked on Linux by SysfsEnumeratorTest -b (i.e. make bench, see GNUmakefile).
+static void BenchmarkEnumerators(void)
+{
+	TRACE(L"BenchmarkEnumerators\n");
+	static const struct { const wchar_t *pszName; unsigned int nFields; unsigned int nBatchSize; } aQueries[] =
+	{
+		{ L"all fields, 1 per call",	eDiskFieldsAll,		1 },
+		{ L"projected, 1 per call",		eDiskFieldsOpen,	1 },
+		{ L"projected, batched",		eDiskFieldsOpen,	DISK_ENUM_DEFAULT_BATCH },
+	};
+	struct { const wchar_t *pszName; IDiskEnumerator *pEnumerator; } aBackends[] =
+	{
+		{ L"Platform",	::CreateDiskEnumerator() },
+		{ L"Simulated",	new CSimulatedDiskEnumerator(BENCHMARK_SIMULATED_DRIVES) },
+	};
+
+	DisplayMessage(L"\nEnumeration benchmark (%u warm runs) :\n", BENCHMARK_RUNS);
+	for (size_t i = 0; i < (sizeof(aBackends) / sizeof(aBackends[0])); i++)
+	{
+		for (size_t j = 0; j < (sizeof(aQueries) / sizeof(aQueries[0])); j++)
+		{
+			TEnumerationBenchmark sResult;
+			std::wstring strErrorInfo;
+
+			if (!::BenchmarkDiskEnumerator(*aBackends[i].pEnumerator, TEnumerationQuery(aQueries[j].nFields, aQueries[j].nBatchSize),
+										   BENCHMARK_RUNS, strErrorInfo, sResult))
+			{
+				DisplayMessage(L"  %-9ws %-24ws : failed, %ws\n", aBackends[i].pszName, aQueries[j].pszName, strErrorInfo.c_str());
+				break;
+			}
+			DisplayMessage(L"  %-9ws %-24ws : %u drive(s), cold first %I64u us total %I64u us, warm first %I64u us (best %I64u) total %I64u us (best %I64u)\n",
+						   aBackends[i].pszName, aQueries[j].pszName, sResult.sCold.nDrives,
+						   sResult.sCold.nFirstDriveUs, sResult.sCold.nTotalUs,
+						   sResult.nMeanFirstDriveUs, sResult.nBestFirstDriveUs, sResult.nMeanTotalUs, sResult.nBestTotalUs);
+		}
+		delete aBackends[i].pEnumerator;
+	}
+}
+
+
+// Grow a container of drive copies, as a large inventory would, then move it; neither should
+// touch the kernel since copies share the device and moves take it (see TSharedDevice).
+static void BenchmarkDriveCopies(void)
+{
+	TRACE(L"BenchmarkDriveCopies\n");
+	typedef CDiskDrive<IUnsupportedInterface> TDrive;
+	TDrive prototype(_bstr_t(L"\\\\.\\PHYSICALDRIVE0"), _bstr_t(L"IDE"), INVALID_HANDLE_VALUE, 512, 0, 0, 0, 0);
+	std::vector<TDrive> vCopies, vMoved;
+	LONG lKernelCalls = TSharedDevice::KernelCalls();
+	unsigned __int64 nStart = ::PerfCounterMicroseconds();
+
+	for (unsigned int i = 0; i < BENCHMARK_DRIVE_COPIES; i++)
+		vCopies.push_back(prototype);
+	for (size_t i = 0; i < vCopies.size(); i++)
+		vMoved.push_back(std::move(vCopies[i]));
+	vCopies.clear();
+	vMoved.clear();
+
+	DisplayMessage(L"\nDrive copies : %u copied then moved in %I64u us, %ld kernel call(s)\n", BENCHMARK_DRIVE_COPIES,
+				   ::PerfCounterMicroseconds() - nStart, TSharedDevice::KernelCalls() - lKernelCalls);
+}
+
+
+// Identify string decode of a synthetic archive of sectors : scalar, SSE2 and batched, and
+// whether the three agree.
+static void BenchmarkIdentifyStrings(void)
+{
+	TRACE(L"BenchmarkIdentifyStrings\n");
+	typedef unsigned int (*TDecode)(const unsigned char*, unsigned int, char*);
+	std::vector<TAtaDiskIdentifySector> vSectors(BENCHMARK_IDENTIFY_SECTORS);
+	std::vector<TIdentifyStrings> vScalar(vSectors.size()), vSse2(vSectors.size()), vBatch(vSectors.size());
+	struct { const wchar_t *pszName; TDecode pfnDecode; std::vector<TIdentifyStrings> *pvStrings; } aDecoders[] = 
+	{
+		{ L"scalar", AtaStringDecodeScalar, &vScalar },
+		{ L"SSE2",   AtaStringDecodeSse2,   &vSse2 },
+	};
+	size_t nMismatches = 0;
+
+	// Space padded, byte swapped strings of varying length, as a drive reports them.
+	for (size_t n = 0; n < vSectors.size(); n++)
+	{
+		TAtaDiskIdentifySector &rSector = vSectors[n];
+		char szModel[sizeof(rSector.pszModelNumber) + 1], szSerialNo[sizeof(rSector.pszSerialNumber) + 1];
+
+		::ZeroMemory(&rSector, sizeof(rSector));
+		::sprintf_s(szModel, sizeof(szModel), "%-40.*s", (int)(8 + (n % 32)), "ST3500320AS BARRACUDA 7200.11 SATA 3.0Gb/s");
+		::sprintf_s(szSerialNo, sizeof(szSerialNo), "%*u", (int)(8 + (n % 12)), (unsigned int)(n * 2654435761u));
+		for (size_t i = 0; i < sizeof(rSector.pszModelNumber); i += 2)
+		{
+			rSector.pszModelNumber[i] = szModel[i + 1];
+			rSector.pszModelNumber[i + 1] = szModel[i];
+		}
+		for (size_t i = 0; i < sizeof(rSector.pszSerialNumber); i += 2)
+		{
+			rSector.pszSerialNumber[i] = szSerialNo[i + 1];
+			rSector.pszSerialNumber[i + 1] = szSerialNo[i];
+		}
+		::memcpy(rSector.pszFirmwareRev, "DS51    ", sizeof(rSector.pszFirmwareRev));
+		::memset(rSector.pszCurrentMediaSerialNo, ' ', sizeof(rSector.pszCurrentMediaSerialNo));
+		rSector.wIntegrityWord = ATA_INTEGRITY_SIGNATURE;
+		rSector.wIntegrityWord |= (unsigned __int16)((unsigned char)(0 - ::AtaSectorSumScalar((const unsigned char*)&rSector)) << 8);
+	}
+
+	DisplayMessage(L"\nIdentify strings : %u sectors, 4 fields each\n", BENCHMARK_IDENTIFY_SECTORS);
+	for (size_t d = 0; d < (sizeof(aDecoders) / sizeof(aDecoders[0])); d++)
+	{
+		if ((aDecoders[d].pfnDecode == AtaStringDecodeSse2) && (!AtaStringSse2Available()))
+		{
+			DisplayMessage(L"   %-8ws  unavailable\n", aDecoders[d].pszName);
+			continue;
+		}
+
+		unsigned __int64 nStart = ::PerfCounterMicroseconds();
+		for (size_t n = 0; n < vSectors.size(); n++)
+		{
+			const TAtaDiskIdentifySector &rSector = vSectors[n];
+			TIdentifyStrings &rStrings = (*aDecoders[d].pvStrings)[n];
+			aDecoders[d].pfnDecode((const unsigned char*)rSector.pszSerialNumber, sizeof(rSector.pszSerialNumber), rStrings.szSerialNo);
+			aDecoders[d].pfnDecode((const unsigned char*)rSector.pszFirmwareRev, sizeof(rSector.pszFirmwareRev), rStrings.szFirmware);
+			aDecoders[d].pfnDecode((const unsigned char*)rSector.pszModelNumber, sizeof(rSector.pszModelNumber), rStrings.szModel);
+			aDecoders[d].pfnDecode((const unsigned char*)rSector.pszCurrentMediaSerialNo, sizeof(rSector.pszCurrentMediaSerialNo), rStrings.szMediaSerialNo);
+		}
+		DisplayMessage(L"   %-8ws  %8I64u us\n", aDecoders[d].pszName, ::PerfCounterMicroseconds() - nStart);
+	}
+
+	unsigned __int64 nStart = ::PerfCounterMicroseconds();
+	::AtaStringDecodeBatch(&vSectors[0], vSectors.size(), &vBatch[0]);
+	DisplayMessage(L"   %-8ws  %8I64u us\n", L"batch", ::PerfCounterMicroseconds() - nStart);
+
+	// As above, each sector's checksum verified in the same pass.
+	std::vector<EIdentifyIntegrity> vIntegrity(vSectors.size());
+	nStart = ::PerfCounterMicroseconds();
+	size_t nCorrupt = ::AtaStringDecodeBatch(&vSectors[0], vSectors.size(), &vBatch[0], &vIntegrity[0]);
+	DisplayMessage(L"   %-8ws  %8I64u us, %Iu corrupt\n", L"verified", ::PerfCounterMicroseconds() - nStart, nCorrupt);
+
+	for (size_t n = 0; n < vSectors.size(); n++)
+	{
+		if (::memcmp(&vScalar[n], &vBatch[n], sizeof(TIdentifyStrings)) != 0)
+			nMismatches++;
+		else if ((AtaStringSse2Available()) && (::memcmp(&vScalar[n], &vSse2[n], sizeof(TIdentifyStrings)) != 0))
+			nMismatches++;
+	}
+	DisplayMessage(L"   %Iu mismatch(es) against the scalar decode\n", nMismatches);
+
+	// The same sectors differenced against their model's baseline, as an identify archive holds them.
+	CIdentifyArchiveWriter archiveWriter;
+	nStart = ::PerfCounterMicroseconds();
+	for (size_t n = 0; n < vSectors.size(); n++)
+		archiveWriter.Add(vSectors[n]);
+	DisplayMessage(L"   %-8ws  %8I64u us, %I64u bytes for %Iu baseline(s) (%I64u bytes undifferenced)\n", L"archive", ::PerfCounterMicroseconds() - nStart,
+				   archiveWriter.ArchiveBytes(), archiveWriter.Baselines(), archiveWriter.Count() * sizeof(TAtaDiskIdentifySector));
+}
+
+
+// -x : report the drives which changed between two snapshots, as text or (-j) JSON records.
+static int DiffSnapshots(void)
+{
+	TRACE(L"DiffSnapshots\n");
+	static const struct { unsigned int nChange; const char *pszName; } s_aNames[] =
+	{
+		{ eSnapChangeFirmware,	"firmware" },
+		{ eSnapChangeSecurity,	"security" },
+		{ eSnapChangeCapacity,	"capacity" },
+		{ eSnapChangeIdentify,	"identify" },
+	};
+	CIdentifySnapshotReader before, after;
+	CSnapshotDiff diff;
+	CJsonRecordWriter jsonWriter;
+	TSnapshotChanges vChanges;
+	_bstr_t bstrOnFailure;
+
+	unsigned __int64 nStart = ::PerfCounterMicroseconds();
+	if ((!before.Open(bstrOnFailure, g_Options.pszDiffBefore)) || (!after.Open(bstrOnFailure, g_Options.pszDiffAfter)) ||
+		(!diff.Compare(bstrOnFailure, before, after, vChanges)))
+	{
+		DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+		return E_FAIL;
+	}
+	unsigned __int64 nElapsedUs = ::PerfCounterMicroseconds() - nStart;
+
+	for (size_t i = 0; i < vChanges.size(); i++)
+	{
+		const TSnapshotChange &rChange = vChanges[i];
+		const CIdentifySnapshotReader &rDrive = (rChange.nAfter != SNAPSHOT_DIFF_NONE) ? after : before;
+		unsigned __int64 nDrive = (rChange.nAfter != SNAPSHOT_DIFF_NONE) ? rChange.nAfter : rChange.nBefore;
+		const char *pszChange = (rChange.nChanges & eSnapChangeAppeared) ? "appeared" : ((rChange.nChanges & eSnapChangeDisappeared) ? "disappeared" : "changed");
+
+		if (g_Options.bJson)
+		{
+			jsonWriter.Begin("change");
+			jsonWriter.Member("change", pszChange);
+			jsonWriter.Member("serial", rDrive.SerialNo(nDrive));
+			jsonWriter.Member("model", rDrive.Model(nDrive));
+			jsonWriter.MemberHex("wwn", rDrive.WorldWideName(nDrive));
+			jsonWriter.Member("firmware", rDrive.Firmware(nDrive));
+			if (rChange.nBefore != SNAPSHOT_DIFF_NONE)
+				jsonWriter.Member("firmwareBefore", before.Firmware(rChange.nBefore));
+			for (size_t n = 0; n < (sizeof(s_aNames) / sizeof(s_aNames[0])); n++)
+				jsonWriter.Member(s_aNames[n].pszName, ((rChange.nChanges & s_aNames[n].nChange) != 0));
+			jsonWriter.Member("words", rChange.nWords);
+			if (!jsonWriter.End())
+				break;
+			continue;
+		}
+
+		std::string strChanges;
+		for (size_t n = 0; n < (sizeof(s_aNames) / sizeof(s_aNames[0])); n++)
+			if (rChange.nChanges & s_aNames[n].nChange)
+			{
+				strChanges += (strChanges.empty()) ? " : " : ", ";
+				strChanges += s_aNames[n].pszName;
+			}
+		if (rChange.nChanges & eSnapChangeFirmware)
+			strChanges += std::string(" (") + before.Firmware(rChange.nBefore) + " -> " + after.Firmware(rChange.nAfter) + ")";
+		DisplayMessage(L"%-12hs %-20hs %-40hs %hs%hs\n", pszChange, rDrive.SerialNo(nDrive), rDrive.Model(nDrive),
+					   rDrive.Firmware(nDrive), strChanges.c_str());
+	}
+	if (!g_Options.bJson)
+		DisplayMessage(L"\n%I64u drive(s) before, %I64u after, %Iu changed, compared in %I64u us\n",
+					   before.Count(), after.Count(), vChanges.size(), nElapsedUs);
+	return 0;
+}
+
+
+// -r : decode a trace dump, one line per record in time order.
+static int DecodeTraceDump(void)
+{
+	TRACE(L"DecodeTraceDump\n");
+	std::vector<TTraceRecord> vRecords;
+	TTraceDumpHeader sHeader;
+	_bstr_t bstrOnFailure;
+
+	if (!::TraceDumpRead(bstrOnFailure, g_Options.pszTraceDecode, sHeader, vRecords))
+	{
+		DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+		return E_FAIL;
+	}
+	for (size_t i = 0; i < vRecords.size(); i++)
+	{
+		const TTraceRecord &rRecord = vRecords[i];
+		double dSeconds = (double)(__int64)(rRecord.nTicks - vRecords[0].nTicks) / (double)sHeader.nTicksPerSecond;
+		DisplayMessage(L"%12.6f  %-10hs  thread %5u  drive %08X  opcode %02X  %08X %u %u %u\n", dSeconds, ::TraceEventName(rRecord.nEvent),
+					   rRecord.nThread, rRecord.nDrive, rRecord.nOpcode, rRecord.anArgs[0], rRecord.anArgs[1], rRecord.anArgs[2], rRecord.anArgs[3]);
+	}
+	DisplayMessage(L"\n%Iu record(s)\n", vRecords.size());
+	return 0;
+}
+
+// -v : decode an identify archive, one line per drive, checking each sector's integrity word.
+static int VerifyArchive(void)
+{
+	TRACE(L"VerifyArchive\n");
+	static const char *s_apszIntegrity[] = { "not reported", "valid", "CORRUPT" };
+	CIdentifyArchiveReader reader;
+	TAtaDiskIdentifySector sSector;
+	_bstr_t bstrOnFailure;
+	unsigned __int64 nDecoded = 0;
+	unsigned __int64 nCorrupt = 0;
+	char szSerialNo[sizeof(sSector.pszSerialNumber) + 1];
+	char szModel[sizeof(sSector.pszModelNumber) + 1];
+	char szFirmware[sizeof(sSector.pszFirmwareRev) + 1];
+
+	unsigned __int64 nStart = ::PerfCounterMicroseconds();
+	if (!reader.Open(bstrOnFailure, g_Options.pszArchiveVerify))
+	{
+		DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+		return E_FAIL;
+	}
+	while (reader.Next(bstrOnFailure, sSector))
+	{
+		EIdentifyIntegrity eIntegrity = ::AtaIdentifyIntegrity(sSector);
+		AtaStringDecode((const unsigned char*)sSector.pszSerialNumber, sizeof(sSector.pszSerialNumber), szSerialNo);
+		AtaStringDecode((const unsigned char*)sSector.pszModelNumber, sizeof(sSector.pszModelNumber), szModel);
+		AtaStringDecode((const unsigned char*)sSector.pszFirmwareRev, sizeof(sSector.pszFirmwareRev), szFirmware);
+		if (eIntegrity == eIntegrityCorrupt)
+			nCorrupt++;
+		nDecoded++;
+		DisplayMessage(L"%-20hs %-40hs %-8hs %hs\n", szSerialNo, szModel, szFirmware, s_apszIntegrity[eIntegrity]);
+	}
+	if (bstrOnFailure.length() > 0)
+	{
+		DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+		return E_FAIL;
+	}
+	DisplayMessage(L"\n%I64u of %I64u drive(s) decoded from %u baseline(s), %I64u failing the integrity check, in %I64u us\n",
+				   nDecoded, reader.Count(), reader.Baselines(), nCorrupt, ::PerfCounterMicroseconds() - nStart);
+	return (nCorrupt > 0) ? E_FAIL : 0;
+}
+
+// -m : upload an image file to a byte table of each trusted drive, reporting the throughput.
+static void UploadTableImage(TListDiskDrives &rDrives)
+{
+	TRACE(L"UploadTableImage\n");
+	TTcgUid uidTable = (_wcsicmp(g_Options.pszBulkTable, L"mbr") == 0) ? TCG_UID_MBR : TCG_UID_DATASTORE;
+	_bstr_t bstrPin(g_Options.pszBulkPin);
+	CCredentialWipe wipePin(bstrPin);
+	const char *pszPin = (const char*)bstrPin;
+
+	for (size_t i = 0; i < rDrives.size(); i++)
+	{
+		pCDiskDrive pDisk = rDrives[i];
+		if (!pDisk->IsDriveTrustCapable())
+			continue;
+
+		CTcgSession<IBusInterface> session(*pDisk);
+		_bstr_t bstrOnFailure, bstrOnEnd;
+		if ((!session.ExchangeProperties(bstrOnFailure)) ||
+			(!session.Start(bstrOnFailure, TCG_UID_LOCKINGSP, true, TCG_UID_ADMIN1, (const BYTE*)pszPin, (unsigned)strlen(pszPin))))
+		{
+			DisplayMessage(L"\n%ws : upload failed : %ws\n", (const wchar_t*)pDisk->Name(), (const wchar_t*)bstrOnFailure);
+			continue;
+		}
+
+		CTcgBulkTransfer<IBusInterface> transfer(session, uidTable);
+		bool bUploaded = transfer.UploadFile(bstrOnFailure, 0, g_Options.pszBulkFile);
+		session.End(bstrOnEnd);
+
+		const TBulkTransferStats &rStats = transfer.Stats();
+		DisplayMessage(L"\n%ws : %ws %ws : %I64u bytes in %u Set call(s) of %u bytes, %I64u us (drive %I64u us), %.2f MB/s%ws%ws\n",
+					   (const wchar_t*)pDisk->Name(), g_Options.pszBulkTable, (bUploaded ? L"uploaded" : L"upload failed"),
+					   rStats.nBytes, rStats.nMethods, rStats.nChunkSize, rStats.nMicroseconds, rStats.nDeviceMicroseconds,
+					   rStats.MegabytesPerSecond(), (bUploaded ? L"" : L" : "), (bUploaded ? L"" : (const wchar_t*)bstrOnFailure));
+	}
+}
+
+// -w : write the trace rings at exit.
+static void WriteTraceDump(void)
+{
+	_bstr_t bstrOnFailure;
+	if ((g_Options.pszTraceFile) && (!::TraceDumpWrite(bstrOnFailure, g_Options.pszTraceFile)))
+		DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+}
 
-HRESULT GetDiskDriveDevices(TListDiskDrives &list);
 
 int _tmain(int argc, _TCHAR* argv[])
 {
@@ -37,9 +382,38 @@ int _tmain(int argc, _TCHAR* argv[])
 	//wchar_t						wch;
 	HRESULT						hr = S_OK;
 	_bstr_t						bstrOnFailure;
+	TDiskFilter					sFilter;
+	std::wstring				strFilterError;
 
 	if (ValidOptions(argc, argv) == false)
 		return nret;
+	if ((g_Options.pszFilter) && (!sFilter.Parse(g_Options.pszFilter, strFilterError)))
+	{
+		DisplayErrorMessage(::BuildMessage(L"Invalid drive filter : %ws  See -? for its terms.", strFilterError.c_str()));
+		return E_INVALIDARG;
+	}
+	if (g_Options.pszDiffBefore)
+		return DiffSnapshots();
+	if (g_Options.pszTraceDecode)
+		return DecodeTraceDump();
+	if (g_Options.pszArchiveVerify)
+		return VerifyArchive();
+	if (g_Options.nRetryAttempts)
+		::RetryPolicy().nMaxAttempts = g_Options.nRetryAttempts;
+	if (g_Options.nRetryBudget != OPTION_UNSET)
+		::RetryPolicy().nDriveBudget = g_Options.nRetryBudget;
+
+	// As a thin client, ask the resident inventory service first.
+	if (g_Options.pszQuery)
+	{
+		std::wstring strReply;
+		if (QueryInventoryService(bstrOnFailure, g_Options.pszQuery, strReply))
+		{
+			DisplayMessage(L"%ws", strReply.c_str());
+			return nret;
+		}
+		DisplayMessage(L"\nInventory service unavailable (%ws), enumerating locally.\n", (const wchar_t*)bstrOnFailure);
+	}
 
 	hr = ::CoInitializeEx(0, COINIT_MULTITHREADED);
 	if (FAILED(hr))
@@ -47,44 +421,146 @@ int _tmain(int argc, _TCHAR* argv[])
 		DisplayErrorMessage(L"COM runtime initialization failed.");
 		return(hr);
 	}
+	if (!::PlatformInitializeSecurity(bstrOnFailure))
+	{
+		DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+		::CoUninitialize();
+		return E_FAIL;
+	}
+
+	// Run as the resident inventory service until stopped.
+	if (g_Options.bDaemon)
+	{
+		// Keep the inventory current from hotplug events, else by periodic refresh.
+		IDeviceEventSource *pEventSource = (g_Options.pszEventFile) ? new CEventFileSource(_bstr_t(g_Options.pszEventFile))
+																	: ::CreateDeviceEventSource();
+		std::wstring strEventError;
+		if ((pEventSource) && (!pEventSource->Begin(strEventError)))
+		{
+			DisplayMessage(L"\nHotplug events unavailable (%ws), refreshing periodically.\n", strEventError.c_str());
+			delete pEventSource;
+			pEventSource = NULL;
+		}
+		{
+			CInventoryService service(pEventSource);
+			if (!service.Run(bstrOnFailure))
+			{
+				DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+				nret = E_FAIL;
+			}
+		}
+		if (pEventSource)
+		{
+			pEventSource->End();
+			delete pEventSource;
+		}
+		WriteTraceDump();
+		::CoUninitialize();
+		return nret;
+	}
 
 	try
 	{
-		TListDiskDrives				listDiskDrives;
-		TListDiskDrives::iterator	iterDiskDrives;
+		CDriveRegistry				registry;		// Owns the drives, releasing them however this block is left
+		CPendingDrives				pendingDrives;	// ... and these until each is identified and registered
+		TListDiskDrives				listDiskDrives;	// Borrowed from the registry once identified
 		pCDiskDrive					pDisk = NULL;
+		CJsonRecordWriter			jsonWriter;		// -j : records stream as each drive is identified
+		CIdentifySnapshotWriter		snapshotWriter;	// -s : sectors of the identified drives
+		CIdentifyArchiveWriter		archiveWriter;	// -a : ""
+		unsigned __int64			nRunStart = ::PerfCounterMicroseconds();
 
-		DisplayMessage(L"\nEnumerating disk drive devices...\n");
+		if (!g_Options.bJson)
+			DisplayMessage(L"\nEnumerating disk drive devices...\n");
 
 		// Enumerate disk drive devices
-		hr = GetDiskDriveDevices(listDiskDrives);
+		TEnumerationStats sEnumerationStats;
+		hr = GetDiskDriveDevices(pendingDrives.List(), (g_Options.bBenchmark ? &sEnumerationStats : NULL), (g_Options.pszFilter ? &sFilter : NULL));
 		if (FAILED(hr))
 			throw hr;
+		if ((g_Options.bBenchmark) && (g_Options.bJson))
+		{
+			jsonWriter.Begin("enumeration");
+			jsonWriter.Member("drives", sEnumerationStats.nDrives);
+			jsonWriter.Member("filtered", sEnumerationStats.nFiltered);
+			jsonWriter.Member("firstDriveUs", sEnumerationStats.nFirstDriveUs);
+			jsonWriter.Member("firstOpenUs", sEnumerationStats.nFirstOpenUs);
+			jsonWriter.Member("queryUs", sEnumerationStats.nBeginUs);
+			jsonWriter.Member("totalUs", sEnumerationStats.nTotalUs);
+			jsonWriter.End();
+		}
+		else if (g_Options.bBenchmark)
+			DisplayMessage(L"\nEnumeration : %u drive(s) (%u filtered), first drive %I64u us (opened %I64u us), query %I64u us, total %I64u us\n",
+						   sEnumerationStats.nDrives, sEnumerationStats.nFiltered, sEnumerationStats.nFirstDriveUs, sEnumerationStats.nFirstOpenUs,
+						   sEnumerationStats.nBeginUs, sEnumerationStats.nTotalUs);
+		if ((g_Options.bBenchmark) && (!g_Options.bJson))
+		{
+			BenchmarkEnumerators();
+			BenchmarkDriveCopies();
+			BenchmarkIdentifyStrings();
+		}
 
-		for (iterDiskDrives = listDiskDrives.begin(); iterDiskDrives != listDiskDrives.end(); iterDiskDrives++)
+		listDiskDrives.reserve(pendingDrives.Count());
+		for (size_t i = 0; i < pendingDrives.Count(); i++)
 		{
-			pDisk = (pCDiskDrive)*iterDiskDrives;
+			pDisk = pendingDrives[i];
 
 			// Read and display each disk's "Identify Sector" information.
-			if (pDisk->QueryIdentifySector(bstrOnFailure) == true)
-			{
-				DisplayMessage(L"\n%ws" 
-								L"\n\tInterface= %ws" 
-								L"\n\tModel= %ws"
-								L"\n\tVendor= %ws"
-								L"\n\tSerialNo= %ws"
-								L"\n\tFirmware= %ws" 
-								L"\n\tATA Passthru Capable= %ws\n", 
-								(const wchar_t*)pDisk->Name(),
-								(const wchar_t*)pDisk->InterfaceType(),
-								(const wchar_t*)pDisk->Model(),
-								(const wchar_t*)pDisk->VendorID(),
-								(const wchar_t*)pDisk->SerialNo(),
-								(const wchar_t*)pDisk->Firmware(),
-								(pDisk->IsAtaPassthruCapable() ? L"Yes" : L"No"));
-			}
+			unsigned __int64 nIdentifyStart = ::PerfCounterMicroseconds();
+			bool bIdentified = pDisk->QueryIdentifySector(bstrOnFailure);
+			unsigned __int64 nIdentifyUs = ::PerfCounterMicroseconds() - nIdentifyStart;
+
+			if (g_Options.bJson)
+				::WriteDiskDriveRecord(jsonWriter, pDisk, (bIdentified ? NULL : (const wchar_t*)bstrOnFailure),
+									   nIdentifyUs, ::PerfCounterMicroseconds() - nRunStart);
+			else if (bIdentified)
+				DisplayMessage(L"%ws", (const wchar_t*)::DescribeDiskDrive(pDisk));
 			else 
 				DisplayMessage((const wchar_t*)bstrOnFailure);
+			if ((bIdentified) && (g_Options.pszSnapshotFile))
+				snapshotWriter.Add(pDisk->IdentifySector()._sectorData);
+			if ((bIdentified) && (g_Options.pszArchiveFile))
+				archiveWriter.Add(pDisk->IdentifySector()._sectorData);
+			listDiskDrives.push_back(pendingDrives.Register(registry, i));
+		}
+
+		if (g_Options.pszSnapshotFile)
+		{
+			if (!snapshotWriter.Write(bstrOnFailure, g_Options.pszSnapshotFile))
+				DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+			else if (!g_Options.bJson)
+				DisplayMessage(L"\nSnapshot : %Iu drive(s) written to %ws\n", snapshotWriter.Count(), g_Options.pszSnapshotFile);
+		}
+		if (g_Options.pszArchiveFile)
+		{
+			if (!archiveWriter.Write(bstrOnFailure, g_Options.pszArchiveFile))
+				DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+			else if (!g_Options.bJson)
+				DisplayMessage(L"\nArchive : %I64u drive(s), %Iu baseline(s), written to %ws\n", archiveWriter.Count(), archiveWriter.Baselines(), g_Options.pszArchiveFile);
+		}
+
+		if (g_Options.pszBulkTable)
+			UploadTableImage(listDiskDrives);
+
+		// Lock or unlock every trusted drive concurrently if requested.
+		if (g_Options.nFleetOperation != eFleetNone)
+		{
+			TFleetOptions sFleetOptions;			// Zeroizes its copy of the PIN
+			_bstr_t bstrPin(g_Options.pszPin);
+			CCredentialWipe wipePin(bstrPin);		// ... and this the converted PIN, however the block is left
+			const char *pszPin = (const char*)bstrPin;
+
+			sFleetOptions.eOperation = (EFleetOperation)g_Options.nFleetOperation;
+			sFleetOptions.nMaxPerBus = g_Options.nMaxPerBus;
+			sFleetOptions.dwDeadlineMs = g_Options.nDeadlineSeconds * 1000;
+			sFleetOptions.vPin.assign(pszPin, pszPin + strlen(pszPin));
+			sFleetOptions.nPinIterations = g_Options.nPinIterations;
+
+			CCredentialCache credentialCache;
+			CFleetLocking fleet(listDiskDrives, sFleetOptions, &credentialCache);
+			if (!fleet.Run(bstrOnFailure))
+				DisplayErrorMessage((const wchar_t*)bstrOnFailure);
+			fleet.Report();
 		}
 		//DisplayMessage(L"\n\nPress any key to continue...\n");
 		//wch = _getwch();
@@ -110,198 +586,8 @@ int _tmain(int argc, _TCHAR* argv[])
 		TranslateErrorCode(nret, bstrOnFailure);
 		DisplayMessage(L"Exception : %08X : %ws\n", nret, (const wchar_t*)bstrOnFailure);
 	}
-		
+
+	WriteTraceDump();
 	::CoUninitialize();		// ensure COM is exited
 	return nret;
 }
-
-
-HRESULT GetDiskDriveDevices(TListDiskDrives &rList)
-{
-	TRACE(L"GetDiskDriveDevices\n");
-    HRESULT hres = S_OK;
-    IWbemLocator *pLoc = NULL;
-    IWbemServices *pSvc = NULL;
-    IEnumWbemClassObject* pEnumerator = NULL;
-
-	// See the WMI SDK documentation.
-
-	// If this code is used within an existing established security context, then the CoInitializeSecurity call can be commented-out.
-	// You'll know this case during testing because the code will fail at runtime here.
-	hres =  CoInitializeSecurity(
-        NULL, 
-        -1,                          // COM authentication
-        NULL,                        // Authentication services
-        NULL,                        // Reserved
-        RPC_C_AUTHN_LEVEL_DEFAULT,   // Default authentication 
-        RPC_C_IMP_LEVEL_IMPERSONATE, // Default Impersonation  
-        NULL,                        // Authentication info
-        EOAC_NONE,                   // Additional capabilities 
-        NULL                         // Reserved
-        );
-                      
-    if (FAILED(hres))
-		goto CleanUp;
-    
-    // Obtain the initial locator to WMI 
-	hres = CoCreateInstance(
-        CLSID_WbemLocator,             
-        0, 
-        CLSCTX_INPROC_SERVER, 
-        IID_IWbemLocator, (LPVOID *) &pLoc);
- 
-    if (FAILED(hres))
-		goto CleanUp;
-	ASSERT(pLoc != NULL);
-
-    // Connect to the root\cimv2 namespace with
-    // the current user and obtain pointer pSvc
-    // to make IWbemServices calls.
-    hres = pLoc->ConnectServer(
-         _bstr_t(L"ROOT\\CIMV2"), // Object path of WMI namespace
-         NULL,                    // User name. NULL = current user
-         NULL,                    // User password. NULL = current
-         0,                       // Locale. NULL indicates current
-         NULL,                    // Security flags.
-         0,                       // Authority (e.g. Kerberos)
-         0,                       // Context object 
-         &pSvc                    // pointer to IWbemServices proxy
-         );
-    
-    if (FAILED(hres))
-		::_com_issue_errorex(hres, pLoc, __uuidof(pLoc));
-	ASSERT(pSvc != NULL);
-
-    // Set security levels on the proxy
-	hres = CoSetProxyBlanket(
-       pSvc,                        // Indicates the proxy to set
-       RPC_C_AUTHN_WINNT,           // RPC_C_AUTHN_xxx
-       RPC_C_AUTHZ_NONE,            // RPC_C_AUTHZ_xxx
-       NULL,                        // Server principal name 
-       RPC_C_AUTHN_LEVEL_CALL,      // RPC_C_AUTHN_LEVEL_xxx 
-       RPC_C_IMP_LEVEL_IMPERSONATE, // RPC_C_IMP_LEVEL_xxx
-       NULL,                        // client identity
-       EOAC_NONE                    // proxy capabilities 
-    );
-
-    if (FAILED(hres))
-		goto CleanUp;
-
-    // Use the IWbemServices pointer to make requests of WMI
-    // Get a list of the attached Disk Drives
-    hres = pSvc->ExecQuery(bstr_t("WQL"), 
-						   bstr_t("SELECT * FROM Win32_DiskDrive"),
-						   WBEM_FLAG_FORWARD_ONLY | WBEM_FLAG_RETURN_IMMEDIATELY, 
-						   NULL,
-						   &pEnumerator);
-    
-    if (FAILED(hres))
-		goto CleanUp;
-
-    // Get the data from the query above
-    IWbemClassObject *pclsObj = NULL;
-    ULONG uReturn = 0;
-    VARIANT vtDeviceID, vtInterfaceType, vtBytesPerSector, vtSCSIBus, vtSCSILogicalUnit, vtSCSIPort, vtSCSITargetId;
-	HANDLE hDevice;
-	pCDiskDrive pInfo = NULL;
-   
-    while (pEnumerator)
-    {
-        pEnumerator->Next(WBEM_INFINITE, 1, &pclsObj, &uReturn);
-
-        if ((0 == uReturn) || (!pclsObj))
-            break;
-		ASSERT(pclsObj);
-
-		::VariantInit(&vtDeviceID);
-		::VariantInit(&vtInterfaceType);
-		::VariantInit(&vtBytesPerSector);
-		::VariantInit(&vtSCSIBus);
-		::VariantInit(&vtSCSILogicalUnit);
-		::VariantInit(&vtSCSIPort);
-		::VariantInit(&vtSCSITargetId);
-		hDevice = INVALID_HANDLE_VALUE;
-		pInfo = NULL;
-
-        // Get the value of the DeviceID property
-        pclsObj->Get(L"DeviceID", 0, &vtDeviceID, 0, 0);
-		pclsObj->Get(L"InterfaceType", 0, &vtInterfaceType, 0, 0);
-		pclsObj->Get(L"BytesPerSector", 0, &vtBytesPerSector, 0, 0);
-		pclsObj->Get(L"SCSIBus", 0, &vtSCSIBus, 0, 0);
-		pclsObj->Get(L"SCSILogicalUnit", 0, &vtSCSILogicalUnit, 0, 0);
-		pclsObj->Get(L"SCSIPort", 0, &vtSCSIPort, 0, 0);
-		pclsObj->Get(L"SCSITargetId", 0, &vtSCSITargetId, 0, 0);
-		
-		TRACE(L"DeviceID=%ws \t InterfaceType=%ws\n", vtDeviceID.bstrVal, vtInterfaceType.bstrVal);
-		// TODO: Obtain any other WMI device info from the pclsObj
-
-		// Open a HANDLE to the device object.
-		hDevice = CreateFile(vtDeviceID.bstrVal,
-                               GENERIC_READ | GENERIC_WRITE,
-                               FILE_SHARE_READ | FILE_SHARE_WRITE,
-                               NULL,
-                               OPEN_EXISTING,
-                               FILE_FLAG_NO_BUFFERING,
-                               NULL);
-
-		// Cache the new CDiskDrive object.
-		if (hDevice != INVALID_HANDLE_VALUE)
-		{
-			if (_bstr_t("USB") == _bstr_t(vtInterfaceType.bstrVal))
-				pInfo = reinterpret_cast<pCDiskDrive>(new CDiskDrive<IUsbInterface>(
-						vtDeviceID.bstrVal, 
-						vtInterfaceType.bstrVal, 
-						hDevice,
-						vtBytesPerSector.uintVal,
-						vtSCSIBus.uintVal,
-						vtSCSILogicalUnit.uiVal,
-						vtSCSIPort.uiVal,
-						vtSCSITargetId.uiVal));
-			else if (_bstr_t("IDE") == _bstr_t(vtInterfaceType.bstrVal))							
-				pInfo = reinterpret_cast<pCDiskDrive>(new CDiskDrive<IAtaInterface>(
-						vtDeviceID.bstrVal, 
-						vtInterfaceType.bstrVal, 
-						hDevice,
-						vtBytesPerSector.uintVal,
-						vtSCSIBus.uintVal,
-						vtSCSILogicalUnit.uiVal,
-						vtSCSIPort.uiVal,
-						vtSCSITargetId.uiVal));
-			else
-				pInfo = reinterpret_cast<pCDiskDrive>(new CDiskDrive<IUnsupportedInterface>(
-						vtDeviceID.bstrVal, 
-						vtInterfaceType.bstrVal, 
-						hDevice,
-						vtBytesPerSector.uintVal,
-						vtSCSIBus.uintVal,
-						vtSCSILogicalUnit.uiVal,
-						vtSCSIPort.uiVal,
-						vtSCSITargetId.uiVal));
-			if (pInfo)
-				rList.push_back(pInfo);
-			else
-				hres = E_OUTOFMEMORY;
-		}
-
-		::VariantClear(&vtDeviceID);
-		::VariantClear(&vtInterfaceType);
-		::VariantClear(&vtBytesPerSector);
-		::VariantClear(&vtSCSIBus);
-		::VariantClear(&vtSCSILogicalUnit);
-		::VariantClear(&vtSCSIPort);
-		::VariantClear(&vtSCSITargetId);
- 		pclsObj->Release();
-		pclsObj = NULL;
-	}
-
-CleanUp:   
-	if (pSvc)
-		pSvc->Release();
-	if (pLoc)
-		pLoc->Release();
-	if (pEnumerator)
-		pEnumerator->Release();
-
-    return hres;   
-}
-
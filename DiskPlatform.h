@@ -0,0 +1,44 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "DiskDrive.h"
+#include "DiskEnumerator.h"
+#include "DeviceEvents.h"
+
+
+//  The platform layer isolates the operating system specific means of discovering and opening
+//  disk drive devices from the drive classes proper.  The Windows implementation (WMI and
+//  CreateFile) is within PlatformWin32.cpp, built into the DriveTrust library.  Enumeration
+//  itself is behind the IDiskEnumerator interface, see DiskEnumerator.h.
+//
+
+// Prepare the calling thread for enumeration (i.e. COM), rbUninitialize reports whether a 
+// matching PlatformUninitialize is owed.
+bool PlatformInitialize(_bstr_t &rbstrErrorInfo, bool &rbUninitialize);
+void PlatformUninitialize(bool bUninitialize);
+
+// Establish the process-wide COM security (i.e. CoInitializeSecurity), once, by the executable
+// rather than the library : an embedding host owns that choice.  Security already established
+// (RPC_E_TOO_LATE) is not a failure.
+bool PlatformInitializeSecurity(_bstr_t &rbstrErrorInfo);
+
+// Open the device and construct the CDiskDrive for its interface type, NULL if it cannot be opened.
+pCDiskDrive OpenDiskDrive(const TDiskDeviceAttributes &rAttributes);
+
+// Append a new, opened, CDiskDrive object for each attached disk drive device selected by pFilter
+// (if any), timing the enumeration if pStats is provided.  Devices not selected are never opened.
+// The caller owns (i.e. Releases) the list entries.
+HRESULT GetDiskDriveDevices(TListDiskDrives &rList, TEnumerationStats *pStats = NULL, const TDiskFilter *pFilter = NULL);
+
+// A new instance of the platform's enumeration backend, owned (i.e. deleted) by the caller.
+IDiskEnumerator *CreateDiskEnumerator(void);
+
+// The attributes of a single device (e.g. as named by a hotplug event) without enumerating, false
+// if the device is absent.
+bool ProbeDiskDevice(const std::wstring &strDeviceID, TDiskDeviceAttributes &rAttributes);
+
+// A new source of the platform's hotplug events, owned (i.e. deleted) by the caller.
+IDeviceEventSource *CreateDeviceEventSource(void);
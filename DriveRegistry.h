@@ -0,0 +1,309 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "DiskDrive.h"
+#include <string>
+#include <unordered_map>
+
+
+//  The CDriveRegistry class owns a set of drives and indexes them by serial number, world wide
+//  name and device path, each lookup being a hash probe rather than a scan of TListDiskDrives
+//  re-decoding every drive's identify strings.
+//
+//  Ownership : Insert takes over the caller's reference to the drive (see CDiskDrive::AddRef),
+//  Remove releases it.  A lookup yields a TDriveHandle, an index and generation pair that stays
+//  valid, and unambiguous, across other inserts and removals; Acquire turns a handle into an
+//  AddRef'd drive, or NULL once that drive has been removed (its slot reused or not).
+//
+//  The keys are decoded once, at Insert, so the drive must already have been identified for its
+//  serial number and world wide name to be indexed.  Where two drives report the same serial
+//  number (e.g. blank or vendor default strings) either may be found, and removing one leaves
+//  the other found.  Lookups take the lock shared, so any number of readers proceed
+//  concurrently with one another.
+//
+//  CPendingDrives owns the drives opened but not yet inserted (e.g. while each is identified).
+//
+
+typedef unsigned __int64 TDriveHandle;			// Generation (high 32 bits) and slot index
+#define DRIVE_HANDLE_INVALID	0
+
+class CDriveRegistry
+{
+  private:
+	typedef struct TDriveSlot
+	{
+		pCDiskDrive			pDisk;				// NULL if free
+		unsigned int		nGeneration;		// Incremented as the slot is vacated
+		std::wstring		strSerialNo;
+		std::wstring		strPath;
+		unsigned __int64	nWorldWideName;
+	} TDriveSlot;
+
+	typedef std::unordered_map<std::wstring, unsigned int>			TStringIndex;
+	typedef std::unordered_multimap<std::wstring, unsigned int>		TSerialNoIndex;	// Serial numbers need not be unique
+	typedef std::unordered_multimap<unsigned __int64, unsigned int>	TWwnIndex;		// "", where a bridge misreports them
+
+	std::vector<TDriveSlot>		_vSlots;
+	std::vector<unsigned int>	_vFree;			// Vacant slot indices
+	TSerialNoIndex				_mapSerialNo;
+	TStringIndex				_mapPath;
+	TWwnIndex					_mapWorldWideName;
+	size_t						_nCount;
+	mutable SRWLOCK				_srwLock;
+
+	static inline TDriveHandle MakeHandle(unsigned int nIndex, unsigned int nGeneration)
+		{ return (((TDriveHandle)nGeneration << 32) | nIndex); }
+
+	// The slot of a current handle, NULL if stale.  Call with the lock held.
+	const TDriveSlot *Slot(TDriveHandle hDrive) const
+	{
+		unsigned int nIndex = (unsigned int)(hDrive & 0xFFFFFFFF);
+		if ((hDrive == DRIVE_HANDLE_INVALID) || (nIndex >= _vSlots.size()))
+			return NULL;
+		const TDriveSlot &rSlot = _vSlots[nIndex];
+		return (((rSlot.pDisk) && (rSlot.nGeneration == (unsigned int)(hDrive >> 32))) ? &rSlot : NULL);
+	}
+
+	template <typename TIndex>
+	TDriveHandle Find(const TIndex &rIndex, const typename TIndex::key_type &rKey) const
+	{
+		TDriveHandle hDrive = DRIVE_HANDLE_INVALID;
+
+		::AcquireSRWLockShared(&_srwLock);
+		typename TIndex::const_iterator iter = rIndex.find(rKey);
+		if (iter != rIndex.end())
+			hDrive = MakeHandle(iter->second, _vSlots[iter->second].nGeneration);
+		::ReleaseSRWLockShared(&_srwLock);
+		return hDrive;
+	}
+
+	// Erase the key's entry for the one slot, leaving those of other drives sharing the key.
+	template <typename TIndex>
+	static void Unindex(TIndex &rIndex, const typename TIndex::key_type &rKey, unsigned int nIndex)
+	{
+		std::pair<typename TIndex::iterator, typename TIndex::iterator> range = rIndex.equal_range(rKey);
+		for (typename TIndex::iterator iter = range.first; iter != range.second; iter++)
+			if (iter->second == nIndex)
+			{
+				rIndex.erase(iter);
+				break;
+			}
+	}
+
+	// Vacate a slot, returning its drive for release outside the lock.  Call with the lock held exclusive.
+	pCDiskDrive Vacate(unsigned int nIndex)
+	{
+		TDriveSlot &rSlot = _vSlots[nIndex];
+		pCDiskDrive pDisk = rSlot.pDisk;
+
+		if (!rSlot.strSerialNo.empty())
+			Unindex(_mapSerialNo, rSlot.strSerialNo, nIndex);
+		if (rSlot.nWorldWideName)
+			Unindex(_mapWorldWideName, rSlot.nWorldWideName, nIndex);
+		Unindex(_mapPath, rSlot.strPath, nIndex);
+
+		rSlot.pDisk = NULL;
+		rSlot.nGeneration++;
+		rSlot.strSerialNo.clear();
+		rSlot.strPath.clear();
+		rSlot.nWorldWideName = 0;
+		_vFree.push_back(nIndex);
+		_nCount--;
+		return pDisk;
+	}
+
+	CDriveRegistry(const CDriveRegistry&);
+	CDriveRegistry &operator=(const CDriveRegistry&);
+
+  public:
+	CDriveRegistry(void) : _nCount(0)
+	{
+		::InitializeSRWLock(&_srwLock);
+	}
+
+	~CDriveRegistry()
+	{
+		Clear();
+	}
+
+	// Register a drive, taking over the caller's reference.  A drive already registered at the
+	// same device path (e.g. a stale entry for a re-attached device) is replaced.
+	TDriveHandle Insert(pCDiskDrive pDisk)
+	{
+		TRACE(L"CDriveRegistry::Insert\n");
+		pCDiskDrive pReplaced = NULL;
+		TDriveSlot sSlot;
+		unsigned int nIndex = 0;
+
+		if (!pDisk)
+			return DRIVE_HANDLE_INVALID;
+		sSlot.pDisk = pDisk;
+		sSlot.strPath = (const wchar_t*)pDisk->Name();
+		sSlot.strSerialNo = (const wchar_t*)pDisk->SerialNo();
+		sSlot.nWorldWideName = pDisk->WorldWideName();
+
+		::AcquireSRWLockExclusive(&_srwLock);
+		TStringIndex::iterator iterPath = _mapPath.find(sSlot.strPath);
+		if (iterPath != _mapPath.end())
+			pReplaced = Vacate(iterPath->second);
+
+		if (_vFree.empty())
+		{
+			nIndex = (unsigned int)_vSlots.size();
+			sSlot.nGeneration = 1;
+			_vSlots.push_back(sSlot);
+		}
+		else
+		{
+			nIndex = _vFree.back();
+			_vFree.pop_back();
+			sSlot.nGeneration = _vSlots[nIndex].nGeneration;
+			_vSlots[nIndex] = sSlot;
+		}
+
+		_mapPath[sSlot.strPath] = nIndex;
+		if (!sSlot.strSerialNo.empty())
+			_mapSerialNo.insert(TSerialNoIndex::value_type(sSlot.strSerialNo, nIndex));
+		if (sSlot.nWorldWideName)
+			_mapWorldWideName.insert(TWwnIndex::value_type(sSlot.nWorldWideName, nIndex));
+		_nCount++;
+		TDriveHandle hDrive = MakeHandle(nIndex, sSlot.nGeneration);
+		::ReleaseSRWLockExclusive(&_srwLock);
+
+		if (pReplaced)
+			pReplaced->Release();
+		return hDrive;
+	}
+
+	// Insert each drive of the list, which is left empty (i.e. its references now registered).
+	void Adopt(TListDiskDrives &rList)
+	{
+		for (size_t i = 0; i < rList.size(); i++)
+			Insert(rList[i]);
+		rList.clear();
+	}
+
+	// Unregister and release a drive, false if the handle is stale.
+	bool Remove(TDriveHandle hDrive)
+	{
+		TRACE(L"CDriveRegistry::Remove\n");
+		pCDiskDrive pDisk = NULL;
+
+		::AcquireSRWLockExclusive(&_srwLock);
+		if (Slot(hDrive))
+			pDisk = Vacate((unsigned int)(hDrive & 0xFFFFFFFF));
+		::ReleaseSRWLockExclusive(&_srwLock);
+
+		if (pDisk)
+			pDisk->Release();
+		return (pDisk != NULL);
+	}
+
+	void Clear(void)
+	{
+		TListDiskDrives listRemoved;
+
+		::AcquireSRWLockExclusive(&_srwLock);
+		for (size_t i = 0; i < _vSlots.size(); i++)
+			if (_vSlots[i].pDisk)
+				listRemoved.push_back(Vacate((unsigned int)i));
+		::ReleaseSRWLockExclusive(&_srwLock);
+
+		for (size_t i = 0; i < listRemoved.size(); i++)
+			listRemoved[i]->Release();
+	}
+
+	// Lookups, DRIVE_HANDLE_INVALID if not found.
+	inline TDriveHandle FindBySerialNo(const std::wstring &strSerialNo) const
+		{ return Find(_mapSerialNo, strSerialNo); }
+
+	inline TDriveHandle FindByPath(const std::wstring &strPath) const
+		{ return Find(_mapPath, strPath); }
+
+	inline TDriveHandle FindByWorldWideName(unsigned __int64 nWorldWideName) const
+		{ return Find(_mapWorldWideName, nWorldWideName); }
+
+	// The drive of a handle, AddRef'd (the caller Releases it), NULL if the handle is stale.
+	pCDiskDrive Acquire(TDriveHandle hDrive) const
+	{
+		pCDiskDrive pDisk = NULL;
+
+		::AcquireSRWLockShared(&_srwLock);
+		const TDriveSlot *pSlot = Slot(hDrive);
+		if (pSlot)
+		{
+			pDisk = pSlot->pDisk;
+			pDisk->AddRef();
+		}
+		::ReleaseSRWLockShared(&_srwLock);
+		return pDisk;
+	}
+
+	// Every registered drive, AddRef'd, in slot order.
+	void Snapshot(TListDiskDrives &rList) const
+	{
+		::AcquireSRWLockShared(&_srwLock);
+		rList.reserve(rList.size() + _nCount);
+		for (size_t i = 0; i < _vSlots.size(); i++)
+			if (_vSlots[i].pDisk)
+			{
+				_vSlots[i].pDisk->AddRef();
+				rList.push_back(_vSlots[i].pDisk);
+			}
+		::ReleaseSRWLockShared(&_srwLock);
+	}
+
+	size_t Count(void) const
+	{
+		::AcquireSRWLockShared(&_srwLock);
+		size_t nCount = _nCount;
+		::ReleaseSRWLockShared(&_srwLock);
+		return nCount;
+	}
+};	// CDriveRegistry
+
+
+//  The CPendingDrives class holds the references to drives opened but not yet inserted into a
+//  CDriveRegistry, releasing those still held however its scope is left (e.g. an exception
+//  thrown while one is identified).
+
+class CPendingDrives
+{
+  private:
+	TListDiskDrives		_list;
+
+	CPendingDrives(const CPendingDrives&);
+	CPendingDrives &operator=(const CPendingDrives&);
+
+  public:
+	CPendingDrives(void) {}
+
+	~CPendingDrives()
+	{
+		for (size_t i = 0; i < _list.size(); i++)
+			if (_list[i])
+				_list[i]->Release();
+	}
+
+	// The list to be filled (e.g. by GetDiskDriveDevices), its drives then owned here.
+	inline TListDiskDrives &List(void)
+		{ return _list; }
+
+	inline size_t Count(void) const
+		{ return _list.size(); }
+
+	inline pCDiskDrive operator[](size_t i) const
+		{ return _list[i]; }
+
+	// Insert the i'th drive, handing over its reference; the drive is then borrowed from the registry.
+	pCDiskDrive Register(CDriveRegistry &rRegistry, size_t i)
+	{
+		pCDiskDrive pDisk = _list[i];
+		rRegistry.Insert(pDisk);
+		_list[i] = NULL;
+		return pDisk;
+	}
+};	// CPendingDrives
@@ -0,0 +1,282 @@
+//************************************************************************
+//  File name: DriveTrust.cpp
+//
+//  Description:
+//  Implements the DriveTrust library public interface (see DriveTrust.h) over
+//  the CDiskDrive classes and the platform layer (see DiskPlatform.h).
+//
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#include "stdafx.h"
+#include "DriveTrust.h"
+#include "DiskDrive.h"
+#include "DiskPlatform.h"
+#include "TcgSession.h"
+
+
+static void SetDriveTrustError(TDriveTrustError *pError, long nCode, const wchar_t *pszMessage)
+{
+	if (pError)
+	{
+		pError->nCode = nCode;
+		::wcsncpy_s(pError->szMessage, DRIVETRUST_MAX_ERROR, (pszMessage ? pszMessage : L""), _TRUNCATE);
+	}
+}
+
+// The message is formatted only for a caller that asked for it.
+static void SetDriveTrustError(TDriveTrustError *pError, const TBusError &rError, const wchar_t *pszDrive)
+{
+	if (pError)
+		SetDriveTrustError(pError, (long)rError.Win32Error(), rError.Describe(pszDrive));
+}
+
+
+static void CopyField(wchar_t *pszDest, size_t nDest, const wchar_t *pszSource)
+{
+	::wcsncpy_s(pszDest, nDest, (pszSource ? pszSource : L""), _TRUNCATE);
+}
+
+// The length of a single IF-RECV response as its header states it, or 0 where the protocol
+// defines no such header (e.g. vendor unique).
+static unsigned int ReceivedLength(BYTE bySecurityProtocol, unsigned short nComId, const std::vector<BYTE> &rResponse)
+{
+	TComPacketStatus status;
+
+	if (bySecurityProtocol == TCG_SECURITY_PROTOCOL_INFO)
+		return ((rResponse.size() >= 8) ? (8 + ((rResponse[6] << 8) | rResponse[7])) : 0);		// Supported protocol list, SPC-4
+	if ((bySecurityProtocol == TCG_SECURITY_PROTOCOL_1) && (nComId == TCG_LEVEL0_DISCOVERY_COMID) && (rResponse.size() >= 4))
+	{
+		unsigned int nParameters = n32ByteSwap(*reinterpret_cast<const unsigned __int32*>(&rResponse[0]));
+		return (4 + ((nParameters < ((unsigned int)-1 - 4)) ? nParameters : ((unsigned int)-1 - 4)));
+	}
+	if (((bySecurityProtocol == TCG_SECURITY_PROTOCOL_1) || (bySecurityProtocol == TCG_SECURITY_PROTOCOL_2)) &&
+		(status.Decode(&rResponse[0], (unsigned)rResponse.size())))
+		return (nSizeTComPacketHeader + status.nLength);
+	return 0;
+}
+
+
+class CDriveTrustDrive : public IDriveTrustDrive
+{
+  private:
+	pCDiskDrive			_pDisk;
+	TDriveTrustInfo		_sInfo;
+	mutable CRITICAL_SECTION	_critInfo;		// Serializes Identify, and Info against it
+
+	// Call with _critInfo held (or before the drive is published).
+	void UpdateInfo(bool bIdentified)
+	{
+		ZeroMemory(&_sInfo, sizeof(_sInfo));
+		CopyField(_sInfo.szPath, DRIVETRUST_MAX_PATH, _pDisk->Name());
+		CopyField(_sInfo.szInterface, DRIVETRUST_MAX_INTERFACE, _pDisk->InterfaceType());
+		_sInfo.nBytesPerSector = _pDisk->BytesPerSector();
+		_sInfo.nScsiBus = (unsigned short)_pDisk->ScsiBus();
+		_sInfo.nScsiLogicalUnit = _pDisk->SCSILogicalUnit();
+		_sInfo.nScsiPort = _pDisk->SCSIPort();
+		_sInfo.nScsiTargetId = _pDisk->SCSITargetId();
+
+		_sInfo.bIdentified = bIdentified;
+		if (bIdentified)
+		{
+			CopyField(_sInfo.szModel, DRIVETRUST_MAX_MODEL, _pDisk->Model());
+			CopyField(_sInfo.szSerialNo, DRIVETRUST_MAX_SERIAL, _pDisk->SerialNo());
+			CopyField(_sInfo.szFirmware, DRIVETRUST_MAX_FIRMWARE, _pDisk->Firmware());
+			_sInfo.bAtaPassthruCapable = _pDisk->IsAtaPassthruCapable();
+			_sInfo.bDriveTrustCapable = _pDisk->IsDriveTrustCapable();
+			::memcpy_s(_sInfo.abyIdentify, sizeof(_sInfo.abyIdentify), &_pDisk->IdentifySector()._sectorData, ATA_DISK_SECTOR_SIZE);
+		}
+	}
+
+	CDriveTrustDrive(const CDriveTrustDrive&);
+	CDriveTrustDrive &operator=(const CDriveTrustDrive&);
+
+  public:
+	CDriveTrustDrive(pCDiskDrive pDisk) : _pDisk(pDisk)
+	{
+		TBusError sError;
+		::InitializeCriticalSection(&_critInfo);
+		UpdateInfo(_pDisk->QueryIdentifySector(sError));
+	}
+
+	virtual ~CDriveTrustDrive()
+	{
+		_pDisk->Release();
+		::DeleteCriticalSection(&_critInfo);
+	}
+
+	virtual TDriveTrustInfo Info(void) const
+	{
+		::EnterCriticalSection(&_critInfo);
+		TDriveTrustInfo sInfo = _sInfo;
+		::LeaveCriticalSection(&_critInfo);
+		return sInfo;
+	}
+
+	virtual bool Identify(TDriveTrustError *pError)
+	{
+		TRACE(L"CDriveTrustDrive::Identify\n");
+		TBusError sError;
+
+		::EnterCriticalSection(&_critInfo);
+		bool bres = _pDisk->QueryIdentifySector(sError);
+		UpdateInfo(bres);
+		::LeaveCriticalSection(&_critInfo);
+		if (!bres)
+			SetDriveTrustError(pError, sError, _pDisk->Name());
+		return bres;
+	}
+
+	virtual bool Transmit(TDriveTrustError *pError, unsigned char bySecurityProtocol, unsigned short nComId,
+						  const unsigned char *pbyCommand, unsigned int nCommandLength,
+						  unsigned char *pbyResponse, unsigned int nResponseCapacity, unsigned int *pnResponse)
+	{
+		TRACE(L"CDriveTrustDrive::Transmit\n");
+		TBusError sError;
+		std::vector<BYTE> vResponse;
+
+		if ((!pbyCommand) || (!pbyResponse) || (!pnResponse))
+		{
+			SetDriveTrustError(pError, ERROR_INVALID_PARAMETER, L"Transmit : Invalid argument.");
+			return false;
+		}
+		*pnResponse = 0;
+		if (!_pDisk->Transmit(sError, bySecurityProtocol, nComId, pbyCommand, nCommandLength, vResponse))
+		{
+			SetDriveTrustError(pError, sError, _pDisk->Name());
+			return false;
+		}
+
+		*pnResponse = (unsigned int)vResponse.size();
+		if (vResponse.size() > nResponseCapacity)
+		{
+			SetDriveTrustError(pError, ERROR_MORE_DATA, L"Transmit : Response exceeds the buffer provided.");
+			return false;
+		}
+		if (!vResponse.empty())
+			::memcpy_s(pbyResponse, nResponseCapacity, &vResponse[0], vResponse.size());
+		return true;
+	}
+
+	virtual bool Receive(TDriveTrustError *pError, unsigned char bySecurityProtocol, unsigned short nComId,
+						 unsigned char *pbyResponse, unsigned int nResponseCapacity, unsigned int *pnResponse)
+	{
+		TRACE(L"CDriveTrustDrive::Receive\n");
+		TBusError sError;
+
+		if ((!pbyResponse) || (nResponseCapacity == 0) || (!pnResponse))
+		{
+			SetDriveTrustError(pError, ERROR_INVALID_PARAMETER, L"Receive : Invalid argument.");
+			return false;
+		}
+		*pnResponse = 0;
+
+		std::vector<BYTE> vResponse(nResponseCapacity);
+		if (!_pDisk->TrustedReceive(sError, bySecurityProtocol, nComId, vResponse))
+		{
+			SetDriveTrustError(pError, sError, _pDisk->Name());
+			return false;
+		}
+		::memcpy_s(pbyResponse, nResponseCapacity, &vResponse[0], nResponseCapacity);
+
+		unsigned int nLength = ::ReceivedLength(bySecurityProtocol, nComId, vResponse);
+		*pnResponse = (nLength) ? nLength : nResponseCapacity;
+		if (*pnResponse > nResponseCapacity)
+		{
+			SetDriveTrustError(pError, ERROR_MORE_DATA, L"Receive : Response exceeds the buffer provided.");
+			return false;
+		}
+		return true;
+	}
+};	// CDriveTrustDrive
+
+
+class CDriveTrustInventory : public IDriveTrustInventory
+{
+  private:
+	std::vector<CDriveTrustDrive*>	_vDrives;
+
+  public:
+	CDriveTrustInventory(TListDiskDrives &rList)
+	{
+		_vDrives.reserve(rList.size());
+		for (size_t i = 0; i < rList.size(); i++)
+			_vDrives.push_back(new CDriveTrustDrive(rList[i]));
+		rList.clear();		// i.e. now owned by the CDriveTrustDrive objects
+	}
+
+	virtual ~CDriveTrustInventory()
+	{
+		for (size_t i = 0; i < _vDrives.size(); i++)
+			delete _vDrives[i];
+	}
+
+	virtual unsigned int Count(void) const
+	{
+		return (unsigned int)_vDrives.size();
+	}
+
+	virtual IDriveTrustDrive *Drive(unsigned int nIndex)
+	{
+		return ((nIndex < _vDrives.size()) ? _vDrives[nIndex] : NULL);
+	}
+
+	virtual void Release(void)
+	{
+		delete this;
+	}
+};	// CDriveTrustInventory
+
+
+unsigned int DriveTrustApiVersion(void)
+{
+	return DRIVETRUST_API_VERSION;
+}
+
+
+bool DriveTrustEnumerate(IDriveTrustInventory **ppInventory, TDriveTrustError *pError)
+{
+	TRACE(L"DriveTrustEnumerate\n");
+	TListDiskDrives listDiskDrives;
+	_bstr_t bstrErrorInfo;
+	bool bUninitialize = false;
+	HRESULT hr = S_OK;
+
+	if (!ppInventory)
+	{
+		SetDriveTrustError(pError, E_INVALIDARG, L"DriveTrustEnumerate : Invalid argument.");
+		return false;
+	}
+	*ppInventory = NULL;
+	if (!::PlatformInitialize(bstrErrorInfo, bUninitialize))
+	{
+		SetDriveTrustError(pError, E_FAIL, bstrErrorInfo);
+		return false;
+	}
+
+	try
+	{
+		hr = ::GetDiskDriveDevices(listDiskDrives);
+		if (SUCCEEDED(hr))
+			*ppInventory = new CDriveTrustInventory(listDiskDrives);
+	}
+	catch (_com_error &Err)
+	{
+		hr = Err.Error();
+	}
+	catch (std::bad_alloc &)
+	{
+		hr = E_OUTOFMEMORY;
+	}
+
+	for (size_t i = 0; i < listDiskDrives.size(); i++)
+		listDiskDrives[i]->Release();
+	::PlatformUninitialize(bUninitialize);
+
+	if (FAILED(hr))
+	{
+		SetDriveTrustError(pError, hr, _com_error(hr).ErrorMessage());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,115 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+
+//  DriveTrust library public interface.
+//
+//  The DriveTrust library (DriveTrust.lib) exposes drive enumeration, the decoded Identify
+//  Sector, and the Trusted Send/Receive transport for use in-process by an embedding agent,
+//  rather than spawning DiskInfo.exe and parsing its output.  This header depends on no
+//  Windows, COM or STL headers; objects are reached through abstract interfaces and created
+//  by the library, so the implementation classes (see DiskDrive.h) may change without
+//  rebuilding the client.  Check DriveTrustApiVersion() against DRIVETRUST_API_VERSION.
+//
+//  Typical use :
+//
+//		IDriveTrustInventory *pInventory = NULL;
+//		TDriveTrustError sError;
+//		if (DriveTrustEnumerate(&pInventory, &sError))
+//		{
+//			for (unsigned n = 0; n < pInventory->Count(); n++)
+//				... pInventory->Drive(n)->Info().szModel ...
+//			pInventory->Release();
+//		}
+//
+//  An inventory and its drives may be used from multiple threads; each drive serializes its
+//  own Send/Receive pairs, and its Identify against Info (which returns a copy for that reason).
+//  The library leaves process-wide COM security (CoInitializeSecurity) to the host.
+//
+
+#define DRIVETRUST_API_VERSION		2
+
+#define DRIVETRUST_MAX_PATH			260
+#define DRIVETRUST_MAX_INTERFACE	16
+#define DRIVETRUST_MAX_MODEL		41
+#define DRIVETRUST_MAX_SERIAL		21
+#define DRIVETRUST_MAX_FIRMWARE		9
+#define DRIVETRUST_MAX_ERROR		512
+#define DRIVETRUST_IDENTIFY_SIZE	512
+
+
+typedef struct TDriveTrustError
+{
+	long			nCode;									// Win32 error or HRESULT, 0 if not applicable
+	wchar_t			szMessage[DRIVETRUST_MAX_ERROR];
+} TDriveTrustError;
+
+
+typedef struct TDriveTrustInfo
+{
+	wchar_t			szPath[DRIVETRUST_MAX_PATH];			// e.g. \\.\PHYSICALDRIVE0
+	wchar_t			szInterface[DRIVETRUST_MAX_INTERFACE];	// e.g. IDE, USB, SCSI
+	unsigned int	nBytesPerSector;
+	unsigned short	nScsiBus;
+	unsigned short	nScsiLogicalUnit;
+	unsigned short	nScsiPort;
+	unsigned short	nScsiTargetId;
+
+	bool			bIdentified;							// The following are valid
+	wchar_t			szModel[DRIVETRUST_MAX_MODEL];
+	wchar_t			szSerialNo[DRIVETRUST_MAX_SERIAL];
+	wchar_t			szFirmware[DRIVETRUST_MAX_FIRMWARE];
+	bool			bAtaPassthruCapable;
+	bool			bDriveTrustCapable;
+	unsigned char	abyIdentify[DRIVETRUST_IDENTIFY_SIZE];	// Raw ATA Identify Sector
+} TDriveTrustInfo;
+
+
+struct IDriveTrustDrive
+{
+	// A copy, consistent even while another thread calls Identify.
+	virtual TDriveTrustInfo Info(void) const = 0;
+
+	// Re-read the Identify Sector, refreshing Info().
+	virtual bool Identify(TDriveTrustError *pError) = 0;
+
+	// Trusted Send of pbyCommand then Trusted Receive of the response (polled until the TPer
+	// has no outstanding data).  *pnResponse is the response length; false with ERROR_MORE_DATA
+	// if nResponseCapacity is insufficient.
+	virtual bool Transmit(TDriveTrustError *pError, unsigned char bySecurityProtocol, unsigned short nComId,
+						  const unsigned char *pbyCommand, unsigned int nCommandLength,
+						  unsigned char *pbyResponse, unsigned int nResponseCapacity, unsigned int *pnResponse) = 0;
+
+	// A single Trusted Receive of nResponseCapacity bytes (e.g. Level 0 Discovery on protocol 0x01,
+	// ComID 0x0001).  *pnResponse is the response length its header states (the protocol list of
+	// protocol 0x00, Level 0 Discovery, or a ComPacket), else nResponseCapacity; false with
+	// ERROR_MORE_DATA if the response is longer, the buffer then holding its first bytes.
+	virtual bool Receive(TDriveTrustError *pError, unsigned char bySecurityProtocol, unsigned short nComId,
+						 unsigned char *pbyResponse, unsigned int nResponseCapacity, unsigned int *pnResponse) = 0;
+
+  protected:
+	virtual ~IDriveTrustDrive() {}
+};
+
+
+struct IDriveTrustInventory
+{
+	virtual unsigned int Count(void) const = 0;
+	virtual IDriveTrustDrive *Drive(unsigned int nIndex) = 0;		// Owned by the inventory
+
+	// Release the inventory, its drives and their device handles.
+	virtual void Release(void) = 0;
+
+  protected:
+	virtual ~IDriveTrustInventory() {}
+};
+
+
+unsigned int DriveTrustApiVersion(void);
+
+// Enumerate attached disk drives and read each Identify Sector.  Drives whose Identify fails are
+// still listed, with TDriveTrustInfo::bIdentified false.
+bool DriveTrustEnumerate(IDriveTrustInventory **ppInventory, TDriveTrustError *pError);
@@ -0,0 +1,219 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include <string.h>
+
+
+//  Drive vendor and family classification from the Identify Sector's model string, the IEEE OUI
+//  of its world wide name and its firmware revision.
+//
+//		s_aModelPrefixes		Model prefix -> vendor, family and quirks.  The longest matching
+//								prefix wins (e.g. "HDS" Hitachi ahead of "HD" Samsung).
+//		s_aVendorOuis			OUI -> vendor, where the model names none (e.g. an OEM model string).
+//		s_aFirmwareQuirks		Model prefix and firmware revision -> further quirks (e.g. a
+//								firmware release with a known field defect).
+//
+//  The model table is kept grouped by its first character, longest prefixes first within a
+//  group; a 96 entry index of the printable ASCII range gives each group's extent, so that a
+//  classification inspects only the few entries sharing the model's first character.  The index
+//  is built in one pass over the table on first use, the nmake build having no generator step.
+//  Prefixes compare without regard to case, as OEMs vary it.
+//
+//  The quirk bits let downstream code (e.g. fleet locking, command timeouts) single out drive
+//  families without repeating the model analysis.
+//
+//		see:	IEEE Registration Authority, "MA-L" public listing, for the OUI assignments.
+//
+
+enum EDriveQuirk
+{
+	eQuirkNone				= 0x0000,
+	eQuirkFirmwareDefect	= 0x0001,		// A firmware release with a published field defect
+	eQuirkSolidState		= 0x0002,		// Flash media (i.e. no spin up, and TRIM matters)
+};
+
+typedef struct TDriveClass
+{
+	const char		*pszVendor;				// "Unknown" if unclassified
+	const char		*pszFamily;				// Empty if only the vendor is known
+	unsigned int	nQuirks;				// EDriveQuirk bits
+
+	TDriveClass(void) : pszVendor("Unknown"), pszFamily(""), nQuirks(eQuirkNone) {}
+	inline bool IsKnown(void) const { return (::strcmp(pszVendor, "Unknown") != 0); }
+} TDriveClass;
+
+
+typedef struct TModelPrefixEntry
+{
+	const char		*pszPrefix;
+	const char		*pszVendor;
+	const char		*pszFamily;
+	unsigned int	nQuirks;
+} TModelPrefixEntry;
+
+// Grouped by first character, longest prefix first within each group.
+static const TModelPrefixEntry s_aModelPrefixes[] =
+{
+	{ "APPLE SSD",	"Apple",			"SSD",				eQuirkSolidState },
+	{ "Crucial",	"Crucial",			"",					eQuirkSolidState },
+	{ "CT",			"Crucial",			"",					eQuirkSolidState },
+	{ "FUJITSU",	"Fujitsu",			"",					eQuirkNone },
+	{ "Hitachi",	"Hitachi",			"",					eQuirkNone },
+	{ "HGST",		"HGST",				"",					eQuirkNone },
+	{ "HDS",		"Hitachi",			"Deskstar",			eQuirkNone },
+	{ "HDT",		"Hitachi",			"Deskstar",			eQuirkNone },
+	{ "HTS",		"Hitachi",			"Travelstar",		eQuirkNone },
+	{ "HTE",		"Hitachi",			"Travelstar",		eQuirkNone },
+	{ "HUA",		"Hitachi",			"Ultrastar",		eQuirkNone },
+	{ "HD",			"Samsung",			"SpinPoint",		eQuirkNone },
+	{ "INTEL SSD",	"Intel",			"SSD",				eQuirkSolidState },
+	{ "IC25",		"IBM",				"Travelstar",		eQuirkNone },
+	{ "IC35",		"IBM",				"Deskstar",			eQuirkNone },
+	{ "KINGSTON",	"Kingston",			"",					eQuirkSolidState },
+	{ "MAXTOR",		"Maxtor",			"",					eQuirkNone },
+	{ "Micron",		"Micron",			"",					eQuirkSolidState },
+	{ "M4-CT",		"Crucial",			"m4",				eQuirkSolidState },
+	{ "MHV",		"Fujitsu",			"Mobile",			eQuirkNone },
+	{ "MHW",		"Fujitsu",			"Mobile",			eQuirkNone },
+	{ "MHY",		"Fujitsu",			"Mobile",			eQuirkNone },
+	{ "MHZ",		"Fujitsu",			"Mobile",			eQuirkNone },
+	{ "MK",			"Toshiba",			"Mobile",			eQuirkNone },
+	{ "OCZ",		"OCZ",				"",					eQuirkSolidState },
+	{ "QUANTUM",	"Quantum",			"",					eQuirkNone },
+	{ "SAMSUNG SSD","Samsung",			"SSD",				eQuirkSolidState },
+	{ "SAMSUNG",	"Samsung",			"",					eQuirkNone },
+	{ "SanDisk",	"SanDisk",			"",					eQuirkSolidState },
+	{ "SSDSA",		"Intel",			"SSD",				eQuirkSolidState },
+	{ "ST3",		"Seagate",			"Barracuda",		eQuirkNone },
+	{ "ST9",		"Seagate",			"Momentus",			eQuirkNone },
+	{ "ST",			"Seagate",			"",					eQuirkNone },
+	{ "TOSHIBA",	"Toshiba",			"",					eQuirkNone },
+	{ "WDC WD",		"Western Digital",	"",					eQuirkNone },
+	{ "WD",			"Western Digital",	"",					eQuirkNone },
+};
+
+
+typedef struct TVendorOuiEntry
+{
+	unsigned int	nOui;
+	const char		*pszVendor;
+} TVendorOuiEntry;
+
+static const TVendorOuiEntry s_aVendorOuis[] =
+{
+	{ 0x000039,	"Toshiba" },
+	{ 0x000C50,	"Seagate" },
+	{ 0x000CCA,	"HGST" },
+	{ 0x0014EE,	"Western Digital" },
+	{ 0x001B44,	"SanDisk" },
+	{ 0x002538,	"Samsung" },
+	{ 0x00A075,	"Micron" },
+	{ 0x5CD2E4,	"Intel" },
+};
+
+
+typedef struct TFirmwareQuirkEntry
+{
+	const char		*pszModelPrefix;
+	const char		*pszFirmware;			// A revision, or its prefix
+	unsigned int	nQuirks;
+} TFirmwareQuirkEntry;
+
+static const TFirmwareQuirkEntry s_aFirmwareQuirks[] =
+{
+	{ "ST3",	"SD15",		eQuirkFirmwareDefect },		// Barracuda 7200.11, fixed by SD1A
+	{ "ST3",	"SD16",		eQuirkFirmwareDefect },
+	{ "ST3",	"SD17",		eQuirkFirmwareDefect },
+	{ "ST3",	"SD18",		eQuirkFirmwareDefect },
+	{ "ST3",	"SD19",		eQuirkFirmwareDefect },
+	{ "M4-CT",	"000",		eQuirkFirmwareDefect },		// m4 5184 hour fault, fixed by 0309
+};
+
+
+inline bool DrivePrefixMatch(const char *pszString, const char *pszPrefix)
+{
+	return (::_strnicmp(pszString, pszPrefix, ::strlen(pszPrefix)) == 0);
+}
+
+// The extent [nFirst, nEnd) within s_aModelPrefixes of the entries for each printable first character.
+class CModelPrefixIndex
+{
+  private:
+	enum { eFirstChar = 0x20, eChars = 0x60 };
+	unsigned char	_anFirst[eChars];
+	unsigned char	_anEnd[eChars];
+
+	static inline unsigned int Slot(char c)
+	{
+		if ((c >= 'a') && (c <= 'z'))
+			c = (char)(c - 'a' + 'A');
+		return (((unsigned char)c >= eFirstChar) && ((unsigned char)c < (eFirstChar + eChars))) ? ((unsigned char)c - eFirstChar) : eChars;
+	}
+
+  public:
+	CModelPrefixIndex(void)
+	{
+		::memset(_anFirst, 0, sizeof(_anFirst));
+		::memset(_anEnd, 0, sizeof(_anEnd));
+		for (unsigned int i = 0; i < (sizeof(s_aModelPrefixes) / sizeof(s_aModelPrefixes[0])); i++)
+		{
+			unsigned int nSlot = Slot(s_aModelPrefixes[i].pszPrefix[0]);
+			ASSERT((_anEnd[nSlot] == 0) || (_anEnd[nSlot] == i));		// i.e. the table is grouped
+			if (_anEnd[nSlot] == 0)
+				_anFirst[nSlot] = (unsigned char)i;
+			_anEnd[nSlot] = (unsigned char)(i + 1);
+		}
+	}
+
+	// The longest prefix of the model, NULL if none.
+	const TModelPrefixEntry *Find(const char *pszModel) const
+	{
+		unsigned int nSlot = Slot(pszModel[0]);
+		if (nSlot >= eChars)
+			return NULL;
+		for (unsigned int i = _anFirst[nSlot]; i < _anEnd[nSlot]; i++)
+			if (DrivePrefixMatch(pszModel, s_aModelPrefixes[i].pszPrefix))
+				return &s_aModelPrefixes[i];
+		return NULL;
+	}
+};
+
+
+// The 24 bit OUI of an IEEE Registered (NAA 5) world wide name, 0 if none.
+inline unsigned int WorldWideNameOui(unsigned __int64 nWorldWideName)
+{
+	return ((nWorldWideName >> 60) == 5) ? (unsigned int)((nWorldWideName >> 36) & 0xFFFFFF) : 0;
+}
+
+// Classify a drive from its (decoded, trimmed) model and firmware strings and its world wide name.
+inline TDriveClass ClassifyDrive(const char *pszModel, const char *pszFirmware, unsigned __int64 nWorldWideName)
+{
+	static const CModelPrefixIndex s_index;
+	const TModelPrefixEntry *pEntry = (pszModel) ? s_index.Find(pszModel) : NULL;
+	TDriveClass sClass;
+
+	if (pEntry)
+	{
+		sClass.pszVendor = pEntry->pszVendor;
+		sClass.pszFamily = pEntry->pszFamily;
+		sClass.nQuirks = pEntry->nQuirks;
+	}
+	else
+	{
+		unsigned int nOui = WorldWideNameOui(nWorldWideName);
+		for (unsigned int i = 0; (nOui) && (i < (sizeof(s_aVendorOuis) / sizeof(s_aVendorOuis[0]))); i++)
+			if (s_aVendorOuis[i].nOui == nOui)
+			{
+				sClass.pszVendor = s_aVendorOuis[i].pszVendor;
+				break;
+			}
+	}
+
+	for (unsigned int i = 0; (pszModel) && (pszFirmware) && (i < (sizeof(s_aFirmwareQuirks) / sizeof(s_aFirmwareQuirks[0]))); i++)
+		if ((DrivePrefixMatch(pszModel, s_aFirmwareQuirks[i].pszModelPrefix)) && (DrivePrefixMatch(pszFirmware, s_aFirmwareQuirks[i].pszFirmware)))
+			sClass.nQuirks |= s_aFirmwareQuirks[i].nQuirks;
+	return sClass;
+}
@@ -0,0 +1,421 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "DiskDrive.h"
+#include "TcgTable.h"
+#include "CredentialCache.h"
+#include <map>
+
+
+//  Fleet-wide lock / unlock orchestration.
+//
+//  The CFleetLocking class runs the lock or unlock session sequence (Level 0 Discovery,
+//  Properties, StartSession on the Locking SP, batched Set of ReadLocked / WriteLocked, and
+//  EndSession) on every trusted drive concurrently, one worker thread per drive.  Concurrency
+//  on each host adapter (i.e. SCSIPort) is bounded by a semaphore so a single HBA or USB hub
+//  is not flooded.  An overall deadline applies : workers not yet started when it passes are
+//  skipped, no session step starts after it (and no End Session is sent), device polls and
+//  retry backoffs are cut short to it, and workers still within a device IO call have that IO
+//  cancelled.  A worker not done shortly after is reported as timed out and left to finish on
+//  its own.  The consolidated TFleetResult list reports the outcome and latency of each drive,
+//  so the wall time of a whole enclosure can be compared with the slowest drive and with the
+//  serial sum.
+//
+//  When TFleetOptions::nPinIterations is set, the PIN presented to each drive is derived from the
+//  credential with PBKDF2-HMAC-SHA256 salted by the drive serial number (see CredentialCache.h).
+//  All PINs are derived as one batch before any session starts.
+//
+//  Coordinating several hosts (e.g. a rack) is a matter of running this on each host; the
+//  per-host report is what a caller aggregates.
+//
+
+enum EFleetOperation { eFleetNone = 0, eFleetUnlock, eFleetLock };
+enum EFleetOutcome { eFleetPending = 0, eFleetSucceeded, eFleetFailed, eFleetTimedOut, eFleetNotTrusted };
+
+#define FLEET_DEFAULT_PER_BUS		4			// Concurrent drives per host adapter
+#define FLEET_DEFAULT_DEADLINE_MS	60000
+#define FLEET_CANCEL_GRACE_MS		1000		// For cancelled device IO to unwind past the deadline
+
+
+typedef struct TFleetOptions
+{
+	EFleetOperation		eOperation;
+	unsigned int		nMaxPerBus;			// Concurrent drives per host adapter, 0 = unlimited
+	DWORD				dwDeadlineMs;		// Overall deadline for the whole fleet
+	TTcgUid				uidAuthority;		// Authority to authenticate as (e.g. Admin1)
+	std::vector<BYTE>	vPin;				// Credential for that authority
+	unsigned int		nPinIterations;		// PBKDF2 iterations deriving per-drive PINs, 0 = present vPin as is
+	unsigned int		nRanges;			// Locking ranges in addition to the Global range
+
+	TFleetOptions(void) : eOperation(eFleetNone), nMaxPerBus(FLEET_DEFAULT_PER_BUS),
+		dwDeadlineMs(FLEET_DEFAULT_DEADLINE_MS), uidAuthority(TCG_UID_ADMIN1), nPinIterations(0), nRanges(0) {}
+
+	~TFleetOptions()
+	{
+		if (!vPin.empty())
+			::SecureZeroMemory(&vPin[0], vPin.size());
+	}
+} TFleetOptions;
+
+
+typedef struct TFleetResult
+{
+	pCDiskDrive			pDisk;
+	EFleetOutcome		eOutcome;
+	_bstr_t				bstrError;
+	unsigned __int64	nQueuedUs;			// Time spent waiting for the host adapter
+	unsigned __int64	nElapsedUs;			// Time spent within the session sequence
+	HANDLE				hThread;
+	BYTE				abyPin[CREDENTIAL_KEY_LENGTH];	// Derived PIN, when nPinIterations is set
+
+	TFleetResult(void) : pDisk(NULL), eOutcome(eFleetPending), nQueuedUs(0), nElapsedUs(0), hThread(NULL)
+		{ memset(abyPin, 0, sizeof(abyPin)); }
+} TFleetResult;
+
+
+class CFleetLocking
+{
+  private:
+	// What a worker uses, owned jointly with Run : a worker still running when Run gives up on
+	// it (see FLEET_CANCEL_GRACE_MS) finishes against its own copy, the last Release freeing it.
+	typedef struct TWorkerContext
+	{
+		volatile LONG		lRefCount;
+		pCDiskDrive			pDisk;				// Referenced
+		HANDLE				hBus;				// Duplicated host adapter semaphore, or NULL
+		EFleetOperation		eOperation;
+		TTcgUid				uidAuthority;
+		unsigned int		nRanges;
+		std::vector<BYTE>	vPin;
+		unsigned __int64	nDeadlineUs;
+		EFleetOutcome		eOutcome;			// Results, read by Run once the worker has exited
+		_bstr_t				bstrError;
+		unsigned __int64	nQueuedUs;
+		unsigned __int64	nElapsedUs;
+
+		TWorkerContext(pCDiskDrive pDiskDrive) : lRefCount(2), pDisk(pDiskDrive), hBus(NULL), eOperation(eFleetNone),
+			uidAuthority(0), nRanges(0), nDeadlineUs(0), eOutcome(eFleetPending), nQueuedUs(0), nElapsedUs(0)
+			{ pDisk->AddRef(); }
+
+		~TWorkerContext()
+		{
+			if (!vPin.empty())
+				::SecureZeroMemory(&vPin[0], vPin.size());
+			if (hBus)
+				::CloseHandle(hBus);
+			pDisk->Release();
+		}
+
+		void Release(void)
+		{
+			if (::InterlockedDecrement(&lRefCount) == 0)
+				delete this;
+		}
+
+	  private:
+		TWorkerContext(const TWorkerContext&);
+		TWorkerContext &operator=(const TWorkerContext&);
+	} TWorkerContext;
+
+	TListDiskDrives					&_rDrives;
+	TFleetOptions					_sOptions;
+	CCredentialCache				*_pCredentialCache;
+	std::vector<TFleetResult>		_vResults;
+	std::vector<TWorkerContext*>	_vContexts;				// Parallel to _vResults, NULL once released
+	std::map<short, HANDLE>			_mapBusSemaphores;		// SCSIPort -> concurrency semaphore
+	unsigned __int64				_nStartUs;
+	unsigned __int64				_nDeadlineUs;
+	unsigned __int64				_nWallUs;
+
+	static unsigned __int64 RemainingUs(unsigned __int64 nDeadlineUs)
+	{
+		unsigned __int64 nNow = ::PerfCounterMicroseconds();
+		return ((nNow < nDeadlineUs) ? (nDeadlineUs - nNow) : 0);
+	}
+
+	static unsigned __stdcall Worker(void *pvContext)
+	{
+		TWorkerContext *pContext = reinterpret_cast<TWorkerContext*>(pvContext);
+		RunDrive(*pContext);
+		pContext->Release();
+		return 0;
+	}
+
+	static void RunDrive(TWorkerContext &rContext)
+	{
+		TRACE(L"CFleetLocking::RunDrive\n");
+		unsigned __int64 nQueued = ::PerfCounterMicroseconds();
+
+		if (rContext.hBus)
+		{
+			if (::WaitForSingleObject(rContext.hBus, (DWORD)(RemainingUs(rContext.nDeadlineUs) / 1000)) != WAIT_OBJECT_0)
+			{
+				rContext.eOutcome = eFleetTimedOut;
+				rContext.bstrError = L"Deadline passed awaiting the host adapter.";
+				return;
+			}
+		}
+
+		unsigned __int64 nStart = ::PerfCounterMicroseconds();
+		rContext.nQueuedUs = nStart - nQueued;
+		if (RemainingUs(rContext.nDeadlineUs) == 0)
+		{
+			rContext.eOutcome = eFleetTimedOut;
+			rContext.bstrError = L"Deadline passed before the session started.";
+		}
+		else
+		{
+			rContext.eOutcome = RunSessionSequence(rContext, rContext.bstrError) ? eFleetSucceeded : eFleetFailed;
+			if ((rContext.eOutcome == eFleetFailed) && (RemainingUs(rContext.nDeadlineUs) == 0))
+				rContext.eOutcome = eFleetTimedOut;
+		}
+		rContext.nElapsedUs = ::PerfCounterMicroseconds() - nStart;
+		::TraceEvent(eTraceFleetDrive, rContext.pDisk->TraceId(), rContext.eOperation, rContext.eOutcome,
+					 (unsigned int)(rContext.nQueuedUs / 1000), (unsigned int)(rContext.nElapsedUs / 1000));
+
+		if (rContext.hBus)
+			::ReleaseSemaphore(rContext.hBus, 1, NULL);
+	}
+
+	// Each step fails without reaching the drive once the deadline has passed, and the session is
+	// then dropped without End Session (see CTcgSession::SetDeadline).
+	static bool RunSessionSequence(TWorkerContext &rContext, _bstr_t &rbstrErrorInfo)
+	{
+		CTcgSession<IBusInterface> session(*rContext.pDisk);
+		CTcgTableBatch<IBusInterface> batch;
+		unsigned __int64 nLocked = (rContext.eOperation == eFleetLock) ? 1 : 0;
+
+		const BYTE *pbyPin = rContext.vPin.empty() ? NULL : &rContext.vPin[0];
+		unsigned int nPin = (unsigned int)rContext.vPin.size();
+
+		session.SetDeadline(rContext.nDeadlineUs);
+		if ((!session.ExchangeProperties(rbstrErrorInfo)) ||
+			(!session.Start(rbstrErrorInfo, TCG_UID_LOCKINGSP, true, rContext.uidAuthority, pbyPin, nPin)))
+			return false;
+
+		batch.SetColumn(TCG_UID_LOCKING_GLOBALRANGE, TCG_LOCKING_COL_READLOCKED, nLocked);
+		batch.SetColumn(TCG_UID_LOCKING_GLOBALRANGE, TCG_LOCKING_COL_WRITELOCKED, nLocked);
+		for (unsigned int n = 1; n <= rContext.nRanges; n++)
+		{
+			batch.SetColumn(TCG_UID_LOCKING_RANGE1 + (n - 1), TCG_LOCKING_COL_READLOCKED, nLocked);
+			batch.SetColumn(TCG_UID_LOCKING_RANGE1 + (n - 1), TCG_LOCKING_COL_WRITELOCKED, nLocked);
+		}
+		if (!batch.Execute(rbstrErrorInfo, session))
+			return false;
+
+		for (size_t i = 0; i < batch.Count(); i++)
+		{
+			if (!batch.Result(i).Succeeded())
+			{
+				rbstrErrorInfo = ::BuildMessage(L"Set ReadLocked/WriteLocked failed, status 0x%02X.", batch.Result(i).byStatus);
+				return false;
+			}
+		}
+		return session.End(rbstrErrorInfo);
+	}
+
+	// A worker's context, holding its own copies of the drive reference, semaphore and PIN.
+	TWorkerContext *CreateContext(TFleetResult &rResult)
+	{
+		TWorkerContext *pContext = new TWorkerContext(rResult.pDisk);
+
+		pContext->eOperation = _sOptions.eOperation;
+		pContext->uidAuthority = _sOptions.uidAuthority;
+		pContext->nRanges = _sOptions.nRanges;
+		pContext->nDeadlineUs = _nDeadlineUs;
+		if (_sOptions.nPinIterations > 0)
+			pContext->vPin.assign(rResult.abyPin, rResult.abyPin + CREDENTIAL_KEY_LENGTH);
+		else
+			pContext->vPin = _sOptions.vPin;
+		if (_sOptions.nMaxPerBus > 0)
+			::DuplicateHandle(::GetCurrentProcess(), _mapBusSemaphores[rResult.pDisk->SCSIPort()],
+							  ::GetCurrentProcess(), &pContext->hBus, 0, FALSE, DUPLICATE_SAME_ACCESS);
+		return pContext;
+	}
+
+	bool DerivePins(_bstr_t &rbstrErrorInfo)
+	{
+		TRACE(L"CFleetLocking::DerivePins\n");
+		std::vector<_bstr_t> vSerials;
+		std::vector<const BYTE*> vSalts;
+		std::vector<unsigned int> vSaltLengths;
+		std::vector<size_t> vIndex;
+		std::vector<BYTE> vKeys;
+		bool bres = true;
+
+		for (size_t i = 0; i < _vResults.size(); i++)
+		{
+			if (_vResults[i].eOutcome == eFleetNotTrusted)
+				continue;
+			vSerials.push_back(_vResults[i].pDisk->SerialNo());
+			vIndex.push_back(i);
+		}
+		if (vIndex.empty())
+			return true;
+		for (size_t i = 0; i < vSerials.size(); i++)
+		{
+			const char *pszSerial = (const char*)vSerials[i];
+			vSalts.push_back((const BYTE*)pszSerial);
+			vSaltLengths.push_back((unsigned int)strlen(pszSerial));
+		}
+
+		vKeys.resize(vIndex.size() * CREDENTIAL_KEY_LENGTH);
+		bres = _pCredentialCache->DeriveKeys(rbstrErrorInfo, &_sOptions.vPin[0], (unsigned int)_sOptions.vPin.size(),
+											 _sOptions.nPinIterations, vIndex.size(), &vSalts[0], &vSaltLengths[0],
+											 (BYTE (*)[CREDENTIAL_KEY_LENGTH])&vKeys[0]);
+		if (bres)
+			for (size_t i = 0; i < vIndex.size(); i++)
+				memcpy(_vResults[vIndex[i]].abyPin, &vKeys[i * CREDENTIAL_KEY_LENGTH], CREDENTIAL_KEY_LENGTH);
+		::SecureZeroMemory(&vKeys[0], vKeys.size());
+		return bres;
+	}
+
+  public:
+	CFleetLocking(TListDiskDrives &rDrives, const TFleetOptions &rOptions, CCredentialCache *pCredentialCache = NULL) :
+		_rDrives(rDrives), _sOptions(rOptions), _pCredentialCache(pCredentialCache), _nStartUs(0), _nDeadlineUs(0), _nWallUs(0)
+	{
+	}
+
+	~CFleetLocking()
+	{
+		std::map<short, HANDLE>::iterator iter;
+		for (iter = _mapBusSemaphores.begin(); iter != _mapBusSemaphores.end(); iter++)
+			::CloseHandle(iter->second);
+		for (size_t i = 0; i < _vResults.size(); i++)
+		{
+			if (_vResults[i].hThread)
+				::CloseHandle(_vResults[i].hThread);
+			if (_vContexts[i])
+				_vContexts[i]->Release();
+			::SecureZeroMemory(_vResults[i].abyPin, sizeof(_vResults[i].abyPin));
+		}
+		if (!_sOptions.vPin.empty())
+			::SecureZeroMemory(&_sOptions.vPin[0], _sOptions.vPin.size());
+	}
+
+	// Run the operation on all trusted drives and wait for every worker to finish, be cancelled,
+	// or be given up on as timed out.
+	bool Run(_bstr_t &rbstrErrorInfo)
+	{
+		TRACE(L"CFleetLocking::Run\n");
+		_nStartUs = ::PerfCounterMicroseconds();
+		_nDeadlineUs = _nStartUs + ((unsigned __int64)_sOptions.dwDeadlineMs * 1000);
+
+		_vResults.assign(_rDrives.size(), TFleetResult());
+		_vContexts.assign(_rDrives.size(), NULL);
+		for (size_t i = 0; i < _rDrives.size(); i++)
+		{
+			_vResults[i].pDisk = _rDrives[i];
+			if (!_rDrives[i]->IsDriveTrustCapable())
+				_vResults[i].eOutcome = eFleetNotTrusted;
+			else if ((_sOptions.nMaxPerBus > 0) && (_mapBusSemaphores.find(_rDrives[i]->SCSIPort()) == _mapBusSemaphores.end()))
+				_mapBusSemaphores[_rDrives[i]->SCSIPort()] = ::CreateSemaphore(NULL, _sOptions.nMaxPerBus, _sOptions.nMaxPerBus, NULL);
+		}
+
+		if (_sOptions.nPinIterations > 0)
+		{
+			if ((!_pCredentialCache) || (_sOptions.vPin.empty()))
+			{
+				rbstrErrorInfo = L"CFleetLocking::Run : PIN derivation requires a credential and a credential cache.";
+				return false;
+			}
+			if (!DerivePins(rbstrErrorInfo))
+				return false;
+		}
+
+		for (size_t i = 0; i < _vResults.size(); i++)
+		{
+			if (_vResults[i].eOutcome == eFleetNotTrusted)
+				continue;
+			_vContexts[i] = CreateContext(_vResults[i]);
+			::SecureZeroMemory(_vResults[i].abyPin, sizeof(_vResults[i].abyPin));
+			_vResults[i].hThread = (HANDLE)::_beginthreadex(NULL, 0, Worker, _vContexts[i], 0, NULL);
+			if (!_vResults[i].hThread)
+			{
+				_vResults[i].eOutcome = eFleetFailed;
+				TranslateErrorCode(::GetLastError(), _vResults[i].bstrError);
+				_vContexts[i]->Release();		// The worker's reference
+			}
+		}
+
+		// Wait out the deadline, then cancel whatever device IO remains outstanding.
+		for (size_t i = 0; i < _vResults.size(); i++)
+		{
+			if (!_vResults[i].hThread)
+				continue;
+			if (::WaitForSingleObject(_vResults[i].hThread, (DWORD)(RemainingUs(_nDeadlineUs) / 1000)) == WAIT_TIMEOUT)
+				::CancelSynchronousIo(_vResults[i].hThread);
+		}
+
+		// Collect the results, giving cancelled IO a moment to unwind.  A worker still running
+		// after that is reported as timed out and keeps its context.
+		unsigned __int64 nGraceUs = ::PerfCounterMicroseconds();
+		nGraceUs = ((nGraceUs > _nDeadlineUs) ? nGraceUs : _nDeadlineUs) + (FLEET_CANCEL_GRACE_MS * 1000);
+		for (size_t i = 0; i < _vResults.size(); i++)
+		{
+			if (!_vContexts[i])
+				continue;
+			if (_vResults[i].hThread)
+			{
+				if (::WaitForSingleObject(_vResults[i].hThread, (DWORD)(RemainingUs(nGraceUs) / 1000)) == WAIT_OBJECT_0)
+				{
+					_vResults[i].eOutcome = _vContexts[i]->eOutcome;
+					_vResults[i].bstrError = _vContexts[i]->bstrError;
+					_vResults[i].nQueuedUs = _vContexts[i]->nQueuedUs;
+					_vResults[i].nElapsedUs = _vContexts[i]->nElapsedUs;
+				}
+				else
+				{
+					_vResults[i].eOutcome = eFleetTimedOut;
+					_vResults[i].bstrError = L"Still running at the deadline, its device IO cancelled.";
+					_vResults[i].nElapsedUs = ::PerfCounterMicroseconds() - _nStartUs;
+				}
+			}
+			_vContexts[i]->Release();
+			_vContexts[i] = NULL;
+		}
+
+		_nWallUs = ::PerfCounterMicroseconds() - _nStartUs;
+		for (size_t i = 0; i < _vResults.size(); i++)
+		{
+			if ((_vResults[i].eOutcome != eFleetSucceeded) && (_vResults[i].eOutcome != eFleetNotTrusted))
+			{
+				rbstrErrorInfo = L"One or more drives failed, see the fleet report.";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Display the consolidated report.
+	void Report(void)
+	{
+		static const wchar_t *pszOutcome[] = { L"Pending", L"Succeeded", L"Failed", L"TimedOut", L"NotTrusted" };
+		unsigned __int64 nSlowestUs = 0;
+		unsigned __int64 nSumUs = 0;
+		unsigned int nCount[5] = { 0, 0, 0, 0, 0 };
+
+		DisplayMessage(L"\n%ws report:\n", (_sOptions.eOperation == eFleetLock) ? L"Lock" : L"Unlock");
+		for (size_t i = 0; i < _vResults.size(); i++)
+		{
+			const TFleetResult &rResult = _vResults[i];
+			nCount[rResult.eOutcome]++;
+			nSumUs += rResult.nElapsedUs;
+			if (rResult.nElapsedUs > nSlowestUs)
+				nSlowestUs = rResult.nElapsedUs;
+			DisplayMessage(L"\t%ws\tPort=%d\t%ws\t%I64u ms (queued %I64u ms)\t%ws\n",
+						   (const wchar_t*)rResult.pDisk->Name(), rResult.pDisk->SCSIPort(), pszOutcome[rResult.eOutcome],
+						   rResult.nElapsedUs / 1000, rResult.nQueuedUs / 1000, (const wchar_t*)rResult.bstrError);
+		}
+		DisplayMessage(L"\tSucceeded=%u Failed=%u TimedOut=%u NotTrusted=%u\n"
+					   L"\tWall=%I64u ms  Slowest=%I64u ms  SerialSum=%I64u ms\n",
+					   nCount[eFleetSucceeded], nCount[eFleetFailed], nCount[eFleetTimedOut], nCount[eFleetNotTrusted],
+					   _nWallUs / 1000, nSlowestUs / 1000, nSumUs / 1000);
+	}
+
+	inline const std::vector<TFleetResult> &Results(void) const
+		{ return _vResults; }
+};	// CFleetLocking
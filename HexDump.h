@@ -0,0 +1,174 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+
+//  Hex dumps (e.g. Trusted Receive buffers, recorded sessions), 16 bytes per fixed width line :
+//
+//		00000010  54 43 47 20 43 6F 6D 50 61 63 6B 65 74 00 00 00  TCG ComPacket...
+//
+//  HexDumpFormat lays out a whole buffer into a caller's buffer of HexDumpSize characters.  Each
+//  line starts from a blank template; its offset, hex pairs and printable column are then stored
+//  from 256 entry tables, so that no formatting call is made per byte or per line.  A short last
+//  line is padded with spaces.  CHexDumpStream dumps a payload of any size as a sequence of
+//  writes, each of HEXDUMP_STREAM_LINES lines, carrying a part line from one write to the next.
+//  Offsets beyond 4 GB show their low 32 bits.
+//
+
+#define HEXDUMP_LINE_BYTES			16
+#define HEXDUMP_LINE_SIZE			76			// Characters, including the newline
+#define HEXDUMP_HEX_COLUMN			10
+#define HEXDUMP_TEXT_COLUMN			59
+#define HEXDUMP_STREAM_LINES		1024		// Lines per fwrite of CHexDumpStream (76 KB)
+
+class CHexDumpTables
+{
+  public:
+	char	aachHex[256][2];				// Byte -> two hex digits
+	char	achText[256];					// Byte -> itself if printable ASCII, else '.'
+	char	achBlankLine[HEXDUMP_LINE_SIZE];
+
+	CHexDumpTables(void)
+	{
+		static const char s_szDigits[] = "0123456789ABCDEF";
+		for (unsigned int i = 0; i < 256; i++)
+		{
+			aachHex[i][0] = s_szDigits[i >> 4];
+			aachHex[i][1] = s_szDigits[i & 0xF];
+			achText[i] = ((i >= 0x20) && (i < 0x7F)) ? (char)i : '.';
+		}
+		::memset(achBlankLine, ' ', sizeof(achBlankLine));
+		achBlankLine[HEXDUMP_LINE_SIZE - 1] = '\n';
+	}
+};
+
+inline const CHexDumpTables &HexDumpTables(void)
+{
+	static const CHexDumpTables s_tables;
+	return s_tables;
+}
+
+// Characters HexDumpFormat writes for nLength bytes.
+inline size_t HexDumpSize(size_t nLength)
+{
+	return ((nLength + HEXDUMP_LINE_BYTES - 1) / HEXDUMP_LINE_BYTES) * HEXDUMP_LINE_SIZE;
+}
+
+// Format nLength bytes, the first at offset nOffset, into pchDest (not NUL terminated); the
+// characters written, 0 if nDestSize is less than HexDumpSize(nLength).
+inline size_t HexDumpFormat(char *pchDest, size_t nDestSize, const BYTE *pBuffer, size_t nLength, unsigned __int64 nOffset = 0)
+{
+	const CHexDumpTables &rTables = HexDumpTables();
+	size_t nSize = HexDumpSize(nLength);
+	char *pchLine = pchDest;
+
+	if (nDestSize < nSize)
+		return 0;
+	for (size_t nDone = 0; nDone < nLength; nDone += HEXDUMP_LINE_BYTES, pchLine += HEXDUMP_LINE_SIZE)
+	{
+		const BYTE *pbyLine = pBuffer + nDone;
+		size_t nBytes = ((nLength - nDone) < HEXDUMP_LINE_BYTES) ? (nLength - nDone) : HEXDUMP_LINE_BYTES;
+		unsigned int nLineOffset = (unsigned int)(nOffset + nDone);
+
+		::memcpy(pchLine, rTables.achBlankLine, HEXDUMP_LINE_SIZE);
+		::memcpy(pchLine + 0, rTables.aachHex[(nLineOffset >> 24) & 0xFF], 2);
+		::memcpy(pchLine + 2, rTables.aachHex[(nLineOffset >> 16) & 0xFF], 2);
+		::memcpy(pchLine + 4, rTables.aachHex[(nLineOffset >> 8) & 0xFF], 2);
+		::memcpy(pchLine + 6, rTables.aachHex[nLineOffset & 0xFF], 2);
+		for (size_t i = 0; i < nBytes; i++)
+		{
+			::memcpy(pchLine + HEXDUMP_HEX_COLUMN + (i * 3), rTables.aachHex[pbyLine[i]], 2);
+			pchLine[HEXDUMP_TEXT_COLUMN + i] = rTables.achText[pbyLine[i]];
+		}
+	}
+	return nSize;
+}
+
+
+//  Dumps a payload to a file in writes of HEXDUMP_STREAM_LINES lines, e.g.
+//
+//		CHexDumpStream dump(pFile);
+//		while (...)
+//			dump.Write(pbyChunk, nChunk);
+//		bool bWritten = dump.End();
+//
+class CHexDumpStream
+{
+  private:
+	FILE				*_pFile;
+	std::vector<char>	_vText;
+	size_t				_nText;					// Characters pending in _vText
+	BYTE				_abyCarry[HEXDUMP_LINE_BYTES];
+	size_t				_nCarry;				// Bytes of a part line, awaiting the rest
+	unsigned __int64	_nOffset;				// Of the first byte not yet formatted
+	bool				_bWritten;				// No write has failed
+
+	void Format(const BYTE *pBuffer, size_t nLength)
+	{
+		_nText += ::HexDumpFormat(&_vText[_nText], _vText.size() - _nText, pBuffer, nLength, _nOffset);
+		_nOffset += nLength;
+		if (_nText == _vText.size())
+			Flush();
+	}
+
+	void Flush(void)
+	{
+		if ((_nText) && (::fwrite(&_vText[0], 1, _nText, _pFile) != _nText))
+			_bWritten = false;
+		_nText = 0;
+	}
+
+	CHexDumpStream(const CHexDumpStream&);
+	CHexDumpStream &operator=(const CHexDumpStream&);
+
+  public:
+	CHexDumpStream(FILE *pFile, unsigned __int64 nOffset = 0) : _pFile(pFile), _vText(HEXDUMP_STREAM_LINES * HEXDUMP_LINE_SIZE),
+																_nText(0), _nCarry(0), _nOffset(nOffset), _bWritten(true)
+	{
+	}
+
+	void Write(const BYTE *pBuffer, size_t nLength)
+	{
+		// Complete a carried part line first.
+		if (_nCarry)
+		{
+			size_t nTake = ((HEXDUMP_LINE_BYTES - _nCarry) < nLength) ? (HEXDUMP_LINE_BYTES - _nCarry) : nLength;
+			::memcpy(_abyCarry + _nCarry, pBuffer, nTake);
+			_nCarry += nTake;
+			pBuffer += nTake;
+			nLength -= nTake;
+			if (_nCarry < HEXDUMP_LINE_BYTES)
+				return;
+			Format(_abyCarry, HEXDUMP_LINE_BYTES);
+			_nCarry = 0;
+		}
+
+		// Whole lines, as many as fit the text buffer at a time.
+		while (nLength >= HEXDUMP_LINE_BYTES)
+		{
+			size_t nLines = (_vText.size() - _nText) / HEXDUMP_LINE_SIZE;
+			size_t nBytes = ((nLength / HEXDUMP_LINE_BYTES) < nLines) ? (nLength - (nLength % HEXDUMP_LINE_BYTES)) : (nLines * HEXDUMP_LINE_BYTES);
+			Format(pBuffer, nBytes);
+			pBuffer += nBytes;
+			nLength -= nBytes;
+		}
+		::memcpy(_abyCarry, pBuffer, nLength);
+		_nCarry = nLength;
+	}
+
+	// Write any part line and the pending text; false if any write failed.
+	bool End(void)
+	{
+		if (_nCarry)
+			Format(_abyCarry, _nCarry);
+		_nCarry = 0;
+		Flush();
+		return ((_bWritten) && (::fflush(_pFile) == 0));
+	}
+};	// CHexDumpStream
@@ -0,0 +1,329 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "AtaIdentifySector.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+
+//  Identify archives : a history of Identify Sectors stored as sparse differences.  Drives of one
+//  model and firmware report nearly identical sectors, differing mainly in the serial number,
+//  world wide name, integrity checksum and a few counters.  The first sector archived for each
+//  (model, firmware) pair becomes that pair's baseline; each sector is then recorded as the words
+//  in which it differs from its baseline.
+//
+//		TArchiveHeader			64 bytes : magic, version, counts and offsets
+//		baselines				nBaselines * 512 bytes
+//		records					nRecords variable length records, in the order added :
+//
+//			unsigned __int32	nBaseline		Baseline index
+//			unsigned __int16	nChanged		Words differing, ARCHIVE_RAW_RECORD if stored whole
+//			unsigned __int8		[nChanged]		Word indices (0-255), ascending
+//			unsigned __int16	[nChanged]		Word values
+//
+//  A record of more than ARCHIVE_MAX_CHANGED words (i.e. where the indices would cost more than
+//  they save) holds the 512 byte sector itself.  A typical record is some 30 bytes against 512.
+//
+//  Records are differenced with AtaSectorDiff (see AtaIdentifySector.h).  Patching copies the
+//  baseline, then stores the few changed words.  Archives are written whole; the reader maps the
+//  file and decodes records in sequence (see CIdentifyArchiveReader::Next, and -v).
+//
+
+#define ARCHIVE_MAGIC				"IDARCH01"
+#define ARCHIVE_VERSION				1
+#define ARCHIVE_SECTOR_WORDS		(ATA_DISK_SECTOR_SIZE / 2)
+#define ARCHIVE_RAW_RECORD			0xFFFF
+#define ARCHIVE_MAX_CHANGED			((ATA_DISK_SECTOR_SIZE / 3) - 2)	// Words, beyond which a record is raw
+#define ARCHIVE_RECORD_HEADER		6				// Bytes, nBaseline and nChanged
+
+#pragma pack(push,1)
+typedef struct TArchiveHeader
+{
+	char				szMagic[8];				// ARCHIVE_MAGIC, unterminated
+	unsigned __int32	nVersion;
+	unsigned __int32	nBaselines;
+	unsigned __int64	nRecords;
+	unsigned __int64	nBaselineOffset;		// From the start of the file
+	unsigned __int64	nRecordOffset;			// ""
+	unsigned __int64	nRecordBytes;
+	unsigned char		abyReserved[16];
+} TArchiveHeader;
+#pragma pack(pop)
+
+
+//  Accumulates sectors as baselines and difference records, then writes the archive.
+class CIdentifyArchiveWriter
+{
+  private:
+	typedef std::unordered_map<std::string, unsigned int>	TBaselineIndex;
+
+	std::vector<TAtaDiskIdentifySector>	_vBaselines;
+	TBaselineIndex						_mapBaselines;		// Model NUL firmware -> baseline index
+	std::vector<BYTE>					_vRecords;
+	unsigned __int64					_nRecords;
+	unsigned __int64					_nRawRecords;
+
+	CIdentifyArchiveWriter(const CIdentifyArchiveWriter&);
+	CIdentifyArchiveWriter &operator=(const CIdentifyArchiveWriter&);
+
+  public:
+	CIdentifyArchiveWriter(void) : _nRecords(0), _nRawRecords(0) {}
+
+	void Add(const TAtaDiskIdentifySector &rSector)
+	{
+		char szModel[sizeof(rSector.pszModelNumber) + 1];
+		char szFirmware[sizeof(rSector.pszFirmwareRev) + 1];
+		unsigned __int16 awMask[ARCHIVE_SECTOR_WORDS / 16];
+		const unsigned __int16 *pwSector = (const unsigned __int16*)&rSector;
+
+		AtaStringDecode((const unsigned char*)rSector.pszModelNumber, sizeof(rSector.pszModelNumber), szModel);
+		AtaStringDecode((const unsigned char*)rSector.pszFirmwareRev, sizeof(rSector.pszFirmwareRev), szFirmware);
+		std::string strKey = std::string(szModel) + '\0' + szFirmware;
+
+		TBaselineIndex::const_iterator iter = _mapBaselines.find(strKey);
+		unsigned int nBaseline = (iter != _mapBaselines.end()) ? iter->second : (unsigned int)_vBaselines.size();
+		if (iter == _mapBaselines.end())
+		{
+			_mapBaselines[strKey] = nBaseline;
+			_vBaselines.push_back(rSector);
+		}
+
+		unsigned int nChanged = AtaSectorDiff(pwSector, (const unsigned __int16*)&_vBaselines[nBaseline], awMask);
+		unsigned __int16 nStored = (nChanged > ARCHIVE_MAX_CHANGED) ? ARCHIVE_RAW_RECORD : (unsigned __int16)nChanged;
+		size_t nAt = _vRecords.size();
+
+		_vRecords.resize(nAt + ARCHIVE_RECORD_HEADER + ((nStored == ARCHIVE_RAW_RECORD) ? sizeof(rSector) : (nChanged * 3)));
+		::memcpy(&_vRecords[nAt], &nBaseline, sizeof(nBaseline));
+		::memcpy(&_vRecords[nAt + 4], &nStored, sizeof(nStored));
+		nAt += ARCHIVE_RECORD_HEADER;
+		if (nStored == ARCHIVE_RAW_RECORD)
+		{
+			::memcpy(&_vRecords[nAt], &rSector, sizeof(rSector));
+			_nRawRecords++;
+		}
+		else
+		{
+			BYTE *pbyIndices = &_vRecords[nAt];
+			BYTE *pbyValues = pbyIndices + nChanged;
+			for (unsigned int g = 0; g < (ARCHIVE_SECTOR_WORDS / 16); g++)
+				for (unsigned int nMask = awMask[g]; nMask; nMask &= (nMask - 1))
+				{
+					unsigned long nBit = 0;
+					::_BitScanForward(&nBit, nMask);
+					unsigned int nWord = (g * 16) + nBit;
+					*pbyIndices++ = (BYTE)nWord;
+					::memcpy(pbyValues, &pwSector[nWord], sizeof(unsigned __int16));
+					pbyValues += sizeof(unsigned __int16);
+				}
+		}
+		_nRecords++;
+	}
+
+	inline unsigned __int64 Count(void) const
+		{ return _nRecords; }
+
+	inline size_t Baselines(void) const
+		{ return _vBaselines.size(); }
+
+	// Bytes the archive will occupy, against Count() * 512 undifferenced.
+	inline unsigned __int64 ArchiveBytes(void) const
+		{ return sizeof(TArchiveHeader) + (_vBaselines.size() * sizeof(TAtaDiskIdentifySector)) + _vRecords.size(); }
+
+	bool Write(_bstr_t &rbstrErrorInfo, const wchar_t *pszPath) const
+	{
+		TRACE(L"CIdentifyArchiveWriter::Write\n");
+		TArchiveHeader sHeader;
+		HANDLE hFile = INVALID_HANDLE_VALUE;
+		const BYTE *apbyParts[3];
+		unsigned __int64 anLengths[3];
+		bool bres = false;
+
+		::ZeroMemory(&sHeader, sizeof(sHeader));
+		::memcpy(sHeader.szMagic, ARCHIVE_MAGIC, sizeof(sHeader.szMagic));
+		sHeader.nVersion = ARCHIVE_VERSION;
+		sHeader.nBaselines = (unsigned __int32)_vBaselines.size();
+		sHeader.nRecords = _nRecords;
+		sHeader.nBaselineOffset = sizeof(TArchiveHeader);
+		sHeader.nRecordOffset = sHeader.nBaselineOffset + (_vBaselines.size() * sizeof(TAtaDiskIdentifySector));
+		sHeader.nRecordBytes = _vRecords.size();
+
+		apbyParts[0] = (const BYTE*)&sHeader;
+		anLengths[0] = sizeof(sHeader);
+		apbyParts[1] = (_vBaselines.empty()) ? NULL : (const BYTE*)&_vBaselines[0];
+		anLengths[1] = _vBaselines.size() * sizeof(TAtaDiskIdentifySector);
+		apbyParts[2] = (_vRecords.empty()) ? NULL : &_vRecords[0];
+		anLengths[2] = _vRecords.size();
+
+		hFile = ::CreateFile(pszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			goto CleanUp;
+		}
+		for (int i = 0; i < 3; i++)
+			for (unsigned __int64 nDone = 0; nDone < anLengths[i]; )
+			{
+				DWORD dwThis = ((anLengths[i] - nDone) < 0x1000000) ? (DWORD)(anLengths[i] - nDone) : 0x1000000;
+				DWORD dwWritten = 0;
+				if ((!::WriteFile(hFile, apbyParts[i] + nDone, dwThis, &dwWritten, NULL)) || (dwWritten != dwThis))
+				{
+					TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+					goto CleanUp;
+				}
+				nDone += dwThis;
+			}
+		bres = true;
+
+	CleanUp:
+		if (hFile != INVALID_HANDLE_VALUE)
+			::CloseHandle(hFile);
+		if (!bres)
+			rbstrErrorInfo = ::BuildMessage(L"CIdentifyArchiveWriter : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+		return bres;
+	}
+};	// CIdentifyArchiveWriter
+
+
+//  Maps an archive read-only and decodes its records in sequence.
+class CIdentifyArchiveReader
+{
+  private:
+	HANDLE					_hFile;
+	HANDLE					_hMapping;
+	const BYTE				*_pbyView;
+	const TArchiveHeader	*_pHeader;
+	const BYTE				*_pbyNext;				// Next record
+	const BYTE				*_pbyEnd;				// End of the records
+	unsigned __int64		_nNext;					// Index of the next record
+
+	CIdentifyArchiveReader(const CIdentifyArchiveReader&);
+	CIdentifyArchiveReader &operator=(const CIdentifyArchiveReader&);
+
+  public:
+	CIdentifyArchiveReader(void) : _hFile(INVALID_HANDLE_VALUE), _hMapping(NULL), _pbyView(NULL), _pHeader(NULL),
+								   _pbyNext(NULL), _pbyEnd(NULL), _nNext(0)
+	{
+	}
+
+	~CIdentifyArchiveReader()
+	{
+		Close();
+	}
+
+	bool Open(_bstr_t &rbstrErrorInfo, const wchar_t *pszPath)
+	{
+		TRACE(L"CIdentifyArchiveReader::Open\n");
+		LARGE_INTEGER liSize = { 0 };
+		unsigned __int64 nSize = 0;
+
+		Close();
+		_hFile = ::CreateFile(pszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if ((_hFile == INVALID_HANDLE_VALUE) || (!::GetFileSizeEx(_hFile, &liSize)) || ((unsigned __int64)liSize.QuadPart > (SIZE_T)-1))
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			goto CleanUp;
+		}
+		if (liSize.QuadPart == 0)
+		{
+			rbstrErrorInfo = L"Not an identify archive, or truncated.";
+			goto CleanUp;
+		}
+		nSize = (unsigned __int64)liSize.QuadPart;
+		_hMapping = ::CreateFileMapping(_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (_hMapping)
+			_pbyView = (const BYTE*)::MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (!_pbyView)
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			goto CleanUp;
+		}
+
+		_pHeader = (const TArchiveHeader*)_pbyView;
+		if ((nSize < sizeof(TArchiveHeader)) || (::memcmp(_pHeader->szMagic, ARCHIVE_MAGIC, sizeof(_pHeader->szMagic)) != 0) ||
+			(_pHeader->nVersion != ARCHIVE_VERSION) || (_pHeader->nBaselineOffset > nSize) ||
+			(((nSize - _pHeader->nBaselineOffset) / sizeof(TAtaDiskIdentifySector)) < _pHeader->nBaselines) ||
+			(_pHeader->nRecordOffset > nSize) || (_pHeader->nRecordBytes > (nSize - _pHeader->nRecordOffset)))
+		{
+			rbstrErrorInfo = L"Not an identify archive, or truncated.";
+			goto CleanUp;
+		}
+		Rewind();
+		return true;
+
+	CleanUp:
+		rbstrErrorInfo = ::BuildMessage(L"CIdentifyArchiveReader : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+		Close();
+		return false;
+	}
+
+	void Close(void)
+	{
+		if (_pbyView)
+			::UnmapViewOfFile(_pbyView);
+		if (_hMapping)
+			::CloseHandle(_hMapping);
+		if (_hFile != INVALID_HANDLE_VALUE)
+			::CloseHandle(_hFile);
+		_hFile = INVALID_HANDLE_VALUE;
+		_hMapping = NULL;
+		_pbyView = NULL;
+		_pHeader = NULL;
+		_pbyNext = _pbyEnd = NULL;
+		_nNext = 0;
+	}
+
+	inline unsigned __int64 Count(void) const
+		{ return (_pHeader) ? _pHeader->nRecords : 0; }
+
+	inline unsigned int Baselines(void) const
+		{ return (_pHeader) ? _pHeader->nBaselines : 0; }
+
+	inline void Rewind(void)
+	{
+		_pbyNext = (_pHeader) ? (_pbyView + _pHeader->nRecordOffset) : NULL;
+		_pbyEnd = (_pHeader) ? (_pbyNext + _pHeader->nRecordBytes) : NULL;
+		_nNext = 0;
+	}
+
+	// Decode the next record into rSector; false once all are decoded, or if a record is malformed
+	// (rbstrErrorInfo then set).
+	bool Next(_bstr_t &rbstrErrorInfo, TAtaDiskIdentifySector &rSector)
+	{
+		unsigned __int32 nBaseline = 0;
+		unsigned __int16 nChanged = 0;
+
+		if ((!_pHeader) || (_nNext >= _pHeader->nRecords))
+			return false;
+		if ((size_t)(_pbyEnd - _pbyNext) >= ARCHIVE_RECORD_HEADER)
+		{
+			::memcpy(&nBaseline, _pbyNext, sizeof(nBaseline));
+			::memcpy(&nChanged, _pbyNext + 4, sizeof(nChanged));
+		}
+		size_t nBody = (nChanged == ARCHIVE_RAW_RECORD) ? sizeof(TAtaDiskIdentifySector) : ((size_t)nChanged * 3);
+		if (((size_t)(_pbyEnd - _pbyNext) < (ARCHIVE_RECORD_HEADER + nBody)) || (nBaseline >= _pHeader->nBaselines) ||
+			((nChanged != ARCHIVE_RAW_RECORD) && (nChanged > ARCHIVE_SECTOR_WORDS)))
+		{
+			rbstrErrorInfo = ::BuildMessage(L"CIdentifyArchiveReader : Record %I64u is malformed.", _nNext);
+			_nNext = _pHeader->nRecords;
+			return false;
+		}
+
+		const BYTE *pbyBody = _pbyNext + ARCHIVE_RECORD_HEADER;
+		if (nChanged == ARCHIVE_RAW_RECORD)
+			::memcpy(&rSector, pbyBody, sizeof(rSector));
+		else
+		{
+			unsigned __int16 *pwSector = (unsigned __int16*)&rSector;
+			::memcpy(&rSector, _pbyView + _pHeader->nBaselineOffset + ((size_t)nBaseline * sizeof(TAtaDiskIdentifySector)), sizeof(rSector));
+			for (unsigned int i = 0; i < nChanged; i++)
+				::memcpy(&pwSector[pbyBody[i]], pbyBody + nChanged + (i * 2), sizeof(unsigned __int16));
+		}
+		_pbyNext = pbyBody + nBody;
+		_nNext++;
+		return true;
+	}
+};	// CIdentifyArchiveReader
@@ -0,0 +1,433 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "AtaIdentifySector.h"
+#include <vector>
+
+
+//  Identify snapshot files : the raw Identify Sectors of many drives (e.g. a fleet archive) and
+//  columns decoded from them, laid out so that a reader maps the file and addresses any column
+//  as an array, with no parsing.  Only the pages of the columns actually read are faulted in
+//  (e.g. a capacity survey of a million drives touches 8 MB of the UserSectors column, not the
+//  512 MB of sectors).
+//
+//		TSnapshotHeader			64 bytes : magic, version, drive and column counts
+//		TSnapshotColumn[]		Directory : column id, width (bytes per drive), offset, length
+//		columns					Each nDrives * nWidth bytes, at a SNAPSHOT_ALIGNMENT offset
+//
+//  Strings are NUL padded to their fixed width (i.e. always terminated).  Numbers are little
+//  endian, as stored by x86 and x64.  A reader ignores column ids it does not know, so columns
+//  may be added without a version change; a column's width may only grow.
+//
+
+#define SNAPSHOT_MAGIC				"IDSNAP01"
+#define SNAPSHOT_VERSION			1
+#define SNAPSHOT_ALIGNMENT			64			// Bytes, column offsets (a cache line)
+#define SNAPSHOT_MAX_COLUMNS		64
+#define SNAPSHOT_WRITE_CHUNK		(16 * 1024 * 1024)	// Bytes per WriteFile
+
+enum ESnapshotColumn
+{
+	eSnapColumnSector = 1,				// TAtaDiskIdentifySector, as read from the drive
+	eSnapColumnSerialNo,				// char[21]
+	eSnapColumnModel,					// char[41]
+	eSnapColumnFirmware,				// char[9]
+	eSnapColumnUserSectors,				// unsigned __int64
+	eSnapColumnLogicalSectorSize,		// unsigned int, bytes
+	eSnapColumnWorldWideName,			// unsigned __int64, 0 if absent
+	eSnapColumnCapabilities,			// unsigned int, ESnapshotCapability bits
+	eSnapColumnIntegrity,				// unsigned char, EIdentifyIntegrity
+	eSnapColumnEnd
+};
+
+enum ESnapshotCapability
+{
+	eSnapCapLba48				= 0x0001,
+	eSnapCapNcq					= 0x0002,
+	eSnapCapSmart				= 0x0004,
+	eSnapCapTrim				= 0x0008,
+	eSnapCapSecuritySupported	= 0x0010,
+	eSnapCapSecurityEnabled		= 0x0020,
+	eSnapCapSecurityLocked		= 0x0040,
+	eSnapCapSecurityFrozen		= 0x0080,
+	eSnapCapTrustedComputing	= 0x0100,
+	eSnapCapDriveTrust			= 0x0200,
+	eSnapCapSolidState			= 0x0400,		// See DriveVendors.h
+	eSnapCapFirmwareDefect		= 0x0800,		// ""
+};
+
+#pragma pack(push,1)
+typedef struct TSnapshotHeader
+{
+	char				szMagic[8];				// SNAPSHOT_MAGIC, unterminated
+	unsigned __int32	nVersion;
+	unsigned __int32	nHeaderSize;			// sizeof(TSnapshotHeader)
+	unsigned __int64	nDrives;
+	unsigned __int32	nColumns;				// TSnapshotColumn entries following the header
+	unsigned __int32	nAlignment;				// SNAPSHOT_ALIGNMENT
+	unsigned __int64	nCreated;				// FILETIME (UTC)
+	unsigned char		abyReserved[24];
+} TSnapshotHeader;
+
+typedef struct TSnapshotColumn
+{
+	unsigned __int32	nId;					// ESnapshotColumn
+	unsigned __int32	nWidth;					// Bytes per drive
+	unsigned __int64	nOffset;				// From the start of the file
+	unsigned __int64	nLength;				// nDrives * nWidth
+} TSnapshotColumn;
+#pragma pack(pop)
+
+// The width of each known column, indexed by ESnapshotColumn.
+static const unsigned int s_anSnapshotColumnWidths[eSnapColumnEnd] =
+{
+	0,
+	sizeof(TAtaDiskIdentifySector),
+	sizeof(((TIdentifyStrings*)0)->szSerialNo),
+	sizeof(((TIdentifyStrings*)0)->szModel),
+	sizeof(((TIdentifyStrings*)0)->szFirmware),
+	sizeof(unsigned __int64),
+	sizeof(unsigned int),
+	sizeof(unsigned __int64),
+	sizeof(unsigned int),
+	sizeof(unsigned char),
+};
+
+inline unsigned __int64 SnapshotAlign(unsigned __int64 nOffset)
+	{ return ((nOffset + SNAPSHOT_ALIGNMENT - 1) & ~(unsigned __int64)(SNAPSHOT_ALIGNMENT - 1)); }
+
+
+//  Accumulates Identify Sectors, then decodes and writes them as a snapshot file.
+class CIdentifySnapshotWriter
+{
+  private:
+	std::vector<TAtaDiskIdentifySector>	_vSectors;
+
+	static bool WriteBytes(_bstr_t &rbstrErrorInfo, HANDLE hFile, const BYTE *pbyData, unsigned __int64 nLength)
+	{
+		while (nLength > 0)
+		{
+			DWORD dwThis = (nLength < SNAPSHOT_WRITE_CHUNK) ? (DWORD)nLength : SNAPSHOT_WRITE_CHUNK;
+			DWORD dwWritten = 0;
+			if ((!::WriteFile(hFile, pbyData, dwThis, &dwWritten, NULL)) || (dwWritten != dwThis))
+			{
+				TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+				return false;
+			}
+			pbyData += dwThis;
+			nLength -= dwThis;
+		}
+		return true;
+	}
+
+	// Decode one column of every drive.
+	void BuildColumn(ESnapshotColumn eColumn, const std::vector<TIdentifyStrings> &vStrings, const std::vector<EIdentifyIntegrity> &vIntegrity,
+					 std::vector<BYTE> &rColumn) const
+	{
+		unsigned int nWidth = s_anSnapshotColumnWidths[eColumn];
+
+		rColumn.assign(_vSectors.size() * nWidth, 0);
+		for (size_t n = 0; n < _vSectors.size(); n++)
+		{
+			BYTE *pbyCell = &rColumn[n * nWidth];
+			TDriveCapabilities sCaps;
+			unsigned int nBits = 0;
+
+			switch (eColumn)
+			{
+			case eSnapColumnSerialNo:	::memcpy(pbyCell, vStrings[n].szSerialNo, nWidth);	continue;
+			case eSnapColumnModel:		::memcpy(pbyCell, vStrings[n].szModel, nWidth);		continue;
+			case eSnapColumnFirmware:	::memcpy(pbyCell, vStrings[n].szFirmware, nWidth);	continue;
+			case eSnapColumnIntegrity:	*pbyCell = (BYTE)vIntegrity[n];						continue;
+			default:					break;
+			}
+
+			::ZeroMemory(&sCaps, sizeof(sCaps));
+			sCaps.Decode(_vSectors[n]);
+			if (eColumn == eSnapColumnUserSectors)
+				::memcpy(pbyCell, &sCaps.nUserSectors, nWidth);
+			else if (eColumn == eSnapColumnLogicalSectorSize)
+				::memcpy(pbyCell, &sCaps.nLogicalSectorSize, nWidth);
+			else if (eColumn == eSnapColumnWorldWideName)
+				::memcpy(pbyCell, &sCaps.nWorldWideName, nWidth);
+			else if (eColumn == eSnapColumnCapabilities)
+			{
+				unsigned int nQuirks = ::ClassifyDrive(vStrings[n].szModel, vStrings[n].szFirmware, sCaps.nWorldWideName).nQuirks;
+				nBits = (sCaps.bLba48 ? eSnapCapLba48 : 0) | (sCaps.bNcq ? eSnapCapNcq : 0) | (sCaps.bSmart ? eSnapCapSmart : 0) |
+						(sCaps.bTrim ? eSnapCapTrim : 0) | (sCaps.bSecuritySupported ? eSnapCapSecuritySupported : 0) |
+						(sCaps.bSecurityEnabled ? eSnapCapSecurityEnabled : 0) | (sCaps.bSecurityLocked ? eSnapCapSecurityLocked : 0) |
+						(sCaps.bSecurityFrozen ? eSnapCapSecurityFrozen : 0) | (sCaps.bTrustedComputing ? eSnapCapTrustedComputing : 0) |
+						(sCaps.bDriveTrust ? eSnapCapDriveTrust : 0) | ((nQuirks & eQuirkSolidState) ? eSnapCapSolidState : 0) |
+						((nQuirks & eQuirkFirmwareDefect) ? eSnapCapFirmwareDefect : 0);
+				::memcpy(pbyCell, &nBits, nWidth);
+			}
+		}
+	}
+
+	CIdentifySnapshotWriter(const CIdentifySnapshotWriter&);
+	CIdentifySnapshotWriter &operator=(const CIdentifySnapshotWriter&);
+
+  public:
+	CIdentifySnapshotWriter(void) {}
+
+	inline void Add(const TAtaDiskIdentifySector &rSector)
+		{ _vSectors.push_back(rSector); }
+
+	inline size_t Count(void) const
+		{ return _vSectors.size(); }
+
+	bool Write(_bstr_t &rbstrErrorInfo, const wchar_t *pszPath) const
+	{
+		TRACE(L"CIdentifySnapshotWriter::Write\n");
+		const unsigned int nColumns = eSnapColumnEnd - 1;
+		std::vector<TIdentifyStrings> vStrings(_vSectors.size());
+		std::vector<EIdentifyIntegrity> vIntegrity(_vSectors.size());
+		std::vector<BYTE> vPrefix, vColumn;
+		TSnapshotHeader sHeader;
+		TSnapshotColumn *pDirectory = NULL;
+		HANDLE hFile = INVALID_HANDLE_VALUE;
+		unsigned __int64 nOffset = 0;
+		BYTE abyPadding[SNAPSHOT_ALIGNMENT] = { 0 };
+		bool bres = false;
+
+		// The strings and integrity of every sector in one pass.
+		if (!_vSectors.empty())
+			::AtaStringDecodeBatch(&_vSectors[0], _vSectors.size(), &vStrings[0], &vIntegrity[0]);
+
+		// The header and directory, the column offsets following from the widths.
+		::ZeroMemory(&sHeader, sizeof(sHeader));
+		::memcpy(sHeader.szMagic, SNAPSHOT_MAGIC, sizeof(sHeader.szMagic));
+		sHeader.nVersion = SNAPSHOT_VERSION;
+		sHeader.nHeaderSize = sizeof(TSnapshotHeader);
+		sHeader.nDrives = _vSectors.size();
+		sHeader.nColumns = nColumns;
+		sHeader.nAlignment = SNAPSHOT_ALIGNMENT;
+		::GetSystemTimeAsFileTime((FILETIME*)&sHeader.nCreated);
+
+		vPrefix.assign(sizeof(TSnapshotHeader) + (nColumns * sizeof(TSnapshotColumn)), 0);
+		::memcpy(&vPrefix[0], &sHeader, sizeof(sHeader));
+		pDirectory = (TSnapshotColumn*)&vPrefix[sizeof(TSnapshotHeader)];
+		nOffset = SnapshotAlign(vPrefix.size());
+		for (unsigned int i = 0; i < nColumns; i++)
+		{
+			pDirectory[i].nId = i + 1;
+			pDirectory[i].nWidth = s_anSnapshotColumnWidths[i + 1];
+			pDirectory[i].nOffset = nOffset;
+			pDirectory[i].nLength = (unsigned __int64)_vSectors.size() * pDirectory[i].nWidth;
+			nOffset = SnapshotAlign(nOffset + pDirectory[i].nLength);
+		}
+
+		hFile = ::CreateFile(pszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			goto CleanUp;
+		}
+		if ((!WriteBytes(rbstrErrorInfo, hFile, &vPrefix[0], vPrefix.size())) ||
+			(!WriteBytes(rbstrErrorInfo, hFile, abyPadding, SnapshotAlign(vPrefix.size()) - vPrefix.size())))
+			goto CleanUp;
+
+		// Each column in turn, only one decoded column held at a time.
+		for (unsigned int i = 0; i < nColumns; i++)
+		{
+			const TSnapshotColumn &rColumn = ((const TSnapshotColumn*)&vPrefix[sizeof(TSnapshotHeader)])[i];
+			const BYTE *pbyData = NULL;
+
+			if (rColumn.nId == eSnapColumnSector)
+				pbyData = (_vSectors.empty()) ? abyPadding : (const BYTE*)&_vSectors[0];
+			else
+			{
+				BuildColumn((ESnapshotColumn)rColumn.nId, vStrings, vIntegrity, vColumn);
+				pbyData = (vColumn.empty()) ? abyPadding : &vColumn[0];
+			}
+			if ((!WriteBytes(rbstrErrorInfo, hFile, pbyData, rColumn.nLength)) ||
+				(!WriteBytes(rbstrErrorInfo, hFile, abyPadding, SnapshotAlign(rColumn.nLength) - rColumn.nLength)))
+				goto CleanUp;
+		}
+		bres = true;
+
+	CleanUp:
+		if (hFile != INVALID_HANDLE_VALUE)
+			::CloseHandle(hFile);
+		if (!bres)
+			rbstrErrorInfo = ::BuildMessage(L"CIdentifySnapshotWriter : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+		return bres;
+	}
+};	// CIdentifySnapshotWriter
+
+
+//  Maps a snapshot file read-only and validates its header and directory; each column is then
+//  addressed in place.  A 32 bit process maps at most some 2 GB (i.e. about 3.5 million drives).
+class CIdentifySnapshotReader
+{
+  private:
+	HANDLE					_hFile;
+	HANDLE					_hMapping;
+	const BYTE				*_pbyView;
+	unsigned __int64		_nSize;
+	unsigned __int64		_nDrives;
+	const BYTE				*_apbyColumns[eSnapColumnEnd];		// NULL if absent
+	unsigned int			_anWidths[eSnapColumnEnd];
+
+	bool Validate(_bstr_t &rbstrErrorInfo)
+	{
+		const TSnapshotHeader *pHeader = (const TSnapshotHeader*)_pbyView;
+
+		if (_nSize < sizeof(TSnapshotHeader))
+		{
+			rbstrErrorInfo = L"Empty or truncated snapshot.";
+			return false;
+		}
+		if (::memcmp(pHeader->szMagic, SNAPSHOT_MAGIC, sizeof(pHeader->szMagic)) != 0)
+		{
+			rbstrErrorInfo = L"Not an identify snapshot.";
+			return false;
+		}
+		if ((pHeader->nVersion != SNAPSHOT_VERSION) || (pHeader->nHeaderSize < sizeof(TSnapshotHeader)) ||
+			(pHeader->nColumns > SNAPSHOT_MAX_COLUMNS) ||
+			((pHeader->nHeaderSize + ((unsigned __int64)pHeader->nColumns * sizeof(TSnapshotColumn))) > _nSize))
+		{
+			rbstrErrorInfo = ::BuildMessage(L"Unsupported snapshot version %u or malformed header.", pHeader->nVersion);
+			return false;
+		}
+
+		const TSnapshotColumn *pDirectory = (const TSnapshotColumn*)(_pbyView + pHeader->nHeaderSize);
+		_nDrives = pHeader->nDrives;
+		for (unsigned int i = 0; i < pHeader->nColumns; i++)
+		{
+			const TSnapshotColumn &rColumn = pDirectory[i];
+			if ((rColumn.nId == 0) || (rColumn.nId >= eSnapColumnEnd))
+				continue;								// A later column, unknown here
+			if ((rColumn.nWidth < s_anSnapshotColumnWidths[rColumn.nId]) || (rColumn.nOffset % SNAPSHOT_ALIGNMENT) ||
+				(_nDrives > (_nSize / rColumn.nWidth)) || (rColumn.nLength != (_nDrives * rColumn.nWidth)) ||
+				(rColumn.nOffset > _nSize) || (rColumn.nLength > (_nSize - rColumn.nOffset)))
+			{
+				rbstrErrorInfo = ::BuildMessage(L"Snapshot column %u is malformed or truncated.", rColumn.nId);
+				return false;
+			}
+
+			// The string getters return cells as C strings, so each must hold its terminator.
+			if ((rColumn.nId == eSnapColumnSerialNo) || (rColumn.nId == eSnapColumnModel) || (rColumn.nId == eSnapColumnFirmware))
+			{
+				for (unsigned __int64 n = 0; n < _nDrives; n++)
+				{
+					if (!::memchr(_pbyView + rColumn.nOffset + (n * rColumn.nWidth), '\0', rColumn.nWidth))
+					{
+						rbstrErrorInfo = ::BuildMessage(L"Snapshot column %u, drive %I64u : string not terminated.", rColumn.nId, n);
+						return false;
+					}
+				}
+			}
+			_apbyColumns[rColumn.nId] = _pbyView + rColumn.nOffset;
+			_anWidths[rColumn.nId] = rColumn.nWidth;
+		}
+		return true;
+	}
+
+	CIdentifySnapshotReader(const CIdentifySnapshotReader&);
+	CIdentifySnapshotReader &operator=(const CIdentifySnapshotReader&);
+
+  public:
+	CIdentifySnapshotReader(void) : _hFile(INVALID_HANDLE_VALUE), _hMapping(NULL), _pbyView(NULL), _nSize(0), _nDrives(0)
+	{
+		::ZeroMemory(_apbyColumns, sizeof(_apbyColumns));
+		::ZeroMemory(_anWidths, sizeof(_anWidths));
+	}
+
+	~CIdentifySnapshotReader()
+	{
+		Close();
+	}
+
+	bool Open(_bstr_t &rbstrErrorInfo, const wchar_t *pszPath)
+	{
+		TRACE(L"CIdentifySnapshotReader::Open\n");
+		LARGE_INTEGER liSize = { 0 };
+
+		Close();
+		_hFile = ::CreateFile(pszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if ((_hFile == INVALID_HANDLE_VALUE) || (!::GetFileSizeEx(_hFile, &liSize)) || ((unsigned __int64)liSize.QuadPart > (SIZE_T)-1))
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			goto CleanUp;
+		}
+		if (liSize.QuadPart == 0)
+		{
+			rbstrErrorInfo = L"Empty or truncated snapshot.";
+			goto CleanUp;
+		}
+		_nSize = (unsigned __int64)liSize.QuadPart;
+		_hMapping = ::CreateFileMapping(_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (_hMapping)
+			_pbyView = (const BYTE*)::MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (!_pbyView)
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			goto CleanUp;
+		}
+		if (Validate(rbstrErrorInfo))
+			return true;
+
+	CleanUp:
+		rbstrErrorInfo = ::BuildMessage(L"CIdentifySnapshotReader : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+		Close();
+		return false;
+	}
+
+	void Close(void)
+	{
+		if (_pbyView)
+			::UnmapViewOfFile(_pbyView);
+		if (_hMapping)
+			::CloseHandle(_hMapping);
+		if (_hFile != INVALID_HANDLE_VALUE)
+			::CloseHandle(_hFile);
+		_hFile = INVALID_HANDLE_VALUE;
+		_hMapping = NULL;
+		_pbyView = NULL;
+		_nSize = _nDrives = 0;
+		::ZeroMemory(_apbyColumns, sizeof(_apbyColumns));
+		::ZeroMemory(_anWidths, sizeof(_anWidths));
+	}
+
+	inline unsigned __int64 Count(void) const
+		{ return _nDrives; }
+
+	inline bool HasColumn(ESnapshotColumn eColumn) const
+		{ return (_apbyColumns[eColumn] != NULL); }
+
+	// A column's cell for drive n, NULL if the column is absent.
+	inline const BYTE *Cell(ESnapshotColumn eColumn, unsigned __int64 n) const
+		{ return (_apbyColumns[eColumn]) ? (_apbyColumns[eColumn] + (n * _anWidths[eColumn])) : NULL; }
+
+	// Columns as arrays, NULL if absent; valid while the file is open.
+	inline const TAtaDiskIdentifySector *Sector(unsigned __int64 n) const
+		{ return (const TAtaDiskIdentifySector*)Cell(eSnapColumnSector, n); }
+
+	inline const char *SerialNo(unsigned __int64 n) const
+		{ return (const char*)Cell(eSnapColumnSerialNo, n); }
+
+	inline const char *Model(unsigned __int64 n) const
+		{ return (const char*)Cell(eSnapColumnModel, n); }
+
+	inline const char *Firmware(unsigned __int64 n) const
+		{ return (const char*)Cell(eSnapColumnFirmware, n); }
+
+	inline unsigned __int64 UserSectors(unsigned __int64 n) const
+		{ const BYTE *p = Cell(eSnapColumnUserSectors, n); return (p) ? *(const unsigned __int64*)p : 0; }
+
+	inline unsigned int LogicalSectorSize(unsigned __int64 n) const
+		{ const BYTE *p = Cell(eSnapColumnLogicalSectorSize, n); return (p) ? *(const unsigned int*)p : 0; }
+
+	inline unsigned __int64 WorldWideName(unsigned __int64 n) const
+		{ const BYTE *p = Cell(eSnapColumnWorldWideName, n); return (p) ? *(const unsigned __int64*)p : 0; }
+
+	inline unsigned int Capabilities(unsigned __int64 n) const
+		{ const BYTE *p = Cell(eSnapColumnCapabilities, n); return (p) ? *(const unsigned int*)p : 0; }
+
+	inline EIdentifyIntegrity Integrity(unsigned __int64 n) const
+		{ const BYTE *p = Cell(eSnapColumnIntegrity, n); return (p) ? (EIdentifyIntegrity)*p : eIntegrityNotReported; }
+};	// CIdentifySnapshotReader
@@ -0,0 +1,700 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "DiskDrive.h"
+#include "DiskPlatform.h"
+#include "DriveRegistry.h"
+#include "JsonWriter.h"
+#include <string>
+
+
+//  Resident inventory service (i.e. "daemon mode", option -d).
+//
+//  A one-shot DiskInfo run pays for COM/WMI initialization, enumeration, device opens and an
+//  IDENTIFY per drive.  The CInventoryService class instead keeps the TListDiskDrives list and the
+//  decoded identify data in memory, refreshing it periodically (or on request).  A refresh is
+//  incremental : drives already known by their DeviceID keep their identify data, only newly
+//  attached drives are queried, and departed drives are released.  The rendered inventory text is
+//  cached at refresh time, so a query is answered with a single pipe write.
+//
+//  Given an IDeviceEventSource (see DeviceEvents.h), the service instead applies hotplug events as
+//  they arrive : an added device alone is probed, opened and identified, and a removed device is
+//  dropped, without periodic full scans; should the source fail, periodic refresh resumes.  Drives
+//  are reference counted (see CDiskDrive::AddRef), so a drive obtained through AcquireDrives()
+//  remains valid after its removal from the inventory.
+//
+//  The drives are also registered within a CDriveRegistry (see DriveRegistry.h), so a find
+//  request locates a drive by serial number, world wide name or device path without a scan.
+//
+//  Queries are served over a local named pipe, the Windows analogue of a Unix domain socket;
+//  remote clients are rejected.  A request is one of the INVENTORY_REQUEST_* strings and the
+//  reply is UTF-16 text.  QueryInventoryService() is the thin client used by option -q.
+//
+
+#define INVENTORY_PIPE_NAME				L"\\\\.\\pipe\\DiskInfo"
+#define INVENTORY_REFRESH_MS			60000
+#define INVENTORY_EVENT_POLL_MS			500			// Stop / refresh request latency with hotplug events
+#define INVENTORY_CLIENT_TIMEOUT_MS		2000
+#define INVENTORY_PIPE_BUFFER			65536
+#define INVENTORY_MAX_REQUEST			64			// wchar_t's
+
+#define INVENTORY_REQUEST_LIST			L"list"		// Cached inventory text
+#define INVENTORY_REQUEST_REFRESH		L"refresh"	// Refresh now, then reply as for list
+#define INVENTORY_REQUEST_STATS			L"stats"	// Service counters
+#define INVENTORY_REQUEST_FIND			L"find "	// find <serial | path | hex WWN> : that drive alone
+
+
+// Render a drive's identify summary as displayed by DiskInfo.
+inline _bstr_t DescribeDiskDrive(pCDiskDrive pDisk)
+{
+	const TDriveCapabilities &rCaps = pDisk->Capabilities();
+	const TDriveClass &rClass = pDisk->DriveClass();
+	_bstr_t bstrDescription(::BuildMessage(L"\n%ws"
+								  L"\n\tInterface= %ws"
+								  L"\n\tModel= %ws"
+								  L"\n\tVendor= %ws"
+								  L"\n\tSerialNo= %ws"
+								  L"\n\tFirmware= %ws"
+								  L"\n\tATA Passthru Capable= %ws\n",
+								  (const wchar_t*)pDisk->Name(),
+								  (const wchar_t*)pDisk->InterfaceType(),
+								  (const wchar_t*)pDisk->Model(),
+								  (const wchar_t*)pDisk->VendorID(),
+								  (const wchar_t*)pDisk->SerialNo(),
+								  (const wchar_t*)pDisk->Firmware(),
+								  (pDisk->IsAtaPassthruCapable() ? L"Yes" : L"No")));
+
+	// BuildMessage's buffer is reused, hence the two steps.
+	bstrDescription += ::BuildMessage(L"\tFamily= %hs%hs%hs\n", rClass.pszFamily, ((rClass.nQuirks & eQuirkSolidState) ? " (solid state)" : ""),
+									  ((rClass.nQuirks & eQuirkFirmwareDefect) ? " (firmware update advised)" : ""));
+	bstrDescription += ::BuildMessage(L"\tCapacity= %I64u MB (%I64u sectors%ws)"
+									  L"\n\tSector Size= %u logical, %u physical"
+									  L"\n\tSATA Generation= %u, NCQ Depth= %u, Rotation= %u"
+									  L"\n\tWWN= %016I64X"
+									  L"\n\tSecurity= %ws%ws%ws, Trusted Computing= %ws, DriveTrust= %ws\n",
+									  rCaps.CapacityBytes() / (1024 * 1024), rCaps.nUserSectors, (rCaps.bLba48 ? L", LBA48" : L""),
+									  rCaps.nLogicalSectorSize, rCaps.nPhysicalSectorSize,
+									  rCaps.nSataGeneration, rCaps.nQueueDepth, rCaps.nRotationRate,
+									  rCaps.nWorldWideName,
+									  (rCaps.bSecuritySupported ? (rCaps.bSecurityEnabled ? L"Enabled" : L"Supported") : L"No"),
+									  (rCaps.bSecurityLocked ? L", Locked" : L""), (rCaps.bSecurityFrozen ? L", Frozen" : L""),
+									  (rCaps.bTrustedComputing ? L"Yes" : L"No"), (rCaps.bDriveTrust ? L"Yes" : L"No"));
+
+	// Only a drive (or its bridge) that has returned a corrupt sector says so.
+	const TIdentifyIntegrityStats &rIntegrity = pDisk->IntegrityStats();
+	if (rIntegrity.nCorrupt > 0)
+		bstrDescription += ::BuildMessage(L"\tIdentify Reads= %u, Corrupt= %u, Recovered= %u\n",
+										  rIntegrity.nReads, rIntegrity.nCorrupt, rIntegrity.nRecovered);
+
+	// Likewise a drive with failures retried or refused (see RetryPolicy.h).
+	const TBusRetryStats &rRetries = pDisk->RetryStats();
+	if ((rRetries.nRetries > 0) || (rRetries.nPermanent > 0) || (rRetries.nBudgetDenied > 0))
+		bstrDescription += ::BuildMessage(L"\tBus Retries= %u (%u ms), Recovered= %u, Permanent= %u, Exhausted= %u, Over Budget= %u\n",
+										  rRetries.nRetries, rRetries.nBackoffMs, rRetries.nRecovered, rRetries.nPermanent,
+										  rRetries.nExhausted, rRetries.nBudgetDenied);
+	return bstrDescription;
+}
+
+
+// Write a drive as a JSON record (see CJsonRecordWriter) : its WMI attributes, then either the
+// decoded identify fields or the IDENTIFY error, its bus retries, and the timings (microseconds)
+// of its IDENTIFY and of its completion since the run began.
+inline bool WriteDiskDriveRecord(CJsonRecordWriter &rWriter, pCDiskDrive pDisk, const wchar_t *pszIdentifyError,
+								 unsigned __int64 nIdentifyUs, unsigned __int64 nElapsedUs)
+{
+	rWriter.Begin("drive");
+	rWriter.Member("path", (const wchar_t*)pDisk->Name());
+	rWriter.Member("interface", (const wchar_t*)pDisk->InterfaceType());
+	rWriter.Member("scsiPort", (unsigned int)pDisk->SCSIPort());
+	rWriter.Member("scsiBus", (unsigned int)pDisk->ScsiBus());
+	rWriter.Member("scsiTargetId", (unsigned int)pDisk->SCSITargetId());
+	rWriter.Member("scsiLogicalUnit", (unsigned int)pDisk->SCSILogicalUnit());
+	rWriter.Member("bytesPerSector", (unsigned int)pDisk->BytesPerSector());
+	if (pszIdentifyError)
+		rWriter.Member("error", pszIdentifyError);
+	else
+	{
+		const TDriveCapabilities &rCaps = pDisk->Capabilities();
+		const TDriveClass &rClass = pDisk->DriveClass();
+		const TIdentifyIntegrityStats &rIntegrity = pDisk->IntegrityStats();
+
+		rWriter.Member("model", (const wchar_t*)pDisk->Model());
+		rWriter.Member("serialNo", (const wchar_t*)pDisk->SerialNo());
+		rWriter.Member("firmware", (const wchar_t*)pDisk->Firmware());
+		rWriter.Member("vendor", rClass.pszVendor);
+		rWriter.Member("family", rClass.pszFamily);
+		rWriter.Member("solidState", ((rClass.nQuirks & eQuirkSolidState) != 0));
+		rWriter.Member("firmwareDefect", ((rClass.nQuirks & eQuirkFirmwareDefect) != 0));
+		rWriter.Member("ataPassthru", pDisk->IsAtaPassthruCapable());
+		rWriter.Member("userSectors", rCaps.nUserSectors);
+		rWriter.Member("capacityBytes", rCaps.CapacityBytes());
+		rWriter.Member("logicalSectorSize", rCaps.nLogicalSectorSize);
+		rWriter.Member("physicalSectorSize", rCaps.nPhysicalSectorSize);
+		rWriter.Member("rotationRate", (unsigned int)rCaps.nRotationRate);
+		rWriter.Member("sataGeneration", (unsigned int)rCaps.nSataGeneration);
+		rWriter.Member("ncqDepth", (unsigned int)rCaps.nQueueDepth);
+		rWriter.Member("ataMajorVersion", (unsigned int)rCaps.nMajorVersion);
+		rWriter.MemberHex("wwn", rCaps.nWorldWideName);
+		rWriter.Member("lba48", (rCaps.bLba48 != 0));
+		rWriter.Member("smart", (rCaps.bSmart != 0));
+		rWriter.Member("trim", (rCaps.bTrim != 0));
+		rWriter.BeginObject("security");
+		rWriter.Member("supported", (rCaps.bSecuritySupported != 0));
+		rWriter.Member("enabled", (rCaps.bSecurityEnabled != 0));
+		rWriter.Member("locked", (rCaps.bSecurityLocked != 0));
+		rWriter.Member("frozen", (rCaps.bSecurityFrozen != 0));
+		rWriter.EndObject();
+		rWriter.Member("trustedComputing", (rCaps.bTrustedComputing != 0));
+		rWriter.Member("driveTrust", (rCaps.bDriveTrust != 0));
+		rWriter.BeginObject("identifyReads");
+		rWriter.Member("reads", rIntegrity.nReads);
+		rWriter.Member("corrupt", rIntegrity.nCorrupt);
+		rWriter.Member("recovered", rIntegrity.nRecovered);
+		rWriter.EndObject();
+	}
+	const TBusRetryStats &rRetries = pDisk->RetryStats();
+	rWriter.BeginObject("busRetries");
+	rWriter.Member("retries", rRetries.nRetries);
+	rWriter.Member("recovered", rRetries.nRecovered);
+	rWriter.Member("permanent", rRetries.nPermanent);
+	rWriter.Member("exhausted", rRetries.nExhausted);
+	rWriter.Member("budgetDenied", rRetries.nBudgetDenied);
+	rWriter.Member("backoffMs", rRetries.nBackoffMs);
+	rWriter.EndObject();
+	rWriter.Member("identifyUs", nIdentifyUs);
+	rWriter.Member("elapsedUs", nElapsedUs);
+	return rWriter.End();
+}
+
+
+class CInventoryService
+{
+  private:
+	TListDiskDrives			_listDrives;
+	CDriveRegistry			_registry;				// Indexes _listDrives, holding references of its own
+	std::vector<_bstr_t>	_vIdentifyErrors;		// Per drive, empty if the IDENTIFY succeeded
+	std::wstring			_strInventory;			// Rendered at refresh, returned by list
+	SRWLOCK					_srwLock;				// Guards _strInventory and the counters
+	CRITICAL_SECTION		_critRefresh;			// Serializes refreshes, held while drives are identified
+	CRITICAL_SECTION		_critDrives;			// Guards _listDrives and _vIdentifyErrors as published, and
+													// the drives' lazily decoded strings; taken briefly
+	HANDLE					_hStopEvent;
+	HANDLE					_hRefreshEvent;			// Wakes the refresh thread early
+	IDeviceEventSource		*_pEventSource;			// Hotplug events, NULL for periodic refresh
+	unsigned int			_nDrives;
+	unsigned __int64		_nEvents;
+	unsigned __int64		_nRefreshes;
+	unsigned __int64		_nLastRefreshUs;
+	unsigned __int64		_nQueries;
+	unsigned __int64		_nQueryUs;				// Sum of request-to-reply times
+	unsigned __int64		_nFinds;
+	unsigned __int64		_nCorruptReads;			// Identify Sector checksum failures of the current drives
+
+	static CInventoryService *_pService;			// For the console control handler
+
+	CInventoryService(const CInventoryService&);
+	CInventoryService &operator=(const CInventoryService&);
+
+	static BOOL WINAPI ConsoleHandler(DWORD dwCtrlType)
+	{
+		UNREFERENCED_PARAMETER(dwCtrlType);
+		if (_pService)
+			_pService->Stop();
+		return TRUE;
+	}
+
+	static unsigned __stdcall RefreshThread(void *pvContext)
+	{
+		CInventoryService *pThis = reinterpret_cast<CInventoryService*>(pvContext);
+		HANDLE ahEvents[2] = { pThis->_hStopEvent, pThis->_hRefreshEvent };
+		_bstr_t bstrErrorInfo;
+
+		if (FAILED(::CoInitializeEx(0, COINIT_MULTITHREADED)))
+			return 1;
+		if (pThis->_pEventSource)
+		{
+			TDeviceEvent sEvent;
+			std::wstring strErrorInfo;
+
+			while (::WaitForSingleObject(pThis->_hStopEvent, 0) == WAIT_TIMEOUT)
+			{
+				unsigned __int64 nWaitStart = ::GetTickCount64();
+				if (pThis->_pEventSource->Wait(strErrorInfo, sEvent, INVENTORY_EVENT_POLL_MS))
+				{
+					pThis->ApplyEvent(sEvent);
+					continue;
+				}
+				if (!strErrorInfo.empty())
+				{
+					// A failed source is reported once and not polled again; refresh periodically instead.
+					DisplayErrorMessage(strErrorInfo.c_str());
+					pThis->_pEventSource->End();
+					break;
+				}
+
+				// An exhausted source (e.g. a replayed event file) returns at once : wait out the poll here.
+				unsigned __int64 nWaitedMs = ::GetTickCount64() - nWaitStart;
+				DWORD dwRemainingMs = (nWaitedMs < INVENTORY_EVENT_POLL_MS) ? (DWORD)(INVENTORY_EVENT_POLL_MS - nWaitedMs) : 0;
+				if (::WaitForMultipleObjects(2, ahEvents, FALSE, dwRemainingMs) == (WAIT_OBJECT_0 + 1))
+					pThis->Refresh(bstrErrorInfo);
+			}
+		}
+		while (::WaitForMultipleObjects(2, ahEvents, FALSE, INVENTORY_REFRESH_MS) != WAIT_OBJECT_0)
+		{
+			if (!pThis->Refresh(bstrErrorInfo))
+				DisplayErrorMessage((const wchar_t*)bstrErrorInfo);
+		}
+		::CoUninitialize();
+		return 0;
+	}
+
+	// Mirror the list into the registry; a drive is registered once identified.
+	inline void Register(pCDiskDrive pDisk)
+	{
+		pDisk->AddRef();
+		_registry.Insert(pDisk);
+	}
+
+	// Only that very drive, not a successor registered at the same path.
+	void Unregister(pCDiskDrive pDisk)
+	{
+		TDriveHandle hDrive = _registry.FindByPath((const wchar_t*)pDisk->Name());
+		pCDiskDrive pRegistered = _registry.Acquire(hDrive);
+		if (pRegistered)
+		{
+			if (pRegistered == pDisk)
+				_registry.Remove(hDrive);
+			pRegistered->Release();
+		}
+	}
+
+	// The description of the drive with the given serial number, device path or world wide name.
+	std::wstring Find(const wchar_t *pszKey)
+	{
+		TRACE(L"CInventoryService::Find\n");
+		wchar_t *pszEnd = NULL;
+		TDriveHandle hDrive = _registry.FindBySerialNo(pszKey);
+		std::wstring strReply;
+
+		if (hDrive == DRIVE_HANDLE_INVALID)
+			hDrive = _registry.FindByPath(pszKey);
+		if (hDrive == DRIVE_HANDLE_INVALID)
+		{
+			unsigned __int64 nWorldWideName = ::_wcstoui64(pszKey, &pszEnd, 16);
+			if ((pszEnd) && (*pszEnd == L'\0') && (pszEnd != pszKey))
+				hDrive = _registry.FindByWorldWideName(nWorldWideName);
+		}
+
+		pCDiskDrive pDisk = _registry.Acquire(hDrive);
+		if (!pDisk)
+			return std::wstring(::BuildMessage(L"No drive '%ws'.\n", pszKey));
+
+		// The identify strings are decoded lazily, so describe under the drives lock.
+		::EnterCriticalSection(&_critDrives);
+		strReply = (const wchar_t*)::DescribeDiskDrive(pDisk);
+		::LeaveCriticalSection(&_critDrives);
+		pDisk->Release();
+		return strReply;
+	}
+
+	// Probe and add a single attached drive, or drop a removed one.  A removal not naming the
+	// device drops whichever known drives can no longer be opened.  Drives are probed and
+	// identified under the refresh lock only, so that Find does not wait on a slow drive.
+	void ApplyEvent(const TDeviceEvent &rEvent)
+	{
+		TRACE(L"CInventoryService::ApplyEvent\n");
+		TDiskDeviceAttributes sAttributes;
+		_bstr_t bstrDeviceID(rEvent.strDeviceID.c_str());
+		std::vector<bool> vRemoved;
+		pCDiskDrive pAdded = NULL;
+		_bstr_t bstrIdentifyError;
+
+		::EnterCriticalSection(&_critRefresh);
+		if (rEvent.eType == eDeviceRemoved)
+		{
+			vRemoved.resize(_listDrives.size(), false);
+			for (size_t i = 0; i < _listDrives.size(); i++)
+				vRemoved[i] = (rEvent.strDeviceID.empty()) ? (!::ProbeDiskDevice((const wchar_t*)_listDrives[i]->Name(), sAttributes))
+														   : (_listDrives[i]->Name() == bstrDeviceID);
+		}
+		else if ((_registry.FindByPath(rEvent.strDeviceID) == DRIVE_HANDLE_INVALID) && (::ProbeDiskDevice(rEvent.strDeviceID, sAttributes)) &&
+				 ((pAdded = ::OpenDiskDrive(sAttributes)) != NULL))
+		{
+			if ((!pAdded->QueryIdentifySector(bstrIdentifyError)) && (bstrIdentifyError.length() == 0))
+				bstrIdentifyError = L"IDENTIFY failed.";
+		}
+
+		::EnterCriticalSection(&_critDrives);
+		for (size_t i = vRemoved.size(); i-- > 0; )
+		{
+			if (!vRemoved[i])
+				continue;
+			pCDiskDrive pDisk = _listDrives[i];
+			_listDrives.erase(_listDrives.begin() + i);
+			_vIdentifyErrors.erase(_vIdentifyErrors.begin() + i);
+			Unregister(pDisk);
+			pDisk->Release();
+		}
+		if (pAdded)
+		{
+			_vIdentifyErrors.push_back(bstrIdentifyError);
+			_listDrives.push_back(pAdded);
+			Register(pAdded);
+		}
+		Render();
+		::LeaveCriticalSection(&_critDrives);
+
+		::AcquireSRWLockExclusive(&_srwLock);
+		_nDrives = (unsigned int)_listDrives.size();
+		_nEvents++;
+		::ReleaseSRWLockExclusive(&_srwLock);
+		::LeaveCriticalSection(&_critRefresh);
+	}
+
+	void Render(void)
+	{
+		std::wstring strInventory;
+		unsigned __int64 nCorruptReads = 0;
+		for (size_t i = 0; i < _listDrives.size(); i++)
+		{
+			nCorruptReads += _listDrives[i]->IntegrityStats().nCorrupt;
+			if (_vIdentifyErrors[i].length() == 0)
+				strInventory += (const wchar_t*)::DescribeDiskDrive(_listDrives[i]);
+			else
+			{
+				strInventory += L"\n";
+				strInventory += (const wchar_t*)_vIdentifyErrors[i];
+			}
+		}
+
+		::AcquireSRWLockExclusive(&_srwLock);
+		_strInventory.swap(strInventory);
+		_nCorruptReads = nCorruptReads;
+		::ReleaseSRWLockExclusive(&_srwLock);
+	}
+
+	// Complete an overlapped pipe read or write, bStarted being the ReadFile or WriteFile result,
+	// waiting on it and on the stop event.  A stop cancels it.  False if it failed or was cancelled.
+	bool CompletePipeIo(HANDLE hPipe, OVERLAPPED &rOverlapped, BOOL bStarted, DWORD &rdwTransferred)
+	{
+		HANDLE ahEvents[2] = { _hStopEvent, rOverlapped.hEvent };
+
+		rdwTransferred = 0;
+		if ((!bStarted) && (::GetLastError() != ERROR_IO_PENDING))
+			return false;
+		if (::WaitForMultipleObjects(2, ahEvents, FALSE, INFINITE) == WAIT_OBJECT_0)
+		{
+			::CancelIo(hPipe);
+			::GetOverlappedResult(hPipe, &rOverlapped, &rdwTransferred, TRUE);		// rOverlapped is in use until then
+			return false;
+		}
+		return (::GetOverlappedResult(hPipe, &rOverlapped, &rdwTransferred, FALSE) != FALSE);
+	}
+
+	void Reply(HANDLE hPipe, OVERLAPPED &rOverlapped, const wchar_t *pszRequest, unsigned __int64 nStartUs)
+	{
+		std::wstring strReply;
+		_bstr_t bstrErrorInfo;
+
+		if ((_wcsicmp(pszRequest, INVENTORY_REQUEST_REFRESH) == 0) && (!Refresh(bstrErrorInfo)))
+			DisplayErrorMessage((const wchar_t*)bstrErrorInfo);
+
+		::AcquireSRWLockShared(&_srwLock);
+		if (_wcsicmp(pszRequest, INVENTORY_REQUEST_STATS) == 0)
+			strReply = ::BuildMessage(L"Drives= %u\nRefreshes= %I64u\nLastRefresh= %I64u us\nHotplugEvents= %I64u\nQueries= %I64u\nFinds= %I64u\nAverageQuery= %I64u us\nCorruptIdentifyReads= %I64u\n",
+									  _nDrives, _nRefreshes, _nLastRefreshUs, _nEvents, _nQueries, _nFinds,
+									  (_nQueries ? (_nQueryUs / _nQueries) : 0), _nCorruptReads);
+		else if ((_wcsicmp(pszRequest, INVENTORY_REQUEST_LIST) == 0) || (_wcsicmp(pszRequest, INVENTORY_REQUEST_REFRESH) == 0))
+			strReply = _strInventory;
+		else if (_wcsnicmp(pszRequest, INVENTORY_REQUEST_FIND, wcslen(INVENTORY_REQUEST_FIND)) != 0)
+			strReply = ::BuildMessage(L"Unrecognized request '%ws'.\n", pszRequest);
+		::ReleaseSRWLockShared(&_srwLock);
+
+		if (_wcsnicmp(pszRequest, INVENTORY_REQUEST_FIND, wcslen(INVENTORY_REQUEST_FIND)) == 0)
+		{
+			strReply = Find(pszRequest + wcslen(INVENTORY_REQUEST_FIND));
+			::AcquireSRWLockExclusive(&_srwLock);
+			_nFinds++;
+			::ReleaseSRWLockExclusive(&_srwLock);
+		}
+
+		// A reply larger than the pipe buffer completes only as the client reads it.
+		DWORD dwWritten = 0;
+		HANDLE hEvent = rOverlapped.hEvent;
+		memset(&rOverlapped, 0, sizeof(rOverlapped));
+		rOverlapped.hEvent = hEvent;
+		CompletePipeIo(hPipe, rOverlapped, ::WriteFile(hPipe, strReply.c_str(), (DWORD)((strReply.length() + 1) * sizeof(wchar_t)), NULL, &rOverlapped), dwWritten);
+
+		::AcquireSRWLockExclusive(&_srwLock);
+		_nQueries++;
+		_nQueryUs += ::PerfCounterMicroseconds() - nStartUs;
+		::ReleaseSRWLockExclusive(&_srwLock);
+	}
+
+	void ReleaseDrives(void)
+	{
+		_registry.Clear();
+		for (size_t i = 0; i < _listDrives.size(); i++)
+			_listDrives[i]->Release();
+		_listDrives.clear();
+		_vIdentifyErrors.clear();
+	}
+
+  public:
+	CInventoryService(IDeviceEventSource *pEventSource = NULL) : _pEventSource(pEventSource), _nDrives(0), _nEvents(0), _nRefreshes(0), _nLastRefreshUs(0), _nQueries(0), _nQueryUs(0), _nFinds(0), _nCorruptReads(0)
+	{
+		::InitializeSRWLock(&_srwLock);
+		::InitializeCriticalSection(&_critRefresh);
+		::InitializeCriticalSection(&_critDrives);
+		_hStopEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+		_hRefreshEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+
+	~CInventoryService()
+	{
+		ReleaseDrives();
+		::CloseHandle(_hStopEvent);
+		::CloseHandle(_hRefreshEvent);
+		::DeleteCriticalSection(&_critRefresh);
+		::DeleteCriticalSection(&_critDrives);
+	}
+
+	// Re-enumerate, keeping known drives (and their identify data) and querying only new ones.
+	bool Refresh(_bstr_t &rbstrErrorInfo)
+	{
+		TRACE(L"CInventoryService::Refresh\n");
+		unsigned __int64 nStart = ::PerfCounterMicroseconds();
+		TListDiskDrives listFound;
+		TListDiskDrives listKept;
+		TListDiskDrives listAdded;
+		std::vector<_bstr_t> vErrors;
+		std::vector<bool> vKnownKept;							// Per _listDrives entry
+		std::unordered_map<std::wstring, size_t> mapKnown;		// DeviceID -> _listDrives index
+		HRESULT hr = S_OK;
+
+		::EnterCriticalSection(&_critRefresh);
+		try
+		{
+			hr = ::GetDiskDriveDevices(listFound);
+		}
+		catch (_com_error &Err)
+		{
+			hr = Err.Error();
+		}
+		if (FAILED(hr))
+		{
+			for (size_t i = 0; i < listFound.size(); i++)
+				listFound[i]->Release();
+			::LeaveCriticalSection(&_critRefresh);
+			rbstrErrorInfo = _com_error(hr).ErrorMessage();
+			return false;
+		}
+
+		for (size_t i = 0; i < _listDrives.size(); i++)
+			mapKnown[(const wchar_t*)_listDrives[i]->Name()] = i;
+		vKnownKept.resize(_listDrives.size(), false);
+
+		// New drives are identified under the refresh lock only, so that Find does not wait on
+		// a slow drive; the drives lock is taken to publish the result.
+		for (size_t i = 0; i < listFound.size(); i++)
+		{
+			pCDiskDrive pFound = listFound[i];
+			std::unordered_map<std::wstring, size_t>::const_iterator iterKnown = mapKnown.find((const wchar_t*)pFound->Name());
+			size_t j = (iterKnown != mapKnown.end()) ? iterKnown->second : _listDrives.size();
+
+			if ((j < _listDrives.size()) && (!vKnownKept[j]) && (_listDrives[j]->InterfaceType() == pFound->InterfaceType()))
+			{
+				listKept.push_back(_listDrives[j]);
+				vErrors.push_back(_vIdentifyErrors[j]);
+				vKnownKept[j] = true;
+				pFound->Release();
+			}
+			else
+			{
+				_bstr_t bstrIdentifyError;
+				if ((!pFound->QueryIdentifySector(bstrIdentifyError)) && (bstrIdentifyError.length() == 0))
+					bstrIdentifyError = L"IDENTIFY failed.";
+				vErrors.push_back(bstrIdentifyError);
+				listKept.push_back(pFound);
+				listAdded.push_back(pFound);
+			}
+		}
+
+		// Whatever known drive was not kept has departed.
+		::EnterCriticalSection(&_critDrives);
+		for (size_t i = 0; i < listAdded.size(); i++)
+			Register(listAdded[i]);
+		for (size_t i = 0; i < _listDrives.size(); i++)
+			if (!vKnownKept[i])
+			{
+				Unregister(_listDrives[i]);
+				_listDrives[i]->Release();
+			}
+		_listDrives.swap(listKept);
+		_vIdentifyErrors.swap(vErrors);
+		Render();
+		::LeaveCriticalSection(&_critDrives);
+
+		::AcquireSRWLockExclusive(&_srwLock);
+		_nDrives = (unsigned int)_listDrives.size();
+		_nRefreshes++;
+		_nLastRefreshUs = ::PerfCounterMicroseconds() - nStart;
+		::ReleaseSRWLockExclusive(&_srwLock);
+		::LeaveCriticalSection(&_critRefresh);
+		return true;
+	}
+
+	// Serve queries until Stop() (e.g. on Ctrl+C).
+	bool Run(_bstr_t &rbstrErrorInfo)
+	{
+		TRACE(L"CInventoryService::Run\n");
+		OVERLAPPED sOverlapped;
+		HANDLE hRefreshThread = NULL;
+		HANDLE hPipe = INVALID_HANDLE_VALUE;
+		HANDLE hConnected = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+		bool bres = true;
+
+		if (!Refresh(rbstrErrorInfo))
+		{
+			::CloseHandle(hConnected);
+			return false;
+		}
+
+		_pService = this;
+		::SetConsoleCtrlHandler(ConsoleHandler, TRUE);
+		hRefreshThread = (HANDLE)::_beginthreadex(NULL, 0, RefreshThread, this, 0, NULL);
+		DisplayMessage(L"\nServing %u drive(s) on %ws, Ctrl+C to stop.\n", (unsigned)_listDrives.size(), INVENTORY_PIPE_NAME);
+
+		while (::WaitForSingleObject(_hStopEvent, 0) == WAIT_TIMEOUT)
+		{
+			HANDLE ahEvents[2] = { _hStopEvent, hConnected };
+			wchar_t szRequest[INVENTORY_MAX_REQUEST + 1];
+			DWORD dwRead = 0;
+
+			hPipe = ::CreateNamedPipe(INVENTORY_PIPE_NAME, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+									  PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+									  PIPE_UNLIMITED_INSTANCES, INVENTORY_PIPE_BUFFER, INVENTORY_MAX_REQUEST * sizeof(wchar_t), 0, NULL);
+			if (hPipe == INVALID_HANDLE_VALUE)
+			{
+				TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+				bres = false;
+				break;
+			}
+
+			memset(&sOverlapped, 0, sizeof(sOverlapped));
+			sOverlapped.hEvent = hConnected;
+			::ResetEvent(hConnected);
+			if (!::ConnectNamedPipe(hPipe, &sOverlapped))
+			{
+				DWORD dwError = ::GetLastError();
+				if (dwError == ERROR_IO_PENDING)
+				{
+					if (::WaitForMultipleObjects(2, ahEvents, FALSE, INFINITE) == WAIT_OBJECT_0)
+					{
+						::CancelIo(hPipe);
+						::CloseHandle(hPipe);
+						break;
+					}
+				}
+				else if (dwError != ERROR_PIPE_CONNECTED)
+				{
+					::CloseHandle(hPipe);
+					continue;
+				}
+			}
+
+			// Read the request and write the reply through the connection's OVERLAPPED, as the handle
+			// requires, each abandoned on stop.
+			memset(&sOverlapped, 0, sizeof(sOverlapped));
+			sOverlapped.hEvent = hConnected;
+			unsigned __int64 nStart = ::PerfCounterMicroseconds();
+			if ((CompletePipeIo(hPipe, sOverlapped, ::ReadFile(hPipe, szRequest, INVENTORY_MAX_REQUEST * sizeof(wchar_t), NULL, &sOverlapped), dwRead)) &&
+				(dwRead > 0))
+			{
+				szRequest[dwRead / sizeof(wchar_t)] = L'\0';
+				Reply(hPipe, sOverlapped, szRequest, nStart);
+				::FlushFileBuffers(hPipe);
+			}
+			::DisconnectNamedPipe(hPipe);
+			::CloseHandle(hPipe);
+		}
+
+		Stop();
+		if (hRefreshThread)
+		{
+			::WaitForSingleObject(hRefreshThread, INFINITE);
+			::CloseHandle(hRefreshThread);
+		}
+		::SetConsoleCtrlHandler(ConsoleHandler, FALSE);
+		_pService = NULL;
+		::CloseHandle(hConnected);
+		return bres;
+	}
+
+	// A snapshot of the inventory, each drive AddRef'd; the caller Releases each.
+	void AcquireDrives(TListDiskDrives &rList)
+	{
+		::EnterCriticalSection(&_critDrives);
+		rList = _listDrives;
+		for (size_t i = 0; i < rList.size(); i++)
+			rList[i]->AddRef();
+		::LeaveCriticalSection(&_critDrives);
+	}
+
+	inline void Stop(void)
+		{ ::SetEvent(_hStopEvent); }
+};	// CInventoryService
+
+__declspec(selectany) CInventoryService *CInventoryService::_pService = NULL;
+
+
+// Thin client : send one request to a running service and return its reply.
+inline bool QueryInventoryService(_bstr_t &rbstrErrorInfo, const wchar_t *pszRequest, std::wstring &rstrReply)
+{
+	TRACE(L"QueryInventoryService\n");
+	HANDLE hPipe = INVALID_HANDLE_VALUE;
+	DWORD dwMode = PIPE_READMODE_MESSAGE;
+	DWORD dwRead = 0;
+	std::vector<wchar_t> vBuffer(INVENTORY_PIPE_BUFFER / sizeof(wchar_t));
+	bool bres = false;
+
+	rstrReply.clear();
+	if (!::WaitNamedPipe(INVENTORY_PIPE_NAME, INVENTORY_CLIENT_TIMEOUT_MS))
+	{
+		TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+		return false;
+	}
+	hPipe = ::CreateFile(INVENTORY_PIPE_NAME, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (hPipe == INVALID_HANDLE_VALUE)
+	{
+		TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+		return false;
+	}
+
+	if ((::SetNamedPipeHandleState(hPipe, &dwMode, NULL, NULL)) &&
+		(::WriteFile(hPipe, pszRequest, (DWORD)(wcslen(pszRequest) * sizeof(wchar_t)), &dwRead, NULL)))
+	{
+		// The reply is one message, possibly larger than the buffer.
+		for (;;)
+		{
+			BOOL bRead = ::ReadFile(hPipe, &vBuffer[0], (DWORD)(vBuffer.size() * sizeof(wchar_t)), &dwRead, NULL);
+			if ((!bRead) && (::GetLastError() != ERROR_MORE_DATA))
+				break;
+			rstrReply.append(&vBuffer[0], dwRead / sizeof(wchar_t));
+			if (bRead)
+			{
+				bres = true;
+				break;
+			}
+		}
+	}
+	if (!bres)
+		TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+	else if ((!rstrReply.empty()) && (rstrReply[rstrReply.length() - 1] == L'\0'))
+		rstrReply.resize(rstrReply.length() - 1);
+	::CloseHandle(hPipe);
+	return bres;
+}
@@ -0,0 +1,176 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include <string>
+#include <stdio.h>
+
+
+//  The CJsonRecordWriter class streams newline delimited JSON (NDJSON), one object per line, e.g.
+//
+//		{"type":"drive","path":"\\\\.\\PHYSICALDRIVE0","model":"ST3500320AS",...}
+//
+//  A record is composed into a buffer kept from one record to the next, so that after the first
+//  few records no allocation occurs, then written with a single fwrite and flushed, so that a
+//  reader sees each record whole as soon as it is complete.  Strings are written as UTF-8 with
+//  the JSON escapes (RFC 8259 section 7); wide strings are taken as UTF-16.  Members are written
+//  in call order and their names are not escaped (i.e. literals).
+//
+
+class CJsonRecordWriter
+{
+  private:
+	FILE			*_pFile;
+	std::string		_strRecord;
+	bool			_bFirstMember;
+	unsigned int	_nRecords;
+
+	void Name(const char *pszName)
+	{
+		if (!_bFirstMember)
+			_strRecord += ',';
+		_bFirstMember = false;
+		_strRecord += '"';
+		_strRecord += pszName;
+		_strRecord += "\":";
+	}
+
+	void Escaped(unsigned int nCodePoint)
+	{
+		static const char s_szHex[] = "0123456789abcdef";
+
+		switch (nCodePoint)
+		{
+		case '"':	_strRecord += "\\\"";	return;
+		case '\\':	_strRecord += "\\\\";	return;
+		case '\n':	_strRecord += "\\n";	return;
+		case '\r':	_strRecord += "\\r";	return;
+		case '\t':	_strRecord += "\\t";	return;
+		}
+		if (nCodePoint < 0x20)
+		{
+			_strRecord += "\\u00";
+			_strRecord += s_szHex[nCodePoint >> 4];
+			_strRecord += s_szHex[nCodePoint & 0xF];
+		}
+		else if (nCodePoint < 0x80)
+			_strRecord += (char)nCodePoint;
+		else if (nCodePoint < 0x800)
+		{
+			_strRecord += (char)(0xC0 | (nCodePoint >> 6));
+			_strRecord += (char)(0x80 | (nCodePoint & 0x3F));
+		}
+		else if (nCodePoint < 0x10000)
+		{
+			_strRecord += (char)(0xE0 | (nCodePoint >> 12));
+			_strRecord += (char)(0x80 | ((nCodePoint >> 6) & 0x3F));
+			_strRecord += (char)(0x80 | (nCodePoint & 0x3F));
+		}
+		else
+		{
+			_strRecord += (char)(0xF0 | (nCodePoint >> 18));
+			_strRecord += (char)(0x80 | ((nCodePoint >> 12) & 0x3F));
+			_strRecord += (char)(0x80 | ((nCodePoint >> 6) & 0x3F));
+			_strRecord += (char)(0x80 | (nCodePoint & 0x3F));
+		}
+	}
+
+	CJsonRecordWriter(const CJsonRecordWriter&);
+	CJsonRecordWriter &operator=(const CJsonRecordWriter&);
+
+  public:
+	CJsonRecordWriter(FILE *pFile = stdout) : _pFile(pFile), _bFirstMember(true), _nRecords(0)
+	{
+		_strRecord.reserve(2048);
+	}
+
+	// Start a record of the given "type" member.
+	void Begin(const char *pszType)
+	{
+		_strRecord.clear();				// Keeps the capacity
+		_strRecord += '{';
+		_bFirstMember = true;
+		Member("type", pszType);
+	}
+
+	void Member(const char *pszName, const char *pszValue)
+	{
+		Name(pszName);
+		_strRecord += '"';
+		for (const unsigned char *p = (const unsigned char*)(pszValue ? pszValue : ""); *p; p++)
+			Escaped(*p);
+		_strRecord += '"';
+	}
+
+	void Member(const char *pszName, const wchar_t *pszValue)
+	{
+		Name(pszName);
+		_strRecord += '"';
+		for (const wchar_t *p = (pszValue ? pszValue : L""); *p; p++)
+		{
+			unsigned int nCodePoint = (unsigned int)*p;
+
+			// A surrogate pair (i.e. beyond the BMP), else a lone surrogate becomes U+FFFD.
+			if ((nCodePoint >= 0xD800) && (nCodePoint <= 0xDBFF) && (p[1] >= 0xDC00) && (p[1] <= 0xDFFF))
+				nCodePoint = 0x10000 + ((nCodePoint - 0xD800) << 10) + ((unsigned int)*++p - 0xDC00);
+			else if ((nCodePoint >= 0xD800) && (nCodePoint <= 0xDFFF))
+				nCodePoint = 0xFFFD;
+			Escaped(nCodePoint);
+		}
+		_strRecord += '"';
+	}
+
+	void Member(const char *pszName, unsigned __int64 nValue)
+	{
+		char szValue[24];
+		Name(pszName);
+		::sprintf_s(szValue, sizeof(szValue), "%I64u", nValue);
+		_strRecord += szValue;
+	}
+
+	void Member(const char *pszName, unsigned int nValue)
+		{ Member(pszName, (unsigned __int64)nValue); }
+
+	void Member(const char *pszName, bool bValue)
+	{
+		Name(pszName);
+		_strRecord += (bValue) ? "true" : "false";
+	}
+
+	// A 64 bit identifier (e.g. a world wide name) as a hex string, since JSON readers commonly
+	// hold numbers as doubles.
+	void MemberHex(const char *pszName, unsigned __int64 nValue)
+	{
+		char szValue[24];
+		Name(pszName);
+		::sprintf_s(szValue, sizeof(szValue), "\"%016I64X\"", nValue);
+		_strRecord += szValue;
+	}
+
+	// Open and close a nested object member.
+	void BeginObject(const char *pszName)
+	{
+		Name(pszName);
+		_strRecord += '{';
+		_bFirstMember = true;
+	}
+
+	void EndObject(void)
+	{
+		_strRecord += '}';
+		_bFirstMember = false;
+	}
+
+	// Complete the record and write it, false if the write failed (e.g. a closed pipe).
+	bool End(void)
+	{
+		_strRecord += "}\n";
+		_nRecords++;
+		return ((::fwrite(_strRecord.data(), 1, _strRecord.length(), _pFile) == _strRecord.length()) && (::fflush(_pFile) == 0));
+	}
+
+	inline unsigned int Records(void) const
+		{ return _nRecords; }
+};	// CJsonRecordWriter
@@ -0,0 +1,714 @@
+//************************************************************************
+//  File name: PlatformWin32.cpp
+//
+//  Description: 
+//  The Windows platform layer (see DiskPlatform.h).  WMI is used to obtain the 
+//  list of attached disk drive devices, each of which is opened for DeviceIoControl.
+//
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#include "stdafx.h"
+#include "DiskPlatform.h"
+#include "UsbInterface.h"
+#include "AtaInterface.h"
+#include <deque>
+#include <map>
+#include <dbt.h>				// DEV_BROADCAST_DEVICEINTERFACE
+
+#pragma comment(lib, "wbemuuid.lib")	// link with this lib for the WMI API's.
+
+
+bool PlatformInitialize(_bstr_t &rbstrErrorInfo, bool &rbUninitialize)
+{
+	TRACE(L"PlatformInitialize\n");
+	HRESULT hr = ::CoInitializeEx(0, COINIT_MULTITHREADED);
+
+	// An embedding host may already have initialized COM, possibly as an STA; WMI works within either.
+	rbUninitialize = SUCCEEDED(hr);
+	if ((FAILED(hr)) && (hr != RPC_E_CHANGED_MODE))
+	{
+		rbstrErrorInfo = L"COM runtime initialization failed.";
+		return false;
+	}
+	return true;
+}
+
+
+void PlatformUninitialize(bool bUninitialize)
+{
+	TRACE(L"PlatformUninitialize\n");
+	if (bUninitialize)
+		::CoUninitialize();
+}
+
+
+bool PlatformInitializeSecurity(_bstr_t &rbstrErrorInfo)
+{
+	TRACE(L"PlatformInitializeSecurity\n");
+	HRESULT hr = ::CoInitializeSecurity(
+		NULL, 
+		-1,                          // COM authentication
+		NULL,                        // Authentication services
+		NULL,                        // Reserved
+		RPC_C_AUTHN_LEVEL_DEFAULT,   // Default authentication 
+		RPC_C_IMP_LEVEL_IMPERSONATE, // Default Impersonation  
+		NULL,                        // Authentication info
+		EOAC_NONE,                   // Additional capabilities 
+		NULL                         // Reserved
+		);
+
+	// Security already established (e.g. by the host, or COM's own default on first use) stands.
+	if ((FAILED(hr)) && (hr != RPC_E_TOO_LATE))
+	{
+		rbstrErrorInfo = _com_error(hr).ErrorMessage();
+		return false;
+	}
+	return true;
+}
+
+
+//  The CWmiDiskEnumerator class enumerates Win32_DiskDrive instances.  The query is semi-synchronous
+//  (i.e. WBEM_FLAG_RETURN_IMMEDIATELY) so the first batch is returned as soon as it is available.
+//  Only the projected properties are selected, rather than SELECT *, sparing WMI the provider work
+//  (and marshaling) of the other forty odd, and instances are retrieved nBatchSize per call.
+//  See the WMI SDK documentation.
+
+static const struct { unsigned int nField; const wchar_t *pszProperty; } s_aWmiDiskProperties[] =
+{
+	{ eDiskFieldDeviceID,			L"DeviceID" },
+	{ eDiskFieldInterfaceType,		L"InterfaceType" },
+	{ eDiskFieldBytesPerSector,		L"BytesPerSector" },
+	{ eDiskFieldSCSIBus,			L"SCSIBus" },
+	{ eDiskFieldSCSILogicalUnit,	L"SCSILogicalUnit" },
+	{ eDiskFieldSCSIPort,			L"SCSIPort" },
+	{ eDiskFieldSCSITargetId,		L"SCSITargetId" },
+	{ eDiskFieldModel,				L"Model" },
+	{ eDiskFieldSerialNumber,		L"SerialNumber" },
+};
+
+// An unsigned integer property.  WMI returns CIM_UINT32 and CIM_UINT16 properties as VT_I4, the
+// other integer types are accepted in case a provider differs; false for VT_NULL (the provider has
+// no value for this drive), VT_EMPTY (not projected) or any other type, leaving rnValue unchanged.
+static bool WmiUnsignedProperty(const VARIANT &rVariant, unsigned int &rnValue)
+{
+	switch (rVariant.vt)
+	{
+	case VT_I4:		rnValue = (unsigned int)rVariant.lVal;			return true;
+	case VT_UI4:	rnValue = rVariant.ulVal;						return true;
+	case VT_I2:		rnValue = (unsigned short)rVariant.iVal;		return true;
+	case VT_UI2:	rnValue = rVariant.uiVal;						return true;
+	default:														return false;
+	}
+}
+
+class CWmiDiskEnumerator : public IDiskEnumerator
+{
+  private:
+	IWbemLocator			*_pLoc;
+	IWbemServices			*_pSvc;
+	IEnumWbemClassObject	*_pEnumerator;
+	HRESULT					_hres;
+	TEnumerationQuery		_sQuery;
+	std::vector<IWbemClassObject*>	_vBatch;	// Instances of the current batch
+	ULONG					_nBatched;				// Count retrieved into _vBatch
+	ULONG					_nBatchNext;			// Next of _vBatch to return
+
+	// e.g. SELECT DeviceID,InterfaceType FROM Win32_DiskDrive WHERE InterfaceType='USB'
+	// The filter's exact terms are passed to WMI, its patterns are left to the caller.
+	static _bstr_t QueryText(const TEnumerationQuery &rQuery)
+	{
+		std::wstring strQuery = L"SELECT ";
+		std::wstring strWhere;
+
+		if (rQuery.nFields == eDiskFieldsAll)
+			strQuery += L"*";
+		else
+		{
+			for (size_t i = 0; i < (sizeof(s_aWmiDiskProperties) / sizeof(s_aWmiDiskProperties[0])); i++)
+				if (rQuery.Wants(s_aWmiDiskProperties[i].nField))
+				{
+					if (strQuery.length() > 7)
+						strQuery += L",";
+					strQuery += s_aWmiDiskProperties[i].pszProperty;
+				}
+		}
+		strQuery += L" FROM Win32_DiskDrive";
+
+		if (rQuery.pFilter)
+		{
+			const TDiskFilter &rFilter = *rQuery.pFilter;
+			if ((!rFilter.strInterfaceType.empty()) && (rFilter.strInterfaceType.find_first_of(L"*?'\\") == std::wstring::npos))
+				strWhere += L" AND InterfaceType='" + rFilter.strInterfaceType + L"'";
+			if (rFilter.nSCSIPort != DISK_FILTER_ANY)
+				strWhere += ::BuildMessage(L" AND SCSIPort=%d", rFilter.nSCSIPort);
+			if (rFilter.nSCSIBus != DISK_FILTER_ANY)
+				strWhere += ::BuildMessage(L" AND SCSIBus=%d", rFilter.nSCSIBus);
+			if (rFilter.nSCSITargetId != DISK_FILTER_ANY)
+				strWhere += ::BuildMessage(L" AND SCSITargetId=%d", rFilter.nSCSITargetId);
+			if (!strWhere.empty())
+				strQuery += L" WHERE" + strWhere.substr(4);
+		}
+		return _bstr_t(strQuery.c_str());
+	}
+
+	void ReleaseBatch(void)
+	{
+		for (ULONG i = _nBatchNext; i < _nBatched; i++)
+			_vBatch[i]->Release();
+		_nBatched = _nBatchNext = 0;
+	}
+
+	bool Failed(std::wstring &rstrErrorInfo)
+	{
+		rstrErrorInfo = _com_error(_hres).ErrorMessage();
+		End();
+		return false;
+	}
+
+	CWmiDiskEnumerator(const CWmiDiskEnumerator&);
+	CWmiDiskEnumerator &operator=(const CWmiDiskEnumerator&);
+
+  public:
+	CWmiDiskEnumerator(void) : _pLoc(NULL), _pSvc(NULL), _pEnumerator(NULL), _hres(S_OK), _nBatched(0), _nBatchNext(0)
+	{
+	}
+
+	virtual ~CWmiDiskEnumerator()
+	{
+		End();
+	}
+
+	virtual bool Begin(std::wstring &rstrErrorInfo, const TEnumerationQuery &rQuery)
+	{
+		TRACE(L"CWmiDiskEnumerator::Begin\n");
+		End();
+		rstrErrorInfo.clear();
+		_sQuery = rQuery;
+		_vBatch.resize(_sQuery.nBatchSize);
+
+		// Process-wide COM security belongs to the host (see PlatformInitializeSecurity); the
+		// proxy blanket below is all the enumeration itself requires.
+
+		// Obtain the initial locator to WMI 
+		_hres = CoCreateInstance(
+			CLSID_WbemLocator,             
+			0, 
+			CLSCTX_INPROC_SERVER, 
+			IID_IWbemLocator, (LPVOID *) &_pLoc);
+
+		if (FAILED(_hres))
+			return Failed(rstrErrorInfo);
+		ASSERT(_pLoc != NULL);
+
+		// Connect to the root\cimv2 namespace with
+		// the current user and obtain pointer _pSvc
+		// to make IWbemServices calls.
+		_hres = _pLoc->ConnectServer(
+			 _bstr_t(L"ROOT\\CIMV2"), // Object path of WMI namespace
+			 NULL,                    // User name. NULL = current user
+			 NULL,                    // User password. NULL = current
+			 0,                       // Locale. NULL indicates current
+			 NULL,                    // Security flags.
+			 0,                       // Authority (e.g. Kerberos)
+			 0,                       // Context object 
+			 &_pSvc                   // pointer to IWbemServices proxy
+			 );
+
+		if (FAILED(_hres))
+			::_com_issue_errorex(_hres, _pLoc, __uuidof(_pLoc));
+		ASSERT(_pSvc != NULL);
+
+		// Set security levels on the proxy
+		_hres = CoSetProxyBlanket(
+		   _pSvc,                       // Indicates the proxy to set
+		   RPC_C_AUTHN_WINNT,           // RPC_C_AUTHN_xxx
+		   RPC_C_AUTHZ_NONE,            // RPC_C_AUTHZ_xxx
+		   NULL,                        // Server principal name 
+		   RPC_C_AUTHN_LEVEL_CALL,      // RPC_C_AUTHN_LEVEL_xxx 
+		   RPC_C_IMP_LEVEL_IMPERSONATE, // RPC_C_IMP_LEVEL_xxx
+		   NULL,                        // client identity
+		   EOAC_NONE                    // proxy capabilities 
+		);
+
+		if (FAILED(_hres))
+			return Failed(rstrErrorInfo);
+
+		// Use the IWbemServices pointer to make requests of WMI
+		// Get a list of the attached Disk Drives
+		_hres = _pSvc->ExecQuery(bstr_t("WQL"), 
+								 QueryText(_sQuery),
+								 WBEM_FLAG_FORWARD_ONLY | WBEM_FLAG_RETURN_IMMEDIATELY, 
+								 NULL,
+								 &_pEnumerator);
+
+		if (FAILED(_hres))
+			return Failed(rstrErrorInfo);
+		return true;
+	}
+
+	virtual bool Next(std::wstring &rstrErrorInfo, TDiskDeviceAttributes &rAttributes)
+	{
+		TRACE(L"CWmiDiskEnumerator::Next\n");
+		IWbemClassObject *pclsObj = NULL;
+		ULONG uReturn = 0;
+		unsigned int nValue = 0;
+		VARIANT vtDeviceID, vtInterfaceType, vtBytesPerSector, vtSCSIBus, vtSCSILogicalUnit, vtSCSIPort, vtSCSITargetId, vtModel, vtSerialNumber;
+
+		rstrErrorInfo.clear();
+		if (!_pEnumerator)
+			return false;
+
+		// Retrieve the next batch once the current is consumed; WBEM_S_FALSE with fewer than
+		// requested marks the last.
+		if (_nBatchNext == _nBatched)
+		{
+			_nBatched = _nBatchNext = 0;
+			_hres = _pEnumerator->Next(WBEM_INFINITE, _sQuery.nBatchSize, &_vBatch[0], &uReturn);
+			if (0 == uReturn)
+			{
+				if (FAILED(_hres))
+					rstrErrorInfo = _com_error(_hres).ErrorMessage();
+				else
+					_hres = S_OK;
+				return false;
+			}
+			_nBatched = uReturn;
+		}
+		pclsObj = _vBatch[_nBatchNext++];
+		ASSERT(pclsObj != NULL);
+
+		::VariantInit(&vtDeviceID);
+		::VariantInit(&vtInterfaceType);
+		::VariantInit(&vtBytesPerSector);
+		::VariantInit(&vtSCSIBus);
+		::VariantInit(&vtSCSILogicalUnit);
+		::VariantInit(&vtSCSIPort);
+		::VariantInit(&vtSCSITargetId);
+		::VariantInit(&vtModel);
+		::VariantInit(&vtSerialNumber);
+
+		// Properties outside the projection are absent (VT_EMPTY), and those the provider has no
+		// value for are VT_NULL, either leaving the defaults.
+		pclsObj->Get(L"DeviceID", 0, &vtDeviceID, 0, 0);
+		if (_sQuery.Wants(eDiskFieldInterfaceType))
+			pclsObj->Get(L"InterfaceType", 0, &vtInterfaceType, 0, 0);
+		if (_sQuery.Wants(eDiskFieldBytesPerSector))
+			pclsObj->Get(L"BytesPerSector", 0, &vtBytesPerSector, 0, 0);
+		if (_sQuery.Wants(eDiskFieldSCSIBus))
+			pclsObj->Get(L"SCSIBus", 0, &vtSCSIBus, 0, 0);
+		if (_sQuery.Wants(eDiskFieldSCSILogicalUnit))
+			pclsObj->Get(L"SCSILogicalUnit", 0, &vtSCSILogicalUnit, 0, 0);
+		if (_sQuery.Wants(eDiskFieldSCSIPort))
+			pclsObj->Get(L"SCSIPort", 0, &vtSCSIPort, 0, 0);
+		if (_sQuery.Wants(eDiskFieldSCSITargetId))
+			pclsObj->Get(L"SCSITargetId", 0, &vtSCSITargetId, 0, 0);
+		if (_sQuery.Wants(eDiskFieldModel))
+			pclsObj->Get(L"Model", 0, &vtModel, 0, 0);
+		if (_sQuery.Wants(eDiskFieldSerialNumber))
+			pclsObj->Get(L"SerialNumber", 0, &vtSerialNumber, 0, 0);
+		
+		TRACE(L"DeviceID=%ws\n", (vtDeviceID.vt == VT_BSTR) ? vtDeviceID.bstrVal : L"");
+		// TODO: Obtain any other WMI device info from the pclsObj
+
+		rAttributes = TDiskDeviceAttributes();
+		rAttributes.strDeviceID = (vtDeviceID.vt == VT_BSTR) ? vtDeviceID.bstrVal : L"";
+		rAttributes.strInterfaceType = (vtInterfaceType.vt == VT_BSTR) ? vtInterfaceType.bstrVal : L"";
+		if (::WmiUnsignedProperty(vtBytesPerSector, nValue))
+			rAttributes.nBytesPerSector = nValue;
+		if (::WmiUnsignedProperty(vtSCSIBus, nValue))
+			rAttributes.nSCSIBus = (unsigned short)nValue;
+		if (::WmiUnsignedProperty(vtSCSILogicalUnit, nValue))
+			rAttributes.nSCSILogicalUnit = (unsigned short)nValue;
+		if (::WmiUnsignedProperty(vtSCSIPort, nValue))
+			rAttributes.nSCSIPort = (unsigned short)nValue;
+		if (::WmiUnsignedProperty(vtSCSITargetId, nValue))
+			rAttributes.nSCSITargetId = (unsigned short)nValue;
+		rAttributes.strModel = (vtModel.vt == VT_BSTR) ? vtModel.bstrVal : L"";
+		rAttributes.strSerialNumber = (vtSerialNumber.vt == VT_BSTR) ? vtSerialNumber.bstrVal : L"";
+
+		::VariantClear(&vtDeviceID);
+		::VariantClear(&vtInterfaceType);
+		::VariantClear(&vtBytesPerSector);
+		::VariantClear(&vtSCSIBus);
+		::VariantClear(&vtSCSILogicalUnit);
+		::VariantClear(&vtSCSIPort);
+		::VariantClear(&vtSCSITargetId);
+		::VariantClear(&vtModel);
+		::VariantClear(&vtSerialNumber);
+ 		pclsObj->Release();
+		return true;
+	}
+
+	virtual void End(void)
+	{
+		ReleaseBatch();
+		if (_pSvc)
+			_pSvc->Release();
+		if (_pLoc)
+			_pLoc->Release();
+		if (_pEnumerator)
+			_pEnumerator->Release();
+		_pSvc = NULL;
+		_pLoc = NULL;
+		_pEnumerator = NULL;
+	}
+
+	inline HRESULT Result(void) const
+		{ return _hres; }
+};	// CWmiDiskEnumerator
+
+
+pCDiskDrive OpenDiskDrive(const TDiskDeviceAttributes &rAttributes)
+{
+	TRACE(L"OpenDiskDrive\n");
+	_bstr_t bstrDeviceID(rAttributes.strDeviceID.c_str());
+	_bstr_t bstrInterfaceType(rAttributes.strInterfaceType.c_str());
+	pCDiskDrive pInfo = NULL;
+
+	// Open a HANDLE to the device object.
+	HANDLE hDevice = CreateFile(rAttributes.strDeviceID.c_str(),
+                               GENERIC_READ | GENERIC_WRITE,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE,
+                               NULL,
+                               OPEN_EXISTING,
+                               FILE_FLAG_NO_BUFFERING,
+                               NULL);
+
+	if (hDevice == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (rAttributes.strInterfaceType == L"USB")
+		pInfo = reinterpret_cast<pCDiskDrive>(new CDiskDrive<IUsbInterface>(
+				bstrDeviceID, 
+				bstrInterfaceType, 
+				hDevice,
+				rAttributes.nBytesPerSector,
+				rAttributes.nSCSIBus,
+				rAttributes.nSCSILogicalUnit,
+				rAttributes.nSCSIPort,
+				rAttributes.nSCSITargetId));
+	else if (rAttributes.strInterfaceType == L"IDE")
+		pInfo = reinterpret_cast<pCDiskDrive>(new CDiskDrive<IAtaInterface>(
+				bstrDeviceID, 
+				bstrInterfaceType, 
+				hDevice,
+				rAttributes.nBytesPerSector,
+				rAttributes.nSCSIBus,
+				rAttributes.nSCSILogicalUnit,
+				rAttributes.nSCSIPort,
+				rAttributes.nSCSITargetId));
+	else
+		pInfo = reinterpret_cast<pCDiskDrive>(new CDiskDrive<IUnsupportedInterface>(
+				bstrDeviceID, 
+				bstrInterfaceType, 
+				hDevice,
+				rAttributes.nBytesPerSector,
+				rAttributes.nSCSIBus,
+				rAttributes.nSCSILogicalUnit,
+				rAttributes.nSCSIPort,
+				rAttributes.nSCSITargetId));
+	return pInfo;
+}
+
+
+HRESULT GetDiskDriveDevices(TListDiskDrives &rList, TEnumerationStats *pStats, const TDiskFilter *pFilter)
+{
+	TRACE(L"GetDiskDriveDevices\n");
+	unsigned long long nStart = ::EnumerationClockUs();
+	CWmiDiskEnumerator enumerator;
+	TDiskDeviceAttributes sAttributes;
+	std::wstring strErrorInfo;
+	HRESULT hres = S_OK;
+	TEnumerationQuery sQuery(eDiskFieldsOpen, DISK_ENUM_DEFAULT_BATCH, pFilter);
+	bool bres = enumerator.Begin(strErrorInfo, sQuery);
+
+	if (pStats)
+		pStats->nBeginUs = ::EnumerationClockUs() - nStart;
+	while ((bres) && (enumerator.Next(strErrorInfo, sAttributes)))
+	{
+		// Unselected devices are neither opened nor identified.
+		if (!sQuery.Selects(sAttributes))
+		{
+			if (pStats)
+				pStats->nFiltered++;
+			continue;
+		}
+		if ((pStats) && (pStats->nDrives++ == 0))
+			pStats->nFirstDriveUs = ::EnumerationClockUs() - nStart;
+
+		// Cache the new CDiskDrive object.
+		pCDiskDrive pInfo = ::OpenDiskDrive(sAttributes);
+		if (pInfo)
+		{
+			rList.push_back(pInfo);
+			if ((pStats) && (pStats->nFirstOpenUs == 0))
+				pStats->nFirstOpenUs = ::EnumerationClockUs() - nStart;
+		}
+	}
+	hres = enumerator.Result();
+	enumerator.End();
+
+	if (pStats)
+		pStats->nTotalUs = ::EnumerationClockUs() - nStart;
+	return hres;
+}
+
+
+bool ProbeDiskDevice(const std::wstring &strDeviceID, TDiskDeviceAttributes &rAttributes)
+{
+	TRACE(L"ProbeDiskDevice\n");
+	BYTE abyDescriptor[1024];
+	STORAGE_PROPERTY_QUERY sQuery;
+	SCSI_ADDRESS sAddress;
+	DISK_GEOMETRY sGeometry;
+	DWORD dwReturned = 0;
+
+	// No access rights are required for these queries, nor do they disturb the device.
+	HANDLE hDevice = ::CreateFile(strDeviceID.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hDevice == INVALID_HANDLE_VALUE)
+		return false;
+
+	rAttributes = TDiskDeviceAttributes();
+	rAttributes.strDeviceID = strDeviceID;
+	rAttributes.strInterfaceType = L"SCSI";
+
+	// Map the storage bus type to the Win32_DiskDrive InterfaceType.
+	memset(&sQuery, 0, sizeof(sQuery));
+	sQuery.PropertyId = StorageDeviceProperty;
+	sQuery.QueryType = PropertyStandardQuery;
+	if (::DeviceIoControl(hDevice, IOCTL_STORAGE_QUERY_PROPERTY, &sQuery, sizeof(sQuery), abyDescriptor, sizeof(abyDescriptor), &dwReturned, NULL))
+	{
+		switch (((STORAGE_DEVICE_DESCRIPTOR*)abyDescriptor)->BusType)
+		{
+		case BusTypeUsb:	rAttributes.strInterfaceType = L"USB";	break;
+		case BusTypeAta:
+		case BusTypeSata:	rAttributes.strInterfaceType = L"IDE";	break;
+		case BusType1394:	rAttributes.strInterfaceType = L"1394";	break;
+		default:			break;
+		}
+	}
+	if (::DeviceIoControl(hDevice, IOCTL_SCSI_GET_ADDRESS, NULL, 0, &sAddress, sizeof(sAddress), &dwReturned, NULL))
+	{
+		rAttributes.nSCSIPort = sAddress.PortNumber;
+		rAttributes.nSCSIBus = sAddress.PathId;
+		rAttributes.nSCSITargetId = sAddress.TargetId;
+		rAttributes.nSCSILogicalUnit = sAddress.Lun;
+	}
+	if (::DeviceIoControl(hDevice, IOCTL_DISK_GET_DRIVE_GEOMETRY, NULL, 0, &sGeometry, sizeof(sGeometry), &dwReturned, NULL))
+		rAttributes.nBytesPerSector = sGeometry.BytesPerSector;
+
+	::CloseHandle(hDevice);
+	return true;
+}
+
+
+//  The CDeviceNotificationSource class receives disk interface arrival and removal notifications
+//  (i.e. WM_DEVICECHANGE) on a message-only window owned by its own thread.  Arrivals are named
+//  by interface path, which is mapped to \\.\PHYSICALDRIVEn by IOCTL_STORAGE_GET_DEVICE_NUMBER
+//  and remembered, so that a later removal of that interface may be named too.  Removal of a disk
+//  that arrived before Begin is reported with an empty strDeviceID.
+//
+//		see:	"Registering for Device Notification" in the Windows SDK documentation.
+
+static const GUID GUID_DiskInterface = { 0x53F56307, 0xB6BF, 0x11D0, { 0x94, 0xF2, 0x00, 0xA0, 0xC9, 0x1E, 0xFB, 0x8B } };	// GUID_DEVINTERFACE_DISK
+static const wchar_t *pszNotificationClass = L"DriveTrustDeviceNotification";
+
+class CDeviceNotificationSource : public IDeviceEventSource
+{
+  private:
+	HANDLE								_hThread;
+	DWORD								_dwThreadId;
+	HANDLE								_hReady;		// The window is registered (or failed to be)
+	HANDLE								_hQueued;		// Semaphore counting _queueEvents
+	CRITICAL_SECTION					_critQueue;
+	std::deque<TDeviceEvent>			_queueEvents;
+	std::map<std::wstring, std::wstring>	_mapInterfaces;	// Interface path -> \\.\PHYSICALDRIVEn
+	std::wstring						_strError;
+
+	CDeviceNotificationSource(const CDeviceNotificationSource&);
+	CDeviceNotificationSource &operator=(const CDeviceNotificationSource&);
+
+	void Queue(const TDeviceEvent &rEvent)
+	{
+		::EnterCriticalSection(&_critQueue);
+		_queueEvents.push_back(rEvent);
+		::LeaveCriticalSection(&_critQueue);
+		::ReleaseSemaphore(_hQueued, 1, NULL);
+	}
+
+	void OnDeviceChange(WPARAM wParam, const DEV_BROADCAST_DEVICEINTERFACE *pInterface)
+	{
+		TDeviceEvent sEvent;
+		std::wstring strInterface = pInterface->dbcc_name;
+
+		if (wParam == DBT_DEVICEARRIVAL)
+		{
+			STORAGE_DEVICE_NUMBER sNumber;
+			DWORD dwReturned = 0;
+			HANDLE hDevice = ::CreateFile(strInterface.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+
+			if (hDevice == INVALID_HANDLE_VALUE)
+				return;
+			if (::DeviceIoControl(hDevice, IOCTL_STORAGE_GET_DEVICE_NUMBER, NULL, 0, &sNumber, sizeof(sNumber), &dwReturned, NULL))
+			{
+				sEvent.eType = eDeviceAdded;
+				sEvent.strDeviceID = ::BuildMessage(L"\\\\.\\PHYSICALDRIVE%u", sNumber.DeviceNumber);
+				_mapInterfaces[strInterface] = sEvent.strDeviceID;
+				Queue(sEvent);
+			}
+			::CloseHandle(hDevice);
+		}
+		else if (wParam == DBT_DEVICEREMOVECOMPLETE)
+		{
+			std::map<std::wstring, std::wstring>::iterator iter = _mapInterfaces.find(strInterface);
+			sEvent.eType = eDeviceRemoved;
+			if (iter != _mapInterfaces.end())
+			{
+				sEvent.strDeviceID = iter->second;
+				_mapInterfaces.erase(iter);
+			}
+			Queue(sEvent);
+		}
+	}
+
+	static LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+	{
+		CDeviceNotificationSource *pThis = reinterpret_cast<CDeviceNotificationSource*>(::GetWindowLongPtr(hWnd, GWLP_USERDATA));
+		const DEV_BROADCAST_HDR *pHeader = reinterpret_cast<const DEV_BROADCAST_HDR*>(lParam);
+
+		if ((uMsg == WM_DEVICECHANGE) && (pThis) && (pHeader) && (pHeader->dbch_devicetype == DBT_DEVTYP_DEVICEINTERFACE))
+		{
+			pThis->OnDeviceChange(wParam, reinterpret_cast<const DEV_BROADCAST_DEVICEINTERFACE*>(pHeader));
+			return TRUE;
+		}
+		return ::DefWindowProc(hWnd, uMsg, wParam, lParam);
+	}
+
+	static unsigned __stdcall NotificationThread(void *pvContext)
+	{
+		CDeviceNotificationSource *pThis = reinterpret_cast<CDeviceNotificationSource*>(pvContext);
+		DEV_BROADCAST_DEVICEINTERFACE sFilter;
+		HDEVNOTIFY hNotify = NULL;
+		WNDCLASSEX sClass;
+		HWND hWnd = NULL;
+		MSG sMsg;
+
+		memset(&sClass, 0, sizeof(sClass));
+		sClass.cbSize = sizeof(sClass);
+		sClass.lpfnWndProc = WindowProc;
+		sClass.hInstance = ::GetModuleHandle(NULL);
+		sClass.lpszClassName = pszNotificationClass;
+		::RegisterClassEx(&sClass);		// (fails harmlessly if already registered)
+
+		hWnd = ::CreateWindowEx(0, pszNotificationClass, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, sClass.hInstance, NULL);
+		if (hWnd)
+		{
+			::SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)pThis);
+			memset(&sFilter, 0, sizeof(sFilter));
+			sFilter.dbcc_size = sizeof(sFilter);
+			sFilter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+			sFilter.dbcc_classguid = GUID_DiskInterface;
+			hNotify = ::RegisterDeviceNotification(hWnd, &sFilter, DEVICE_NOTIFY_WINDOW_HANDLE);
+		}
+		if (!hNotify)
+		{
+			_bstr_t bstrErrorInfo;
+			TranslateErrorCode(::GetLastError(), bstrErrorInfo);
+			pThis->_strError = (const wchar_t*)bstrErrorInfo;
+			if (hWnd)
+				::DestroyWindow(hWnd);
+			::SetEvent(pThis->_hReady);
+			return 1;
+		}
+		::SetEvent(pThis->_hReady);
+
+		while (::GetMessage(&sMsg, NULL, 0, 0) > 0)
+		{
+			::TranslateMessage(&sMsg);
+			::DispatchMessage(&sMsg);
+		}
+		::UnregisterDeviceNotification(hNotify);
+		::DestroyWindow(hWnd);
+		return 0;
+	}
+
+  public:
+	CDeviceNotificationSource(void) : _hThread(NULL), _dwThreadId(0)
+	{
+		_hReady = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+		_hQueued = ::CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+		::InitializeCriticalSection(&_critQueue);
+	}
+
+	virtual ~CDeviceNotificationSource()
+	{
+		End();
+		::CloseHandle(_hReady);
+		::CloseHandle(_hQueued);
+		::DeleteCriticalSection(&_critQueue);
+	}
+
+	virtual bool Begin(std::wstring &rstrErrorInfo)
+	{
+		TRACE(L"CDeviceNotificationSource::Begin\n");
+		unsigned nThreadId = 0;
+
+		End();
+		rstrErrorInfo.clear();
+		_strError.clear();
+		::ResetEvent(_hReady);
+		_hThread = (HANDLE)::_beginthreadex(NULL, 0, NotificationThread, this, 0, &nThreadId);
+		if (!_hThread)
+		{
+			rstrErrorInfo = L"CDeviceNotificationSource::Begin : Unable to start the notification thread.";
+			return false;
+		}
+		_dwThreadId = nThreadId;
+		::WaitForSingleObject(_hReady, INFINITE);
+		if (!_strError.empty())
+		{
+			rstrErrorInfo = L"CDeviceNotificationSource::Begin : RegisterDeviceNotification : " + _strError;
+			End();
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool Wait(std::wstring &rstrErrorInfo, TDeviceEvent &rEvent, unsigned int nTimeoutMs)
+	{
+		rstrErrorInfo.clear();
+		if ((!_hThread) || (::WaitForSingleObject(_hQueued, nTimeoutMs) != WAIT_OBJECT_0))
+			return false;
+
+		::EnterCriticalSection(&_critQueue);
+		rEvent = _queueEvents.front();
+		_queueEvents.pop_front();
+		::LeaveCriticalSection(&_critQueue);
+		return true;
+	}
+
+	virtual void End(void)
+	{
+		if (_hThread)
+		{
+			::PostThreadMessage(_dwThreadId, WM_QUIT, 0, 0);
+			::WaitForSingleObject(_hThread, INFINITE);
+			::CloseHandle(_hThread);
+			_hThread = NULL;
+			_dwThreadId = 0;
+		}
+	}
+};	// CDeviceNotificationSource
+
+
+IDeviceEventSource *CreateDeviceEventSource(void)
+{
+	return new CDeviceNotificationSource();
+}
+
+
+IDiskEnumerator *CreateDiskEnumerator(void)
+{
+	return new CWmiDiskEnumerator();
+}
@@ -0,0 +1,197 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "BusError.h"
+
+
+//  Retry of failed bus operations (see CDiskDrive), decided from the decoded failure (see
+//  BusError.h).  A transient failure (e.g. a unit attention after a bus reset, an interface CRC
+//  error, a busy bridge) is retried after an exponential backoff, up to the policy's attempts.
+//  A permanent one (e.g. a command the drive aborts as unsupported, an illegal request, a device
+//  no longer connected) fails at once, so that a dead path costs one attempt.  Each drive also
+//  holds a budget of retries, restored at one per refill interval, so that a drive failing every
+//  command stops being retried well before it would stall an inventory run.
+//
+//  Only repeatable operations are retried : IDENTIFY, a lone IF-RECV, and a Transmit whose
+//  IF-SEND the drive definitely refused (see RetryClassifyRefusal).  Once an IF-SEND is accepted
+//  the TPer's session state has moved on, and a failure of its response is returned as is.
+//
+//		see:	T13 ATA8-ACS, section 6.2 (the Error register)
+//				T10 SPC-3, section 4.5.6 (sense key and additional sense code)
+//
+
+#define RETRY_DEFAULT_ATTEMPTS		3			// Per operation, the first included
+#define RETRY_DEFAULT_BASE_MS		50			// Delay before the first retry, doubled for each after
+#define RETRY_DEFAULT_MAX_MS		2000
+#define RETRY_DEFAULT_BUDGET		16			// Retries a drive may spend at once
+#define RETRY_DEFAULT_REFILL_MS		30000		// One retry restored per interval
+#define RETRY_NEVER					((DWORD)-1)
+
+enum ERetryClass
+{
+	eRetryPermanent = 0,
+	eRetryTransient,
+};
+
+// The process's policy, set (e.g. from the command line, see -y) before drives are used.
+typedef struct TRetryPolicy
+{
+	unsigned int	nMaxAttempts;			// 1 = never retry
+	unsigned int	nBaseDelayMs;
+	unsigned int	nMaxDelayMs;
+	unsigned int	nDriveBudget;			// 0 = unlimited
+	unsigned int	nBudgetRefillMs;		// 0 = never restored
+
+	TRetryPolicy(void) : nMaxAttempts(RETRY_DEFAULT_ATTEMPTS), nBaseDelayMs(RETRY_DEFAULT_BASE_MS), nMaxDelayMs(RETRY_DEFAULT_MAX_MS),
+						 nDriveBudget(RETRY_DEFAULT_BUDGET), nBudgetRefillMs(RETRY_DEFAULT_REFILL_MS) {}
+
+	// The delay before attempt nAttempt + 1 : the exponential delay, of which the upper half is
+	// jittered by nSeed (e.g. the drive), so that drives of one bus failing together do not
+	// retry together.
+	DWORD BackoffMs(unsigned int nAttempt, unsigned int nSeed) const
+	{
+		unsigned __int64 nDelay = (unsigned __int64)nBaseDelayMs << ((nAttempt < 32) ? (nAttempt - 1) : 31);
+		if (nDelay > nMaxDelayMs)
+			nDelay = nMaxDelayMs;
+		unsigned int nHalf = (unsigned int)(nDelay / 2);
+		unsigned int nHash = (nSeed ^ (nAttempt * 0x9E3779B9)) * 0x85EBCA6B;
+		return (DWORD)(nDelay - nHalf + ((nHash >> 16) % (nHalf + 1)));
+	}
+} TRetryPolicy;
+
+inline TRetryPolicy &RetryPolicy(void)
+{
+	static TRetryPolicy s_policy;
+	return s_policy;
+}
+
+
+// A drive's retries available, restored over time (see TRetryPolicy::nBudgetRefillMs).
+typedef struct TRetryBudget
+{
+	unsigned int		nTokens;
+	unsigned __int64	nRefillMs;			// GetTickCount64 of the last refill, 0 before the first retry
+
+	TRetryBudget(void) : nTokens(0), nRefillMs(0) {}
+
+	bool Take(const TRetryPolicy &rPolicy, unsigned __int64 nNowMs)
+	{
+		if (rPolicy.nDriveBudget == 0)
+			return true;
+		if (nRefillMs == 0)
+		{
+			nTokens = rPolicy.nDriveBudget;
+			nRefillMs = nNowMs;
+		}
+		else if ((rPolicy.nBudgetRefillMs) && (nNowMs > nRefillMs) && ((nNowMs - nRefillMs) >= rPolicy.nBudgetRefillMs))
+		{
+			unsigned __int64 nRefills = (nNowMs - nRefillMs) / rPolicy.nBudgetRefillMs;
+			nTokens = ((nTokens + nRefills) < rPolicy.nDriveBudget) ? (nTokens + (unsigned int)nRefills) : rPolicy.nDriveBudget;
+			nRefillMs += nRefills * rPolicy.nBudgetRefillMs;
+		}
+		if (nTokens == 0)
+			return false;
+		nTokens--;
+		return true;
+	}
+} TRetryBudget;
+
+
+// The retry decisions made for a drive.
+typedef struct TBusRetryStats
+{
+	unsigned int	nRetries;				// Attempts repeated after a transient failure
+	unsigned int	nRecovered;				// Operations succeeding on a retry
+	unsigned int	nPermanent;				// Failures not retried, being permanent
+	unsigned int	nExhausted;				// Transient failures still failing at the last attempt
+	unsigned int	nBudgetDenied;			// Retries refused, the drive's budget spent
+	unsigned int	nBackoffMs;				// Total delay before retries
+
+	TBusRetryStats(void) : nRetries(0), nRecovered(0), nPermanent(0), nExhausted(0), nBudgetDenied(0), nBackoffMs(0) {}
+} TBusRetryStats;
+
+
+// ATA Error register : an interface CRC error or a media change is worth a retry; an abort (e.g.
+// an unsupported command), an uncorrectable read or a missing address is not.
+inline ERetryClass RetryClassifyAta(BYTE byError)
+{
+	if (byError & 0x80)						// ICRC
+		return eRetryTransient;
+	if (byError & (0x04 | 0x10 | 0x40))		// ABRT, IDNF, UNC
+		return eRetryPermanent;
+	if (byError & (0x20 | 0x08))			// MC, MCR
+		return eRetryTransient;
+	return eRetryPermanent;
+}
+
+inline ERetryClass RetryClassify(const TBusError &rError)
+{
+	switch (rError.byPhase)
+	{
+	case eBusPhaseDeviceIo:
+		switch (rError.dwOsError)
+		{
+		case ERROR_NOT_READY:
+		case ERROR_BUSY:
+		case ERROR_SEM_TIMEOUT:
+		case ERROR_IO_DEVICE:
+		case ERROR_CRC:
+		case ERROR_GEN_FAILURE:
+		case ERROR_RETRY:
+		case ERROR_MEDIA_CHANGED:
+		case ERROR_BUS_RESET:
+		case ERROR_NO_SYSTEM_RESOURCES:
+			return eRetryTransient;
+		}
+		return eRetryPermanent;				// e.g. ERROR_INVALID_FUNCTION, ERROR_DEVICE_NOT_CONNECTED
+
+	case eBusPhaseAtaStatus:
+		return RetryClassifyAta(rError.byAtaError);
+
+	case eBusPhaseScsiStatus:
+		if ((rError.byScsiStatus == 0x08) || (rError.byScsiStatus == 0x28))		// BUSY, TASK SET FULL
+			return eRetryTransient;
+		if (rError.byAtaStatus & 0x01)		// The bridge returned the drive's registers, ERR set
+			return RetryClassifyAta(rError.byAtaError);
+		switch (rError.bySenseKey)
+		{
+		case 0x02:							// NOT READY, unless no medium or intervention required
+			return ((rError.byAsc == 0x3A) || ((rError.byAsc == 0x04) && (rError.byAscq == 0x03))) ? eRetryPermanent : eRetryTransient;
+		case 0x06:							// UNIT ATTENTION (e.g. ASC 29h, a reset)
+		case 0x0B:							// ABORTED COMMAND
+			return eRetryTransient;
+		}
+		return eRetryPermanent;				// e.g. ILLEGAL REQUEST, MEDIUM ERROR, HARDWARE ERROR
+	}
+	return eRetryPermanent;					// Arguments, protocol errors, TPer timeouts, and a sector corrupt
+											// when re-read (CDiskDrive::QueryIdentifySector's one re-read is its retry)
+}
+
+// As above, for a command that must not be repeated once the drive may have accepted it (an
+// IF-SEND) : transient only when the failure shows the command was not executed.  A busy or not
+// ready device, a unit attention, or an abort for an interface CRC error qualifies; a timeout
+// or an I/O error does not, the TPer having perhaps taken the command before it failed.
+inline ERetryClass RetryClassifyRefusal(const TBusError &rError)
+{
+	switch (rError.byPhase)
+	{
+	case eBusPhaseDeviceIo:
+		return ((rError.dwOsError == ERROR_NOT_READY) || (rError.dwOsError == ERROR_BUSY)) ? eRetryTransient : eRetryPermanent;
+
+	case eBusPhaseAtaStatus:
+		return ((rError.byAtaError & 0x04) && (rError.byAtaError & 0x80)) ? eRetryTransient : eRetryPermanent;		// ABRT with ICRC
+
+	case eBusPhaseScsiStatus:
+		if ((rError.byScsiStatus == 0x08) || (rError.byScsiStatus == 0x28))		// BUSY, TASK SET FULL
+			return eRetryTransient;
+		if (rError.byAtaStatus & 0x01)
+			return ((rError.byAtaError & 0x04) && (rError.byAtaError & 0x80)) ? eRetryTransient : eRetryPermanent;
+		if ((rError.bySenseKey == 0x02) || (rError.bySenseKey == 0x06))			// NOT READY, UNIT ATTENTION
+			return ::RetryClassify(rError);
+		return eRetryPermanent;				// e.g. ABORTED COMMAND, perhaps after the data was taken
+	}
+	return eRetryPermanent;
+}
@@ -0,0 +1,129 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "DiskEnumerator.h"
+#include <stdio.h>
+
+
+//  The CSimulatedDiskEnumerator class produces synthetic drives at a modelled cost, so that the
+//  enumeration path and its benchmark may be exercised without hardware or a WMI service (e.g. on
+//  a build machine).  The cost model follows a management query :
+//
+//		nConnectUs			once per Begin (i.e. locator, connection and query setup)
+//		nRoundTripUs		once per batch of drives retrieved
+//		nFieldUs			per attribute per drive, nAllFields attributes if unprojected
+//
+//  Costs are spent busy waiting on EnumerationClockUs rather than sleeping, since the scheduler
+//  quantum would otherwise dwarf them.  Drives are named \\.\SIMULATEDn and are not openable.
+//
+
+typedef struct TSimulatedCosts
+{
+	unsigned int		nConnectUs;
+	unsigned int		nRoundTripUs;
+	unsigned int		nFieldUs;
+	unsigned int		nAllFields;				// Attribute count of an unprojected query
+
+	// Defaults roughly in proportion to a local Win32_DiskDrive query (of some 50 properties).
+	TSimulatedCosts(void) : nConnectUs(20000), nRoundTripUs(2000), nFieldUs(40), nAllFields(50) {}
+} TSimulatedCosts;
+
+
+class CSimulatedDiskEnumerator : public IDiskEnumerator
+{
+  private:
+	unsigned int		_nDrives;
+	TSimulatedCosts		_sCosts;
+	TEnumerationQuery	_sQuery;
+	unsigned int		_nNext;					// Next drive, _nDrives once exhausted
+	unsigned int		_nBatched;				// Drives remaining of the current batch
+	bool				_bStarted;
+
+	static void Spend(unsigned long long nUs)
+	{
+		unsigned long long nUntil = EnumerationClockUs() + nUs;
+		while (EnumerationClockUs() < nUntil)
+			;
+	}
+
+	unsigned int FieldCount(void) const
+	{
+		unsigned int nCount = 0;
+
+		if (_sQuery.nFields == eDiskFieldsAll)
+			return _sCosts.nAllFields;
+		for (unsigned int nBits = _sQuery.nFields & eDiskFieldsOpen; nBits; nBits &= (nBits - 1))
+			nCount++;
+		return nCount;
+	}
+
+	CSimulatedDiskEnumerator(const CSimulatedDiskEnumerator&);
+	CSimulatedDiskEnumerator &operator=(const CSimulatedDiskEnumerator&);
+
+  public:
+	CSimulatedDiskEnumerator(unsigned int nDrives, const TSimulatedCosts &rCosts = TSimulatedCosts())
+		: _nDrives(nDrives), _sCosts(rCosts), _nNext(0), _nBatched(0), _bStarted(false)
+	{
+	}
+
+	virtual ~CSimulatedDiskEnumerator()
+	{
+		End();
+	}
+
+	virtual bool Begin(std::wstring &rstrErrorInfo, const TEnumerationQuery &rQuery)
+	{
+		End();
+		rstrErrorInfo.clear();
+		_sQuery = rQuery;
+		_nNext = 0;
+		_nBatched = 0;
+		Spend(_sCosts.nConnectUs);
+		_bStarted = true;
+		return true;
+	}
+
+	virtual bool Next(std::wstring &rstrErrorInfo, TDiskDeviceAttributes &rAttributes)
+	{
+		wchar_t szDeviceID[32], szSerialNumber[16];
+
+		rstrErrorInfo.clear();
+		if ((!_bStarted) || (_nNext >= _nDrives))
+			return false;
+
+		// A batch is retrieved (and paid for) as a whole.
+		if (_nBatched == 0)
+		{
+			_nBatched = ((_nDrives - _nNext) < _sQuery.nBatchSize) ? (_nDrives - _nNext) : _sQuery.nBatchSize;
+			Spend(_sCosts.nRoundTripUs + ((unsigned long long)_sCosts.nFieldUs * FieldCount() * _nBatched));
+		}
+		_nBatched--;
+
+		swprintf(szDeviceID, sizeof(szDeviceID) / sizeof(szDeviceID[0]), L"\\\\.\\SIMULATED%u", _nNext);
+		rAttributes = TDiskDeviceAttributes();
+		rAttributes.strDeviceID = szDeviceID;
+		if (_sQuery.Wants(eDiskFieldInterfaceType))
+			rAttributes.strInterfaceType = ((_nNext % 4) == 3) ? L"USB" : L"IDE";
+		if (_sQuery.Wants(eDiskFieldSCSIPort))
+			rAttributes.nSCSIPort = (unsigned short)(_nNext / 8);
+		if (_sQuery.Wants(eDiskFieldSCSITargetId))
+			rAttributes.nSCSITargetId = (unsigned short)(_nNext % 8);
+		if (_sQuery.Wants(eDiskFieldModel))
+			rAttributes.strModel = ((_nNext % 4) == 3) ? L"SIMULATED USB DISK" : L"SIMULATED ATA DISK";
+		if (_sQuery.Wants(eDiskFieldSerialNumber))
+		{
+			swprintf(szSerialNumber, sizeof(szSerialNumber) / sizeof(szSerialNumber[0]), L"SIM%08u", _nNext);
+			rAttributes.strSerialNumber = szSerialNumber;
+		}
+		_nNext++;
+		return true;
+	}
+
+	virtual void End(void)
+	{
+		_bStarted = false;
+	}
+};	// CSimulatedDiskEnumerator
@@ -0,0 +1,200 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "IdentifySnapshot.h"
+#include <vector>
+
+
+//  Differences between two identify snapshots (see IdentifySnapshot.h), e.g. yesterday's and
+//  today's inventory : the drives which appeared, disappeared, or changed firmware, security
+//  state, capacity or other identify words.
+//
+//  Drives are joined on their world wide name, or where a drive reports none, on its serial
+//  number and model.  The earlier snapshot's keys are hashed into an open addressed table (linear
+//  probing, at most half full); each drive of the later snapshot then probes it once.  A key
+//  repeated within a snapshot (e.g. a drive seen through two paths) joins its occurrences in
+//  order.  Joined drives compare their sectors with AtaSectorDiff, so that an unchanged drive
+//  costs a 512 byte compare and its changes are classified from the differing words.  Only the
+//  changed drives are reported.  Both snapshots must hold every column joined, compared or
+//  reported (see Compare), else a missing one would read as empty and report false changes.
+//
+
+#define SNAPSHOT_DIFF_NONE			((unsigned __int64)-1)		// No such drive in a snapshot
+
+enum ESnapshotChange
+{
+	eSnapChangeNone				= 0x0000,
+	eSnapChangeAppeared			= 0x0001,		// Only in the later snapshot
+	eSnapChangeDisappeared		= 0x0002,		// Only in the earlier snapshot
+	eSnapChangeFirmware			= 0x0004,		// Words 23-26
+	eSnapChangeSecurity			= 0x0008,		// Word 128, or the trusted capabilities
+	eSnapChangeCapacity			= 0x0010,		// Words 60-61 and 100-103, or the logical sector size
+	eSnapChangeIdentify			= 0x0020,		// Any other word, bar the integrity word
+};
+
+typedef struct TSnapshotChange
+{
+	unsigned int		nChanges;				// ESnapshotChange bits
+	unsigned int		nWords;					// Identify words differing
+	unsigned __int64	nBefore;				// Drive index in the earlier snapshot, or SNAPSHOT_DIFF_NONE
+	unsigned __int64	nAfter;					// "" later ""
+} TSnapshotChange;
+
+typedef std::vector<TSnapshotChange> TSnapshotChanges;
+
+
+class CSnapshotDiff
+{
+  private:
+	typedef struct TSlot
+	{
+		unsigned __int64	nHash;
+		unsigned __int64	nDrive;				// Earlier snapshot index + 1, 0 if the slot is empty
+	} TSlot;
+
+	std::vector<TSlot>	_vSlots;
+	unsigned __int64	_nMask;
+
+	CSnapshotDiff(const CSnapshotDiff&);
+	CSnapshotDiff &operator=(const CSnapshotDiff&);
+
+	// The world wide name, mixed, else FNV-1a over the model, a NUL and the serial number.
+	static unsigned __int64 KeyHash(const CIdentifySnapshotReader &rSnapshot, unsigned __int64 n)
+	{
+		unsigned __int64 nWorldWideName = rSnapshot.WorldWideName(n);
+		if (nWorldWideName)
+			return nWorldWideName * 0x9E3779B97F4A7C15ULL;
+
+		unsigned __int64 nHash = 0xCBF29CE484222325ULL;
+		for (const unsigned char *p = (const unsigned char*)rSnapshot.Model(n); *p; p++)
+			nHash = (nHash ^ *p) * 0x100000001B3ULL;
+		nHash *= 0x100000001B3ULL;
+		for (const unsigned char *p = (const unsigned char*)rSnapshot.SerialNo(n); *p; p++)
+			nHash = (nHash ^ *p) * 0x100000001B3ULL;
+		return nHash;
+	}
+
+	static bool KeyEqual(const CIdentifySnapshotReader &rBefore, unsigned __int64 nBefore,
+						 const CIdentifySnapshotReader &rAfter, unsigned __int64 nAfter)
+	{
+		unsigned __int64 nWorldWideName = rBefore.WorldWideName(nBefore);
+		if (nWorldWideName != rAfter.WorldWideName(nAfter))
+			return false;
+		return ((nWorldWideName) || ((::strcmp(rBefore.SerialNo(nBefore), rAfter.SerialNo(nAfter)) == 0) &&
+									 (::strcmp(rBefore.Model(nBefore), rAfter.Model(nAfter)) == 0)));
+	}
+
+	// Classify the differences of a joined drive, eSnapChangeNone if there are none.
+	static unsigned int Compare(const CIdentifySnapshotReader &rBefore, unsigned __int64 nBefore,
+								const CIdentifySnapshotReader &rAfter, unsigned __int64 nAfter, unsigned int &rnWords)
+	{
+		const unsigned int nTrustedCaps = eSnapCapSecuritySupported | eSnapCapSecurityEnabled | eSnapCapSecurityLocked |
+										  eSnapCapSecurityFrozen | eSnapCapTrustedComputing | eSnapCapDriveTrust;
+		unsigned __int16 awMask[ATA_DISK_SECTOR_SIZE / 32];
+		unsigned int nChanges = eSnapChangeNone;
+
+		rnWords = ::AtaSectorDiff((const unsigned __int16*)rBefore.Sector(nBefore), (const unsigned __int16*)rAfter.Sector(nAfter), awMask);
+		if (rnWords == 0)
+			return eSnapChangeNone;
+
+		// Word w is bit (w % 16) of awMask[w / 16].
+		if (awMask[1] & 0x0780)										// 23-26
+			nChanges |= eSnapChangeFirmware;
+		if ((awMask[8] & 0x0001) ||									// 128
+			((rBefore.Capabilities(nBefore) ^ rAfter.Capabilities(nAfter)) & nTrustedCaps))
+			nChanges |= eSnapChangeSecurity;
+		if ((awMask[3] & 0x3000) || (awMask[6] & 0x00F0) ||			// 60-61, 100-103
+			(rBefore.LogicalSectorSize(nBefore) != rAfter.LogicalSectorSize(nAfter)))
+			nChanges |= eSnapChangeCapacity;
+
+		awMask[1] &= ~0x0780;
+		awMask[3] &= ~0x3000;
+		awMask[6] &= ~0x00F0;
+		awMask[8] &= ~0x0001;
+		awMask[15] &= ~0x8000;										// 255, follows any other change
+		for (unsigned int g = 0; g < (ATA_DISK_SECTOR_SIZE / 32); g++)
+			if (awMask[g])
+			{
+				nChanges |= eSnapChangeIdentify;
+				break;
+			}
+		return nChanges;
+	}
+
+  public:
+	CSnapshotDiff(void) : _nMask(0) {}
+
+	// The changed drives between rBefore and rAfter : those of rAfter in its order, then those only
+	// in rBefore in its order.
+	bool Compare(_bstr_t &rbstrErrorInfo, const CIdentifySnapshotReader &rBefore, const CIdentifySnapshotReader &rAfter,
+				 TSnapshotChanges &rvChanges)
+	{
+		TRACE(L"CSnapshotDiff::Compare\n");
+		const ESnapshotColumn aeRequired[] = { eSnapColumnSector, eSnapColumnSerialNo, eSnapColumnModel, eSnapColumnFirmware,
+											   eSnapColumnLogicalSectorSize, eSnapColumnWorldWideName, eSnapColumnCapabilities };
+		std::vector<bool> vJoined;
+		unsigned __int64 nSlots = 16;
+
+		for (size_t c = 0; c < (sizeof(aeRequired) / sizeof(aeRequired[0])); c++)
+			if ((!rBefore.HasColumn(aeRequired[c])) || (!rAfter.HasColumn(aeRequired[c])))
+			{
+				rbstrErrorInfo = ::BuildMessage(L"CSnapshotDiff : A snapshot lacks column %u.", (unsigned int)aeRequired[c]);
+				return false;
+			}
+
+		rvChanges.clear();
+		while (nSlots < (rBefore.Count() * 2))
+			nSlots <<= 1;
+		if (nSlots > (SIZE_T)-1 / sizeof(TSlot))
+		{
+			rbstrErrorInfo = L"CSnapshotDiff : The earlier snapshot is too large.";
+			return false;
+		}
+		_vSlots.assign((size_t)nSlots, TSlot());				// i.e. all empty
+		_nMask = nSlots - 1;
+		vJoined.assign((size_t)rBefore.Count(), false);
+
+		for (unsigned __int64 n = 0; n < rBefore.Count(); n++)
+		{
+			unsigned __int64 nHash = KeyHash(rBefore, n);
+			unsigned __int64 nSlot = nHash & _nMask;
+			while (_vSlots[(size_t)nSlot].nDrive)
+				nSlot = (nSlot + 1) & _nMask;
+			_vSlots[(size_t)nSlot].nHash = nHash;
+			_vSlots[(size_t)nSlot].nDrive = n + 1;
+		}
+
+		for (unsigned __int64 n = 0; n < rAfter.Count(); n++)
+		{
+			TSnapshotChange sChange = { eSnapChangeAppeared, 0, SNAPSHOT_DIFF_NONE, n };
+			unsigned __int64 nHash = KeyHash(rAfter, n);
+
+			for (unsigned __int64 nSlot = nHash & _nMask; _vSlots[(size_t)nSlot].nDrive; nSlot = (nSlot + 1) & _nMask)
+			{
+				unsigned __int64 nBefore = _vSlots[(size_t)nSlot].nDrive - 1;
+				if ((_vSlots[(size_t)nSlot].nHash == nHash) && (!vJoined[(size_t)nBefore]) && (KeyEqual(rBefore, nBefore, rAfter, n)))
+				{
+					vJoined[(size_t)nBefore] = true;
+					sChange.nBefore = nBefore;
+					sChange.nChanges = Compare(rBefore, nBefore, rAfter, n, sChange.nWords);
+					break;
+				}
+			}
+			if (sChange.nChanges != eSnapChangeNone)
+				rvChanges.push_back(sChange);
+		}
+
+		for (unsigned __int64 n = 0; n < rBefore.Count(); n++)
+			if (!vJoined[(size_t)n])
+			{
+				TSnapshotChange sChange = { eSnapChangeDisappeared, 0, n, SNAPSHOT_DIFF_NONE };
+				rvChanges.push_back(sChange);
+			}
+
+		_vSlots.clear();
+		return true;
+	}
+};	// CSnapshotDiff
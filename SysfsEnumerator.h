@@ -0,0 +1,262 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "DiskEnumerator.h"
+
+#ifdef __linux__
+
+#include <map>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+//  The CSysfsDiskEnumerator class enumerates disk drives on Linux by reading sysfs directly
+//  rather than through a management layer :
+//
+//		<root>/class/scsi_device/H:C:T:L/device/block/<name>	SCSI address of each block device
+//		<root>/block/<name>/device								present for physical devices only
+//		<root>/block/<name>/queue/logical_block_size			BytesPerSector
+//		<root>/block/<name>/device/vendor						"ATA" for (S)ATA behind libata
+//		<root>/block/<name>/device/model						Model, from the kernel's INQUIRY
+//		<root>/block/<name>/device/vpd_pg80						Unit serial number VPD page
+//
+//  The interface type follows Win32_DiskDrive : USB if the device path passes through a USB
+//  controller, IDE for ATA devices, otherwise SCSI.  The sysfs root is a constructor parameter so
+//  that a fabricated tree may stand in for /sys (see SysfsEnumeratorTest.cpp, built by GNUmakefile).
+//  Each Next() reads a single /sys/block entry, and only the files behind the projected
+//  attributes; the SCSI class directory is walked once per Begin, and not at all unless an
+//  address field is wanted.  A device outside it (e.g. NVMe) simply has no address.  The batch
+//  size is immaterial here (readdir buffers).  A query's path pattern is tested on the name
+//  alone, before any of the device's files are read.
+//
+//		see:	Documentation/ABI/testing/sysfs-block and sysfs-class-scsi_device in the Linux kernel.
+//
+
+#define SYSFS_DEFAULT_ROOT		"/sys"
+
+class CSysfsDiskEnumerator : public IDiskEnumerator
+{
+  private:
+	typedef struct TScsiAddress
+	{
+		unsigned short	nHost;
+		unsigned short	nChannel;
+		unsigned short	nTarget;
+		unsigned short	nLun;
+	} TScsiAddress;
+
+	std::string							_strRoot;
+	DIR									*_pBlockDir;
+	TEnumerationQuery					_sQuery;
+	std::map<std::string, TScsiAddress>	_mapScsiAddresses;		// Block device name -> H:C:T:L
+
+	static bool ReadLine(const std::string &strPath, std::string &rstrLine)
+	{
+		char szLine[256];
+		FILE *pFile = fopen(strPath.c_str(), "r");
+
+		if (!pFile)
+			return false;
+		rstrLine.clear();
+		if (fgets(szLine, sizeof(szLine), pFile))
+		{
+			rstrLine = szLine;
+			while ((!rstrLine.empty()) && ((rstrLine[rstrLine.length() - 1] == '\n') || (rstrLine[rstrLine.length() - 1] == ' ')))
+				rstrLine.erase(rstrLine.length() - 1);
+		}
+		fclose(pFile);
+		return true;
+	}
+
+	static bool Exists(const std::string &strPath)
+	{
+		struct stat sStat;
+		return (stat(strPath.c_str(), &sStat) == 0);
+	}
+
+	static std::wstring Widen(const std::string &str)
+	{
+		return std::wstring(str.begin(), str.end());
+	}
+
+	// The serial number from the unit serial number VPD page (SPC-4 7.8.19) : a four byte header,
+	// the page length in byte 3, then the space padded ASCII serial number.
+	static std::string ReadSerialNumber(const std::string &strDevice)
+	{
+		unsigned char abyPage[256];
+		std::string strSerial;
+		FILE *pFile = fopen((strDevice + "/vpd_pg80").c_str(), "rb");
+
+		if (!pFile)
+			return strSerial;
+		size_t nRead = fread(abyPage, 1, sizeof(abyPage), pFile);
+		fclose(pFile);
+		if ((nRead > 4) && (abyPage[1] == 0x80))
+		{
+			size_t nLength = ((size_t)abyPage[3] < (nRead - 4)) ? (size_t)abyPage[3] : (nRead - 4);
+			strSerial.assign((const char*)&abyPage[4], nLength);
+			strSerial.erase(0, strSerial.find_first_not_of(' '));
+			strSerial.erase(strSerial.find_last_not_of(std::string(" \0", 2)) + 1);
+		}
+		return strSerial;
+	}
+
+	// Map each SCSI device's block device name to its H:C:T:L address.
+	void ReadScsiAddresses(void)
+	{
+		std::string strClass = _strRoot + "/class/scsi_device";
+		DIR *pClassDir = opendir(strClass.c_str());
+		struct dirent *pEntry;
+
+		_mapScsiAddresses.clear();
+		if (!pClassDir)
+			return;
+		while ((pEntry = readdir(pClassDir)) != NULL)
+		{
+			unsigned int nHost, nChannel, nTarget, nLun;
+			if (sscanf(pEntry->d_name, "%u:%u:%u:%u", &nHost, &nChannel, &nTarget, &nLun) != 4)
+				continue;
+
+			std::string strBlock = strClass + "/" + pEntry->d_name + "/device/block";
+			DIR *pBlockDir = opendir(strBlock.c_str());
+			struct dirent *pBlock;
+			if (!pBlockDir)
+				continue;
+			while ((pBlock = readdir(pBlockDir)) != NULL)
+			{
+				if (pBlock->d_name[0] == '.')
+					continue;
+				TScsiAddress sAddress = { (unsigned short)nHost, (unsigned short)nChannel, (unsigned short)nTarget, (unsigned short)nLun };
+				_mapScsiAddresses[pBlock->d_name] = sAddress;
+			}
+			closedir(pBlockDir);
+		}
+		closedir(pClassDir);
+	}
+
+	std::wstring InterfaceType(const std::string &strDevice)
+	{
+		char szResolved[PATH_MAX];
+		std::string strVendor;
+
+		if (realpath(strDevice.c_str(), szResolved))
+		{
+			if (strstr(szResolved, "/usb"))
+				return L"USB";
+			if (strstr(szResolved, "/ata"))
+				return L"IDE";
+		}
+		if ((ReadLine(strDevice + "/vendor", strVendor)) && (strVendor == "ATA"))
+			return L"IDE";
+		return L"SCSI";
+	}
+
+	CSysfsDiskEnumerator(const CSysfsDiskEnumerator&);
+	CSysfsDiskEnumerator &operator=(const CSysfsDiskEnumerator&);
+
+  public:
+	CSysfsDiskEnumerator(const char *pszRoot = SYSFS_DEFAULT_ROOT) : _strRoot(pszRoot), _pBlockDir(NULL)
+	{
+	}
+
+	virtual ~CSysfsDiskEnumerator()
+	{
+		End();
+	}
+
+	virtual bool Begin(std::wstring &rstrErrorInfo, const TEnumerationQuery &rQuery)
+	{
+		std::string strBlock = _strRoot + "/block";
+
+		End();
+		rstrErrorInfo.clear();
+		_sQuery = rQuery;
+		_mapScsiAddresses.clear();
+		if (_sQuery.Wants(eDiskFieldsAddress))
+			ReadScsiAddresses();
+		_pBlockDir = opendir(strBlock.c_str());
+		if (!_pBlockDir)
+		{
+			rstrErrorInfo = L"CSysfsDiskEnumerator::Begin : Unable to open " + Widen(strBlock) + L" : " + Widen(strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+	virtual bool Next(std::wstring &rstrErrorInfo, TDiskDeviceAttributes &rAttributes)
+	{
+		struct dirent *pEntry;
+
+		rstrErrorInfo.clear();
+		if (!_pBlockDir)
+			return false;
+		while ((pEntry = readdir(_pBlockDir)) != NULL)
+		{
+			if (pEntry->d_name[0] == '.')
+				continue;
+			if ((_sQuery.pFilter) && (!_sQuery.pFilter->MatchesPath(Widen(std::string("/dev/") + pEntry->d_name))))
+				continue;
+			if (Probe(pEntry->d_name, rAttributes))
+				return true;
+		}
+		return false;
+	}
+
+	// The attributes of a single block device (e.g. as named by a hotplug event), false if it is
+	// absent or virtual.  Usable without Begin, projected as per the last Begin if any.
+	bool Probe(const std::string &strName, TDiskDeviceAttributes &rAttributes)
+	{
+		std::string strBlock = _strRoot + "/block/" + strName;
+		std::string strSectorSize, strModel;
+
+		// Virtual block devices (loop, ram, dm-, md, zram, ...) have no device link.
+		if (!Exists(strBlock + "/device"))
+			return false;
+
+		rAttributes = TDiskDeviceAttributes();
+		rAttributes.strDeviceID = Widen("/dev/" + strName);
+		if (_sQuery.Wants(eDiskFieldInterfaceType))
+			rAttributes.strInterfaceType = InterfaceType(strBlock + "/device");
+		if ((_sQuery.Wants(eDiskFieldBytesPerSector)) && (ReadLine(strBlock + "/queue/logical_block_size", strSectorSize)))
+			rAttributes.nBytesPerSector = (unsigned int)strtoul(strSectorSize.c_str(), NULL, 10);
+		if ((_sQuery.Wants(eDiskFieldModel)) && (ReadLine(strBlock + "/device/model", strModel)))
+			rAttributes.strModel = Widen(strModel);
+		if (_sQuery.Wants(eDiskFieldSerialNumber))
+			rAttributes.strSerialNumber = Widen(ReadSerialNumber(strBlock + "/device"));
+		if (!_sQuery.Wants(eDiskFieldsAddress))
+			return true;
+
+		// Outside an enumeration (e.g. a device just attached) the map may predate the device.
+		if (!_pBlockDir)
+			ReadScsiAddresses();
+		std::map<std::string, TScsiAddress>::const_iterator iter = _mapScsiAddresses.find(strName);
+		if (iter != _mapScsiAddresses.end())
+		{
+			rAttributes.nSCSIPort = iter->second.nHost;
+			rAttributes.nSCSIBus = iter->second.nChannel;
+			rAttributes.nSCSITargetId = iter->second.nTarget;
+			rAttributes.nSCSILogicalUnit = iter->second.nLun;
+		}
+		return true;
+	}
+
+	virtual void End(void)
+	{
+		_sQuery.pFilter = NULL;		// Not owned, nor applicable to a later Probe
+		if (_pBlockDir)
+		{
+			closedir(_pBlockDir);
+			_pBlockDir = NULL;
+		}
+	}
+};	// CSysfsDiskEnumerator
+
+#endif // __linux__
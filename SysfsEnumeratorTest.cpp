@@ -0,0 +1,224 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+//  SysfsEnumeratorTest.cpp : Exercises CSysfsDiskEnumerator (see SysfsEnumerator.h) on Linux,
+//  built by GNUmakefile.
+//
+//		SysfsEnumeratorTest					Enumerate a fabricated sysfs tree, checking each attribute.
+//		SysfsEnumeratorTest -b [root]		Time-to-first-drive benchmark of the sysfs backend over
+//											root (default /sys), as BenchmarkEnumerators in DiskInfo.cpp.
+//
+//  The fabricated tree holds an ATA disk, a USB disk, an NVMe disk (outside the SCSI class) and a
+//  loop device, linked as the kernel links them :
+//
+//		block/sda/device -> devices/pci0000:00/ata1/host0/target0:0:0/0:0:0:0
+//		class/scsi_device/0:0:0:0/device -> the same, whose block/sda names the disk
+//
+
+#include "SysfsEnumerator.h"
+
+#include <algorithm>
+#include <ftw.h>
+#include <unistd.h>
+
+#define BENCHMARK_RUNS		5
+
+static unsigned int s_nFailures = 0;
+
+#define CHECK(expression)	\
+	((expression) ? (void)0 : (void)(s_nFailures++, printf("%s(%d) : check failed : %s\n", __FILE__, __LINE__, #expression)))
+
+
+static void MakePath(const std::string &strPath)
+{
+	for (size_t nSlash = strPath.find('/', 1); ; nSlash = strPath.find('/', nSlash + 1))
+	{
+		mkdir(strPath.substr(0, nSlash).c_str(), 0755);
+		if (nSlash == std::string::npos)
+			break;
+	}
+}
+
+static void WriteFile(const std::string &strPath, const void *pvData, size_t nLength)
+{
+	FILE *pFile = fopen(strPath.c_str(), "wb");
+
+	if (pFile)
+	{
+		fwrite(pvData, 1, nLength, pFile);
+		fclose(pFile);
+	}
+}
+
+static inline void WriteFile(const std::string &strPath, const char *pszLine)
+	{ WriteFile(strPath, pszLine, strlen(pszLine)); }
+
+// A unit serial number VPD page : the page code, its length and the space padded serial number.
+static void WriteSerialPage(const std::string &strPath, const char *pszSerial)
+{
+	unsigned char abyPage[4 + 20] = { 0x00, 0x80, 0x00, 20 };
+
+	memset(&abyPage[4], ' ', 20);
+	memcpy(&abyPage[4 + 20 - strlen(pszSerial)], pszSerial, strlen(pszSerial));
+	WriteFile(strPath, abyPage, sizeof(abyPage));
+}
+
+// A disk at devices/<strDevicePath>, linked from block/<name> and, given an address, from the SCSI class.
+static void AddDisk(const std::string &strRoot, const char *pszName, const std::string &strDevicePath, const char *pszAddress,
+					const char *pszVendor, const char *pszModel, const char *pszSerial, const char *pszSectorSize)
+{
+	std::string strDevice = strRoot + "/devices/" + strDevicePath;
+	std::string strBlock = strRoot + "/block/" + pszName;
+
+	MakePath(strDevice);
+	MakePath(strBlock + "/queue");
+	WriteFile(strBlock + "/queue/logical_block_size", pszSectorSize);
+	symlink(strDevice.c_str(), (strBlock + "/device").c_str());
+	if (pszVendor)
+		WriteFile(strDevice + "/vendor", pszVendor);
+	WriteFile(strDevice + "/model", pszModel);
+	if (pszSerial)
+		WriteSerialPage(strDevice + "/vpd_pg80", pszSerial);
+	if (pszAddress)
+	{
+		MakePath(strDevice + "/block/" + pszName);
+		MakePath(strRoot + "/class/scsi_device/" + pszAddress);
+		symlink(strDevice.c_str(), (strRoot + "/class/scsi_device/" + pszAddress + "/device").c_str());
+	}
+}
+
+static int RemoveEntry(const char *pszPath, const struct stat *, int, struct FTW *)
+{
+	return remove(pszPath);
+}
+
+static bool ByDeviceID(const TDiskDeviceAttributes &rLeft, const TDiskDeviceAttributes &rRight)
+{
+	return (rLeft.strDeviceID < rRight.strDeviceID);
+}
+
+
+static void TestFabricatedTree(const std::string &strRoot)
+{
+	CSysfsDiskEnumerator enumerator(strRoot.c_str());
+	std::vector<TDiskDeviceAttributes> vDevices;
+	TDiskDeviceAttributes sAttributes;
+	std::wstring strErrorInfo;
+	TDiskFilter sFilter;
+
+	AddDisk(strRoot, "sda", "pci0000:00/0000:00:1f.2/ata1/host0/target0:0:0/0:0:0:0", "0:0:0:0",
+			"ATA     ", "ST3500418AS     ", "5VM1ABCD", "512\n");
+	AddDisk(strRoot, "sdb", "pci0000:00/0000:00:14.0/usb2/2-1/2-1:1.0/host6/target6:0:0/6:0:0:0", "6:0:0:1",
+			"Generic ", "Flash Disk      ", NULL, "4096\n");
+	AddDisk(strRoot, "nvme0n1", "pci0000:00/0000:00:1d.0/0000:3d:00.0/nvme/nvme0", NULL,
+			NULL, "Samsung SSD 970 EVO", NULL, "512\n");
+	MakePath(strRoot + "/block/loop0/queue");
+
+	// Every projected attribute, in name order.
+	CHECK(EnumerateDiskDevices(enumerator, strErrorInfo, vDevices, NULL, TEnumerationQuery(eDiskFieldsAll)));
+	CHECK(strErrorInfo.empty());
+	std::sort(vDevices.begin(), vDevices.end(), ByDeviceID);
+	CHECK(vDevices.size() == 3);
+	if (vDevices.size() == 3)
+	{
+		CHECK(vDevices[0].strDeviceID == L"/dev/nvme0n1");
+		CHECK(vDevices[0].strInterfaceType == L"SCSI");
+		CHECK(vDevices[0].strModel == L"Samsung SSD 970 EVO");
+		CHECK(vDevices[0].strSerialNumber.empty());
+		CHECK((vDevices[0].nSCSIPort == 0) && (vDevices[0].nSCSIBus == 0) && (vDevices[0].nSCSITargetId == 0) && (vDevices[0].nSCSILogicalUnit == 0));
+
+		CHECK(vDevices[1].strDeviceID == L"/dev/sda");
+		CHECK(vDevices[1].strInterfaceType == L"IDE");
+		CHECK(vDevices[1].nBytesPerSector == 512);
+		CHECK(vDevices[1].strModel == L"ST3500418AS");
+		CHECK(vDevices[1].strSerialNumber == L"5VM1ABCD");
+
+		CHECK(vDevices[2].strDeviceID == L"/dev/sdb");
+		CHECK(vDevices[2].strInterfaceType == L"USB");
+		CHECK(vDevices[2].nBytesPerSector == 4096);
+		CHECK((vDevices[2].nSCSIPort == 6) && (vDevices[2].nSCSIBus == 0) && (vDevices[2].nSCSITargetId == 0) && (vDevices[2].nSCSILogicalUnit == 1));
+	}
+
+	// A path pattern, tested before the device is read.
+	vDevices.clear();
+	CHECK(sFilter.Parse(L"path=/dev/sd*", strErrorInfo));
+	CHECK(EnumerateDiskDevices(enumerator, strErrorInfo, vDevices, NULL, TEnumerationQuery(eDiskFieldsOpen, 1, &sFilter)));
+	CHECK(vDevices.size() == 2);
+
+	// An address, "any" explicitly, and values that are not numbers rejected by field.
+	vDevices.clear();
+	CHECK(sFilter.Parse(L"port=6,bus=any", strErrorInfo));
+	CHECK(sFilter.nSCSIBus == DISK_FILTER_ANY);
+	CHECK(EnumerateDiskDevices(enumerator, strErrorInfo, vDevices, NULL, TEnumerationQuery(eDiskFieldsOpen, 1, &sFilter)));
+	CHECK((vDevices.size() == 1) && (vDevices[0].strDeviceID == L"/dev/sdb"));
+	CHECK(!sFilter.Parse(L"port=usb", strErrorInfo));
+	CHECK(strErrorInfo.find(L"port") != std::wstring::npos);
+	CHECK(!sFilter.Parse(L"target=-1", strErrorInfo));
+	CHECK(strErrorInfo.find(L"target") != std::wstring::npos);
+	CHECK(!sFilter.Parse(L"bus=", strErrorInfo));
+	CHECK(!sFilter.Parse(L"port=70000", strErrorInfo));
+	CHECK(!sFilter.Parse(L"colour=red", strErrorInfo));
+
+	// Outside an enumeration, a device attached since is probed with its address.
+	AddDisk(strRoot, "sdc", "pci0000:00/0000:00:1f.2/ata2/host1/target1:0:0/1:0:0:0", "1:0:0:0",
+			"ATA     ", "WDC WD10EZEX", "WD-WCC1", "512\n");
+	CHECK(enumerator.Probe("sdc", sAttributes));
+	CHECK((sAttributes.strDeviceID == L"/dev/sdc") && (sAttributes.nSCSIPort == 1));
+	CHECK(!enumerator.Probe("loop0", sAttributes));
+	CHECK(!enumerator.Probe("sdz", sAttributes));
+
+	// An absent root fails Begin with a description.
+	CSysfsDiskEnumerator absent((strRoot + "/absent").c_str());
+	vDevices.clear();
+	CHECK(!EnumerateDiskDevices(absent, strErrorInfo, vDevices));
+	CHECK(!strErrorInfo.empty());
+}
+
+
+static int Benchmark(const char *pszRoot)
+{
+	static const struct { const char *pszName; unsigned int nFields; } aQueries[] =
+	{
+		{ "all fields",		eDiskFieldsAll },
+		{ "projected",		eDiskFieldsOpen },
+		{ "path only",		eDiskFieldDeviceID },
+	};
+	CSysfsDiskEnumerator enumerator(pszRoot);
+
+	printf("\nEnumeration benchmark of %s (%u warm runs) :\n", pszRoot, BENCHMARK_RUNS);
+	for (size_t j = 0; j < (sizeof(aQueries) / sizeof(aQueries[0])); j++)
+	{
+		TEnumerationBenchmark sResult;
+		std::wstring strErrorInfo;
+
+		if (!BenchmarkDiskEnumerator(enumerator, TEnumerationQuery(aQueries[j].nFields), BENCHMARK_RUNS, strErrorInfo, sResult))
+		{
+			printf("  Sysfs     %-24s : failed, %ls\n", aQueries[j].pszName, strErrorInfo.c_str());
+			return 1;
+		}
+		printf("  Sysfs     %-24s : %u drive(s), cold first %llu us total %llu us, warm first %llu us (best %llu) total %llu us (best %llu)\n",
+			   aQueries[j].pszName, sResult.sCold.nDrives, sResult.sCold.nFirstDriveUs, sResult.sCold.nTotalUs,
+			   sResult.nMeanFirstDriveUs, sResult.nBestFirstDriveUs, sResult.nMeanTotalUs, sResult.nBestTotalUs);
+	}
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	if ((argc > 1) && (strcmp(argv[1], "-b") == 0))
+		return Benchmark((argc > 2) ? argv[2] : SYSFS_DEFAULT_ROOT);
+
+	char szRoot[] = "/tmp/SysfsEnumeratorTest.XXXXXX";
+	if (!mkdtemp(szRoot))
+	{
+		printf("Unable to create the fabricated sysfs tree : %s\n", strerror(errno));
+		return 1;
+	}
+	TestFabricatedTree(szRoot);
+	nftw(szRoot, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+
+	printf("%s : %u check(s) failed\n", (s_nFailures) ? "FAILED" : "Passed", s_nFailures);
+	return (s_nFailures) ? 1 : 0;
+}
@@ -0,0 +1,369 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "TcgTable.h"
+
+
+//  Streaming bulk transfer to and from TCG byte tables (e.g. the shadow MBR and the DataStore).
+//
+//  An upload is framed into the largest Set [Where, Values] method calls the session's limits
+//  allow (bounded by MaxIndTokenSize and the ComPacket token payload).  Each call is built in
+//  place within one of two ComPacket frame buffers : the method prefix is encoded first and the
+//  image bytes are then read straight into position behind it, so no intermediate copy is made.
+//  While one frame is in flight to the drive, an overlapped ReadFile fills the other.  Downloads
+//  mirror this : each Get response is handed to an overlapped WriteFile while the next Get is
+//  issued.  A memory-mapped variant copies from a mapped view (or any caller buffer) instead.
+//
+//  The TBulkTransferStats struct reports bytes moved, method calls and sustained MB/s.  A TPer
+//  whose limits leave no room for table bytes behind the method framing (i.e. a token payload of
+//  TCG_BULK_METHOD_FRAMING bytes or less) is refused.
+//
+
+#define TCG_BULK_SET_SUFFIX_LENGTH	8		// EndName EndList EndOfData StartList 0 0 0 EndList
+#define TCG_BULK_METHOD_FRAMING		64		// Token payload reserved for the method call around the bytes
+
+
+typedef struct TBulkTransferStats
+{
+	unsigned __int64	nBytes;				// Table bytes transferred
+	unsigned int		nMethods;			// Set / Get method calls issued
+	unsigned int		nChunkSize;			// Table bytes per method call
+	unsigned __int64	nMicroseconds;		// Elapsed time of the whole transfer
+	unsigned __int64	nDeviceMicroseconds;	// Portion spent within Transmit (i.e. the drive)
+
+	TBulkTransferStats(void) : nBytes(0), nMethods(0), nChunkSize(0), nMicroseconds(0), nDeviceMicroseconds(0) {}
+
+	inline double MegabytesPerSecond(void) const
+		{ return ((nMicroseconds > 0) ? ((double)nBytes / (double)nMicroseconds) : 0.0); }
+} TBulkTransferStats;
+
+
+template <typename IBusInterfaceType>
+class CTcgBulkTransfer
+{
+  private:
+	CTcgSession<IBusInterfaceType>	&_rSession;
+	TTcgUid							_uidTable;
+	unsigned int					_nChunk;			// Table bytes per method call
+	std::vector<BYTE>				_vFrame[2];			// Double buffered ComPacket frames
+	TBulkTransferStats				_sStats;
+
+	// Encode the Set method prefix for nLength bytes at nOffset into rFrame at TCG_PAYLOAD_OFFSET.
+	// Returns the frame offset at which the nLength value bytes belong.
+	unsigned int PrepareSetFrame(std::vector<BYTE> &rFrame, unsigned int nOffset, unsigned int nLength)
+	{
+		CTcgTokenWriter writer;
+		writer.BeginMethod(_uidTable, TCG_METHOD_SET);
+		writer.StartName(); writer.UInt(TCG_NAME_SET_WHERE); writer.UInt(nOffset); writer.EndName();
+		writer.StartName(); writer.UInt(TCG_NAME_SET_VALUES); writer.BytesHeader(nLength);
+
+		unsigned int nData = (unsigned int)TCG_PAYLOAD_OFFSET + writer.Size();
+		unsigned int nRequired = TcgRoundUpTransfer(nData + nLength + TCG_BULK_SET_SUFFIX_LENGTH + 3,
+													_rSession.Disk().BytesPerSector());
+		if (rFrame.size() < nRequired)
+			rFrame.resize(nRequired, 0);
+		::memcpy_s(&rFrame[TCG_PAYLOAD_OFFSET], rFrame.size() - TCG_PAYLOAD_OFFSET, &writer.Buffer()[0], writer.Size());
+		return nData;
+	}
+
+	// Append the method suffix behind the value bytes, send the frame and check the method status.
+	bool CompleteSetFrame(_bstr_t &rbstrErrorInfo, std::vector<BYTE> &rFrame, unsigned int nDataEnd)
+	{
+		static const BYTE pbySuffix[TCG_BULK_SET_SUFFIX_LENGTH] =
+			{ TCG_TOKEN_ENDNAME, TCG_TOKEN_ENDLIST, TCG_TOKEN_ENDOFDATA, TCG_TOKEN_STARTLIST, 0x00, 0x00, 0x00, TCG_TOKEN_ENDLIST };
+		TListTcgMethodResults results;
+
+		::memcpy_s(&rFrame[nDataEnd], rFrame.size() - nDataEnd, pbySuffix, sizeof(pbySuffix));
+
+		unsigned __int64 nStartUs = ::PerfCounterMicroseconds();
+		bool bres = _rSession.InvokeFramed(rbstrErrorInfo, rFrame, (nDataEnd + sizeof(pbySuffix)) - (unsigned int)TCG_PAYLOAD_OFFSET, results);
+		_sStats.nDeviceMicroseconds += ::PerfCounterMicroseconds() - nStartUs;
+		_sStats.nMethods++;
+		if (!bres)
+			return false;
+		if ((results.size() != 1) || (results[0].byStatus != TCG_STATUS_SUCCESS))
+		{
+			rbstrErrorInfo = ::BuildMessage(L"CTcgBulkTransfer : Set failed, status 0x%02X.",
+											results.empty() ? TCG_STATUS_FAIL : results[0].byStatus);
+			return false;
+		}
+		return true;
+	}
+
+	bool CheckChunk(_bstr_t &rbstrErrorInfo)
+	{
+		if (_nChunk > 0)
+			return true;
+		rbstrErrorInfo = ::BuildMessage(L"CTcgBulkTransfer : %ws : The TPer's limits leave no room for table data.",
+										(const wchar_t*)_rSession.Disk().Name());
+		return false;
+	}
+
+	// Prepare the next frame and start an overlapped read of its value bytes from the image file.
+	bool BeginRead(_bstr_t &rbstrErrorInfo, HANDLE hFile, OVERLAPPED &rOverlapped, unsigned int nTableOffset, unsigned int &rnIssued,
+				   unsigned int nLength, unsigned int &rnData, unsigned int &rnThis, std::vector<BYTE> &rFrame)
+	{
+		rnThis = ((nLength - rnIssued) < _nChunk) ? (nLength - rnIssued) : _nChunk;
+		rnData = PrepareSetFrame(rFrame, nTableOffset + rnIssued, rnThis);
+		rOverlapped.Offset = rnIssued;
+		::ResetEvent(rOverlapped.hEvent);
+		if ((!::ReadFile(hFile, &rFrame[rnData], rnThis, NULL, &rOverlapped)) && (::GetLastError() != ERROR_IO_PENDING))
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			return false;
+		}
+		rnIssued += rnThis;
+		return true;
+	}
+
+  public:
+	CTcgBulkTransfer(CTcgSession<IBusInterfaceType> &rSession, TTcgUid uidTable) : _rSession(rSession), _uidTable(uidTable)
+	{
+		// Largest value that fits both an individual token and a ComPacket, less the method framing;
+		// 0 if none does (see CheckChunk).
+		const TTcgProperties &rLimits = rSession.Properties();
+		unsigned int nToken = (rLimits.nMaxIndTokenSize > 4) ? (rLimits.nMaxIndTokenSize - 4) : 0;
+		unsigned int nPayload = (rLimits.MaxTokenPayload() > TCG_BULK_METHOD_FRAMING) ? (rLimits.MaxTokenPayload() - TCG_BULK_METHOD_FRAMING) : 0;
+		_nChunk = (nToken < nPayload) ? nToken : nPayload;
+		if (_nChunk > TCG_TRANSFER_BLOCK_SIZE)
+			_nChunk -= (_nChunk % TCG_TRANSFER_BLOCK_SIZE);
+		_sStats.nChunkSize = _nChunk;
+	}
+
+	// Upload from memory (e.g. a mapped view of the image file).
+	bool Upload(_bstr_t &rbstrErrorInfo, unsigned int nTableOffset, const BYTE *pbyImage, unsigned int nLength)
+	{
+		TRACE(L"CTcgBulkTransfer::Upload\n");
+		unsigned __int64 nStartUs = ::PerfCounterMicroseconds();
+
+		if (!CheckChunk(rbstrErrorInfo))
+			return false;
+		for (unsigned int nDone = 0; nDone < nLength; )
+		{
+			unsigned int nThis = ((nLength - nDone) < _nChunk) ? (nLength - nDone) : _nChunk;
+			std::vector<BYTE> &rFrame = _vFrame[0];
+			unsigned int nData = PrepareSetFrame(rFrame, nTableOffset + nDone, nThis);
+			::memcpy_s(&rFrame[nData], rFrame.size() - nData, pbyImage + nDone, nThis);
+			if (!CompleteSetFrame(rbstrErrorInfo, rFrame, nData + nThis))
+				return false;
+			nDone += nThis;
+			_sStats.nBytes += nThis;
+		}
+		_sStats.nMicroseconds += ::PerfCounterMicroseconds() - nStartUs;
+		return true;
+	}
+
+	// Upload from a memory-mapped image file.
+	bool UploadMappedFile(_bstr_t &rbstrErrorInfo, unsigned int nTableOffset, const wchar_t *pszPath)
+	{
+		TRACE(L"CTcgBulkTransfer::UploadMappedFile\n");
+		HANDLE hFile = ::CreateFile(pszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		HANDLE hMapping = NULL;
+		const BYTE *pbyView = NULL;
+		LARGE_INTEGER liSize = { 0 };
+		bool bres = false;
+
+		if ((hFile == INVALID_HANDLE_VALUE) || (!::GetFileSizeEx(hFile, &liSize)) || (liSize.HighPart != 0))
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			rbstrErrorInfo = ::BuildMessage(L"CTcgBulkTransfer : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+			goto CleanUp;
+		}
+		if (liSize.LowPart > 0)
+		{
+			hMapping = ::CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (hMapping)
+				pbyView = (const BYTE*)::MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+			if (!pbyView)
+			{
+				TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+				goto CleanUp;
+			}
+		}
+		bres = Upload(rbstrErrorInfo, nTableOffset, pbyView, liSize.LowPart);
+
+	CleanUp:
+		if (pbyView)
+			::UnmapViewOfFile(pbyView);
+		if (hMapping)
+			::CloseHandle(hMapping);
+		if (hFile != INVALID_HANDLE_VALUE)
+			::CloseHandle(hFile);
+		return bres;
+	}
+
+	// Upload an image file, reading the next chunk (overlapped) while the current one is in flight.
+	bool UploadFile(_bstr_t &rbstrErrorInfo, unsigned int nTableOffset, const wchar_t *pszPath)
+	{
+		TRACE(L"CTcgBulkTransfer::UploadFile\n");
+		if (!CheckChunk(rbstrErrorInfo))
+			return false;
+
+		unsigned __int64 nStartUs = ::PerfCounterMicroseconds();
+		HANDLE hFile = ::CreateFile(pszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+									FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		OVERLAPPED ov[2];
+		unsigned int nData[2] = { 0, 0 };
+		unsigned int nThis[2] = { 0, 0 };
+		bool bPending[2] = { false, false };
+		LARGE_INTEGER liSize = { 0 };
+		unsigned int nLength = 0;
+		unsigned int nIssued = 0;
+		unsigned int nSlot = 0;
+		bool bres = false;
+
+		if ((hFile == INVALID_HANDLE_VALUE) || (!::GetFileSizeEx(hFile, &liSize)) || (liSize.HighPart != 0))
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			rbstrErrorInfo = ::BuildMessage(L"CTcgBulkTransfer : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+			if (hFile != INVALID_HANDLE_VALUE)
+				::CloseHandle(hFile);
+			return false;
+		}
+		nLength = liSize.LowPart;
+		::ZeroMemory(ov, sizeof(ov));
+		ov[0].hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+		ov[1].hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+
+		// Prime the first frame, then each pass waits for the current frame's read, starts reading
+		// the next frame and sends the current one.
+		if ((nLength > 0) && (!BeginRead(rbstrErrorInfo, hFile, ov[0], nTableOffset, nIssued, nLength, nData[0], nThis[0], _vFrame[0])))
+			goto CleanUp;
+		bPending[0] = (nLength > 0);
+
+		for (nSlot = 0; bPending[nSlot]; nSlot = 1 - nSlot)
+		{
+			DWORD dwRead = 0;
+			bPending[nSlot] = false;
+			if ((!::GetOverlappedResult(hFile, &ov[nSlot], &dwRead, TRUE)) || (dwRead != nThis[nSlot]))
+			{
+				TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+				goto CleanUp;
+			}
+
+			if (nIssued < nLength)
+			{
+				if (!BeginRead(rbstrErrorInfo, hFile, ov[1 - nSlot], nTableOffset, nIssued, nLength, nData[1 - nSlot], nThis[1 - nSlot], _vFrame[1 - nSlot]))
+					goto CleanUp;
+				bPending[1 - nSlot] = true;
+			}
+
+			if (!CompleteSetFrame(rbstrErrorInfo, _vFrame[nSlot], nData[nSlot] + nThis[nSlot]))
+				goto CleanUp;
+			_sStats.nBytes += nThis[nSlot];
+		}
+		bres = true;
+
+	CleanUp:
+		for (int i = 0; i < 2; i++)
+		{
+			DWORD dwIgnored = 0;
+			if (bPending[i])
+			{
+				::CancelIo(hFile);
+				::GetOverlappedResult(hFile, &ov[i], &dwIgnored, TRUE);
+			}
+			if (ov[i].hEvent)
+				::CloseHandle(ov[i].hEvent);
+		}
+		::CloseHandle(hFile);
+		_sStats.nMicroseconds += ::PerfCounterMicroseconds() - nStartUs;
+		return bres;
+	}
+
+	// Download nLength table bytes at nTableOffset into a file, writing (overlapped) each chunk
+	// while the next Get is in flight.
+	bool DownloadFile(_bstr_t &rbstrErrorInfo, unsigned int nTableOffset, unsigned int nLength, const wchar_t *pszPath)
+	{
+		TRACE(L"CTcgBulkTransfer::DownloadFile\n");
+		if (!CheckChunk(rbstrErrorInfo))
+			return false;
+
+		unsigned __int64 nStartUs = ::PerfCounterMicroseconds();
+		HANDLE hFile = ::CreateFile(pszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_OVERLAPPED, NULL);
+		std::vector<BYTE> vChunk[2];
+		OVERLAPPED ov[2];
+		bool bPending[2] = { false, false };
+		bool bres = false;
+
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+			rbstrErrorInfo = ::BuildMessage(L"CTcgBulkTransfer : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+			return false;
+		}
+		::ZeroMemory(ov, sizeof(ov));
+		ov[0].hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+		ov[1].hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+
+		for (unsigned int nDone = 0, nSlot = 0; nDone < nLength; nSlot = 1 - nSlot)
+		{
+			unsigned int nThis = ((nLength - nDone) < _nChunk) ? (nLength - nDone) : _nChunk;
+			DWORD dwWritten = 0;
+
+			// The buffer for this slot is free once its previous write has completed.
+			if (bPending[nSlot])
+			{
+				bPending[nSlot] = false;
+				if (!::GetOverlappedResult(hFile, &ov[nSlot], &dwWritten, TRUE))
+				{
+					TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+					goto CleanUp;
+				}
+			}
+
+			CTcgTableBatch<IBusInterfaceType> batch;
+			batch.GetBytes(_uidTable, nTableOffset + nDone, nThis);
+			unsigned __int64 nDeviceUs = ::PerfCounterMicroseconds();
+			bool bGet = batch.Execute(rbstrErrorInfo, _rSession);
+			_sStats.nDeviceMicroseconds += ::PerfCounterMicroseconds() - nDeviceUs;
+			_sStats.nMethods++;
+			if (!bGet)
+				goto CleanUp;
+			if ((!batch.Result(0).Succeeded()) || (batch.Result(0).vBytes.size() != nThis))
+			{
+				rbstrErrorInfo = ::BuildMessage(L"CTcgBulkTransfer : Get failed, status 0x%02X.", batch.Result(0).byStatus);
+				goto CleanUp;
+			}
+
+			vChunk[nSlot] = batch.Result(0).vBytes;
+			ov[nSlot].Offset = nDone;
+			::ResetEvent(ov[nSlot].hEvent);
+			if ((!::WriteFile(hFile, &vChunk[nSlot][0], nThis, NULL, &ov[nSlot])) && (::GetLastError() != ERROR_IO_PENDING))
+			{
+				TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+				goto CleanUp;
+			}
+			bPending[nSlot] = true;
+			nDone += nThis;
+			_sStats.nBytes += nThis;
+		}
+		bres = true;
+
+	CleanUp:
+		for (int i = 0; i < 2; i++)
+		{
+			DWORD dwWritten = 0;
+			if ((bPending[i]) && (!::GetOverlappedResult(hFile, &ov[i], &dwWritten, TRUE)) && (bres))
+			{
+				TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+				bres = false;
+			}
+			if (ov[i].hEvent)
+				::CloseHandle(ov[i].hEvent);
+		}
+		::CloseHandle(hFile);
+		_sStats.nMicroseconds += ::PerfCounterMicroseconds() - nStartUs;
+		return bres;
+	}
+
+	// Accessors
+	inline const TBulkTransferStats &Stats(void) const
+		{ return _sStats; }
+
+	inline unsigned int ChunkSize(void) const
+		{ return _nChunk; }
+};	// CTcgBulkTransfer
@@ -0,0 +1,123 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "stdafx.h"
+
+
+//  The TCG "Storage Architecture Core Specification" defines the ComPacket, Packet and Data
+//  SubPacket framing carried within the ATA TRUSTED SEND and TRUSTED RECEIVE (i.e. IF-SEND and
+//  IF-RECV) payloads.  All multi-byte fields are big-endian on the wire, hence the accessors
+//  below byte-swap via n32ByteSwap and n16ByteSwap.
+//
+//		see:	http://www.trustedcomputinggroup.org
+//				"TCG Storage Architecture Core Specification", section 3.2.3 (ComPackets)
+//				"TCG Storage Interface Interactions Specification" (IF-SEND / IF-RECV)
+//
+
+#define TCG_SECURITY_PROTOCOL_INFO		0x00	// Security Protocol Information (i.e. supported protocol list)
+#define TCG_SECURITY_PROTOCOL_1			0x01	// TCG : Level 0 Discovery, sessions and method calls
+#define TCG_SECURITY_PROTOCOL_2			0x02	// TCG : ComID management (e.g. STACK_RESET)
+#define TCG_SECURITY_PROTOCOL_VENDOR	0xF0	// Vendor unique; the historical default used herein
+
+#define TCG_TRANSFER_BLOCK_SIZE			512		// IF-SEND / IF-RECV transfer length unit (bytes)
+#define TCG_MAX_TRANSFER_BLOCKS			0xFFFF	// Transfer length is a 16 bit count of blocks
+
+
+#pragma pack(push,1)
+//
+//	ComPacket header : one per IF-SEND / IF-RECV payload.
+//
+typedef struct TComPacketHeader
+{
+	unsigned __int32	ulReserved;					//0-3
+	unsigned __int16	wComID;						//4-5
+	unsigned __int16	wComIDExtension;			//6-7
+	unsigned __int32	ulOutstandingData;			//8-11		IF-RECV only : bytes pending within the TPer
+	unsigned __int32	ulMinTransfer;				//12-15		IF-RECV only : minimum IF-RECV transfer required
+	unsigned __int32	ulLength;					//16-19		bytes of Packet data following this header
+} TComPacketHeader;
+
+//
+//	Packet header : one per session within a ComPacket.
+//
+typedef struct TPacketHeader
+{
+	unsigned __int32	ulTSN;						//0-3		TPer session number
+	unsigned __int32	ulHSN;						//4-7		Host session number
+	unsigned __int32	ulSeqNumber;				//8-11
+	unsigned __int16	wReserved;					//12-13
+	unsigned __int16	wAckType;					//14-15
+	unsigned __int32	ulAcknowledgement;			//16-19
+	unsigned __int32	ulLength;					//20-23		bytes of SubPacket data following this header
+} TPacketHeader;
+
+//
+//	Data SubPacket header : the token stream payload follows, padded to a 4 byte boundary.
+//
+typedef struct TDataSubPacketHeader
+{
+	BYTE				pbyReserved[6];				//0-5
+	unsigned __int16	wKind;						//6-7		0x0000 = data
+	unsigned __int32	ulLength;					//8-11		bytes of token payload (excludes pad)
+} TDataSubPacketHeader;
+//
+#pragma	pack(pop)
+
+static const unsigned int nSizeTComPacketHeader = sizeof(TComPacketHeader);
+static const unsigned int nSizeTPacketHeader = sizeof(TPacketHeader);
+static const unsigned int nSizeTDataSubPacketHeader = sizeof(TDataSubPacketHeader);
+
+
+// The TComPacketStatus struct holds the host-order view of an IF-RECV ComPacket header.
+//
+typedef struct TComPacketStatus
+{
+	unsigned short		nComID;
+	unsigned int		nOutstandingData;
+	unsigned int		nMinTransfer;
+	unsigned int		nLength;
+
+	TComPacketStatus(void) : nComID(0), nOutstandingData(0), nMinTransfer(0), nLength(0) {}
+
+	// Decode the header at the front of an IF-RECV buffer.  Returns false if the buffer cannot hold one.
+	bool Decode(const BYTE *pbyBuffer, unsigned nSizeBuffer)
+	{
+		ASSERT(pbyBuffer != NULL);
+		if ((!pbyBuffer) || (nSizeBuffer < nSizeTComPacketHeader))
+			return false;
+
+		const TComPacketHeader *pHeader = reinterpret_cast<const TComPacketHeader*>(pbyBuffer);
+		nComID = n16ByteSwap(pHeader->wComID);
+		nOutstandingData = n32ByteSwap(pHeader->ulOutstandingData);
+		nMinTransfer = n32ByteSwap(pHeader->ulMinTransfer);
+		nLength = n32ByteSwap(pHeader->ulLength);
+		return true;
+	}
+
+	// A response is present within this transfer.
+	inline bool HasResponse(void) const
+		{ return (nLength > 0); }
+
+	// No response present, yet the TPer holds (or is still producing) response data for this ComID.
+	inline bool IsPending(void) const
+		{ return ((nLength == 0) && (nOutstandingData > 0)); }
+
+	// The number of response bytes the TPer reports as pending, zero if it cannot yet say.
+	// An OutstandingData value of 1 only indicates that the TPer is still processing.
+	inline unsigned int PendingBytes(void) const
+	{
+		unsigned int nPending = (nOutstandingData > 1) ? nOutstandingData : 0;
+		return ((nMinTransfer > nPending) ? nMinTransfer : nPending);
+	}
+} TComPacketStatus;
+
+
+// Round a transfer length up to the next whole transfer block.
+inline unsigned int TcgRoundUpTransfer(unsigned int nBytes, unsigned int nBlockSize = TCG_TRANSFER_BLOCK_SIZE)
+{
+	ASSERT(nBlockSize > 0);
+	return (((nBytes + nBlockSize - 1) / nBlockSize) * nBlockSize);
+}
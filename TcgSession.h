@@ -0,0 +1,488 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "DiskDrive.h"
+#include "TcgComPacket.h"
+#include "TcgTokens.h"
+
+
+//  TCG Storage sessions.
+//
+//  The CTcgSession class frames method invocations into ComPackets for a drive, exchanges them
+//  via CDiskDrive::Transmit and splits the response token stream into per-method results.  The
+//  session also performs Level 0 Discovery (to find the base ComID) and the Properties exchange
+//  (to learn the TPer's ComPacket and method limits, used by the batching in TcgTable.h).
+//
+//		see:	"TCG Storage Architecture Core Specification", sections 3.3 (Communications)
+//				and 5.2 (Session Manager)
+//
+
+#define TCG_LEVEL0_DISCOVERY_COMID		0x0001
+#define TCG_LEVEL0_DISCOVERY_LENGTH		2048
+#define TCG_HOST_SESSION_NUMBER			0x00000105
+#define TCG_PAYLOAD_OFFSET				(sizeof(TComPacketHeader) + sizeof(TPacketHeader) + sizeof(TDataSubPacketHeader))
+
+// Level 0 Discovery feature codes.
+#define TCG_FEATURE_TPER				0x0001
+#define TCG_FEATURE_LOCKING				0x0002
+#define TCG_FEATURE_GEOMETRY			0x0003
+#define TCG_FEATURE_ENTERPRISE			0x0100
+#define TCG_FEATURE_OPAL_V1				0x0200
+#define TCG_FEATURE_SINGLE_USER			0x0201
+#define TCG_FEATURE_DATASTORE			0x0202
+#define TCG_FEATURE_OPAL_V2				0x0203
+#define TCG_FEATURE_OPALITE				0x0301
+#define TCG_FEATURE_PYRITE_V1			0x0302
+#define TCG_FEATURE_PYRITE_V2			0x0303
+#define TCG_FEATURE_RUBY				0x0304
+
+
+// The TTcgProperties struct holds the TPer communication limits reported by the Properties method.
+// The defaults are the minimums every TPer must support.
+//
+typedef struct TTcgProperties
+{
+	unsigned int		nMaxComPacketSize;
+	unsigned int		nMaxResponseComPacketSize;
+	unsigned int		nMaxPacketSize;
+	unsigned int		nMaxIndTokenSize;
+	unsigned int		nMaxPackets;
+	unsigned int		nMaxSubpackets;
+	unsigned int		nMaxMethods;
+
+	TTcgProperties(void)
+	{
+		nMaxComPacketSize = 2048;
+		nMaxResponseComPacketSize = 2048;
+		nMaxPacketSize = 2028;
+		nMaxIndTokenSize = 1992;
+		nMaxPackets = 1;
+		nMaxSubpackets = 1;
+		nMaxMethods = 1;
+	}
+
+	// Largest token payload that fits within one Data SubPacket of a ComPacket.
+	inline unsigned int MaxTokenPayload(void) const
+	{
+		unsigned int nFraming = nSizeTComPacketHeader + nSizeTPacketHeader + nSizeTDataSubPacketHeader + 3;
+		unsigned int nPacket = nMaxPacketSize + nSizeTComPacketHeader;
+		unsigned int nLimit = (nMaxComPacketSize < nPacket) ? nMaxComPacketSize : nPacket;
+		return ((nLimit > nFraming) ? (nLimit - nFraming) : 0);
+	}
+
+	// Largest token payload of one response ComPacket.
+	inline unsigned int MaxResponsePayload(void) const
+	{
+		unsigned int nFraming = nSizeTComPacketHeader + nSizeTPacketHeader + nSizeTDataSubPacketHeader;
+		return ((nMaxResponseComPacketSize > nFraming) ? (nMaxResponseComPacketSize - nFraming) : 0);
+	}
+
+	// The limits leave room for at least one method and its response (a TPer may report any values).
+	inline bool Framable(void) const
+		{ return ((MaxTokenPayload() > 0) && (MaxResponsePayload() > 0) && (nMaxMethods > 0)); }
+} TTcgProperties;
+
+
+// The TTcgMethodResult struct locates one method result within the session's decoded response
+// tokens.  The range [nFirst, nEnd) spans the contents of the outermost result list.
+//
+typedef struct TTcgMethodResult
+{
+	BYTE				byStatus;
+	unsigned int		nFirst;
+	unsigned int		nEnd;
+} TTcgMethodResult;
+
+typedef std::vector<TTcgMethodResult> TListTcgMethodResults;
+
+
+template <typename IBusInterfaceType>
+class CTcgSession
+{
+  private:
+	CDiskDrive<IBusInterfaceType>	&_rDisk;
+	unsigned short					_nComId;			// Base ComID from Level 0 Discovery
+	unsigned int					_nTSN;				// TPer session number, 0 when no session is open
+	unsigned int					_nHSN;				// Host session number
+	bool							_bDiscovered;
+	TTcgProperties					_sProperties;		// Negotiated communication limits
+	std::vector<BYTE>				_vCommand;			// IF-SEND ComPacket under construction
+	std::vector<BYTE>				_vResponse;			// Last IF-RECV ComPacket
+	TListTcgTokens					_listTokens;		// Decoded from _vResponse (references it)
+	unsigned __int64				_nDeadlineUs;		// PerfCounterMicroseconds by which to be done, 0 = none
+
+	// Write the ComPacket / Packet / Data SubPacket headers in front of a payload already placed at
+	// TCG_PAYLOAD_OFFSET, zero the pad and return the transfer length (whole blocks).
+	unsigned int FrameComPacket(std::vector<BYTE> &rFrame, unsigned int nPayload, unsigned int nTSN, unsigned int nHSN)
+	{
+		unsigned int nSubPacket = nSizeTDataSubPacketHeader + nPayload + ((4 - (nPayload % 4)) % 4);
+		unsigned int nPacket = nSizeTPacketHeader + nSubPacket;
+		unsigned int nComPacket = nSizeTComPacketHeader + nPacket;
+		unsigned int nTransfer = TcgRoundUpTransfer(nComPacket, _rDisk.BytesPerSector());
+
+		if (rFrame.size() < nTransfer)
+			rFrame.resize(nTransfer, 0);
+		::ZeroMemory(&rFrame[0], TCG_PAYLOAD_OFFSET);
+		::ZeroMemory(rFrame.data() + TCG_PAYLOAD_OFFSET + nPayload, nTransfer - (TCG_PAYLOAD_OFFSET + nPayload));	// Zero bytes when the payload fills the frame
+
+		TComPacketHeader *pComPacket = reinterpret_cast<TComPacketHeader*>(&rFrame[0]);
+		pComPacket->wComID = n16ByteSwap(_nComId);
+		pComPacket->ulLength = n32ByteSwap(nPacket);
+
+		TPacketHeader *pPacket = reinterpret_cast<TPacketHeader*>(&rFrame[nSizeTComPacketHeader]);
+		pPacket->ulTSN = n32ByteSwap(nTSN);
+		pPacket->ulHSN = n32ByteSwap(nHSN);
+		pPacket->ulLength = n32ByteSwap(nSubPacket);
+
+		TDataSubPacketHeader *pSubPacket = reinterpret_cast<TDataSubPacketHeader*>(&rFrame[nSizeTComPacketHeader + nSizeTPacketHeader]);
+		pSubPacket->ulLength = n32ByteSwap(nPayload);
+		return nTransfer;
+	}
+
+	// Wrap the token payload in ComPacket / Packet / Data SubPacket headers for the current session.
+	unsigned int BuildComPacket(const std::vector<BYTE> &rPayload, unsigned int nTSN, unsigned int nHSN)
+	{
+		unsigned int nPayload = (unsigned int)rPayload.size();
+
+		_vCommand.resize(TCG_PAYLOAD_OFFSET + nPayload);
+		if (nPayload > 0)
+			::memcpy_s(&_vCommand[TCG_PAYLOAD_OFFSET], _vCommand.size() - TCG_PAYLOAD_OFFSET, &rPayload[0], nPayload);
+		return FrameComPacket(_vCommand, nPayload, nTSN, nHSN);
+	}
+
+	// Locate and decode the token payload of the response ComPacket held in _vResponse.
+	bool DecodeResponse(_bstr_t &rbstrErrorInfo)
+	{
+		unsigned int nOffset = nSizeTComPacketHeader + nSizeTPacketHeader + nSizeTDataSubPacketHeader;
+		if (_vResponse.size() < nOffset)
+		{
+			rbstrErrorInfo = L"CTcgSession : Response ComPacket too short.";
+			return false;
+		}
+
+		const TPacketHeader *pPacket = reinterpret_cast<const TPacketHeader*>(&_vResponse[nSizeTComPacketHeader]);
+		const TDataSubPacketHeader *pSubPacket = reinterpret_cast<const TDataSubPacketHeader*>(&_vResponse[nSizeTComPacketHeader + nSizeTPacketHeader]);
+		unsigned int nPayload = n32ByteSwap(pSubPacket->ulLength);
+
+		if ((n32ByteSwap(pPacket->ulHSN) != _nHSN) && (_nTSN != 0))
+		{
+			rbstrErrorInfo = ::BuildMessage(L"CTcgSession : Response for HSN 0x%08X, expected 0x%08X.", n32ByteSwap(pPacket->ulHSN), _nHSN);
+			return false;
+		}
+		if ((nOffset + nPayload) > _vResponse.size())
+		{
+			rbstrErrorInfo = L"CTcgSession : Response SubPacket length exceeds the ComPacket.";
+			return false;
+		}
+		if (!TcgDecodeTokens((nPayload > 0) ? &_vResponse[nOffset] : NULL, nPayload, _listTokens))
+		{
+			rbstrErrorInfo = L"CTcgSession : Malformed response token stream.";
+			return false;
+		}
+		return true;
+	}
+
+	// Split the decoded tokens into method results : [Call InvokingUID MethodUID] StartList ... EndList EndOfData StatusList
+	bool SplitResults(_bstr_t &rbstrErrorInfo, TListTcgMethodResults &rResults)
+	{
+		unsigned int i = 0;
+		unsigned int nTokens = (unsigned int)_listTokens.size();
+		rResults.clear();
+
+		while (i < nTokens)
+		{
+			if (_listTokens[i].Is(TCG_TOKEN_ENDOFSESSION))
+			{
+				_nTSN = 0;
+				break;
+			}
+			if (_listTokens[i].Is(TCG_TOKEN_CALL))
+				i += 3;			// session manager responses arrive as a method call
+			if ((i >= nTokens) || (!_listTokens[i].Is(TCG_TOKEN_STARTLIST)))
+			{
+				rbstrErrorInfo = L"CTcgSession : Method result list expected.";
+				return false;
+			}
+
+			TTcgMethodResult result = { TCG_STATUS_FAIL, i + 1, 0 };
+			int nDepth = 0;
+			for (; i < nTokens; i++)
+			{
+				if (_listTokens[i].Is(TCG_TOKEN_STARTLIST))
+					nDepth++;
+				else if ((_listTokens[i].Is(TCG_TOKEN_ENDLIST)) && (--nDepth == 0))
+					break;
+			}
+			result.nEnd = i++;
+
+			// EndOfData StartList status reserved reserved EndList
+			if (((i + 6) > nTokens) ||
+				(!_listTokens[i].Is(TCG_TOKEN_ENDOFDATA)) ||
+				(!_listTokens[i + 1].Is(TCG_TOKEN_STARTLIST)) ||
+				(!_listTokens[i + 2].IsUInt()))
+			{
+				rbstrErrorInfo = L"CTcgSession : Method status list expected.";
+				return false;
+			}
+			result.byStatus = (BYTE)_listTokens[i + 2].nValue;
+			rResults.push_back(result);
+			i += 6;
+		}
+		return true;
+	}
+
+	// The time an exchange may take : TCG_RECEIVE_TIMEOUT_MS, or less when the deadline (see
+	// SetDeadline) is nearer.  Fails, nothing being sent, once the deadline has passed.
+	bool ExchangeTimeout(_bstr_t &rbstrErrorInfo, DWORD &rdwTimeoutMs)
+	{
+		unsigned __int64 nNowUs = ::PerfCounterMicroseconds();
+
+		rdwTimeoutMs = TCG_RECEIVE_TIMEOUT_MS;
+		if (_nDeadlineUs == 0)
+			return true;
+		if ((nNowUs + 1000) > _nDeadlineUs)
+		{
+			rbstrErrorInfo = ::BuildMessage(L"CTcgSession : %ws : Deadline passed.", (const wchar_t*)_rDisk.Name());
+			return false;
+		}
+		if (((_nDeadlineUs - nNowUs) / 1000) < rdwTimeoutMs)
+			rdwTimeoutMs = (DWORD)((_nDeadlineUs - nNowUs) / 1000);
+		return true;
+	}
+
+	// Exchange the token payload on the current session (or the session manager when nTSN is 0).
+	bool Exchange(_bstr_t &rbstrErrorInfo, const std::vector<BYTE> &rPayload, unsigned int nTSN, unsigned int nHSN, TListTcgMethodResults &rResults)
+	{
+		DWORD dwTimeoutMs = 0;
+		if (!ExchangeTimeout(rbstrErrorInfo, dwTimeoutMs))
+			return false;
+		unsigned int nTransfer = BuildComPacket(rPayload, nTSN, nHSN);
+		if (!_rDisk.Transmit(rbstrErrorInfo, TCG_SECURITY_PROTOCOL_1, _nComId, &_vCommand[0], nTransfer, _vResponse, dwTimeoutMs))
+			return false;
+		if (!DecodeResponse(rbstrErrorInfo))
+			return false;
+		return SplitResults(rbstrErrorInfo, rResults);
+	}
+
+  public:
+	CTcgSession(CDiskDrive<IBusInterfaceType> &rDisk) : _rDisk(rDisk), _nComId(0), _nTSN(0),
+		_nHSN(TCG_HOST_SESSION_NUMBER), _bDiscovered(false), _nDeadlineUs(0)
+	{
+	}
+
+	// An open session is ended on destruction, unless the deadline has passed : the TPer then
+	// closes it on its own session timeout.
+	~CTcgSession()
+	{
+		_bstr_t bstrIgnored;
+		if (IsOpen())
+			End(bstrIgnored);
+	}
+
+	// Level 0 Discovery : confirm TCG support and obtain the base ComID.
+	bool Discover(_bstr_t &rbstrErrorInfo)
+	{
+		TRACE(L"CTcgSession::Discover\n");
+		std::vector<BYTE> vDiscovery(TCG_LEVEL0_DISCOVERY_LENGTH, 0);
+		DWORD dwTimeoutMs = 0;
+
+		if (!ExchangeTimeout(rbstrErrorInfo, dwTimeoutMs))
+			return false;
+		if (!_rDisk.TrustedReceive(rbstrErrorInfo, TCG_SECURITY_PROTOCOL_1, TCG_LEVEL0_DISCOVERY_COMID, vDiscovery, dwTimeoutMs))
+			return false;
+
+		// 48 byte header (big-endian length of the following data), then feature descriptors.
+		unsigned int nLength = n32ByteSwap(*reinterpret_cast<const unsigned __int32*>(&vDiscovery[0])) + 4;
+		if (nLength > vDiscovery.size())
+			nLength = (unsigned int)vDiscovery.size();
+
+		for (unsigned int i = 48; (i + 4) <= nLength; )
+		{
+			unsigned short nFeature = (unsigned short)((vDiscovery[i] << 8) | vDiscovery[i + 1]);
+			unsigned int nDescriptor = 4 + vDiscovery[i + 3];
+			if ((nFeature == TCG_FEATURE_ENTERPRISE) || (nFeature == TCG_FEATURE_OPAL_V1) || (nFeature == TCG_FEATURE_OPAL_V2) ||
+				(nFeature == TCG_FEATURE_OPALITE) || (nFeature == TCG_FEATURE_PYRITE_V1) || (nFeature == TCG_FEATURE_PYRITE_V2) ||
+				(nFeature == TCG_FEATURE_RUBY))
+			{
+				if ((i + 6) <= nLength)
+				{
+					_nComId = (unsigned short)((vDiscovery[i + 4] << 8) | vDiscovery[i + 5]);
+					_bDiscovered = true;
+					return true;
+				}
+			}
+			i += nDescriptor;
+		}
+		rbstrErrorInfo = ::BuildMessage(L"CTcgSession::Discover : %ws : No TCG SSC feature descriptor.", (const wchar_t*)_rDisk.Name());
+		return false;
+	}
+
+	// Session manager Properties method : learn the TPer's communication limits.
+	bool ExchangeProperties(_bstr_t &rbstrErrorInfo)
+	{
+		TRACE(L"CTcgSession::ExchangeProperties\n");
+		CTcgTokenWriter writer;
+		TListTcgMethodResults results;
+
+		if ((!_bDiscovered) && (!Discover(rbstrErrorInfo)))
+			return false;
+
+		// Advertise matching host limits so the TPer will use its own maximums.
+		writer.BeginMethod(TCG_UID_SMUID, TCG_METHOD_PROPERTIES);
+		writer.StartName();
+		writer.UInt(0);
+		writer.StartList();
+		writer.StartName(); writer.Bytes("MaxComPacketSize"); writer.UInt(TCG_MAX_TRANSFER_BLOCKS * 32); writer.EndName();
+		writer.StartName(); writer.Bytes("MaxPacketSize"); writer.UInt((TCG_MAX_TRANSFER_BLOCKS * 32) - nSizeTComPacketHeader); writer.EndName();
+		writer.StartName(); writer.Bytes("MaxIndTokenSize"); writer.UInt((TCG_MAX_TRANSFER_BLOCKS * 32) - 56); writer.EndName();
+		writer.StartName(); writer.Bytes("MaxPackets"); writer.UInt(1); writer.EndName();
+		writer.StartName(); writer.Bytes("MaxSubpackets"); writer.UInt(1); writer.EndName();
+		writer.StartName(); writer.Bytes("MaxMethods"); writer.UInt(0xFFFF); writer.EndName();
+		writer.EndList();
+		writer.EndName();
+		writer.EndMethod();
+
+		if (!Exchange(rbstrErrorInfo, writer.Buffer(), 0, 0, results))
+			return false;
+		if ((results.size() != 1) || (results[0].byStatus != TCG_STATUS_SUCCESS))
+		{
+			rbstrErrorInfo = L"CTcgSession::ExchangeProperties : Properties method failed.";
+			return false;
+		}
+
+		// The first nested list holds the TPer properties as name / value pairs.
+		TTcgProperties sTPer;
+		for (unsigned int i = results[0].nFirst + 1; (i + 3) < results[0].nEnd; i++)
+		{
+			if (_listTokens[i].Is(TCG_TOKEN_ENDLIST))
+				break;
+			if ((!_listTokens[i].Is(TCG_TOKEN_STARTNAME)) || (!_listTokens[i + 2].IsUInt()))
+				continue;
+			const TTcgToken &rName = _listTokens[i + 1];
+			unsigned int nValue = (unsigned int)_listTokens[i + 2].nValue;
+			if (rName.NameEquals("MaxComPacketSize"))				sTPer.nMaxComPacketSize = nValue;
+			else if (rName.NameEquals("MaxResponseComPacketSize"))	sTPer.nMaxResponseComPacketSize = nValue;
+			else if (rName.NameEquals("MaxPacketSize"))				sTPer.nMaxPacketSize = nValue;
+			else if (rName.NameEquals("MaxIndTokenSize"))			sTPer.nMaxIndTokenSize = nValue;
+			else if (rName.NameEquals("MaxPackets"))				sTPer.nMaxPackets = nValue;
+			else if (rName.NameEquals("MaxSubpackets"))				sTPer.nMaxSubpackets = nValue;
+			else if (rName.NameEquals("MaxMethods"))				sTPer.nMaxMethods = nValue;
+			i += 3;
+		}
+		_sProperties = sTPer;
+		return true;
+	}
+
+	// StartSession on the given SP, optionally authenticating as uidAuthority with the given challenge (PIN).
+	bool Start(_bstr_t &rbstrErrorInfo, TTcgUid uidSP, bool bWrite, TTcgUid uidAuthority = 0,
+			   const BYTE *pbyChallenge = NULL, unsigned nChallenge = 0)
+	{
+		TRACE(L"CTcgSession::Start\n");
+		CTcgTokenWriter writer;
+		TListTcgMethodResults results;
+
+		if ((!_bDiscovered) && (!Discover(rbstrErrorInfo)))
+			return false;
+		if (IsOpen())
+			End(rbstrErrorInfo);
+
+		writer.BeginMethod(TCG_UID_SMUID, TCG_METHOD_STARTSESSION);
+		writer.UInt(_nHSN);
+		writer.Uid(uidSP);
+		writer.UInt(bWrite ? 1 : 0);
+		if (pbyChallenge != NULL)
+		{
+			writer.StartName(); writer.UInt(0); writer.Bytes(pbyChallenge, nChallenge); writer.EndName();
+		}
+		if (uidAuthority != 0)
+		{
+			writer.StartName(); writer.UInt(3); writer.Uid(uidAuthority); writer.EndName();
+		}
+		writer.EndMethod();
+
+		if (!Exchange(rbstrErrorInfo, writer.Buffer(), 0, 0, results))
+			return false;
+		if ((results.size() != 1) || (results[0].byStatus != TCG_STATUS_SUCCESS) ||
+			((results[0].nFirst + 1) >= results[0].nEnd) ||
+			(!_listTokens[results[0].nFirst].IsUInt()) || (!_listTokens[results[0].nFirst + 1].IsUInt()))
+		{
+			rbstrErrorInfo = ::BuildMessage(L"CTcgSession::Start : %ws : StartSession failed, status 0x%02X.",
+											(const wchar_t*)_rDisk.Name(), results.empty() ? TCG_STATUS_FAIL : results[0].byStatus);
+			return false;
+		}
+
+		// SyncSession [ HostSessionID, SPSessionID ]
+		_nTSN = (unsigned int)_listTokens[results[0].nFirst + 1].nValue;
+		return true;
+	}
+
+	// Past the deadline nothing is sent, and the session is forgotten as if ended.
+	bool End(_bstr_t &rbstrErrorInfo)
+	{
+		TRACE(L"CTcgSession::End\n");
+		std::vector<BYTE> vEnd(1, TCG_TOKEN_ENDOFSESSION);
+		TListTcgMethodResults results;
+
+		if (!IsOpen())
+			return true;
+		bool bres = Exchange(rbstrErrorInfo, vEnd, _nTSN, _nHSN, results);
+		_nTSN = 0;
+		return bres;
+	}
+
+	// Invoke one or more encoded method calls within the open session.  One result is returned per method.
+	bool Invoke(_bstr_t &rbstrErrorInfo, const std::vector<BYTE> &rMethods, TListTcgMethodResults &rResults)
+	{
+		TRACE(L"CTcgSession::Invoke\n");
+		if (!IsOpen())
+		{
+			rbstrErrorInfo = L"CTcgSession::Invoke : No session is open.";
+			return false;
+		}
+		return Exchange(rbstrErrorInfo, rMethods, _nTSN, _nHSN, rResults);
+	}
+
+	// As Invoke, for a caller which has placed nPayload bytes of encoded methods at TCG_PAYLOAD_OFFSET
+	// within rFrame (e.g. reading bulk data straight into place, see TcgBulkTransfer.h).
+	bool InvokeFramed(_bstr_t &rbstrErrorInfo, std::vector<BYTE> &rFrame, unsigned int nPayload, TListTcgMethodResults &rResults)
+	{
+		TRACE(L"CTcgSession::InvokeFramed\n");
+		if (!IsOpen())
+		{
+			rbstrErrorInfo = L"CTcgSession::InvokeFramed : No session is open.";
+			return false;
+		}
+		DWORD dwTimeoutMs = 0;
+		if (!ExchangeTimeout(rbstrErrorInfo, dwTimeoutMs))
+			return false;
+		unsigned int nTransfer = FrameComPacket(rFrame, nPayload, _nTSN, _nHSN);
+		if (!_rDisk.Transmit(rbstrErrorInfo, TCG_SECURITY_PROTOCOL_1, _nComId, &rFrame[0], nTransfer, _vResponse, dwTimeoutMs))
+			return false;
+		if (!DecodeResponse(rbstrErrorInfo))
+			return false;
+		return SplitResults(rbstrErrorInfo, rResults);
+	}
+
+	// Bound every later exchange, End Session included, by nDeadlineUs (see PerfCounterMicroseconds).
+	inline void SetDeadline(unsigned __int64 nDeadlineUs)
+		{ _nDeadlineUs = nDeadlineUs; }
+
+	// Accessors
+	inline bool IsOpen(void) const
+		{ return (_nTSN != 0); }
+
+	inline unsigned short ComId(void) const
+		{ return _nComId; }
+
+	inline const TTcgProperties &Properties(void) const
+		{ return _sProperties; }
+
+	inline const TListTcgTokens &Tokens(void) const
+		{ return _listTokens; }
+
+	inline CDiskDrive<IBusInterfaceType> &Disk(void)
+		{ return _rDisk; }
+};	// CTcgSession
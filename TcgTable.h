@@ -0,0 +1,442 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "TcgSession.h"
+
+
+//  Batched TCG table access.
+//
+//  Reading the Locking ranges, C_PIN entries or the DataStore one cell at a time costs one
+//  IF-SEND / IF-RECV exchange per method.  The CTcgTableBatch class queues Get and Set
+//  operations, then packs as many of them as the negotiated limits permit (MaxMethods, the
+//  ComPacket token payload and an estimate of the response size) into each exchange.  Results
+//  are copied out of the response so they remain valid after later exchanges.  Operations that
+//  fail with RESPONSE_OVERFLOW as part of a multi-method exchange are retried individually.
+//
+//  ReadLockingRanges, ReadCPins and ReadByteTable decode batch results into typed structs.
+//
+
+#define TCG_CELL_RESPONSE_ESTIMATE		16		// Estimated response bytes per requested column
+#define TCG_METHOD_RESPONSE_OVERHEAD	16		// Result list, EndOfData and status list
+
+// Locking table columns.
+#define TCG_LOCKING_COL_RANGESTART			3
+#define TCG_LOCKING_COL_RANGELENGTH			4
+#define TCG_LOCKING_COL_READLOCKENABLED		5
+#define TCG_LOCKING_COL_WRITELOCKENABLED	6
+#define TCG_LOCKING_COL_READLOCKED			7
+#define TCG_LOCKING_COL_WRITELOCKED			8
+
+// C_PIN table columns.
+#define TCG_CPIN_COL_PIN					3
+#define TCG_CPIN_COL_TRYLIMIT				5
+#define TCG_CPIN_COL_TRIES					6
+#define TCG_CPIN_COL_PERSISTENCE			7
+
+
+// A column value copied from a Get result.
+//
+typedef struct TTcgCell
+{
+	unsigned int		nColumn;
+	bool				bBytes;
+	unsigned __int64	nValue;
+	std::vector<BYTE>	vBytes;
+} TTcgCell;
+
+// The outcome of one batched operation.
+//
+typedef struct TTcgOperationResult
+{
+	BYTE					byStatus;
+	std::vector<TTcgCell>	vCells;			// Get on an object : the returned columns
+	std::vector<BYTE>		vBytes;			// Get on a byte table : the returned bytes
+
+	TTcgOperationResult(void) : byStatus(TCG_STATUS_FAIL) {}
+
+	inline bool Succeeded(void) const
+		{ return (byStatus == TCG_STATUS_SUCCESS); }
+
+	const TTcgCell *Find(unsigned int nColumn) const
+	{
+		for (size_t i = 0; i < vCells.size(); i++)
+			if (vCells[i].nColumn == nColumn)
+				return &vCells[i];
+		return NULL;
+	}
+
+	unsigned __int64 UInt(unsigned int nColumn, unsigned __int64 nDefault = 0) const
+	{
+		const TTcgCell *pCell = Find(nColumn);
+		return (((pCell != NULL) && (!pCell->bBytes)) ? pCell->nValue : nDefault);
+	}
+} TTcgOperationResult;
+
+
+template <typename IBusInterfaceType>
+class CTcgTableBatch
+{
+  private:
+	enum ETcgOperation { eGetColumns, eGetBytes, eSetColumns, eSetBytes };
+
+	typedef struct TOperation
+	{
+		ETcgOperation		eKind;
+		TTcgUid				uidInvoking;
+		unsigned int		nFirst;				// start column, or byte table start row
+		unsigned int		nLast;				// end column, or byte table end row
+		std::vector<BYTE>	vMethod;			// Encoded method call
+	} TOperation;
+
+	std::vector<TOperation>				_vOperations;
+	std::vector<TTcgOperationResult>	_vResults;
+	unsigned int						_nExchanges;		// Exchanges performed by the last Execute
+
+	size_t Queue(ETcgOperation eKind, TTcgUid uidInvoking, unsigned int nFirst, unsigned int nLast, CTcgTokenWriter &rWriter)
+	{
+		TOperation op;
+		op.eKind = eKind;
+		op.uidInvoking = uidInvoking;
+		op.nFirst = nFirst;
+		op.nLast = nLast;
+		op.vMethod = rWriter.Buffer();
+		_vOperations.push_back(op);
+		return (_vOperations.size() - 1);
+	}
+
+	unsigned int EstimateResponse(const TOperation &rOp) const
+	{
+		switch (rOp.eKind)
+		{
+		case eGetColumns:
+			return (TCG_METHOD_RESPONSE_OVERHEAD + ((rOp.nLast - rOp.nFirst + 1) * TCG_CELL_RESPONSE_ESTIMATE));
+		case eGetBytes:
+			return (TCG_METHOD_RESPONSE_OVERHEAD + CTcgTokenWriter::BytesAtomSize(rOp.nLast - rOp.nFirst + 1));
+		default:
+			return TCG_METHOD_RESPONSE_OVERHEAD;
+		}
+	}
+
+	// Copy the result of one method out of the session's response tokens.
+	void CopyResult(const TOperation &rOp, const TListTcgTokens &rTokens, const TTcgMethodResult &rMethod, TTcgOperationResult &rResult)
+	{
+		rResult.byStatus = rMethod.byStatus;
+		rResult.vCells.clear();
+		rResult.vBytes.clear();
+		if (rMethod.byStatus != TCG_STATUS_SUCCESS)
+			return;
+
+		if (rOp.eKind == eGetBytes)
+		{
+			// [ bytes ]
+			if ((rMethod.nFirst < rMethod.nEnd) && (rTokens[rMethod.nFirst].bBytes))
+				rResult.vBytes.assign(rTokens[rMethod.nFirst].pbyData, rTokens[rMethod.nFirst].pbyData + rTokens[rMethod.nFirst].nLength);
+		}
+		else if (rOp.eKind == eGetColumns)
+		{
+			// [ [ Name column value EndName ... ] ]
+			for (unsigned int i = rMethod.nFirst + 1; (i + 3) < rMethod.nEnd; i++)
+			{
+				if ((!rTokens[i].Is(TCG_TOKEN_STARTNAME)) || (!rTokens[i + 1].IsUInt()) || (!rTokens[i + 2].IsAtom()))
+					continue;
+				TTcgCell cell;
+				cell.nColumn = (unsigned int)rTokens[i + 1].nValue;
+				cell.bBytes = rTokens[i + 2].bBytes;
+				cell.nValue = rTokens[i + 2].nValue;
+				if (cell.bBytes)
+					cell.vBytes.assign(rTokens[i + 2].pbyData, rTokens[i + 2].pbyData + rTokens[i + 2].nLength);
+				rResult.vCells.push_back(cell);
+				i += 3;
+			}
+		}
+	}
+
+	// Exchange the operations [nFirst, nEnd) as one batch.
+	bool ExchangeBatch(_bstr_t &rbstrErrorInfo, CTcgSession<IBusInterfaceType> &rSession, size_t nFirst, size_t nEnd, std::vector<size_t> &rOverflowed)
+	{
+		std::vector<BYTE> vPayload;
+		TListTcgMethodResults results;
+
+		for (size_t i = nFirst; i < nEnd; i++)
+			vPayload.insert(vPayload.end(), _vOperations[i].vMethod.begin(), _vOperations[i].vMethod.end());
+
+		_nExchanges++;
+		if (!rSession.Invoke(rbstrErrorInfo, vPayload, results))
+			return false;
+		if (results.size() != (nEnd - nFirst))
+		{
+			rbstrErrorInfo = ::BuildMessage(L"CTcgTableBatch : %u results returned for %u methods.", (unsigned)results.size(), (unsigned)(nEnd - nFirst));
+			return false;
+		}
+
+		for (size_t i = nFirst; i < nEnd; i++)
+		{
+			if ((results[i - nFirst].byStatus == TCG_STATUS_RESPONSE_OVERFLOW) && ((nEnd - nFirst) > 1))
+				rOverflowed.push_back(i);
+			CopyResult(_vOperations[i], rSession.Tokens(), results[i - nFirst], _vResults[i]);
+		}
+		return true;
+	}
+
+  public:
+	CTcgTableBatch(void) : _nExchanges(0) {}
+
+	inline void Clear(void)
+	{
+		_vOperations.clear();
+		_vResults.clear();
+	}
+
+	// Get columns [nStartColumn, nEndColumn] of one object (table row).
+	size_t GetColumns(TTcgUid uidObject, unsigned int nStartColumn, unsigned int nEndColumn)
+	{
+		CTcgTokenWriter writer;
+		writer.BeginMethod(uidObject, TCG_METHOD_GET);
+		writer.StartList();
+		writer.StartName(); writer.UInt(TCG_NAME_STARTCOLUMN); writer.UInt(nStartColumn); writer.EndName();
+		writer.StartName(); writer.UInt(TCG_NAME_ENDCOLUMN); writer.UInt(nEndColumn); writer.EndName();
+		writer.EndList();
+		writer.EndMethod();
+		return Queue(eGetColumns, uidObject, nStartColumn, nEndColumn, writer);
+	}
+
+	// Get nLength bytes from a byte table (e.g. DataStore, MBR) at nOffset.
+	size_t GetBytes(TTcgUid uidTable, unsigned int nOffset, unsigned int nLength)
+	{
+		ASSERT(nLength > 0);
+		CTcgTokenWriter writer;
+		writer.BeginMethod(uidTable, TCG_METHOD_GET);
+		writer.StartList();
+		writer.StartName(); writer.UInt(TCG_NAME_STARTROW); writer.UInt(nOffset); writer.EndName();
+		writer.StartName(); writer.UInt(TCG_NAME_ENDROW); writer.UInt(nOffset + nLength - 1); writer.EndName();
+		writer.EndList();
+		writer.EndMethod();
+		return Queue(eGetBytes, uidTable, nOffset, nOffset + nLength - 1, writer);
+	}
+
+	// Set one unsigned integer column of an object.
+	size_t SetColumn(TTcgUid uidObject, unsigned int nColumn, unsigned __int64 nValue)
+	{
+		CTcgTokenWriter writer;
+		writer.BeginMethod(uidObject, TCG_METHOD_SET);
+		writer.StartName(); writer.UInt(TCG_NAME_SET_VALUES);
+		writer.StartList();
+		writer.StartName(); writer.UInt(nColumn); writer.UInt(nValue); writer.EndName();
+		writer.EndList();
+		writer.EndName();
+		writer.EndMethod();
+		return Queue(eSetColumns, uidObject, nColumn, nColumn, writer);
+	}
+
+	// Set one byte sequence column of an object (e.g. C_PIN PIN).
+	size_t SetColumn(TTcgUid uidObject, unsigned int nColumn, const BYTE *pbyValue, unsigned int nLength)
+	{
+		CTcgTokenWriter writer;
+		writer.BeginMethod(uidObject, TCG_METHOD_SET);
+		writer.StartName(); writer.UInt(TCG_NAME_SET_VALUES);
+		writer.StartList();
+		writer.StartName(); writer.UInt(nColumn); writer.Bytes(pbyValue, nLength); writer.EndName();
+		writer.EndList();
+		writer.EndName();
+		writer.EndMethod();
+		return Queue(eSetColumns, uidObject, nColumn, nColumn, writer);
+	}
+
+	// Write nLength bytes into a byte table at nOffset.
+	size_t SetBytes(TTcgUid uidTable, unsigned int nOffset, const BYTE *pbyValue, unsigned int nLength)
+	{
+		CTcgTokenWriter writer;
+		writer.BeginMethod(uidTable, TCG_METHOD_SET);
+		writer.StartName(); writer.UInt(TCG_NAME_SET_WHERE); writer.UInt(nOffset); writer.EndName();
+		writer.StartName(); writer.UInt(TCG_NAME_SET_VALUES); writer.Bytes(pbyValue, nLength); writer.EndName();
+		writer.EndMethod();
+		return Queue(eSetBytes, uidTable, nOffset, nOffset + nLength - 1, writer);
+	}
+
+	// Issue all queued operations in as few exchanges as the session limits allow.
+	bool Execute(_bstr_t &rbstrErrorInfo, CTcgSession<IBusInterfaceType> &rSession)
+	{
+		TRACE(L"CTcgTableBatch::Execute\n");
+		const TTcgProperties &rLimits = rSession.Properties();
+		unsigned int nMaxPayload = rLimits.MaxTokenPayload();
+		unsigned int nMaxResponse = rLimits.MaxResponsePayload();
+		std::vector<size_t> vOverflowed;
+
+		if (!rLimits.Framable())
+		{
+			rbstrErrorInfo = L"CTcgTableBatch::Execute : The negotiated ComPacket limits leave no room for a method.";
+			return false;
+		}
+
+		_vResults.assign(_vOperations.size(), TTcgOperationResult());
+		_nExchanges = 0;
+
+		size_t nFirst = 0;
+		while (nFirst < _vOperations.size())
+		{
+			size_t nEnd = nFirst;
+			unsigned int nPayload = 0;
+			unsigned int nResponse = 0;
+
+			// Always take at least one operation; the TPer reports an oversize method itself.
+			while ((nEnd < _vOperations.size()) && ((nEnd - nFirst) < rLimits.nMaxMethods))
+			{
+				unsigned int nMethod = (unsigned int)_vOperations[nEnd].vMethod.size();
+				unsigned int nEstimate = EstimateResponse(_vOperations[nEnd]);
+				if ((nEnd > nFirst) && (((nPayload + nMethod) > nMaxPayload) || ((nResponse + nEstimate) > nMaxResponse)))
+					break;
+				nPayload += nMethod;
+				nResponse += nEstimate;
+				nEnd++;
+			}
+
+			if (!ExchangeBatch(rbstrErrorInfo, rSession, nFirst, nEnd, vOverflowed))
+				return false;
+			nFirst = nEnd;
+		}
+
+		for (size_t i = 0; i < vOverflowed.size(); i++)
+		{
+			std::vector<size_t> vIgnored;
+			if (!ExchangeBatch(rbstrErrorInfo, rSession, vOverflowed[i], vOverflowed[i] + 1, vIgnored))
+				return false;
+		}
+		return true;
+	}
+
+	// Accessors
+	inline size_t Count(void) const
+		{ return _vOperations.size(); }
+
+	inline const TTcgOperationResult &Result(size_t nIndex) const
+		{ return _vResults[nIndex]; }
+
+	inline unsigned int Exchanges(void) const
+		{ return _nExchanges; }
+};	// CTcgTableBatch
+
+
+// A decoded Locking table row.
+//
+typedef struct TLockingRange
+{
+	TTcgUid				uid;
+	BYTE				byStatus;
+	unsigned __int64	nRangeStart;
+	unsigned __int64	nRangeLength;
+	bool				bReadLockEnabled;
+	bool				bWriteLockEnabled;
+	bool				bReadLocked;
+	bool				bWriteLocked;
+} TLockingRange;
+
+// A decoded C_PIN table row (the PIN column itself is not readable).
+//
+typedef struct TCPinInfo
+{
+	TTcgUid				uid;
+	BYTE				byStatus;
+	unsigned int		nTryLimit;
+	unsigned int		nTries;
+	bool				bPersistence;
+} TCPinInfo;
+
+
+// Read the Global range and Locking ranges 1..nRanges.
+template <typename IBusInterfaceType>
+bool ReadLockingRanges(_bstr_t &rbstrErrorInfo, CTcgSession<IBusInterfaceType> &rSession, unsigned int nRanges, std::vector<TLockingRange> &rRanges)
+{
+	TRACE(L"ReadLockingRanges\n");
+	CTcgTableBatch<IBusInterfaceType> batch;
+
+	batch.GetColumns(TCG_UID_LOCKING_GLOBALRANGE, TCG_LOCKING_COL_RANGESTART, TCG_LOCKING_COL_WRITELOCKED);
+	for (unsigned int n = 1; n <= nRanges; n++)
+		batch.GetColumns(TCG_UID_LOCKING_RANGE1 + (n - 1), TCG_LOCKING_COL_RANGESTART, TCG_LOCKING_COL_WRITELOCKED);
+	if (!batch.Execute(rbstrErrorInfo, rSession))
+		return false;
+
+	rRanges.resize(batch.Count());
+	for (size_t i = 0; i < batch.Count(); i++)
+	{
+		const TTcgOperationResult &rResult = batch.Result(i);
+		TLockingRange &rRange = rRanges[i];
+		rRange.uid = (i == 0) ? TCG_UID_LOCKING_GLOBALRANGE : (TCG_UID_LOCKING_RANGE1 + (i - 1));
+		rRange.byStatus = rResult.byStatus;
+		rRange.nRangeStart = rResult.UInt(TCG_LOCKING_COL_RANGESTART);
+		rRange.nRangeLength = rResult.UInt(TCG_LOCKING_COL_RANGELENGTH);
+		rRange.bReadLockEnabled = (rResult.UInt(TCG_LOCKING_COL_READLOCKENABLED) != 0);
+		rRange.bWriteLockEnabled = (rResult.UInt(TCG_LOCKING_COL_WRITELOCKENABLED) != 0);
+		rRange.bReadLocked = (rResult.UInt(TCG_LOCKING_COL_READLOCKED) != 0);
+		rRange.bWriteLocked = (rResult.UInt(TCG_LOCKING_COL_WRITELOCKED) != 0);
+	}
+	TRACE(L"ReadLockingRanges : %u ranges in %u exchanges\n", (unsigned)rRanges.size(), batch.Exchanges());
+	return true;
+}
+
+// Read the try limit, tries and persistence of the given C_PIN objects.
+template <typename IBusInterfaceType>
+bool ReadCPins(_bstr_t &rbstrErrorInfo, CTcgSession<IBusInterfaceType> &rSession, const std::vector<TTcgUid> &rUids, std::vector<TCPinInfo> &rPins)
+{
+	TRACE(L"ReadCPins\n");
+	CTcgTableBatch<IBusInterfaceType> batch;
+
+	for (size_t i = 0; i < rUids.size(); i++)
+		batch.GetColumns(rUids[i], TCG_CPIN_COL_TRYLIMIT, TCG_CPIN_COL_PERSISTENCE);
+	if (!batch.Execute(rbstrErrorInfo, rSession))
+		return false;
+
+	rPins.resize(rUids.size());
+	for (size_t i = 0; i < rUids.size(); i++)
+	{
+		const TTcgOperationResult &rResult = batch.Result(i);
+		rPins[i].uid = rUids[i];
+		rPins[i].byStatus = rResult.byStatus;
+		rPins[i].nTryLimit = (unsigned int)rResult.UInt(TCG_CPIN_COL_TRYLIMIT);
+		rPins[i].nTries = (unsigned int)rResult.UInt(TCG_CPIN_COL_TRIES);
+		rPins[i].bPersistence = (rResult.UInt(TCG_CPIN_COL_PERSISTENCE) != 0);
+	}
+	return true;
+}
+
+// Read nLength bytes of a byte table (e.g. DataStore) in MaxIndTokenSize sized, batched Gets.
+template <typename IBusInterfaceType>
+bool ReadByteTable(_bstr_t &rbstrErrorInfo, CTcgSession<IBusInterfaceType> &rSession, TTcgUid uidTable,
+				   unsigned int nOffset, unsigned int nLength, std::vector<BYTE> &rBytes)
+{
+	TRACE(L"ReadByteTable\n");
+	CTcgTableBatch<IBusInterfaceType> batch;
+	const TTcgProperties &rLimits = rSession.Properties();
+
+	// Each chunk is returned as one byte token (of up to 4 header bytes) within one response.
+	unsigned int nToken = (rLimits.nMaxIndTokenSize > 4) ? (rLimits.nMaxIndTokenSize - 4) : 0;
+	unsigned int nResponse = (rLimits.MaxResponsePayload() > (TCG_METHOD_RESPONSE_OVERHEAD + 4)) ?
+								(rLimits.MaxResponsePayload() - (TCG_METHOD_RESPONSE_OVERHEAD + 4)) : 0;
+	unsigned int nChunk = (nToken < nResponse) ? nToken : nResponse;
+	if (nChunk == 0)
+	{
+		rbstrErrorInfo = ::BuildMessage(L"ReadByteTable : The negotiated limits (MaxIndTokenSize %u, MaxResponseComPacketSize %u) leave no room for data.",
+										rLimits.nMaxIndTokenSize, rLimits.nMaxResponseComPacketSize);
+		return false;
+	}
+
+	for (unsigned int nDone = 0; nDone < nLength; nDone += nChunk)
+		batch.GetBytes(uidTable, nOffset + nDone, ((nLength - nDone) < nChunk) ? (nLength - nDone) : nChunk);
+	if (!batch.Execute(rbstrErrorInfo, rSession))
+		return false;
+
+	rBytes.clear();
+	rBytes.reserve(nLength);
+	for (size_t i = 0; i < batch.Count(); i++)
+	{
+		if (!batch.Result(i).Succeeded())
+		{
+			rbstrErrorInfo = ::BuildMessage(L"ReadByteTable : Get failed, status 0x%02X.", batch.Result(i).byStatus);
+			return false;
+		}
+		rBytes.insert(rBytes.end(), batch.Result(i).vBytes.begin(), batch.Result(i).vBytes.end());
+	}
+	return true;
+}
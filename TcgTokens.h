@@ -0,0 +1,304 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "stdafx.h"
+
+
+//  TCG Storage data stream encoding.
+//
+//  Method invocations and their results are carried as a stream of tokens within a Data
+//  SubPacket (see TcgComPacket.h).  A token is either a control token (e.g. StartList, Call)
+//  or an "atom" holding an unsigned integer or a byte sequence.  Atoms are encoded as tiny,
+//  short, medium or long atoms depending upon their length.  UIDs are 8 byte sequences.
+//
+//		see:	"TCG Storage Architecture Core Specification", section 3.2.2 (Data Stream Encoding)
+//				"TCG Storage Security Subsystem Class: Opal", section 6 (UIDs)
+//
+
+#define TCG_TOKEN_STARTLIST			0xF0
+#define TCG_TOKEN_ENDLIST			0xF1
+#define TCG_TOKEN_STARTNAME			0xF2
+#define TCG_TOKEN_ENDNAME			0xF3
+#define TCG_TOKEN_CALL				0xF8
+#define TCG_TOKEN_ENDOFDATA			0xF9
+#define TCG_TOKEN_ENDOFSESSION		0xFA
+#define TCG_TOKEN_STARTTRANSACTION	0xFB
+#define TCG_TOKEN_ENDTRANSACTION	0xFC
+#define TCG_TOKEN_EMPTY				0xFF
+
+// Method status codes returned within the status list following each method result.
+#define TCG_STATUS_SUCCESS				0x00
+#define TCG_STATUS_NOT_AUTHORIZED		0x01
+#define TCG_STATUS_SP_BUSY				0x03
+#define TCG_STATUS_SP_FAILED			0x04
+#define TCG_STATUS_SP_DISABLED			0x05
+#define TCG_STATUS_SP_FROZEN			0x06
+#define TCG_STATUS_NO_SESSIONS_AVAILABLE	0x07
+#define TCG_STATUS_UNIQUENESS_CONFLICT	0x08
+#define TCG_STATUS_INSUFFICIENT_SPACE	0x09
+#define TCG_STATUS_INSUFFICIENT_ROWS	0x0A
+#define TCG_STATUS_INVALID_PARAMETER	0x0C
+#define TCG_STATUS_TPER_MALFUNCTION		0x0F
+#define TCG_STATUS_TRANSACTION_FAILURE	0x10
+#define TCG_STATUS_RESPONSE_OVERFLOW	0x11
+#define TCG_STATUS_AUTHORITY_LOCKED_OUT	0x12
+#define TCG_STATUS_FAIL					0x3F
+
+typedef unsigned __int64 TTcgUid;
+
+// Session manager, SP and method UIDs.
+static const TTcgUid TCG_UID_SMUID					= 0x00000000000000FFULL;
+static const TTcgUid TCG_UID_THISSP					= 0x0000000000000001ULL;
+static const TTcgUid TCG_UID_ADMINSP				= 0x0000020500000001ULL;
+static const TTcgUid TCG_UID_LOCKINGSP				= 0x0000020500000002ULL;
+static const TTcgUid TCG_METHOD_PROPERTIES			= 0x000000000000FF01ULL;
+static const TTcgUid TCG_METHOD_STARTSESSION		= 0x000000000000FF02ULL;
+static const TTcgUid TCG_METHOD_SYNCSESSION			= 0x000000000000FF03ULL;
+static const TTcgUid TCG_METHOD_GET					= 0x0000000600000016ULL;
+static const TTcgUid TCG_METHOD_SET					= 0x0000000600000017ULL;
+static const TTcgUid TCG_METHOD_AUTHENTICATE		= 0x000000060000001CULL;
+
+// Authorities.
+static const TTcgUid TCG_UID_ANYBODY				= 0x0000000900000001ULL;
+static const TTcgUid TCG_UID_SID					= 0x0000000900000006ULL;
+static const TTcgUid TCG_UID_ADMIN1					= 0x0000000900010001ULL;
+static const TTcgUid TCG_UID_USER1					= 0x0000000900030001ULL;
+
+// Tables and objects.
+static const TTcgUid TCG_UID_LOCKING_GLOBALRANGE	= 0x0000080200000001ULL;
+static const TTcgUid TCG_UID_LOCKING_RANGE1			= 0x0000080200030001ULL;	// RangeN = RANGE1 + (N - 1)
+static const TTcgUid TCG_UID_MBRCONTROL				= 0x0000080300000001ULL;
+static const TTcgUid TCG_UID_MBR					= 0x0000080400000000ULL;
+static const TTcgUid TCG_UID_DATASTORE				= 0x0000100100000000ULL;
+static const TTcgUid TCG_UID_C_PIN_SID				= 0x0000000B00000001ULL;
+static const TTcgUid TCG_UID_C_PIN_MSID				= 0x0000000B00008402ULL;
+static const TTcgUid TCG_UID_C_PIN_ADMIN1			= 0x0000000B00010001ULL;
+static const TTcgUid TCG_UID_C_PIN_USER1			= 0x0000000B00030001ULL;	// UserN = USER1 + (N - 1)
+
+// Method parameter names.
+#define TCG_NAME_STARTROW			0x01
+#define TCG_NAME_ENDROW				0x02
+#define TCG_NAME_STARTCOLUMN		0x03
+#define TCG_NAME_ENDCOLUMN			0x04
+#define TCG_NAME_SET_WHERE			0x00
+#define TCG_NAME_SET_VALUES			0x01
+
+
+// The CTcgTokenWriter class appends encoded tokens to a byte buffer.
+//
+class CTcgTokenWriter
+{
+  private:
+	std::vector<BYTE>	_vBuffer;
+
+  public:
+	inline void Clear(void)
+		{ _vBuffer.clear(); }
+
+	inline const std::vector<BYTE> &Buffer(void) const
+		{ return _vBuffer; }
+
+	inline unsigned Size(void) const
+		{ return (unsigned)_vBuffer.size(); }
+
+	inline void Control(BYTE byToken)
+		{ _vBuffer.push_back(byToken); }
+
+	inline void StartList(void)		{ Control(TCG_TOKEN_STARTLIST); }
+	inline void EndList(void)		{ Control(TCG_TOKEN_ENDLIST); }
+	inline void StartName(void)		{ Control(TCG_TOKEN_STARTNAME); }
+	inline void EndName(void)		{ Control(TCG_TOKEN_ENDNAME); }
+	inline void Call(void)			{ Control(TCG_TOKEN_CALL); }
+	inline void EndOfData(void)		{ Control(TCG_TOKEN_ENDOFDATA); }
+	inline void EndOfSession(void)	{ Control(TCG_TOKEN_ENDOFSESSION); }
+
+	void UInt(unsigned __int64 nValue)
+	{
+		// Tiny atom for 0..63, otherwise a short atom of the minimal big-endian length.
+		if (nValue < 0x40)
+		{
+			_vBuffer.push_back((BYTE)nValue);
+			return;
+		}
+		BYTE pbyValue[8];
+		unsigned nLength = 0;
+		for (int nShift = 56; nShift >= 0; nShift -= 8)
+		{
+			BYTE by = (BYTE)(nValue >> nShift);
+			if ((nLength > 0) || (by != 0))
+				pbyValue[nLength++] = by;
+		}
+		_vBuffer.push_back((BYTE)(0x80 | nLength));
+		_vBuffer.insert(_vBuffer.end(), &pbyValue[0], &pbyValue[nLength]);
+	}
+
+	void Bytes(const BYTE *pbyValue, unsigned nLength)
+	{
+		ASSERT((pbyValue != NULL) || (nLength == 0));
+		BytesHeader(nLength);
+		if (nLength > 0)
+			_vBuffer.insert(_vBuffer.end(), pbyValue, pbyValue + nLength);
+	}
+
+	// The atom header alone, for callers placing the nLength value bytes themselves.
+	void BytesHeader(unsigned nLength)
+	{
+		if (nLength <= 0x0F)
+		{
+			_vBuffer.push_back((BYTE)(0xA0 | nLength));
+		}
+		else if (nLength <= 0x07FF)
+		{
+			_vBuffer.push_back((BYTE)(0xD0 | (nLength >> 8)));
+			_vBuffer.push_back((BYTE)(nLength & 0xFF));
+		}
+		else
+		{
+			ASSERT(nLength <= 0x00FFFFFF);
+			_vBuffer.push_back(0xE2);
+			_vBuffer.push_back((BYTE)(nLength >> 16));
+			_vBuffer.push_back((BYTE)(nLength >> 8));
+			_vBuffer.push_back((BYTE)(nLength & 0xFF));
+		}
+	}
+
+	inline void Bytes(const char *pszValue)
+		{ Bytes((const BYTE*)pszValue, (unsigned)::strlen(pszValue)); }
+
+	void Uid(TTcgUid uid)
+	{
+		BYTE pbyUid[8];
+		for (int i = 0; i < 8; i++)
+			pbyUid[i] = (BYTE)(uid >> (56 - (8 * i)));
+		Bytes(pbyUid, sizeof(pbyUid));
+	}
+
+	// Begin a method invocation : Call InvokingUID MethodUID StartList
+	void BeginMethod(TTcgUid uidInvoking, TTcgUid uidMethod)
+	{
+		Call();
+		Uid(uidInvoking);
+		Uid(uidMethod);
+		StartList();
+	}
+
+	// Complete a method invocation : EndList EndOfData StatusList
+	void EndMethod(void)
+	{
+		EndList();
+		EndOfData();
+		StartList();
+		UInt(0);
+		UInt(0);
+		UInt(0);
+		EndList();
+	}
+
+	// The encoded size of a short or medium byte atom of the given length.
+	static inline unsigned BytesAtomSize(unsigned nLength)
+		{ return (nLength + ((nLength <= 0x0F) ? 1 : ((nLength <= 0x07FF) ? 2 : 4))); }
+};	// CTcgTokenWriter
+
+
+// The TTcgToken struct is a decoded token.  Byte atoms reference the source buffer.
+//
+typedef struct TTcgToken
+{
+	BYTE				byControl;		// control token value, or 0 for an atom
+	bool				bBytes;			// atom : byte sequence (otherwise an integer)
+	unsigned __int64	nValue;			// atom : integer value
+	const BYTE			*pbyData;		// atom : byte sequence
+	unsigned			nLength;		// atom : byte sequence length
+
+	inline bool IsAtom(void) const			{ return (byControl == 0); }
+	inline bool Is(BYTE byToken) const		{ return (byControl == byToken); }
+	inline bool IsUInt(void) const			{ return (IsAtom() && !bBytes); }
+
+	TTcgUid AsUid(void) const
+	{
+		TTcgUid uid = 0;
+		for (unsigned i = 0; (i < nLength) && (i < 8); i++)
+			uid = (uid << 8) | pbyData[i];
+		return uid;
+	}
+
+	bool NameEquals(const char *pszName) const
+	{
+		unsigned nNameLength = (unsigned)::strlen(pszName);
+		return (bBytes && (nLength == nNameLength) && (::memcmp(pbyData, pszName, nLength) == 0));
+	}
+} TTcgToken;
+
+typedef std::vector<TTcgToken> TListTcgTokens;
+
+
+// Decode a token stream.  Empty tokens are dropped.  Returns false on a malformed stream.
+inline bool TcgDecodeTokens(const BYTE *pbyStream, unsigned nLength, TListTcgTokens &rTokens)
+{
+	unsigned i = 0;
+	rTokens.clear();
+
+	while (i < nLength)
+	{
+		TTcgToken token = { 0, false, 0, NULL, 0 };
+		BYTE by = pbyStream[i];
+		unsigned nHeader = 0;
+		unsigned nAtom = 0;
+
+		if (by < 0x80)					// tiny atom (unsigned values only herein)
+		{
+			token.nValue = by & 0x3F;
+			rTokens.push_back(token);
+			i++;
+			continue;
+		}
+		else if (by < 0xC0)				// short atom
+		{
+			token.bBytes = ((by & 0x20) != 0);
+			nHeader = 1;
+			nAtom = by & 0x0F;
+		}
+		else if (by < 0xE0)				// medium atom
+		{
+			if ((i + 1) >= nLength)
+				return false;
+			token.bBytes = ((by & 0x10) != 0);
+			nHeader = 2;
+			nAtom = ((by & 0x07) << 8) | pbyStream[i + 1];
+		}
+		else if (by < 0xF0)				// long atom
+		{
+			if ((i + 3) >= nLength)
+				return false;
+			token.bBytes = ((by & 0x02) != 0);
+			nHeader = 4;
+			nAtom = (pbyStream[i + 1] << 16) | (pbyStream[i + 2] << 8) | pbyStream[i + 3];
+		}
+		else							// control token
+		{
+			if (by != TCG_TOKEN_EMPTY)
+			{
+				token.byControl = by;
+				rTokens.push_back(token);
+			}
+			i++;
+			continue;
+		}
+
+		if ((i + nHeader + nAtom) > nLength)
+			return false;
+		token.pbyData = &pbyStream[i + nHeader];
+		token.nLength = nAtom;
+		if (!token.bBytes)
+		{
+			for (unsigned j = 0; (j < nAtom) && (j < 8); j++)
+				token.nValue = (token.nValue << 8) | token.pbyData[j];
+		}
+		rTokens.push_back(token);
+		i += nHeader + nAtom;
+	}
+	return true;
+}
@@ -0,0 +1,245 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+
+//  Binary trace rings : fixed size event records kept in memory, cheap enough to leave enabled on
+//  production hosts, and written to a file (e.g. at exit, see -w) for an offline decoder (-r).
+//  The TRACE macro remains the debug build's text trace; it formats each message and passes it
+//  to OutputDebugString.
+//
+//  TraceEvent stores a record without a lock, a formatting call or an allocation : a thread
+//  claims the next slot of its ring with one (uncontended) interlocked increment and fills it in
+//  place.  Each thread registers a ring of its own on first use, held thereafter in thread local
+//  storage; rings are not reclaimed at thread exit, so a dump still holds the records of threads
+//  since ended.  Once TRACE_RINGS - 1 threads have registered, later threads share the last ring,
+//  their slots still differing, so that a long lived process with thread churn keeps tracing.  A
+//  slot's sequence number is cleared before the record is filled and set after, so that a dump
+//  taken while threads trace skips records half written, as it does those already overwritten.
+//  Each ring keeps its latest TRACE_RING_RECORDS records.  The rings are zero initialized static
+//  storage, so that they need no construction and the pages of unused rings cost nothing.
+//
+//		TTraceDumpHeader		64 bytes : magic, version, record size, timer frequency
+//		TTraceRecord[]			In ring order; the decoder sorts them by time
+//
+
+#define TRACE_RINGS					64			// The last shared by threads registered beyond the others
+#define TRACE_RING_RECORDS			4096		// Per ring, a power of two
+#define TRACE_DUMP_MAGIC			"TRCDUMP1"
+#define TRACE_DUMP_VERSION			1
+
+enum ETraceEvent
+{
+	eTraceNone = 0,
+	eTraceDeviceIo,						// Opcode : ATA command or SCSI CDB opcode.  Args : IOCTL, bytes returned, Win32 error, microseconds
+	eTraceIdentify,						// Args : reads, corrupt reads, Win32 error
+	eTraceFleetDrive,					// Opcode : EFleetOperation.  Args : EFleetOutcome, queued and elapsed milliseconds
+	eTraceRetry,						// Opcode : EBusOperation.  Args : attempt failed, EBusPhase, Win32 error, delay milliseconds
+	eTraceEventEnd
+};
+
+static const char *const s_apszTraceEvents[eTraceEventEnd] = { "none", "DeviceIo", "Identify", "FleetDrive", "Retry" };
+
+#pragma pack(push,1)
+typedef struct TTraceRecord
+{
+	volatile unsigned __int32	nSequence;		// Slot number + 1, 0 while being written
+	unsigned __int16			nEvent;			// ETraceEvent
+	unsigned __int16			nOpcode;		// Event specific (e.g. the ATA command)
+	unsigned __int64			nTicks;			// QueryPerformanceCounter
+	unsigned __int32			nThread;
+	unsigned __int32			nDrive;			// See CDiskDrive::TraceId, 0 if none
+	unsigned __int32			anArgs[4];		// Event specific
+} TTraceRecord;
+
+typedef struct TTraceDumpHeader
+{
+	char				szMagic[8];				// TRACE_DUMP_MAGIC, unterminated
+	unsigned __int32	nVersion;
+	unsigned __int32	nRecordSize;			// sizeof(TTraceRecord)
+	unsigned __int64	nTicksPerSecond;		// QueryPerformanceFrequency
+	unsigned __int64	nRecords;
+	unsigned char		abyReserved[32];
+} TTraceDumpHeader;
+#pragma pack(pop)
+
+typedef struct TTraceRing
+{
+	volatile LONG		lNext;					// Slots claimed
+	TTraceRecord		aRecords[TRACE_RING_RECORDS];
+} TTraceRing;
+
+typedef struct TTraceRings
+{
+	volatile LONG		lRegistered;			// Rings claimed by threads
+	TTraceRing			aRings[TRACE_RINGS];
+} TTraceRings;
+
+// One instance across translation units, zero initialized before any code runs.
+inline TTraceRings &TraceRings(void)
+{
+	static TTraceRings s_rings;
+	return s_rings;
+}
+
+// The calling thread's ring, registered on its first call.
+inline TTraceRing &TraceThreadRing(void)
+{
+	static __declspec(thread) TTraceRing *s_pRing = NULL;
+
+	if (!s_pRing)
+	{
+		TTraceRings &rRings = TraceRings();
+		LONG lRing = ::InterlockedIncrement(&rRings.lRegistered) - 1;
+		s_pRing = &rRings.aRings[((unsigned long)lRing < TRACE_RINGS) ? lRing : (TRACE_RINGS - 1)];
+	}
+	return *s_pRing;
+}
+
+inline void TraceEvent(ETraceEvent eEvent, unsigned int nDrive, unsigned int nOpcode,
+					   unsigned int nArg0 = 0, unsigned int nArg1 = 0, unsigned int nArg2 = 0, unsigned int nArg3 = 0)
+{
+	DWORD dwThread = ::GetCurrentThreadId();
+	TTraceRing &rRing = ::TraceThreadRing();
+	unsigned __int32 nSlot = (unsigned __int32)::InterlockedIncrement(&rRing.lNext) - 1;
+	TTraceRecord &rRecord = rRing.aRecords[nSlot & (TRACE_RING_RECORDS - 1)];
+	LARGE_INTEGER liNow;
+
+	::QueryPerformanceCounter(&liNow);
+	rRecord.nSequence = 0;
+	_ReadWriteBarrier();
+	rRecord.nEvent = (unsigned __int16)eEvent;
+	rRecord.nOpcode = (unsigned __int16)nOpcode;
+	rRecord.nTicks = (unsigned __int64)liNow.QuadPart;
+	rRecord.nThread = dwThread;
+	rRecord.nDrive = nDrive;
+	rRecord.anArgs[0] = nArg0;
+	rRecord.anArgs[1] = nArg1;
+	rRecord.anArgs[2] = nArg2;
+	rRecord.anArgs[3] = nArg3;
+	_ReadWriteBarrier();
+	rRecord.nSequence = nSlot + 1;
+}
+
+// The complete records of every ring, oldest first within each ring.
+inline void TraceSnapshot(std::vector<TTraceRecord> &rvRecords)
+{
+	TTraceRings &rRings = TraceRings();
+
+	rvRecords.clear();
+	for (unsigned int r = 0; r < TRACE_RINGS; r++)
+	{
+		TTraceRing &rRing = rRings.aRings[r];
+		unsigned __int32 nEnd = (unsigned __int32)rRing.lNext;
+		unsigned __int32 nCount = (nEnd < TRACE_RING_RECORDS) ? nEnd : TRACE_RING_RECORDS;
+
+		for (unsigned __int32 nSlot = nEnd - nCount; nSlot != nEnd; nSlot++)
+		{
+			const TTraceRecord &rRecord = rRing.aRecords[nSlot & (TRACE_RING_RECORDS - 1)];
+			if (rRecord.nSequence != (nSlot + 1))
+				continue;
+			_ReadWriteBarrier();
+			TTraceRecord sCopy = *(const TTraceRecord*)&rRecord;
+			_ReadWriteBarrier();
+			if (rRecord.nSequence == (nSlot + 1))		// i.e. not overwritten while copied
+				rvRecords.push_back(sCopy);
+		}
+	}
+}
+
+inline bool TraceDumpWrite(_bstr_t &rbstrErrorInfo, const wchar_t *pszPath)
+{
+	TRACE(L"TraceDumpWrite\n");
+	std::vector<TTraceRecord> vRecords;
+	TTraceDumpHeader sHeader;
+	LARGE_INTEGER liFrequency;
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	DWORD dwWritten = 0;
+	bool bres = false;
+
+	::TraceSnapshot(vRecords);
+	::QueryPerformanceFrequency(&liFrequency);
+	::ZeroMemory(&sHeader, sizeof(sHeader));
+	::memcpy(sHeader.szMagic, TRACE_DUMP_MAGIC, sizeof(sHeader.szMagic));
+	sHeader.nVersion = TRACE_DUMP_VERSION;
+	sHeader.nRecordSize = sizeof(TTraceRecord);
+	sHeader.nTicksPerSecond = (unsigned __int64)liFrequency.QuadPart;
+	sHeader.nRecords = vRecords.size();
+
+	hFile = ::CreateFile(pszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if ((hFile == INVALID_HANDLE_VALUE) ||
+		(!::WriteFile(hFile, &sHeader, sizeof(sHeader), &dwWritten, NULL)) || (dwWritten != sizeof(sHeader)) ||
+		((!vRecords.empty()) && ((!::WriteFile(hFile, &vRecords[0], (DWORD)(vRecords.size() * sizeof(TTraceRecord)), &dwWritten, NULL)) ||
+								 (dwWritten != (vRecords.size() * sizeof(TTraceRecord))))))
+	{
+		TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+		rbstrErrorInfo = ::BuildMessage(L"TraceDumpWrite : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+	}
+	else
+		bres = true;
+
+	if (hFile != INVALID_HANDLE_VALUE)
+		::CloseHandle(hFile);
+	return bres;
+}
+
+inline bool TraceRecordEarlier(const TTraceRecord &rLeft, const TTraceRecord &rRight)
+{
+	return (rLeft.nTicks < rRight.nTicks);
+}
+
+// Read a dump, its records sorted by time.
+inline bool TraceDumpRead(_bstr_t &rbstrErrorInfo, const wchar_t *pszPath, TTraceDumpHeader &rHeader, std::vector<TTraceRecord> &rvRecords)
+{
+	TRACE(L"TraceDumpRead\n");
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	LARGE_INTEGER liSize = { 0 };
+	DWORD dwRead = 0;
+	bool bres = false;
+
+	rvRecords.clear();
+	hFile = ::CreateFile(pszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if ((hFile == INVALID_HANDLE_VALUE) || (!::GetFileSizeEx(hFile, &liSize)) ||
+		(!::ReadFile(hFile, &rHeader, sizeof(rHeader), &dwRead, NULL)))
+	{
+		TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+		goto CleanUp;
+	}
+	if ((dwRead != sizeof(rHeader)) || (::memcmp(rHeader.szMagic, TRACE_DUMP_MAGIC, sizeof(rHeader.szMagic)) != 0) ||
+		(rHeader.nVersion != TRACE_DUMP_VERSION) || (rHeader.nRecordSize != sizeof(TTraceRecord)) || (rHeader.nTicksPerSecond == 0) ||
+		(rHeader.nRecords != (((unsigned __int64)liSize.QuadPart - sizeof(rHeader)) / sizeof(TTraceRecord))))
+	{
+		rbstrErrorInfo = L"Not a trace dump, or truncated.";
+		goto CleanUp;
+	}
+	rvRecords.resize((size_t)rHeader.nRecords);
+	if ((!rvRecords.empty()) &&
+		((!::ReadFile(hFile, &rvRecords[0], (DWORD)(rvRecords.size() * sizeof(TTraceRecord)), &dwRead, NULL)) ||
+		 (dwRead != (rvRecords.size() * sizeof(TTraceRecord)))))
+	{
+		TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
+		goto CleanUp;
+	}
+	std::stable_sort(rvRecords.begin(), rvRecords.end(), TraceRecordEarlier);
+	bres = true;
+
+CleanUp:
+	if (hFile != INVALID_HANDLE_VALUE)
+		::CloseHandle(hFile);
+	if (!bres)
+	{
+		rvRecords.clear();
+		rbstrErrorInfo = ::BuildMessage(L"TraceDumpRead : %ws : %ws", pszPath, (const wchar_t*)rbstrErrorInfo);
+	}
+	return bres;
+}
+
+inline const char *TraceEventName(unsigned int nEvent)
+{
+	return (nEvent < eTraceEventEnd) ? s_apszTraceEvents[nEvent] : "unknown";
+}
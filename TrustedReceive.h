@@ -0,0 +1,114 @@
+//**************************************************************************
+//  2008 Microsoft Corporation.  For illustration purposes only.
+//**************************************************************************
+
+#pragma once
+
+#include "stdafx.h"
+#include "TcgComPacket.h"
+
+
+//  IF-RECV polling.
+//
+//  The TPer may not have finished processing an IF-SEND by the time the host issues the matching
+//  IF-RECV.  In that case the returned ComPacket is empty (Length = 0) with OutstandingData set,
+//  and the host must poll again.  When the response is ready but larger than the transfer the
+//  host requested, MinTransfer (and OutstandingData) report what is required.
+//
+//  The TReceivePollStats struct, kept per drive, tracks the observed IF-SEND to response
+//  latency using the smoothed estimate and mean deviation scheme familiar from TCP
+//  retransmit timers (RFC 6298).  The first IF-RECV is delayed until just before the response
+//  is expected and subsequent polls back off exponentially from a fraction of the deviation.
+//  This keeps both the number of wasted (empty) IF-RECV commands and the added response
+//  latency small.  The last response size is also remembered so that the first IF-RECV is
+//  normally large enough to avoid a resize round trip; it is the size of that response, not of
+//  the transfer which held it, so that one large response does not inflate every later IF-RECV.
+//
+
+#define TCG_RECEIVE_TIMEOUT_MS		15000		// Matches the 15 second DeviceIoControl timeout used herein
+#define TCG_POLL_MIN_DELAY_US		100			// Smallest back-off step between empty polls
+#define TCG_POLL_MAX_DELAY_US		50000		// Largest back-off step between empty polls
+#define TCG_POLL_MAX_BACKOFF_SHIFT	8
+
+typedef struct TReceivePollStats
+{
+	double				dLatencyUs;				// Smoothed IF-SEND to response latency (microseconds)
+	double				dDeviationUs;			// Smoothed mean deviation of the above
+	unsigned int		nLastResponseLength;	// Length (bytes) of the last response ComPacket
+	unsigned __int64	nTransactions;			// Completed Send/Receive exchanges
+	unsigned __int64	nReceives;				// IF-RECV commands issued
+	unsigned __int64	nEmptyReceives;			// IF-RECV commands returning no response (still processing)
+	unsigned __int64	nResizedReceives;		// IF-RECV commands reissued with a larger transfer length
+
+	TReceivePollStats(void)
+	{
+		Initialize();
+	}
+
+	inline void Initialize(void)
+	{
+		dLatencyUs = 0.0;
+		dDeviationUs = 0.0;
+		nLastResponseLength = 0;
+		nTransactions = 0;
+		nReceives = 0;
+		nEmptyReceives = 0;
+		nResizedReceives = 0;
+	}
+
+	// Delay before the first IF-RECV of an exchange.  Without history, poll immediately.
+	unsigned int FirstPollDelayUs(void) const
+	{
+		if (nTransactions == 0)
+			return 0;
+		double dDelay = dLatencyUs - (2.0 * dDeviationUs);
+		return ((dDelay > 0.0) ? (unsigned int)dDelay : 0);
+	}
+
+	// Delay before the next IF-RECV after nEmpty consecutive empty polls in this exchange.
+	unsigned int NextPollDelayUs(unsigned int nEmpty) const
+	{
+		double dStep = dDeviationUs / 2.0;
+		if (dStep < TCG_POLL_MIN_DELAY_US)
+			dStep = TCG_POLL_MIN_DELAY_US;
+
+		unsigned int nShift = (nEmpty > 0) ? (nEmpty - 1) : 0;
+		if (nShift > TCG_POLL_MAX_BACKOFF_SHIFT)
+			nShift = TCG_POLL_MAX_BACKOFF_SHIFT;
+
+		double dDelay = dStep * (double)(1u << nShift);
+		return ((dDelay > TCG_POLL_MAX_DELAY_US) ? TCG_POLL_MAX_DELAY_US : (unsigned int)dDelay);
+	}
+
+	// Fold a completed exchange into the estimates.
+	void RecordResponse(unsigned __int64 nLatencyUs, unsigned int nResponseLength)
+	{
+		double dSample = (double)nLatencyUs;
+		if (nTransactions == 0)
+		{
+			dLatencyUs = dSample;
+			dDeviationUs = dSample / 2.0;
+		}
+		else
+		{
+			double dError = dSample - dLatencyUs;
+			dLatencyUs += dError / 8.0;
+			dDeviationUs += (((dError < 0.0) ? -dError : dError) - dDeviationUs) / 4.0;
+		}
+		nLastResponseLength = nResponseLength;
+		nTransactions++;
+	}
+} TReceivePollStats;
+
+
+// Sleep for approximately the given number of microseconds.  Sleep() granularity is milliseconds
+// (and often the 15.6ms system tick), so shorter waits simply yield the processor.
+inline void SleepMicroseconds(unsigned int nMicroseconds)
+{
+	if (nMicroseconds == 0)
+		return;
+	if (nMicroseconds < 1000)
+		::SwitchToThread();
+	else
+		::Sleep(nMicroseconds / 1000);
+}
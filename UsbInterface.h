@@ -70,7 +70,7 @@ typedef struct _ATAReturnDescriptor
 
 interface IUsbInterface : public IBusInterface
 {
-	virtual bool ReadIdentifySector(_bstr_t &rbstrErrorInfo)
+	virtual bool ReadIdentifySector(TBusError &rError)
 	{
 		TRACE(L"IUsbInterface::ReadIdentifySector\n");
 		CDiskDrive<IUsbInterface> *pDisk = dynamic_cast<CDiskDrive<IUsbInterface>*>(this);
@@ -90,7 +90,6 @@ interface IUsbInterface : public IBusInterface
 
 		SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER	sptdwb;  
 		DWORD	dwReturnedLength = 0;
-		ATAReturnDescriptor *pSenseInfo = NULL;
 
 		::ZeroMemory(&sptdwb, sizeof(SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER));
 		sptdwb.sptd.Length = sizeof(SCSI_PASS_THROUGH_DIRECT);
@@ -123,8 +122,7 @@ interface IUsbInterface : public IBusInterface
 			&dwReturnedLength,
 			NULL))
 		{
-			::TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
-			rbstrErrorInfo = ::BuildMessage(L"IUsbInterface::ReadIdentifySector : %ws\n", (const wchar_t*)rbstrErrorInfo);
+			rError.SetOsError(eBusOpIdentify, ::GetLastError());
 			return false;		
 		}
 
@@ -140,34 +138,14 @@ interface IUsbInterface : public IBusInterface
 		}
 		else  
 		{
-			pSenseInfo = reinterpret_cast<ATAReturnDescriptor*>(&sptdwb.ucSenseBuf[8]);
-			if (pSenseInfo->Status > 0x00)
-			{
-				// The ATAReturnDescriptor::Status field corresponds to the ATA "Features" register upon failed response
-				rbstrErrorInfo = ::BuildMessage(L"Drive status flags : "
-					L"NoMedia=%02X : "
-					L"Abort=%02X : "
-					L"MediaChangeRequest=%02X : "
-					L"DeviceNotFound=%02X : "
-					L"MediaChanged=%02x : "
-					L"Uncorr=%02X : "
-					L"IntrCRC=%02X", 
-					pSenseInfo->Status & 0x02,
-					pSenseInfo->Status & 0x04,
-					pSenseInfo->Status & 0x08,
-					pSenseInfo->Status & 0x10,
-					pSenseInfo->Status & 0x20,
-					pSenseInfo->Status & 0x40,
-					pSenseInfo->Status & 0x80);
-			}
-			rbstrErrorInfo = ::BuildMessage(L"IUsbInterface::ReadIdentifySector : operation failed.  ScsiStatus=0x%02X  ucSenseBuf[0]=0x%02X.  %ws\n", 
-											sptdwb.sptd.ScsiStatus, sptdwb.ucSenseBuf[0], (const wchar_t*)rbstrErrorInfo);
+			// The sense data, and the ATA registers of an ATA Return descriptor, are decoded when displayed.
+			rError.SetScsiError(eBusOpIdentify, sptdwb.sptd.ScsiStatus, sptdwb.ucSenseBuf, sptdwb.sptd.SenseInfoLength);
 			return false;   
 		}
 		//return true;
 	}
 
-	virtual bool Send(_bstr_t &rbstrErrorInfo, const BYTE *pbyBuffer, unsigned nSizeBuffer)
+	virtual bool Send(TBusError &rError, const BYTE *pbyBuffer, unsigned nSizeBuffer)
 	{
 		TRACE(L"IUsbInterface::Send\n");
 		CDiskDrive<IUsbInterface> *pDisk = dynamic_cast<CDiskDrive<IUsbInterface>*>(this);
@@ -176,13 +154,13 @@ interface IUsbInterface : public IBusInterface
 
 		if ((!pbyBuffer) || (nSizeBuffer == 0))
 		{
-			rbstrErrorInfo += ::BuildMessage(L"E_INVALIDARG : %ws : %ws ", __FILE__, __LINE__);
+			rError.Set(eBusOpSend, eBusPhaseArgument);
 			return false;
 		}
 
 		SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER	sptdwb;  
 		DWORD	dwReturnedLength = 0;
-		ATAReturnDescriptor *pSenseInfo = NULL;
+		unsigned nTransferLength = nSizeBuffer / pDisk->BytesPerSector();
 
 		::ZeroMemory(&sptdwb, sizeof(SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER));
 		sptdwb.sptd.Length = sizeof(SCSI_PASS_THROUGH_DIRECT);
@@ -203,8 +181,11 @@ interface IUsbInterface : public IBusInterface
 		sptdwb.sptd.Cdb[0] = 0xA1;	
 		sptdwb.sptd.Cdb[1] = 0x0A;                        
 		sptdwb.sptd.Cdb[2] = 0x22;
-		sptdwb.sptd.Cdb[3] = 0xF0;
-		sptdwb.sptd.Cdb[4] = 0x01;                        
+		sptdwb.sptd.Cdb[3] = pDisk->SecurityProtocol();				// ATA Features : Security Protocol
+		sptdwb.sptd.Cdb[4] = (UCHAR)(nTransferLength & 0xFF);			// ATA Count : Transfer length (7:0)
+		sptdwb.sptd.Cdb[5] = (UCHAR)(nTransferLength >> 8);				// ATA LBA Low : Transfer length (15:8)
+		sptdwb.sptd.Cdb[6] = (UCHAR)(pDisk->ComId() & 0xFF);			// ATA LBA Mid : SP Specific (i.e. ComID)
+		sptdwb.sptd.Cdb[7] = (UCHAR)(pDisk->ComId() >> 8);				// ATA LBA High : SP Specific
 		sptdwb.sptd.Cdb[9] = 0x5E;                        
 
 		if (!pDisk->DeviceIo(
@@ -216,9 +197,7 @@ interface IUsbInterface : public IBusInterface
 			&dwReturnedLength,
 			NULL))
 		{
-			// TODO : deeper error analysis here.
-			::TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
-			rbstrErrorInfo = ::BuildMessage(L"IUsbInterface::Send : %ws\n", (const wchar_t*)rbstrErrorInfo);
+			rError.SetOsError(eBusOpSend, ::GetLastError());
 			return false;		
 		}
 
@@ -235,34 +214,14 @@ interface IUsbInterface : public IBusInterface
 		}
 		else
 		{
-			pSenseInfo = reinterpret_cast<ATAReturnDescriptor*>(&sptdwb.ucSenseBuf[8]);
-			if (pSenseInfo->Status > 0x00)
-			{
-				// The ATAReturnDescriptor::Status field corresponds to the ATA "Features" register upon failed response
-				rbstrErrorInfo = ::BuildMessage(L"Drive status flags : "
-					L"NoMedia=%02X : "
-					L"Abort=%02X : "
-					L"MediaChangeRequest=%02X : "
-					L"DeviceNotFound=%02X : "
-					L"MediaChanged=%02x : "
-					L"Uncorr=%02X : "
-					L"IntrCRC=%02X", 
-					pSenseInfo->Status & 0x02,
-					pSenseInfo->Status & 0x04,
-					pSenseInfo->Status & 0x08,
-					pSenseInfo->Status & 0x10,
-					pSenseInfo->Status & 0x20,
-					pSenseInfo->Status & 0x40,
-					pSenseInfo->Status & 0x80);
-			}
-			rbstrErrorInfo = ::BuildMessage(L"IUsbInterface::ReadIdentifySector : operation failed.  ScsiStatus=0x%02X  ucSenseBuf[0]=0x%02X.  %ws\n", 
-											sptdwb.sptd.ScsiStatus, sptdwb.ucSenseBuf[0], (const wchar_t*)rbstrErrorInfo);
+			// The sense data, and the ATA registers of an ATA Return descriptor, are decoded when displayed.
+			rError.SetScsiError(eBusOpSend, sptdwb.sptd.ScsiStatus, sptdwb.ucSenseBuf, sptdwb.sptd.SenseInfoLength);
 			return false;   
 		}
 		//return true;
 	}
 
-	virtual bool Receive(_bstr_t &rbstrErrorInfo, const BYTE *pbyBuffer, unsigned nSizeBuffer)
+	virtual bool Receive(TBusError &rError, const BYTE *pbyBuffer, unsigned nSizeBuffer)
 	{
 		TRACE(L"IUsbInterface::Receive\n");
 		CDiskDrive<IUsbInterface> *pDisk = dynamic_cast<CDiskDrive<IUsbInterface>*>(this);
@@ -271,13 +230,13 @@ interface IUsbInterface : public IBusInterface
 
 		if ((!pbyBuffer) || (nSizeBuffer == 0))
 		{
-			rbstrErrorInfo += ::BuildMessage(L"E_INVALIDARG : %ws : %ws ", __FILE__, __LINE__);
+			rError.Set(eBusOpReceive, eBusPhaseArgument);
 			return false;
 		}
 
 		SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER	sptdwb;  
 		DWORD	dwReturnedLength = 0;
-		ATAReturnDescriptor *pSenseInfo = NULL;
+		unsigned nTransferLength = nSizeBuffer / pDisk->BytesPerSector();
 
 		::ZeroMemory(&sptdwb, sizeof(SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER));
 		sptdwb.sptd.Length = sizeof(SCSI_PASS_THROUGH_DIRECT);
@@ -298,8 +257,11 @@ interface IUsbInterface : public IBusInterface
 		sptdwb.sptd.Cdb[0] = 0xA1;	
 		sptdwb.sptd.Cdb[1] = 0x08;                        
 		sptdwb.sptd.Cdb[2] = 0x2A;
-		sptdwb.sptd.Cdb[3] = 0xF0;
-		sptdwb.sptd.Cdb[4] = 0x01;                        
+		sptdwb.sptd.Cdb[3] = pDisk->SecurityProtocol();
+		sptdwb.sptd.Cdb[4] = (UCHAR)(nTransferLength & 0xFF);                        
+		sptdwb.sptd.Cdb[5] = (UCHAR)(nTransferLength >> 8);
+		sptdwb.sptd.Cdb[6] = (UCHAR)(pDisk->ComId() & 0xFF);
+		sptdwb.sptd.Cdb[7] = (UCHAR)(pDisk->ComId() >> 8);
 		sptdwb.sptd.Cdb[9] = 0x5C;                        
 
 		if (!pDisk->DeviceIo(
@@ -311,9 +273,7 @@ interface IUsbInterface : public IBusInterface
 			&dwReturnedLength,
 			NULL))
 		{
-			// TODO : deeper error analysis here.
-			::TranslateErrorCode(::GetLastError(), rbstrErrorInfo);
-			rbstrErrorInfo = ::BuildMessage(L"IUsbInterface::Receive : %ws\n", (const wchar_t*)rbstrErrorInfo);
+			rError.SetOsError(eBusOpReceive, ::GetLastError());
 			return false;		
 		}
 
@@ -331,28 +291,8 @@ interface IUsbInterface : public IBusInterface
 		}
 		else
 		{
-			pSenseInfo = reinterpret_cast<ATAReturnDescriptor*>(&sptdwb.ucSenseBuf[8]);
-			if (pSenseInfo->Status > 0x00)
-			{
-				// The ATAReturnDescriptor::Status field corresponds to the ATA "Features" register upon failed response
-				rbstrErrorInfo = ::BuildMessage(L"Drive status flags : "
-					L"NoMedia=%02X : "
-					L"Abort=%02X : "
-					L"MediaChangeRequest=%02X : "
-					L"DeviceNotFound=%02X : "
-					L"MediaChanged=%02x : "
-					L"Uncorr=%02X : "
-					L"IntrCRC=%02X", 
-					pSenseInfo->Status & 0x02,
-					pSenseInfo->Status & 0x04,
-					pSenseInfo->Status & 0x08,
-					pSenseInfo->Status & 0x10,
-					pSenseInfo->Status & 0x20,
-					pSenseInfo->Status & 0x40,
-					pSenseInfo->Status & 0x80);
-			}
-			rbstrErrorInfo = ::BuildMessage(L"IUsbInterface::ReadIdentifySector : operation failed.  ScsiStatus=0x%02X  ucSenseBuf[0]=0x%02X.  %ws\n", 
-											sptdwb.sptd.ScsiStatus, sptdwb.ucSenseBuf[0], (const wchar_t*)rbstrErrorInfo);
+			// The sense data, and the ATA registers of an ATA Return descriptor, are decoded when displayed.
+			rError.SetScsiError(eBusOpReceive, sptdwb.sptd.ScsiStatus, sptdwb.ucSenseBuf, sptdwb.sptd.SenseInfoLength);
 			return false;   
 		}
 		//return true;
@@ -3,16 +3,51 @@
 //**************************************************************************
 
 #include "stdafx.h"
+#include "HexDump.h"
 
 
 // *********************************************************************************
 // Utility Functions 
 //
 
+TProgramOptions g_Options = { 0, NULL, 4, 60, 0, false, NULL, false, NULL, NULL, false, NULL, NULL, NULL, NULL, NULL, NULL, 0, OPTION_UNSET, NULL, NULL, NULL, NULL };
+
 void DisplayUsage(wchar_t *progname)
 {
-	DisplayMessage(	L"Usage:\n\n  %ws [-g] [-?] \n\n"	
+	DisplayMessage(	L"Usage:\n\n  %ws [-u pin | -l pin] [-c n] [-t seconds] [-h iterations] [-d [-e file] | -q [request]] [-f filter] [-b] [-j] [-s file] [-a file | -v file] [-x before after] [-w file | -r file] [-y attempts[,budget]] [-m table file pin] [-?] \n\n"	
 					L"  -? Display this message\n"						
+					L"  -u Unlock all trusted drives concurrently using the Admin1 pin\n"
+					L"  -l Lock all trusted drives concurrently using the Admin1 pin\n"
+					L"  -c Concurrent drives per host adapter for -u / -l (default 4, 0 = unlimited)\n"
+					L"  -t Deadline in seconds for -u / -l (default 60)\n"
+					L"  -h Derive each drive's pin from the -u / -l credential and its serial number\n"
+					L"     with PBKDF2-HMAC-SHA256 of the given iteration count\n"
+					L"  -d Run as a resident inventory service answering queries on a local pipe\n"
+					L"  -e Replay hotplug events from a uevent record file within the service\n"
+					L"  -q Query the resident service (list, refresh or stats; default list),\n"
+					L"     enumerating locally if it is not running\n"
+					L"  -f Select drives before opening them, by comma separated key=value terms of\n"
+					L"     interface, port, bus, target, path, model or serial (* and ? wildcards;\n"
+					L"     port, bus and target take a number or any), e.g. -f interface=USB,model=ST3*\n"
+					L"  -b Report enumeration timing (time to first drive) and benchmark each\n"
+					L"     enumeration backend, with and without field projection and batching\n"
+					L"  -j Write newline delimited JSON, one record per drive as it is identified\n"
+					L"     (with -b, the enumeration timing as a record of its own)\n"
+					L"  -s Write the identified drives' sectors and decoded columns to a snapshot file\n"
+					L"  -a Write the identified drives' sectors to an identify archive, each stored as\n"
+					L"     its differences from the first sector of the same model and firmware\n"
+					L"  -v Decode an identify archive (see -a), listing each drive and checking\n"
+					L"     each sector's integrity word\n"
+					L"  -x Report the drives which appeared, disappeared or changed between two\n"
+					L"     snapshot files (see -s)\n"
+					L"  -w Write the binary trace records (device requests, identify reads, fleet\n"
+					L"     drive outcomes, retries) to a file at exit\n"
+					L"  -r Decode a trace file written by -w\n"
+					L"  -y Attempts of a bus operation failing transiently (default 3, 1 = no retry),\n"
+					L"     and the retries a drive may spend before its budget refills (default 16,\n"
+					L"     0 = no budget)\n"
+					L"  -m Upload an image file to the datastore or mbr table of each trusted drive\n"
+					L"     as Admin1 with the given pin, reporting the sustained MB/s\n"
 					L"\t(note:  no arguments executes with program defaults)", 
 					progname);
 }
@@ -32,6 +67,127 @@ bool ValidOptions(int argc, _TCHAR *argv[])
 				DisplayUsage(argv[0]);
 				return(false);
 
+			case L'u':
+			case L'l':
+				if ((i + 1) >= argc)
+				{
+					DisplayUsage(argv[0]);
+					return(false);
+				}
+				g_Options.nFleetOperation = (tolower(argv[i][1]) == L'u') ? 1 : 2;
+				g_Options.pszPin = argv[++i];
+				break;
+
+			case L'c':
+			case L't':
+			case L'h':
+				if ((i + 1) >= argc)
+				{
+					DisplayUsage(argv[0]);
+					return(false);
+				}
+				if (tolower(argv[i][1]) == L'c')
+					g_Options.nMaxPerBus = (unsigned int)_wtoi(argv[++i]);
+				else if (tolower(argv[i][1]) == L'h')
+					g_Options.nPinIterations = (unsigned int)_wtoi(argv[++i]);
+				else
+					g_Options.nDeadlineSeconds = (unsigned int)_wtoi(argv[++i]);
+				break;
+
+			case L'd':
+				g_Options.bDaemon = true;
+				break;
+
+			case L'b':
+				g_Options.bBenchmark = true;
+				break;
+
+			case L'j':
+				g_Options.bJson = true;
+				break;
+
+			case L'e':
+			case L'f':
+			case L's':
+			case L'a':
+			case L'v':
+			case L'w':
+			case L'r':
+				if ((i + 1) >= argc)
+				{
+					DisplayUsage(argv[0]);
+					return(false);
+				}
+				if (tolower(argv[i][1]) == L'e')
+					g_Options.pszEventFile = argv[++i];
+				else if (tolower(argv[i][1]) == L's')
+					g_Options.pszSnapshotFile = argv[++i];
+				else if (tolower(argv[i][1]) == L'a')
+					g_Options.pszArchiveFile = argv[++i];
+				else if (tolower(argv[i][1]) == L'v')
+					g_Options.pszArchiveVerify = argv[++i];
+				else if (tolower(argv[i][1]) == L'w')
+					g_Options.pszTraceFile = argv[++i];
+				else if (tolower(argv[i][1]) == L'r')
+					g_Options.pszTraceDecode = argv[++i];
+				else
+					g_Options.pszFilter = argv[++i];
+				break;
+
+			case L'q':
+				g_Options.pszQuery = L"list";
+				if (((i + 1) < argc) && (argv[i + 1][0] != L'-') && (argv[i + 1][0] != L'/'))
+					g_Options.pszQuery = argv[++i];
+				break;
+
+			case L'x':
+				if ((i + 2) >= argc)
+				{
+					DisplayUsage(argv[0]);
+					return(false);
+				}
+				g_Options.pszDiffBefore = argv[++i];
+				g_Options.pszDiffAfter = argv[++i];
+				break;
+
+			case L'y':
+				{
+					wchar_t *pszEnd = NULL;
+					if ((i + 1) >= argc)
+					{
+						DisplayUsage(argv[0]);
+						return(false);
+					}
+					g_Options.nRetryAttempts = (unsigned int)wcstoul(argv[++i], &pszEnd, 10);
+					if (*pszEnd == L',')
+					{
+						const wchar_t *pszBudget = pszEnd + 1;
+						g_Options.nRetryBudget = (unsigned int)wcstoul(pszBudget, &pszEnd, 10);
+						if ((pszEnd == pszBudget) || (g_Options.nRetryBudget == OPTION_UNSET))
+						{
+							DisplayUsage(argv[0]);
+							return(false);
+						}
+					}
+					if ((g_Options.nRetryAttempts == 0) || (*pszEnd != L'\0'))
+					{
+						DisplayUsage(argv[0]);
+						return(false);
+					}
+				}
+				break;
+
+			case L'm':
+				if (((i + 3) >= argc) || ((_wcsicmp(argv[i + 1], L"datastore") != 0) && (_wcsicmp(argv[i + 1], L"mbr") != 0)))
+				{
+					DisplayUsage(argv[0]);
+					return(false);
+				}
+				g_Options.pszBulkTable = argv[++i];
+				g_Options.pszBulkFile = argv[++i];
+				g_Options.pszBulkPin = argv[++i];
+				break;
+
 			// TODO : add new command line options here.
 
 			default:	// unrecognized option
@@ -44,8 +200,10 @@ bool ValidOptions(int argc, _TCHAR *argv[])
 }
 
 
-// TODO : Add concurrency protection around these data structures if needed.
-static wchar_t msg[8192];			
+// The message buffer is per-thread since BuildMessage results are consumed by concurrent
+// drive sessions (see FleetLocking.h).
+// TODO : Add concurrency protection around the remaining data structures if needed.
+static __declspec(thread) wchar_t msg[8192];			
 static wchar_t description[2048];
 static wchar_t source[1048];
 static wchar_t iface[1048];
@@ -137,6 +295,20 @@ void TranslateErrorCode(DWORD dwErrorCode, _bstr_t &rMessage)
 	return;
 }
 
+unsigned __int64 PerfCounterMicroseconds(void)
+{
+	static LARGE_INTEGER liFrequency = { 0 };
+	LARGE_INTEGER liNow;
+
+	if (liFrequency.QuadPart == 0)
+		::QueryPerformanceFrequency(&liFrequency);
+	::QueryPerformanceCounter(&liNow);
+
+	// split the division to avoid overflowing the 64 bit intermediate on long uptimes
+	return (((liNow.QuadPart / liFrequency.QuadPart) * 1000000) + 
+			(((liNow.QuadPart % liFrequency.QuadPart) * 1000000) / liFrequency.QuadPart));
+}
+
 
 #ifdef _DEBUG
 void _cdecl Trace(const wchar_t *pszFormat, ...)
@@ -154,9 +326,7 @@ void _cdecl Trace(const wchar_t *pszFormat, ...)
 #endif // _DEBUG
 
 
-static char HexMsg[1024];
-static const char *szFormatHex16   = "%02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X \n"; 
-
+// One fwrite for a buffer of up to HEXDUMP_STREAM_LINES lines, see HexDump.h.
 bool HexDump2File(FILE *pFile, const BYTE *pBuffer, unsigned nLength)
 {
 	ASSERT(pFile);
@@ -165,25 +335,9 @@ bool HexDump2File(FILE *pFile, const BYTE *pBuffer, unsigned nLength)
 	if ((!pFile) || (!pBuffer))
 		return false;
 
-	fprintf(pFile, "\n");
-	BYTE *pc = (BYTE*)pBuffer;
-	unsigned nFullLines = nLength / 16;
-	unsigned nRemaining = nLength % 16;
-
-	for (unsigned lcv1 = 0; lcv1 < nFullLines; lcv1++)
-	{
-		sprintf_s(HexMsg, sizeof(HexMsg), szFormatHex16, pc[0],pc[1],pc[2],pc[3],pc[4],pc[5],pc[6],pc[7],pc[8],pc[9],pc[10],pc[11],pc[12],pc[13],pc[14],pc[15]);
-		pc += 16;
-		fprintf(pFile, "%s", HexMsg);
-	}
-
-	for (unsigned lcv2=0; lcv2 < nRemaining; lcv2++)
-	{
-		fprintf(pFile, "%02X ", pc[lcv2]);
-	}
-	fprintf(pFile, "\n");
-
-	return true;
+	CHexDumpStream dump(pFile);
+	dump.Write(pBuffer, nLength);
+	return dump.End();
 }
 
 
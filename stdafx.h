@@ -18,8 +18,42 @@
 #include <ntddscsi.h>			//   e.g. .\WDK.H
 #include <ntdddisk.h>			// Need the IDE_REGS struct for DeviceIoControl calls.
 #include <vector>				// Minimal use of STL for managing multiple attached devices.
+#include <process.h>			// _beginthreadex
 using namespace std;
 
+//  Application global-scoped options, populated by ValidOptions...
+
+#define OPTION_UNSET	((unsigned int)-1)		// A numeric option not given, where 0 is a valid value
+
+typedef struct TProgramOptions
+{
+	int				nFleetOperation;		// 0 = none, 1 = unlock, 2 = lock (see FleetLocking.h)
+	const wchar_t	*pszPin;				// Credential for the fleet operation
+	unsigned int	nMaxPerBus;				// Concurrent drives per host adapter
+	unsigned int	nDeadlineSeconds;		// Overall deadline for the fleet operation
+	unsigned int	nPinIterations;			// PBKDF2 iterations deriving per-drive PINs, 0 = none
+	bool			bDaemon;				// Run as the resident inventory service
+	const wchar_t	*pszQuery;				// Request for the resident inventory service
+	bool			bBenchmark;				// Report enumeration timing
+	const wchar_t	*pszEventFile;			// Hotplug events replayed by the resident service
+	const wchar_t	*pszFilter;				// Drive selection, see TDiskFilter::Parse
+	bool			bJson;					// Stream one JSON record per drive, see JsonWriter.h
+	const wchar_t	*pszSnapshotFile;		// Identify snapshot written, see IdentifySnapshot.h
+	const wchar_t	*pszArchiveFile;		// Identify archive written, see IdentifyArchive.h
+	const wchar_t	*pszDiffBefore;			// Snapshots compared, see SnapshotDiff.h
+	const wchar_t	*pszDiffAfter;			// ""
+	const wchar_t	*pszTraceFile;			// Trace records written at exit, see TraceRing.h
+	const wchar_t	*pszTraceDecode;		// Trace file decoded
+	unsigned int	nRetryAttempts;			// Bus operation attempts, 0 = default (see RetryPolicy.h)
+	unsigned int	nRetryBudget;			// Retries per drive, 0 = unlimited, OPTION_UNSET = default
+	const wchar_t	*pszBulkTable;			// Byte table uploaded to (datastore or mbr), see TcgBulkTransfer.h
+	const wchar_t	*pszBulkFile;			// Image uploaded
+	const wchar_t	*pszBulkPin;			// Admin1 credential for the upload
+	const wchar_t	*pszArchiveVerify;		// Identify archive decoded and checked, see IdentifyArchive.h
+} TProgramOptions;
+
+extern TProgramOptions g_Options;
+
 //  Application global-scoped utility functions...
 
 #ifdef _DEBUG
@@ -40,6 +74,7 @@ void DisplayErrorMessage(_com_error &e);
 void DisplayMessage(const wchar_t *pszFormat, ...);	
 const wchar_t* BuildMessage(const wchar_t *pszFormat, ...);
 void TranslateErrorCode(DWORD dwErrorCode, _bstr_t &rMessage);
+unsigned __int64 PerfCounterMicroseconds(void);
 
 inline unsigned __int32 n32ByteSwap(unsigned __int32 dwOriginal)
 {